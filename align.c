@@ -0,0 +1,354 @@
+#include "fft.h"
+#include "micarray.h"
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define SAMPLE_RATE 48000
+#define OVERSAMPLE 8
+#define PACKET_MS 10
+#define DURATION 20
+#define PHONES 8
+#define SNR 10.0
+#define SEED 1
+#define HARMONICS 24
+#define TRANSIT_MS 5
+#define DELAY_MS 60
+#define CLOCK_ERROR_US 250
+#define MAX_DRIFT_PPM 40
+#define GAIN_SLACK 2.0
+
+// Plays a voice-like signal to phones spread around a room, as each would
+// capture it: late by the time sound takes to get there, on a clock that runs
+// off by up to MAX_DRIFT_PPM, with noise of its own at SNR dB below the
+// signal. Capture times are told to the array off by up to CLOCK_ERROR_US,
+// by another error every second, as clock sync would be. Runs the array on
+// it three times: as a beam with lags found by correlation, as a beam placed
+// by capture time alone, and with a channel per phone. Prints a line of JSON
+// per run to stdout and a summary to stderr, with how far phones are placed
+// from where they should be against the first one, in samples, over the
+// second half, the signal to noise ratio of the beam against that of the
+// first phone alone, and the share of a core the array took. Fails if the
+// correlated beam comes out more than GAIN_SLACK dB short of the 10 log10
+// phones dB that summing phones with noise of their own makes for at best.
+//
+// The signal is a train of harmonics on a gliding pitch, shaped by two
+// formants, with syllables and pauses in between, plus breath noise, made at
+// OVERSAMPLE times the rate so that phones can take it at any time.
+struct phone {
+  double delay;
+  double ratio;
+  double start;
+  uint32_t timestamp;
+  int64_t frame;
+  double clock_error;
+  uint32_t seed;
+};
+
+struct result {
+  double error_mean;
+  double error_max;
+  double beam_snr;
+  double phone_snr;
+  double core_percent;
+};
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static uint32_t next_random(uint32_t* state) {
+  uint32_t x = *state;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  return *state = x;
+}
+
+// Seeds of their own for every use of random numbers, as xorshift states
+// that are only a few steps apart would make for noise that correlates.
+static uint32_t derive_seed(uint32_t seed, uint32_t use) {
+  uint32_t x = seed * 0x9e3779b9u + use * 0x85ebca6bu;
+  x ^= x >> 16;
+  x *= 0x7feb352du;
+  x ^= x >> 15;
+  x *= 0x846ca68bu;
+  x ^= x >> 16;
+  return x ? x : 1;
+}
+
+static double uniform(uint32_t* state) {
+  return next_random(state) / 4294967296.0;
+}
+
+static float formant(double frequency, double center, double width) {
+  double distance = (frequency - center) / width;
+  return (float)(1 / (1 + distance * distance));
+}
+
+static void make_signal(float* samples, long count, uint32_t seed) {
+  seed = derive_seed(seed, 0);
+  int rate = SAMPLE_RATE * OVERSAMPLE;
+  double phase = 0;
+  double hiss = 0;
+  double breath = 0;
+  for (long i = 0; i < count; ++i) {
+    double t = (double)i / rate;
+    double pitch =
+        170 + 80 * sin(2 * M_PI * 0.7 * t) * sin(2 * M_PI * 0.13 * t);
+    phase += 2 * M_PI * pitch / rate;
+    double syllable = sin(M_PI * fmod(t * 4.7, 1.0));
+    double envelope = syllable > 0.2 ? (syllable - 0.2) / 0.8 : 0;
+    double first = 500 + 300 * sin(2 * M_PI * 1.9 * t);
+    double second = 1500 + 700 * sin(2 * M_PI * 1.3 * t + 1);
+    double sum = 0;
+    for (int k = 1; k <= HARMONICS; ++k) {
+      double frequency = k * pitch;
+      sum += sin(k * phase) / k *
+             (formant(frequency, first, 150) + formant(frequency, second, 250));
+    }
+    // Breath noise is white noise through two one pole low passes at 3 kHz,
+    // which leave next to nothing past what phones take.
+    hiss += 0.048 * ((uniform(&seed) - 0.5) - hiss);
+    breath += 0.048 * (hiss - breath);
+    samples[i] = (float)(envelope * (0.3 * sum + 4 * breath));
+  }
+}
+
+// Signal at time t by linear interpolation, and silence outside of it.
+static double signal_at(const float* signal, long count, double t) {
+  double index = t * SAMPLE_RATE * OVERSAMPLE;
+  long i = (long)floor(index);
+  if (i < 0 || i + 1 >= count) {
+    return 0;
+  }
+  double fraction = index - i;
+  return signal[i] + (signal[i + 1] - signal[i]) * fraction;
+}
+
+static double gaussian(uint32_t* state) {
+  double u = uniform(state) + 1e-12;
+  double v = uniform(state);
+  return sqrt(-2 * log(u)) * cos(2 * M_PI * v);
+}
+
+static void place_phones(struct phone* phones, int count, uint32_t seed) {
+  seed = derive_seed(seed, 1);
+  for (int p = 0; p < count; ++p) {
+    // Phones sit up to 5 m from the talker, which sound takes 15 ms for.
+    phones[p] = (struct phone){
+        .delay = 0.002 + 0.013 * uniform(&seed),
+        .ratio = 1 + MAX_DRIFT_PPM * 1e-6 * (2 * uniform(&seed) - 1),
+        .start = 0.01 * uniform(&seed),
+        .timestamp = next_random(&seed),
+        .seed = derive_seed(seed, 3 + p)};
+  }
+}
+
+// Time the frame of the phone is captured at, on the true clock.
+static double capture_time(const struct phone* phone, int64_t frame) {
+  return phone->start + frame / (SAMPLE_RATE * phone->ratio);
+}
+
+// Where the frame captured at true time t sits in the input of the phone, by
+// its timestamps unwrapped the way the array does.
+static double frame_at(const struct phone* phone, double t) {
+  return (int64_t)phone->timestamp +
+         (t - phone->start) * SAMPLE_RATE * phone->ratio;
+}
+
+static int run(const float* signal, long count, int phones_count, double snr,
+               int beam, int correlate, uint32_t seed,
+               struct result* result) {
+  struct phone phones[ARRAY_MAX_INPUTS];
+  place_phones(phones, phones_count, seed);
+  struct mic_array array;
+  if (!array_init(&array, beam ? 0 : phones_count)) {
+    fprintf(stderr, "Failed to allocate array\n");
+    return 0;
+  }
+  array.correlate = correlate;
+  for (int p = 0; p < phones_count; ++p) {
+    array_join(&array, SAMPLE_RATE);
+  }
+  double power = 0;
+  for (long i = 0; i < count; ++i) {
+    power += (double)signal[i] * signal[i];
+  }
+  double noise_level = sqrt(power / count) * pow(10, -snr / 20);
+  int packet = SAMPLE_RATE * PACKET_MS / 1000;
+  float* samples = malloc(packet * sizeof(float));
+  int channels = beam ? 1 : phones_count;
+  float* out = malloc((size_t)array.block * channels * sizeof(float));
+  long packets = count / (SAMPLE_RATE * OVERSAMPLE) * 1000 / PACKET_MS;
+  double duration = (double)packets * PACKET_MS / 1000;
+  double error_sum = 0, error_max = 0, beam_signal = 0, beam_noise = 0,
+         phone_signal = 0, phone_noise = 0;
+  long errors = 0;
+  uint64_t busy = 0;
+  uint32_t noise_seed = derive_seed(seed, 2);
+  // Receiver time starts a second in, so that every time is positive.
+  const uint64_t base = 1000000000;
+  for (long tick = 0; tick < packets; ++tick) {
+    double now = (double)tick * PACKET_MS / 1000;
+    for (int p = 0; p < phones_count; ++p) {
+      struct phone* phone = &phones[p];
+      if (tick % (1000 / PACKET_MS) == 0) {
+        phone->clock_error =
+            CLOCK_ERROR_US * 1e-6 * (2 * uniform(&noise_seed) - 1);
+      }
+      while (capture_time(phone, phone->frame + packet) + TRANSIT_MS / 1e3 <=
+             now) {
+        for (int i = 0; i < packet; ++i) {
+          double t = capture_time(phone, phone->frame + i);
+          samples[i] = (float)(signal_at(signal, count, t - phone->delay) +
+                               noise_level * gaussian(&phone->seed));
+        }
+        double told = capture_time(phone, phone->frame) + phone->clock_error;
+        uint64_t start = now_ns();
+        array_write(&array, p, phone->timestamp + (uint32_t)phone->frame,
+                    base + (uint64_t)(told * 1e9), samples, packet, 1);
+        busy += now_ns() - start;
+        phone->frame += packet;
+      }
+    }
+    uint64_t local = base + (uint64_t)(now * 1e9);
+    while (array_deadline(&array, DELAY_MS * 1000000ull) <= local) {
+      int64_t position = array.position;
+      uint64_t start = now_ns();
+      array_render(&array, out);
+      busy += now_ns() - start;
+      double block_start = (array.start_time - base) / 1e9 +
+                           (double)position / SAMPLE_RATE;
+      if (block_start < duration / 2 || array.reference != 0) {
+        continue;
+      }
+      // Where every phone is read from against where it should be, for
+      // the sound the first phone is read at.
+      const struct phone* first = &phones[0];
+      double read_first = position + array.inputs[0].offset;
+      double heard = first->start +
+                     (read_first - (int64_t)first->timestamp) /
+                         (SAMPLE_RATE * first->ratio) -
+                     first->delay;
+      for (int p = 1; p < phones_count; ++p) {
+        const struct array_input* input = &array.inputs[p];
+        double expected = frame_at(&phones[p], heard + phones[p].delay);
+        double placed =
+            position + (input->locked ? array.inputs[0].offset +
+                                            input->relative
+                                      : input->offset);
+        double error = fabs(placed - expected);
+        error_sum += error;
+        error_max = error > error_max ? error : error_max;
+        errors++;
+      }
+      for (int i = 0; i < array.block; ++i) {
+        double t = heard + (double)i / (SAMPLE_RATE * first->ratio);
+        double clean = signal_at(signal, count, t);
+        double value = out[i * channels];
+        if (beam) {
+          beam_signal += clean * clean;
+          beam_noise += (value - clean) * (value - clean);
+        } else {
+          phone_signal += clean * clean;
+          phone_noise += (value - clean) * (value - clean);
+        }
+      }
+    }
+  }
+  *result = (struct result){
+      .error_mean = errors ? error_sum / errors : INFINITY,
+      .error_max = errors ? error_max : INFINITY,
+      .beam_snr = 10 * log10(beam_signal / beam_noise),
+      .phone_snr = 10 * log10(phone_signal / phone_noise),
+      .core_percent = 100.0 * busy / (duration * 1e9)};
+  free(samples);
+  free(out);
+  array_free(&array);
+  return 1;
+}
+
+int main(int argc, char** argv) {
+  int phones = PHONES;
+  double snr = SNR;
+  long seconds = DURATION;
+  uint32_t seed = SEED;
+  for (int opt; (opt = getopt(argc, argv, "p:n:d:s:")) != -1;) {
+    switch (opt) {
+      case 'p':
+        phones = atoi(optarg);
+        break;
+      case 'n':
+        snr = atof(optarg);
+        break;
+      case 'd':
+        seconds = atol(optarg);
+        break;
+      case 's':
+        seed = (uint32_t)atol(optarg);
+        break;
+      default:
+        phones = 0;
+        break;
+    }
+  }
+  if (optind != argc || phones < 2 || phones > ARRAY_MAX_INPUTS ||
+      seconds <= 0 || !seed) {
+    fprintf(stderr,
+            "Usage: %s [-p phones] [-n snr_db] [-d seconds] [-s seed]\n",
+            argv[0]);
+    return EXIT_FAILURE;
+  }
+  long count = seconds * SAMPLE_RATE * OVERSAMPLE;
+  float* signal = malloc(count * sizeof(float));
+  if (!signal) {
+    fprintf(stderr, "Failed to allocate signal\n");
+    return EXIT_FAILURE;
+  }
+  make_signal(signal, count, seed);
+  static const struct {
+    const char* name;
+    int beam;
+    int correlate;
+  } modes[] = {{"beam", 1, 1}, {"beam_capture_time", 1, 0},
+               {"channels", 0, 1}};
+  struct result results[3];
+  for (int m = 0; m < 3; ++m) {
+    if (!run(signal, count, phones, snr, modes[m].beam, modes[m].correlate,
+             seed, &results[m])) {
+      free(signal);
+      return EXIT_FAILURE;
+    }
+  }
+  // Channel runs keep the first phone as it is, which makes for the single
+  // phone figure.
+  double single = results[2].phone_snr;
+  for (int m = 0; m < 3; ++m) {
+    const struct result* r = &results[m];
+    printf("{\"mode\":\"%s\",\"phones\":%d,\"rate\":%d,\"phone_snr_db\":%.1f,"
+           "\"error_mean_samples\":%.3f,\"error_max_samples\":%.3f,"
+           "\"snr_db\":%.2f,\"gain_db\":%.2f,\"core_percent\":%.2f}\n",
+           modes[m].name, phones, SAMPLE_RATE, snr, r->error_mean,
+           r->error_max, modes[m].beam ? r->beam_snr : single,
+           modes[m].beam ? r->beam_snr - single : 0, r->core_percent);
+    fprintf(stderr,
+            "%-17s %d phones: placed off by %.3f samples on average, %.3f "
+            "at most, snr %.2f dB, %+.2f dB over one phone, %.2f%% of a "
+            "core\n",
+            modes[m].name, phones, r->error_mean, r->error_max,
+            modes[m].beam ? r->beam_snr : single,
+            modes[m].beam ? r->beam_snr - single : 0, r->core_percent);
+  }
+  free(signal);
+  double best = 10 * log10(phones);
+  return results[0].beam_snr - single >= best - GAIN_SLACK ? EXIT_SUCCESS
+                                                          : EXIT_FAILURE;
+}
@@ -1,226 +1,163 @@
-#include "bufqueue.h"
+#include "capture.h"
 #include "jhelpers.h"
+#include "packet.h"
+#include "sender.h"
 #include "sles.h"
 #include "utils.h"
 
 #include <errno.h>
 #include <stdlib.h>
 #include <string.h>
-#include <unistd.h>
 
-#include <arpa/inet.h>
+#include <limits.h>
 #include <pthread.h>
+#include <stdio.h>
 
 #include <android/log.h>
 #include <android/native_activity.h>
 #include <android/window.h>
 
-#define BUFFER_COUNT 4
-#define KICKSTART_COUNT 3
-
+// Lives as long as the activity, so that whatever takes long to set up is set
+// up once, and the sender keeps its session across pauses, which lets the
+// receivers it had take audio again right away on resume. Capture is created
+// on the first resume and only stopped on pause.
 struct Instance {
-  int sample_rate;
-  int buffer_size;
+  struct Sender sender;
+  int frames_per_buffer;
+  struct CaptureBackend* capture;
   jobject multicast_lock;
-  ANativeActivity* activity;
-  atomic_flag running;
+  int streaming;
   pthread_t thread;
-  struct BufferQueue* queue_impl;
 };
 
-static int ScanClients(int fd, struct sockaddr* addr) {
-  socklen_t addr_len = sizeof(*addr);
-  int result = recvfrom(fd, NULL, 0, MSG_DONTWAIT, addr, &addr_len);
-  if (!result) {
-    struct in_addr in = ((struct sockaddr_in*)addr)->sin_addr;
-    uint16_t port = ((struct sockaddr_in*)addr)->sin_port;
-    LOG(INFO, "Client discovered at %s:%u", inet_ntoa(in), ntohs(port));
+static struct CaptureBackend* CreateCapture(struct Sender* sender) {
+  struct CaptureBackend* capture =
+      CreateSlesCapture(sender->sample_rate, sender->channels,
+                        sender->encoding, SENDER_MAX_BUFFERS, SenderCallback,
+                        sender);
+  if (!capture && (sender->channels != 1 ||
+                   sender->encoding != PACKET_ENCODING_S16LE)) {
+    // Every device records mono s16, and the stream tells the receiver.
+    LOG(WARN, "Failed to record %d channels of encoding %d, using mono s16",
+        sender->channels, sender->encoding);
+    sender->channels = 1;
+    sender->encoding = PACKET_ENCODING_S16LE;
+    capture = CreateSlesCapture(sender->sample_rate, sender->channels,
+                                sender->encoding, SENDER_MAX_BUFFERS,
+                                SenderCallback, sender);
   }
-  return !result || errno == EAGAIN;
+  return capture;
 }
 
-static void ThreadLoop(struct Instance* instance, SLRecordItf recorder,
-                       SLAndroidSimpleBufferQueueItf queue, int fd) {
-  struct BufferQueue queue_impl[3];
-  void* queue_storage[LENGTH(queue_impl)][BUFFER_COUNT];
-  for (unsigned i = 0; i < LENGTH(queue_impl); ++i) {
-    InitBufferQueue(&queue_impl[i], LENGTH(queue_storage[i]), queue_storage[i]);
-  }
-  instance->queue_impl = queue_impl;
-  uint8_t buffers[BUFFER_COUNT][instance->buffer_size];
-  for (int i = 0; i < BUFFER_COUNT; ++i) {
-    if (i < KICKSTART_COUNT) {
-      SLresult result =
-          (*queue)->Enqueue(queue, buffers[i], instance->buffer_size);
-      if (result != SL_RESULT_SUCCESS) {
-        LOG(ERROR, "Failed to enqueue kickstart buffer (%s)",
-            SlResultString(result));
-        goto shortcut;
-      }
+static void* ThreadProc(void* arg) {
+  LOG(DEBUG, "Entering %s(%p)", __func__, arg);
+  struct Instance* instance = (struct Instance*)arg;
+  struct Sender* sender = &instance->sender;
+  if (!instance->capture) {
+    instance->capture = CreateCapture(sender);
+    if (instance->capture) {
+      sender->buffer_size =
+          instance->frames_per_buffer * SenderFrameSize(sender);
     }
-    struct BufferQueue* target = i < KICKSTART_COUNT ? &instance->queue_impl[1]
-                                                     : &instance->queue_impl[0];
-    BufferQueuePush(target, buffers[i]);
   }
-  SLresult result =
-      (*recorder)->SetRecordState(recorder, SL_RECORDSTATE_RECORDING);
-  if (result != SL_RESULT_SUCCESS) {
-    LOG(ERROR, "Failed to start recording (%s)", SlResultString(result));
-    goto shortcut;
+  if (!instance->capture) {
+    LOG(ERROR, "Failed to create capture backend");
+  } else {
+    RunSender(sender, instance->capture);
   }
-  struct sockaddr addr;
-  memset(&addr, 0, sizeof(addr));
-  while (atomic_flag_test_and_set(&instance->running)) {
-    void* buffer = BufferQueuePop(&instance->queue_impl[2], 1);
-    if (!ScanClients(fd, &addr)) {
-      LOG(ERROR, "Failed to scan clients (%s)", strerror(errno));
-      break;
-    }
-    if (addr.sa_family) {
-      ssize_t sent =
-          sendto(fd, buffer, instance->buffer_size, 0, &addr, sizeof(addr));
-      if (sent != instance->buffer_size) {
-        LOG(ERROR, "Failed to send data (%s)", strerror(errno));
-        break;
-      }
-    }
-    BufferQueuePush(&instance->queue_impl[0], buffer);
+  LOG(DEBUG, "Leaving %s(%p)", __func__, arg);
+  return NULL;
+}
+
+static void OnActivityResume(ANativeActivity* activity) {
+  LOG(DEBUG, "Entering %s(%p)", __func__, (void*)activity);
+  ANativeActivity_setWindowFlags(activity, AWINDOW_FLAG_KEEP_SCREEN_ON, 0);
+  struct Instance* instance = activity->instance;
+  if (!instance) {
+    return;
   }
-shortcut:
-  result = (*recorder)->SetRecordState(recorder, SL_RECORDSTATE_STOPPED);
-  if (result != SL_RESULT_SUCCESS) {
-    LOG(ERROR, "Failed to stop recording (%s)", SlResultString(result));
+  if (!AcquireMulticastLock(activity->env, instance->multicast_lock)) {
+    LOG(ERROR, "Failed to acquire multicast lock");
+    return;
   }
-  result = (*queue)->Clear(queue);
-  if (result != SL_RESULT_SUCCESS) {
-    LOG(ERROR, "Failed to clear queue (%s)", SlResultString(result));
+  atomic_flag_test_and_set(&instance->sender.running);
+  if (pthread_create(&instance->thread, NULL, ThreadProc, instance)) {
+    LOG(ERROR, "Failed to create thread (%s)", strerror(errno));
+    ReleaseMulticastLock(activity->env, instance->multicast_lock);
+    return;
   }
+  instance->streaming = 1;
 }
 
-static void QueueCallback(SLAndroidSimpleBufferQueueItf queue, void* data) {
-#ifdef ENABLE_CALLBACK_LOGGING
-  LOG(DEBUG, "Entering %s(%p)", __func__, data);
-#endif  // ENABLE_CALLBACK_LOGGING
-  struct Instance* instance = (struct Instance*)data;
-  void* output = BufferQueuePop(&instance->queue_impl[1], 1);
-  BufferQueuePush(&instance->queue_impl[2], output);
-  void* input = BufferQueuePop(&instance->queue_impl[0], 1);
-  for (; input; input = BufferQueuePop(&instance->queue_impl[0], 0)) {
-    SLresult result = (*queue)->Enqueue(queue, input, instance->buffer_size);
-    if (result != SL_RESULT_SUCCESS) {
-      LOG(ERROR, "Failed to enqueue buffer (%s)", SlResultString(result));
-      BufferQueuePush(&instance->queue_impl[0], input);
-      return;
-    }
-    BufferQueuePush(&instance->queue_impl[1], input);
+static void OnActivityPause(ANativeActivity* activity) {
+  LOG(DEBUG, "Entering %s(%p)", __func__, (void*)activity);
+  struct Instance* instance = activity->instance;
+  if (!instance || !instance->streaming) {
+    return;
+  }
+  instance->streaming = 0;
+  atomic_flag_clear(&instance->sender.running);
+  if (pthread_join(instance->thread, NULL)) {
+    LOG(ERROR, "Failed to join thread (%s)", strerror(errno));
   }
-  // TODO(mburakov): In sample code there's a logic to put device to sleep if
-  // shadow buffer is empty. This makes no sense here as we always enqueue.
+  ReleaseMulticastLock(activity->env, instance->multicast_lock);
 }
 
-static void* ThreadProc(void* arg) {
-  LOG(DEBUG, "Entering %s(%p)", __func__, arg);
-  struct Instance* instance = (struct Instance*)arg;
-  SLObjectItf engine_obj = NULL, recorder_obj = NULL;
-  int fd = -1;
-  do {
-    SLEngineItf engine_iface = CreateAudioEngine(&engine_obj);
-    if (!engine_iface) {
-      LOG(ERROR, "Failed to create audio engine");
-      break;
-    }
-    SLRecordItf recorder_iface = CreateAudioRecorder(
-        engine_iface, instance->sample_rate, BUFFER_COUNT, &recorder_obj);
-    if (!recorder_iface) {
-      LOG(ERROR, "Failed to create audio recorder");
-      break;
-    }
-    SLAndroidSimpleBufferQueueItf queue_iface =
-        CreateAudioQueue(recorder_obj, QueueCallback, arg);
-    if (!queue_iface) {
-      LOG(ERROR, "Failed to create audio queue");
-      break;
-    }
-    fd = socket(AF_INET, SOCK_DGRAM, 0);
-    if (fd == -1) {
-      LOG(ERROR, "Failed to create socket (%s)", strerror(errno));
-      break;
-    }
-    struct sockaddr_in addr = {.sin_family = AF_INET, .sin_port = htons(12345)};
-    if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) == -1) {
-      LOG(ERROR, "Failed to bind socket (%s)", strerror(errno));
-      break;
-    }
-    ThreadLoop(arg, recorder_iface, queue_iface, fd);
-  } while (0);
-  if (recorder_obj) {
-    (*recorder_obj)->Destroy(recorder_obj);
-  }
-  if (engine_obj) {
-    (*engine_obj)->Destroy(engine_obj);
+static void OnActivityDestroy(ANativeActivity* activity) {
+  LOG(DEBUG, "Entering %s(%p)", __func__, (void*)activity);
+  struct Instance* instance = activity->instance;
+  if (!instance) {
+    return;
   }
-  if (fd != -1) {
-    close(fd);
+  OnActivityPause(activity);
+  activity->instance = NULL;
+  if (instance->capture) {
+    instance->capture->Destroy(instance->capture);
   }
-  LOG(DEBUG, "Leaving %s(%p)", __func__, arg);
-  return NULL;
+  DeleteMulticastLock(activity->env, instance->multicast_lock);
+  free(instance);
 }
 
-static void OnActivityResume(ANativeActivity* activity) {
-  LOG(DEBUG, "Entering %s(%p)", __func__, (void*)activity);
-  ANativeActivity_setWindowFlags(activity, AWINDOW_FLAG_KEEP_SCREEN_ON, 0);
-  struct Instance* instance = (struct Instance*)malloc(sizeof(struct Instance));
+static struct Instance* CreateInstance(ANativeActivity* activity) {
+  struct Instance* instance =
+      (struct Instance*)calloc(1, sizeof(struct Instance));
   do {
     if (!instance) {
       LOG(ERROR, "Failed to allocate instance data (%s)", strerror(errno));
       break;
     }
-    int frames_per_buffer;
-    if (!GetBufferConfig(activity->env, activity->clazz, &instance->sample_rate,
-                         &frames_per_buffer)) {
+    if (!GetBufferConfig(activity->env, activity->clazz,
+                         &instance->sender.sample_rate,
+                         &instance->frames_per_buffer)) {
       LOG(ERROR, "Failed to get buffer configuration");
       break;
     }
     LOG(INFO, "Audio configuration sample_rate=%d, frames_per_buffer=%d",
-        instance->sample_rate, frames_per_buffer);
-    int sample_size = SL_PCMSAMPLEFORMAT_FIXED_16 >> 3;
-    instance->buffer_size = frames_per_buffer * sample_size;
-    instance->multicast_lock = NULL;
-    if (!AcquireMulticastLock(activity->env, activity->clazz, "andrecord",
-                              &instance->multicast_lock)) {
-      LOG(ERROR, "Failed to acquire multicast lock");
+        instance->sender.sample_rate, instance->frames_per_buffer);
+    instance->sender.channels = 1;
+    char config[PATH_MAX];
+    snprintf(config, sizeof(config), "%s/andrecord.conf",
+             activity->externalDataPath ? activity->externalDataPath : "");
+    if (activity->externalDataPath &&
+        !LoadSenderOptions(&instance->sender, config)) {
+      LOG(ERROR, "Failed to load options from %s", config);
       break;
     }
-    instance->activity = activity;
-    atomic_flag_test_and_set(&instance->running);
-    if (pthread_create(&instance->thread, NULL, ThreadProc, instance)) {
-      LOG(ERROR, "Failed to create thread (%s)", strerror(errno));
+    if (!SenderFrameSize(&instance->sender)) {
+      LOG(ERROR, "Unsupported format of %d channels, encoding %d",
+          instance->sender.channels, instance->sender.encoding);
       break;
     }
-    activity->instance = instance;
-    return;
-  } while (0);
-  if (instance) {
-    if (instance->multicast_lock) {
-      ReleaseMulticastLock(activity->env, instance->multicast_lock);
+    instance->multicast_lock =
+        CreateMulticastLock(activity->env, activity->clazz, "andrecord");
+    if (!instance->multicast_lock) {
+      LOG(ERROR, "Failed to create multicast lock");
+      break;
     }
-    free(instance);
-  }
-}
-
-static void OnActivityPause(ANativeActivity* activity) {
-  LOG(DEBUG, "Entering %s(%p)", __func__, (void*)activity);
-  if (!activity->instance) {
-    return;
-  }
-  struct Instance* instance = activity->instance;
-  activity->instance = NULL;
-  atomic_flag_clear(&instance->running);
-  if (pthread_join(instance->thread, NULL)) {
-    LOG(ERROR, "Failed to join thread (%s)", strerror(errno));
-  }
-  ReleaseMulticastLock(activity->env, instance->multicast_lock);
+    return instance;
+  } while (0);
   free(instance);
+  return NULL;
 }
 
 __attribute__((visibility("default"))) void ANativeActivity_onCreate(
@@ -228,6 +165,8 @@ __attribute__((visibility("default"))) void ANativeActivity_onCreate(
   (void)savedState;
   (void)savedStateSize;
   LOG(DEBUG, "Entering %s(%p)", __func__, (void*)activity);
+  activity->instance = CreateInstance(activity);
   activity->callbacks->onResume = OnActivityResume;
   activity->callbacks->onPause = OnActivityPause;
+  activity->callbacks->onDestroy = OnActivityDestroy;
 }
@@ -0,0 +1,356 @@
+#define _GNU_SOURCE
+
+#include "archive.h"
+#include "packet.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// Discontinuities take entries of their own, so leave room for as many as
+// there are regular ones, and then some.
+#define INDEX_SLACK 64
+
+static uint64_t clock_ns(clockid_t clock) {
+  struct timespec ts;
+  clock_gettime(clock, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static uint64_t bytes_per_second(const struct archive_header* header) {
+  return (uint64_t)header->rate * header->channels *
+         PacketEncodingSampleSize(header->encoding);
+}
+
+// Segments are well below 4 GiB, which keeps this from overflowing.
+static uint64_t bytes_to_ns(const struct archive_header* header,
+                            uint64_t bytes) {
+  return bytes * 1000000000 / bytes_per_second(header);
+}
+
+static void next_path(const struct archive* archive, char* path) {
+  snprintf(path, PATH_MAX, "%s/%s.next%s", archive->dir, archive->name,
+           ARCHIVE_SUFFIX);
+}
+
+static void segment_path(const struct archive* archive, uint64_t time,
+                         char* path) {
+  time_t seconds = time / 1000000000;
+  struct tm tm;
+  char stamp[32];
+  strftime(stamp, sizeof(stamp), "%Y%m%dT%H%M%S", gmtime_r(&seconds, &tm));
+  snprintf(path, PATH_MAX, "%s/%s-%s.%09uZ%s", archive->dir, archive->name,
+           stamp, (unsigned)(time % 1000000000), ARCHIVE_SUFFIX);
+}
+
+static void unmap(struct archive_segment* segment) {
+  if (segment->header && munmap(segment->header, segment->size) == -1) {
+    perror("Failed to unmap archive segment");
+  }
+  if (segment->fd != -1 && close(segment->fd) == -1) {
+    perror("Failed to close archive segment");
+  }
+  *segment = (struct archive_segment){.fd = -1};
+}
+
+// Preallocates the whole file, so that writing through the mapping never runs
+// out of space or has to wait for blocks to be allocated, and sizes the index
+// for the format.
+static int create_segment(struct archive* archive,
+                          struct archive_segment* segment, uint16_t format) {
+  char path[PATH_MAX];
+  next_path(archive, path);
+  segment->fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (segment->fd == -1) {
+    perror("Failed to create archive segment");
+    return 0;
+  }
+  int result;
+  if ((result = posix_fallocate(segment->fd, 0, archive->segment_size))) {
+    fprintf(stderr, "Failed to allocate archive segment: %s\n",
+            strerror(result));
+    unmap(segment);
+    return 0;
+  }
+  segment->size = archive->segment_size;
+  segment->header = mmap(NULL, segment->size, PROT_READ | PROT_WRITE,
+                         MAP_SHARED, segment->fd, 0);
+  if (segment->header == MAP_FAILED) {
+    perror("Failed to map archive segment");
+    segment->header = NULL;
+    unmap(segment);
+    return 0;
+  }
+  // Faults on the mapping would otherwise read ahead, and zero-fill megabytes
+  // of page cache at once.
+  if (madvise(segment->header, segment->size, MADV_RANDOM) == -1) {
+    perror("Failed to advise archive segment");
+  }
+  segment->format = format;
+  struct archive_header* header = segment->header;
+  header->magic = ARCHIVE_MAGIC;
+  header->version = ARCHIVE_VERSION;
+  header->rate = PacketFormatRate(format);
+  header->channels = PACKET_FORMAT_CHANNELS(format);
+  header->encoding = PACKET_FORMAT_ENCODING(format);
+  uint64_t interval = bytes_per_second(header) * ARCHIVE_INDEX_INTERVAL / 1000;
+  header->index_capacity = archive->segment_size / interval * 2 + INDEX_SLACK;
+  size_t page = sysconf(_SC_PAGESIZE);
+  size_t index_end = sizeof(*header) +
+                     header->index_capacity * sizeof(struct archive_entry);
+  header->data_offset = (index_end + page - 1) / page * page;
+  size_t frame_size = PacketFormatFrameSize(format);
+  if (header->data_offset + frame_size > segment->size) {
+    fprintf(stderr, "Archive segments of %zu bytes are too small\n",
+            segment->size);
+    unmap(segment);
+    unlink(path);
+    return 0;
+  }
+  header->data_size =
+      (segment->size - header->data_offset) / frame_size * frame_size;
+  return 1;
+}
+
+// Gives the rest of the preallocated space back to the file system.
+static void close_segment(struct archive_segment* segment) {
+  if (!segment->header) {
+    return;
+  }
+  off_t size = segment->header->data_offset + segment->header->length;
+  int fd = segment->fd;
+  segment->fd = -1;
+  unmap(segment);
+  if (ftruncate(fd, size) == -1) {
+    perror("Failed to trim archive segment");
+  }
+  if (close(fd) == -1) {
+    perror("Failed to close archive segment");
+  }
+}
+
+// Moves on to the prepared segment, or to a new one if there is none for
+// this format, and names it after the time of its first frame. Unmapping the
+// one before takes milliseconds, so that is left to archive_prepare too.
+static int rotate(struct archive* archive, uint16_t format, uint64_t time) {
+  close_segment(&archive->previous);
+  archive->previous = archive->current;
+  archive->current = (struct archive_segment){.fd = -1};
+  char path[PATH_MAX];
+  if (archive->next.header && archive->next.format != format) {
+    unmap(&archive->next);
+    next_path(archive, path);
+    unlink(path);
+  }
+  if (!archive->next.header &&
+      !create_segment(archive, &archive->next, format)) {
+    return 0;
+  }
+  char name[PATH_MAX];
+  next_path(archive, path);
+  segment_path(archive, time, name);
+  if (rename(path, name) == -1) {
+    perror("Failed to name archive segment");
+    return 0;
+  }
+  archive->current = archive->next;
+  archive->next = (struct archive_segment){.fd = -1};
+  return 1;
+}
+
+int archive_init(struct archive* archive, const char* dir, const char* name,
+                 size_t segment_size) {
+  memset(archive, 0, sizeof(*archive));
+  archive->dir = dir;
+  snprintf(archive->name, sizeof(archive->name), "%s", name);
+  archive->segment_size = segment_size;
+  archive->previous.fd = -1;
+  archive->current.fd = -1;
+  archive->next.fd = -1;
+  if (mkdir(dir, 0755) == -1 && errno != EEXIST) {
+    perror("Failed to create archive directory");
+    return 0;
+  }
+  return 1;
+}
+
+void archive_free(struct archive* archive) {
+  close_segment(&archive->previous);
+  close_segment(&archive->current);
+  if (archive->next.header) {
+    char path[PATH_MAX];
+    unmap(&archive->next);
+    next_path(archive, path);
+    unlink(path);
+  }
+}
+
+// Capture time is on the monotonic clock, and is 0 when there is none, in
+// which case the audio is taken to be captured as it is written. Index goes
+// by wall clock time though, as of the start of the segment. Audio written
+// before the sender clock is known is thus stamped later than it was
+// captured, by the whole latency, and capture times after it can go back
+// past it. Index entries never do, so that the index stays sorted: one that
+// would is left out, and the audio goes on from the entry before it at the
+// sample rate until capture time catches up, and a segment that starts
+// meanwhile starts at the time of the last entry.
+int archive_write(struct archive* archive, uint16_t format, const void* data,
+                  size_t length, uint64_t capture_time) {
+  struct archive_header* header = archive->current.header;
+  uint64_t time = capture_time ? capture_time : clock_ns(CLOCK_MONOTONIC);
+  size_t frame_size = PacketFormatFrameSize(format);
+  while (length) {
+    if (!header || archive->current.format != format ||
+        header->length == header->data_size ||
+        header->index_count == header->index_capacity) {
+      archive->realtime_offset =
+          clock_ns(CLOCK_REALTIME) - clock_ns(CLOCK_MONOTONIC);
+      uint64_t start = time + archive->realtime_offset;
+      if (!rotate(archive, format,
+                  start > archive->last_time ? start : archive->last_time)) {
+        return 0;
+      }
+      header = archive->current.header;
+    }
+    uint64_t realtime = time + archive->realtime_offset;
+    if (realtime < archive->last_time && !header->index_count) {
+      realtime = archive->last_time;
+    }
+    uint64_t interval =
+        bytes_per_second(header) * ARCHIVE_INDEX_INTERVAL / 1000;
+    const struct archive_entry* last =
+        header->index_count ? &header->index[header->index_count - 1] : NULL;
+    int64_t skew =
+        last ? (int64_t)(realtime - last->time -
+                         bytes_to_ns(header, header->length - last->offset))
+             : 0;
+    if (!last || (realtime >= last->time &&
+                  (header->length - last->offset >= interval ||
+                   skew > ARCHIVE_INDEX_SKEW * 1000000ll ||
+                   skew < -ARCHIVE_INDEX_SKEW * 1000000ll))) {
+      header->index[header->index_count] =
+          (struct archive_entry){.time = realtime, .offset = header->length};
+      atomic_thread_fence(memory_order_release);
+      header->index_count++;
+      archive->last_time = realtime;
+    }
+    size_t chunk = header->data_size - header->length;
+    chunk = (chunk < length ? chunk : length) / frame_size * frame_size;
+    if (!chunk) {
+      break;
+    }
+    uint8_t* target = (uint8_t*)header + header->data_offset + header->length;
+    if (data) {
+      memcpy(target, data, chunk);
+      data = (const uint8_t*)data + chunk;
+    } else {
+      memset(target, 0, chunk);
+    }
+    atomic_thread_fence(memory_order_release);
+    header->length += chunk;
+    length -= chunk;
+    time += bytes_to_ns(header, chunk);
+  }
+  return 1;
+}
+
+// Makes the next segment once the current one is half full, well before it is
+// needed, so that rotating does not wait for the file system.
+int archive_prepare(struct archive* archive) {
+  close_segment(&archive->previous);
+  const struct archive_header* header = archive->current.header;
+  if (!header || archive->next.header ||
+      header->length < header->data_size / 2) {
+    return 1;
+  }
+  return create_segment(archive, &archive->next, archive->current.format);
+}
+
+int archive_open(struct archive_segment* segment, const char* path) {
+  *segment = (struct archive_segment){.fd = -1};
+  segment->fd = open(path, O_RDONLY | O_CLOEXEC);
+  struct stat st;
+  if (segment->fd == -1 || fstat(segment->fd, &st) == -1) {
+    unmap(segment);
+    return 0;
+  }
+  segment->size = st.st_size;
+  if (segment->size < sizeof(struct archive_header)) {
+    unmap(segment);
+    errno = EINVAL;
+    return 0;
+  }
+  segment->header =
+      mmap(NULL, segment->size, PROT_READ, MAP_SHARED, segment->fd, 0);
+  if (segment->header == MAP_FAILED) {
+    segment->header = NULL;
+    unmap(segment);
+    return 0;
+  }
+  const struct archive_header* header = segment->header;
+  if (header->magic != ARCHIVE_MAGIC || header->version != ARCHIVE_VERSION ||
+      !header->rate || !header->channels ||
+      !PacketEncodingSampleSize(header->encoding) ||
+      header->data_offset > segment->size ||
+      header->index_capacity * sizeof(struct archive_entry) >
+          header->data_offset ||
+      header->index_count > header->index_capacity ||
+      header->data_offset + header->length > segment->size) {
+    unmap(segment);
+    errno = EINVAL;
+    return 0;
+  }
+  return 1;
+}
+
+void archive_close(struct archive_segment* segment) { unmap(segment); }
+
+uint64_t archive_start_time(const struct archive_header* header) {
+  return header->index_count ? header->index[0].time : 0;
+}
+
+uint64_t archive_end_time(const struct archive_header* header) {
+  if (!header->index_count) {
+    return 0;
+  }
+  const struct archive_entry* last = &header->index[header->index_count - 1];
+  return last->time + bytes_to_ns(header, header->length - last->offset);
+}
+
+// Finds the entry at or before time by binary search, and goes on from it at
+// the sample rate, up to the next entry. Returns the offset of the first frame
+// at or after time, which is length past the end.
+uint64_t archive_find(const struct archive_header* header, uint64_t time) {
+  uint32_t low = 0, high = header->index_count;
+  while (low < high) {
+    uint32_t middle = low + (high - low) / 2;
+    if (header->index[middle].time <= time) {
+      low = middle + 1;
+    } else {
+      high = middle;
+    }
+  }
+  if (!low) {
+    return 0;
+  }
+  const struct archive_entry* entry = &header->index[low - 1];
+  uint64_t end =
+      low < header->index_count ? header->index[low].offset : header->length;
+  uint64_t frame_size =
+      (uint64_t)header->channels * PacketEncodingSampleSize(header->encoding);
+  uint64_t elapsed = time - entry->time;
+  if (elapsed >= bytes_to_ns(header, end - entry->offset)) {
+    return end;
+  }
+  uint64_t frames = (elapsed * header->rate + 999999999) / 1000000000;
+  uint64_t offset = entry->offset + frames * frame_size;
+  return offset < end ? offset : end;
+}
@@ -0,0 +1,85 @@
+#include <stddef.h>
+#include <stdint.h>
+
+#define ARCHIVE_MAGIC 0x76637261
+#define ARCHIVE_VERSION 1
+#define ARCHIVE_SUFFIX ".seg"
+// Size of segment files in MiB, by default and at most.
+#define ARCHIVE_SEGMENT_SIZE 64
+#define ARCHIVE_MAX_SEGMENT_SIZE 1024
+
+// Index entries map wall clock capture time of a frame, in nanoseconds since
+// the epoch, to its offset into data. There is one every
+// ARCHIVE_INDEX_INTERVAL milliseconds of audio, and one more wherever the
+// audio jumps by more than ARCHIVE_INDEX_SKEW milliseconds against its own
+// time, like when the sender restarts. Time of any other frame follows from
+// the entry before it and the sample rate. Entries only ever go forward in
+// time, across segments as well.
+#define ARCHIVE_INDEX_INTERVAL 1000
+#define ARCHIVE_INDEX_SKEW 50
+
+struct archive_entry {
+  uint64_t time;
+  uint64_t offset;
+};
+
+// Every segment file starts with this header, followed by its index, and then
+// by up to data_size bytes of interleaved frames from data_offset on. Length
+// counts the bytes written so far, and the index entries and length only ever
+// go up once whatever they cover is in place, so a segment that is still
+// being written can be read as well. Segments of a stream are named after it
+// and the time of their first frame, as <name>-<YYYYmmddTHHMMSS.nnnnnnnnn>Z
+// followed by ARCHIVE_SUFFIX, so that they sort in time order.
+struct archive_header {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t rate;
+  uint16_t channels;
+  uint16_t encoding;
+  uint32_t data_offset;
+  uint32_t index_capacity;
+  uint64_t data_size;
+  uint64_t length;
+  uint32_t index_count;
+  uint32_t reserved;
+  struct archive_entry index[];
+};
+
+struct archive_segment {
+  int fd;
+  size_t size;
+  uint16_t format;
+  struct archive_header* header;
+};
+
+// Writes the audio of a stream to segment files of segment_size bytes in a
+// directory. Segments are preallocated and written through a shared mapping,
+// so writing never waits for the disk, and the next one is made ahead of
+// time by archive_prepare once the current one is half full. Full segments are
+// closed by archive_prepare as well, and the last one is trimmed to what was
+// written when the stream goes away. Last time is that of the last index
+// entry, which later ones never go below.
+struct archive {
+  const char* dir;
+  char name[64];
+  size_t segment_size;
+  struct archive_segment previous;
+  struct archive_segment current;
+  struct archive_segment next;
+  int64_t realtime_offset;
+  uint64_t last_time;
+};
+
+int archive_init(struct archive* archive, const char* dir, const char* name,
+                 size_t segment_size);
+void archive_free(struct archive* archive);
+int archive_write(struct archive* archive, uint16_t format, const void* data,
+                  size_t length, uint64_t capture_time);
+int archive_prepare(struct archive* archive);
+
+// Maps a segment for reading. Returns 0 and leaves errno set on failure.
+int archive_open(struct archive_segment* segment, const char* path);
+void archive_close(struct archive_segment* segment);
+uint64_t archive_start_time(const struct archive_header* header);
+uint64_t archive_end_time(const struct archive_header* header);
+uint64_t archive_find(const struct archive_header* header, uint64_t time);
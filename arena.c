@@ -0,0 +1,39 @@
+#include "arena.h"
+
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+
+int arena_init(struct arena* arena, int slots, int slot_size) {
+  long page_size = sysconf(_SC_PAGESIZE);
+  long stride = (slot_size + page_size - 1) / page_size * page_size;
+  arena->size = stride * slots;
+  arena->memory = mmap(NULL, arena->size, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+  if (arena->memory == MAP_FAILED) {
+    return 0;
+  }
+  arena->free = malloc(slots * sizeof(void*));
+  if (!arena->free) {
+    munmap(arena->memory, arena->size);
+    return 0;
+  }
+  for (arena->count = 0; arena->count < slots; arena->count++) {
+    arena->free[arena->count] = (char*)arena->memory + stride * arena->count;
+  }
+  return 1;
+}
+
+void arena_free(struct arena* arena) {
+  free(arena->free);
+  munmap(arena->memory, arena->size);
+}
+
+void* arena_alloc(struct arena* arena) {
+  return arena->count ? arena->free[--arena->count] : NULL;
+}
+
+void arena_release(struct arena* arena, void* slot) {
+  arena->free[arena->count++] = slot;
+}
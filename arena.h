@@ -0,0 +1,13 @@
+// Preallocated pool of page-aligned, fixed-size slots. Datagrams are received
+// straight into these and handed around by pointer until they are written out.
+struct arena {
+  void* memory;
+  long size;
+  void** free;
+  int count;
+};
+
+int arena_init(struct arena* arena, int slots, int slot_size);
+void arena_free(struct arena* arena);
+void* arena_alloc(struct arena* arena);
+void arena_release(struct arena* arena, void* slot);
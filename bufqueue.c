@@ -1,54 +1,90 @@
 #include "bufqueue.h"
 
-#include <sched.h>
+#include <unistd.h>
+
+#include <linux/futex.h>
+#include <sys/syscall.h>
 
 #ifdef ENABLE_QUEUE_LOGGING
-#include <android/log.h>
 #include "utils.h"
 #endif  // ENABLE_QUEUE_LOGGING
 
-static int IsQueueEmpty(struct BufferQueue* queue) {
-  return atomic_flag_test_and_set(&queue->empty);
+#ifndef BUFFER_QUEUE_SPIN_COUNT
+#define BUFFER_QUEUE_SPIN_COUNT 128
+#endif  // BUFFER_QUEUE_SPIN_COUNT
+
+static unsigned Advance(struct BufferQueue* queue, unsigned position) {
+  return ++position == 2u * queue->length ? 0 : position;
+}
+
+static void* Take(struct BufferQueue* queue, unsigned head) {
+  unsigned index = head < (unsigned)queue->length ? head : head - queue->length;
+  void* result = queue->buffers[index];
+  atomic_store_explicit(&queue->head, Advance(queue, head),
+                        memory_order_release);
+  return result;
 }
 
 void InitBufferQueue(struct BufferQueue* queue, int length, void** storage) {
   queue->length = length;
   queue->buffers = storage;
-  queue->head = 0;
-  atomic_store(&queue->tail, 0);
-  atomic_flag_test_and_set(&queue->empty);
+  atomic_init(&queue->head, 0);
+  atomic_init(&queue->tail, 0);
+  atomic_init(&queue->waiting, 0);
+}
+
+int BufferQueueSize(struct BufferQueue* queue) {
+  unsigned head = atomic_load_explicit(&queue->head, memory_order_acquire);
+  unsigned tail = atomic_load_explicit(&queue->tail, memory_order_acquire);
+  return (int)((tail + 2u * queue->length - head) % (2u * queue->length));
 }
 
 void BufferQueuePush(struct BufferQueue* queue, void* buffer) {
-// TODO(mburakov): Adjust memory order
 #ifdef ENABLE_QUEUE_LOGGING
   LOG(DEBUG, "%s(%p, %p)", __func__, (void*)queue, buffer);
 #endif  // ENABLE_QUEUE_LOGGING
-  int tail = atomic_load(&queue->tail);
-  queue->buffers[tail] = buffer;
-  tail = (tail + 1) % queue->length;
-  atomic_store(&queue->tail, tail);
-  atomic_flag_clear(&queue->empty);
+  unsigned tail = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+  unsigned index = tail < (unsigned)queue->length ? tail : tail - queue->length;
+  queue->buffers[index] = buffer;
+  // Sequentially consistent pair with the consumer in BufferQueuePop: either
+  // the consumer sees the new tail, or the producer sees it waiting.
+  atomic_store(&queue->tail, Advance(queue, tail));
+  if (atomic_load(&queue->waiting)) {
+    syscall(SYS_futex, &queue->tail, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+  }
 }
 
-void* BufferQueuePop(struct BufferQueue* queue, int blocking) {
-  int empty = blocking ? 0 : IsQueueEmpty(queue);
-  while (blocking && IsQueueEmpty(queue)) {
-    sched_yield();
-  }
-  if (empty && !blocking) {
-#ifdef ENABLE_QUEUE_LOGGING
-    LOG(DEBUG, "%s(%p, 0) -> NULL", __func__, (void*)queue);
-#endif  // ENABLE_QUEUE_LOGGING
-    return NULL;
+void* BufferQueuePop(struct BufferQueue* queue) {
+  unsigned head = atomic_load_explicit(&queue->head, memory_order_relaxed);
+  for (int spin = 0; spin < BUFFER_QUEUE_SPIN_COUNT; ++spin) {
+    if (atomic_load_explicit(&queue->tail, memory_order_acquire) != head) {
+      return Take(queue, head);
+    }
   }
-  void* result = queue->buffers[queue->head];
-  queue->head = (queue->head + 1) % queue->length;
-  if (atomic_load(&queue->tail) > queue->head) {
-    atomic_flag_clear(&queue->empty);
+  for (;;) {
+    atomic_store(&queue->waiting, 1);
+    unsigned tail = atomic_load(&queue->tail);
+    if (tail != head) {
+      break;
+    }
+    // Kernel rechecks the tail, so a push racing with this call is not lost.
+    syscall(SYS_futex, &queue->tail, FUTEX_WAIT_PRIVATE, tail, NULL, NULL, 0);
   }
+  atomic_store_explicit(&queue->waiting, 0, memory_order_relaxed);
+  void* result = Take(queue, head);
 #ifdef ENABLE_QUEUE_LOGGING
-  LOG(DEBUG, "%s(%p, %d) -> %p", __func__, (void*)queue, blocking, result);
+  LOG(DEBUG, "%s(%p) -> %p", __func__, (void*)queue, result);
 #endif  // ENABLE_QUEUE_LOGGING
   return result;
 }
+
+void* BufferQueueTryPop(struct BufferQueue* queue) {
+  unsigned head = atomic_load_explicit(&queue->head, memory_order_relaxed);
+  if (atomic_load_explicit(&queue->tail, memory_order_acquire) == head) {
+#ifdef ENABLE_QUEUE_LOGGING
+    LOG(DEBUG, "%s(%p) -> NULL", __func__, (void*)queue);
+#endif  // ENABLE_QUEUE_LOGGING
+    return NULL;
+  }
+  return Take(queue, head);
+}
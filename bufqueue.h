@@ -1,13 +1,18 @@
 #include <stdatomic.h>
 
+// Single-producer/single-consumer ring. Positions run modulo twice the length
+// so that a full ring can be told apart from an empty one, and the tail
+// doubles as the futex word the consumer parks on.
 struct BufferQueue {
   int length;
   void** buffers;
-  int head;
-  atomic_int tail;
-  atomic_flag empty;
+  atomic_uint head;
+  atomic_uint tail;
+  atomic_int waiting;
 };
 
 void InitBufferQueue(struct BufferQueue* queue, int length, void** storage);
+int BufferQueueSize(struct BufferQueue* queue);
 void BufferQueuePush(struct BufferQueue* queue, void* buffer);
-void* BufferQueuePop(struct BufferQueue* queue, int blocking);
+void* BufferQueuePop(struct BufferQueue* queue);
+void* BufferQueueTryPop(struct BufferQueue* queue);
@@ -0,0 +1,58 @@
+#include "buftune.h"
+
+void InitBufferTuner(struct BufferTuner* tuner, int depth, int min_depth,
+                     int max_depth, uint64_t period) {
+  tuner->depth = depth;
+  tuner->min_depth = min_depth;
+  tuner->max_depth = max_depth;
+  tuner->period = period;
+  tuner->window_length =
+      (int)((uint64_t)BUFFER_TUNER_WINDOW * 1000000 / period);
+  if (tuner->window_length < 1) {
+    tuner->window_length = 1;
+  }
+  tuner->window_callbacks = 0;
+  tuner->window_need = 0;
+  tuner->quiet_windows = 0;
+}
+
+static int Clamp(const struct BufferTuner* tuner, int depth) {
+  if (depth < tuner->min_depth) {
+    return tuner->min_depth;
+  }
+  return depth > tuner->max_depth ? tuner->max_depth : depth;
+}
+
+// Callbacks are late by whole periods, as a device fills another buffer
+// meanwhile, and anything short of half a period is jitter.
+int BufferTunerUpdate(struct BufferTuner* tuner, uint64_t interval,
+                      int spare, int held) {
+  int late = interval ? (int)((interval + tuner->period / 2) /
+                              tuner->period) - 1
+                      : 0;
+  int need = held + 1 + (late > 0 ? late : 0);
+  if (!spare) {
+    need = need > tuner->depth ? need : tuner->depth + 1;
+  }
+  if (need > tuner->window_need) {
+    tuner->window_need = need;
+  }
+  if (need > tuner->depth) {
+    tuner->depth = Clamp(tuner, need);
+    tuner->quiet_windows = 0;
+  }
+  if (++tuner->window_callbacks < tuner->window_length) {
+    return tuner->depth;
+  }
+  if (tuner->window_need < tuner->depth) {
+    if (++tuner->quiet_windows >= BUFFER_TUNER_SHRINK_WINDOWS) {
+      tuner->depth = Clamp(tuner, tuner->depth - 1);
+      tuner->quiet_windows = 0;
+    }
+  } else {
+    tuner->quiet_windows = 0;
+  }
+  tuner->window_callbacks = 0;
+  tuner->window_need = 0;
+  return tuner->depth;
+}
@@ -0,0 +1,36 @@
+#include <stdint.h>
+
+// Buffers that no callback of a window called for are given up after this
+// many windows in a row, and windows are this many milliseconds long.
+#define BUFFER_TUNER_WINDOW 1000
+#define BUFFER_TUNER_SHRINK_WINDOWS 10
+
+// Picks how many capture buffers go around, as the fewest that keep the
+// capture device from running dry. Every callback tells it how long it came
+// after the last one, how many buffers the device still had to fill, the one
+// it is filling included, and how many were elsewhere. Those make for how many
+// there have to be: every one that was elsewhere, and one more for the device
+// to fill for every period until the next callback, which is one period and
+// one more for every period this one was late. Depth grows at once whenever a
+// callback calls for more than there are, or found the device with nothing
+// left to fill, which is when it would have to wait for the sender loop, and
+// shrinks one buffer at a time once no callback called for as many for long
+// enough.
+struct BufferTuner {
+  int depth;
+  int min_depth;
+  int max_depth;
+  uint64_t period;
+  int window_length;
+  int window_callbacks;
+  int window_need;
+  int quiet_windows;
+};
+
+void InitBufferTuner(struct BufferTuner* tuner, int depth, int min_depth,
+                     int max_depth, uint64_t period);
+// Returns the depth to go on with. Interval is 0 for the first callback,
+// spare is how many buffers the device had left to fill, and held how many
+// were elsewhere, the one just filled included.
+int BufferTunerUpdate(struct BufferTuner* tuner, uint64_t interval,
+                      int spare, int held);
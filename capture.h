@@ -0,0 +1,12 @@
+typedef void (*CaptureCallback)(void* callback_arg);
+
+// Audio source modeled after SLAndroidSimpleBufferQueueItf. Empty buffers are
+// enqueued in advance, and the callback fires on a backend thread once per
+// filled buffer, in the order the buffers were enqueued. Backends embed this
+// structure as their first member.
+struct CaptureBackend {
+  int (*Enqueue)(struct CaptureBackend* backend, void* buffer, int size);
+  int (*Start)(struct CaptureBackend* backend);
+  void (*Stop)(struct CaptureBackend* backend);
+  void (*Destroy)(struct CaptureBackend* backend);
+};
@@ -0,0 +1,73 @@
+#include "clocksync.h"
+#include "packet.h"
+
+#include <string.h>
+
+_Static_assert(CLOCK_SYNC_REQUEST_SIZE ==
+                   sizeof(struct PacketHeader) + sizeof(struct ClockReport),
+               "Clock request size mismatch");
+
+// Fills buffer with a request stamped with the local time, and returns its
+// size.
+int clock_sync_request(void* buffer, uint64_t now) {
+  struct PacketHeader header = {.type = PACKET_TYPE_CLOCK,
+                                .length = sizeof(struct ClockReport)};
+  struct ClockReport report = {.origin = now};
+  memcpy(buffer, &header, sizeof(header));
+  memcpy((char*)buffer + sizeof(header), &report, sizeof(report));
+  return CLOCK_SYNC_REQUEST_SIZE;
+}
+
+// Takes an answer that came in at local time now. Returns 0 for anything that
+// makes no sense as an answer to a request of this receiver.
+int clock_sync_update(struct clock_sync* sync, const void* packet, int size,
+                      uint64_t now) {
+  struct PacketHeader header;
+  struct ClockReport report;
+  if (size != CLOCK_SYNC_REQUEST_SIZE) {
+    return 0;
+  }
+  memcpy(&header, packet, sizeof(header));
+  memcpy(&report, (const char*)packet + sizeof(header), sizeof(report));
+  int sample_rate = PacketFormatRate(header.format);
+  if (!sample_rate || !report.origin || report.origin > now ||
+      report.transmit < report.receive ||
+      now - report.origin < report.transmit - report.receive) {
+    return 0;
+  }
+  struct clock_sample sample = {
+      .offset = ((int64_t)(report.receive - report.origin) +
+                 (int64_t)(report.transmit - now)) /
+                2,
+      .rtt = (now - report.origin) - (report.transmit - report.receive)};
+  sync->samples[sync->next] = sample;
+  sync->next = (sync->next + 1) % CLOCK_SYNC_SAMPLES;
+  if (sync->count < CLOCK_SYNC_SAMPLES) {
+    sync->count++;
+  }
+  const struct clock_sample* best = sync->samples;
+  for (int i = 1; i < sync->count; ++i) {
+    if (sync->samples[i].rtt < best->rtt) {
+      best = &sync->samples[i];
+    }
+  }
+  sync->offset = best->offset;
+  sync->rtt = best->rtt;
+  sync->timestamp = header.timestamp;
+  sync->capture = report.capture;
+  sync->sample_rate = sample_rate;
+  return 1;
+}
+
+// Returns the local time the frame with the timestamp was captured at, or 0
+// before the first answer. Frames are taken to come at the nominal rate, which
+// is close enough between answers that come every second.
+uint64_t clock_sync_capture_time(const struct clock_sync* sync,
+                                 uint32_t timestamp) {
+  if (!sync->count) {
+    return 0;
+  }
+  int64_t frames = (int32_t)(timestamp - sync->timestamp);
+  return sync->capture + frames * 1000000000 / sync->sample_rate -
+         sync->offset;
+}
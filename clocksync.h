@@ -0,0 +1,29 @@
+#include <stdint.h>
+
+#define CLOCK_SYNC_SAMPLES 8
+#define CLOCK_SYNC_REQUEST_SIZE 44
+
+// NTP-style estimate of how far the clock of a sender is ahead of the local
+// one. Every exchange gives an offset that is off by no more than half of its
+// round trip, so the one with the shortest round trip of the last few is
+// trusted. Answers also tie a frame timestamp to the sender time it was
+// captured at, so that the capture time of any frame can be told locally.
+struct clock_sync {
+  struct clock_sample {
+    int64_t offset;
+    uint64_t rtt;
+  } samples[CLOCK_SYNC_SAMPLES];
+  int count;
+  int next;
+  int64_t offset;
+  uint64_t rtt;
+  uint32_t timestamp;
+  uint64_t capture;
+  int sample_rate;
+};
+
+int clock_sync_request(void* buffer, uint64_t now);
+int clock_sync_update(struct clock_sync* sync, const void* packet, int size,
+                      uint64_t now);
+uint64_t clock_sync_capture_time(const struct clock_sync* sync,
+                                 uint32_t timestamp);
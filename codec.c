@@ -0,0 +1,275 @@
+#include "codec.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define RICE_BITS 5
+#define ESCAPE_ZEROS 24
+
+struct BitWriter {
+  uint8_t* data;
+  int capacity;
+  int size;
+  uint64_t cache;
+  int bits;
+};
+
+struct BitReader {
+  const uint8_t* data;
+  int size;
+  int offset;
+  uint64_t cache;
+  int bits;
+};
+
+static int PutBits(struct BitWriter* writer, uint32_t value, int count) {
+  writer->cache = writer->cache << count | value;
+  writer->bits += count;
+  for (; writer->bits >= 8; writer->bits -= 8) {
+    if (writer->size == writer->capacity) {
+      return 0;
+    }
+    writer->data[writer->size++] = (uint8_t)(writer->cache >> (writer->bits - 8));
+  }
+  return 1;
+}
+
+static int FlushBits(struct BitWriter* writer) {
+  return !writer->bits || PutBits(writer, 0, 8 - writer->bits);
+}
+
+static int GetBits(struct BitReader* reader, int count, uint32_t* value) {
+  while (reader->bits < count) {
+    if (reader->offset == reader->size) {
+      return 0;
+    }
+    reader->cache = reader->cache << 8 | reader->data[reader->offset++];
+    reader->bits += 8;
+  }
+  reader->bits -= count;
+  *value = (uint32_t)(reader->cache >> reader->bits) &
+           (uint32_t)((1ull << count) - 1);
+  return 1;
+}
+
+static uint32_t ZigZag(int32_t value) {
+  return (uint32_t)(value << 1) ^ (uint32_t)(value >> 31);
+}
+
+static int32_t UnZigZag(uint32_t value) {
+  return (int32_t)(value >> 1) ^ -(int32_t)(value & 1);
+}
+
+// Residuals of the fixed predictor of a given order. Plain loops over
+// contiguous int32 arrays, so that the compiler vectorizes them for NEON/SSE.
+static void Predict(const int32_t* restrict x, int count, int order,
+                    int32_t* restrict residual) {
+  switch (order) {
+    case 0:
+      for (int i = 0; i < count; ++i) {
+        residual[i] = x[i];
+      }
+      break;
+    case 1:
+      for (int i = 1; i < count; ++i) {
+        residual[i] = x[i] - x[i - 1];
+      }
+      break;
+    case 2:
+      for (int i = 2; i < count; ++i) {
+        residual[i] = x[i] - 2 * x[i - 1] + x[i - 2];
+      }
+      break;
+    case 3:
+      for (int i = 3; i < count; ++i) {
+        residual[i] = x[i] - 3 * x[i - 1] + 3 * x[i - 2] - x[i - 3];
+      }
+      break;
+    case 4:
+      for (int i = 4; i < count; ++i) {
+        residual[i] =
+            x[i] - 4 * x[i - 1] + 6 * x[i - 2] - 4 * x[i - 3] + x[i - 4];
+      }
+      break;
+  }
+}
+
+static uint64_t SumAbs(const int32_t* residual, int count) {
+  uint64_t sum = 0;
+  for (int i = 0; i < count; ++i) {
+    sum += (uint32_t)abs(residual[i]);
+  }
+  return sum;
+}
+
+static int RiceParameter(const uint32_t* values, int count) {
+  uint64_t sum = 0;
+  for (int i = 0; i < count; ++i) {
+    sum += values[i];
+  }
+  int k = 0;
+  while (k < (1 << RICE_BITS) - 1 && (uint64_t)count << (k + 1) <= sum) {
+    ++k;
+  }
+  return k;
+}
+
+static int PutRice(struct BitWriter* writer, uint32_t value, int k) {
+  uint32_t quotient = value >> k;
+  if (quotient >= ESCAPE_ZEROS) {
+    return PutBits(writer, 0, ESCAPE_ZEROS) && PutBits(writer, value, 32);
+  }
+  return PutBits(writer, 1, quotient + 1) &&
+         (!k || PutBits(writer, value & ((1u << k) - 1), k));
+}
+
+static int GetRice(struct BitReader* reader, int k, uint32_t* value) {
+  uint32_t bit, quotient = 0;
+  for (;; ++quotient) {
+    if (quotient == ESCAPE_ZEROS) {
+      return GetBits(reader, 32, value);
+    }
+    if (!GetBits(reader, 1, &bit)) {
+      return 0;
+    }
+    if (bit) {
+      break;
+    }
+  }
+  uint32_t remainder = 0;
+  if (k && !GetBits(reader, k, &remainder)) {
+    return 0;
+  }
+  *value = quotient << k | remainder;
+  return 1;
+}
+
+static int EncodeChannel(struct BitWriter* writer, const int16_t* samples,
+                         int frames, int channels) {
+  int32_t x[frames], residual[frames];
+  for (int i = 0; i < frames; ++i) {
+    x[i] = samples[i * channels];
+  }
+  int order = 0;
+  uint64_t best = UINT64_MAX;
+  for (int candidate = 0; candidate <= CODEC_MAX_ORDER && candidate < frames;
+       ++candidate) {
+    Predict(x, frames, candidate, residual);
+    uint64_t cost = SumAbs(residual + candidate, frames - candidate);
+    if (cost < best) {
+      best = cost;
+      order = candidate;
+    }
+  }
+  Predict(x, frames, order, residual);
+  if (!PutBits(writer, order, 3)) {
+    return 0;
+  }
+  for (int i = 0; i < order; ++i) {
+    if (!PutBits(writer, (uint16_t)x[i], 16)) {
+      return 0;
+    }
+  }
+  uint32_t values[CODEC_PARTITION];
+  for (int start = order; start < frames; start += CODEC_PARTITION) {
+    int count = frames - start < CODEC_PARTITION ? frames - start
+                                                 : CODEC_PARTITION;
+    for (int i = 0; i < count; ++i) {
+      values[i] = ZigZag(residual[start + i]);
+    }
+    int k = RiceParameter(values, count);
+    if (!PutBits(writer, k, RICE_BITS)) {
+      return 0;
+    }
+    for (int i = 0; i < count; ++i) {
+      if (!PutRice(writer, values[i], k)) {
+        return 0;
+      }
+    }
+  }
+  return 1;
+}
+
+static int DecodeChannel(struct BitReader* reader, int16_t* samples,
+                         int frames, int channels) {
+  uint32_t value, order;
+  if (!GetBits(reader, 3, &order) || order > CODEC_MAX_ORDER ||
+      (int)order > frames) {
+    return 0;
+  }
+  int32_t x[frames];
+  for (uint32_t i = 0; i < order; ++i) {
+    if (!GetBits(reader, 16, &value)) {
+      return 0;
+    }
+    x[i] = (int16_t)value;
+  }
+  for (int start = order; start < frames; start += CODEC_PARTITION) {
+    int count = frames - start < CODEC_PARTITION ? frames - start
+                                                 : CODEC_PARTITION;
+    uint32_t k;
+    if (!GetBits(reader, RICE_BITS, &k)) {
+      return 0;
+    }
+    for (int i = start; i < start + count; ++i) {
+      if (!GetRice(reader, k, &value)) {
+        return 0;
+      }
+      int32_t e = UnZigZag(value);
+      switch (order) {
+        case 0:
+          x[i] = e;
+          break;
+        case 1:
+          x[i] = e + x[i - 1];
+          break;
+        case 2:
+          x[i] = e + 2 * x[i - 1] - x[i - 2];
+          break;
+        case 3:
+          x[i] = e + 3 * x[i - 1] - 3 * x[i - 2] + x[i - 3];
+          break;
+        case 4:
+          x[i] = e + 4 * x[i - 1] - 6 * x[i - 2] + 4 * x[i - 3] - x[i - 4];
+          break;
+      }
+    }
+  }
+  for (int i = 0; i < frames; ++i) {
+    samples[i * channels] = (int16_t)x[i];
+  }
+  return 1;
+}
+
+int CodecEncode(const int16_t* samples, int frames, int channels,
+                uint8_t* output, int capacity) {
+  if (frames <= 0 || frames > UINT16_MAX) {
+    return 0;
+  }
+  struct BitWriter writer = {.data = output, .capacity = capacity};
+  if (!PutBits(&writer, frames, 16)) {
+    return 0;
+  }
+  for (int channel = 0; channel < channels; ++channel) {
+    if (!EncodeChannel(&writer, samples + channel, frames, channels)) {
+      return 0;
+    }
+  }
+  return FlushBits(&writer) ? writer.size : 0;
+}
+
+int CodecDecode(const uint8_t* input, int length, int channels,
+                int16_t* samples, int max_frames) {
+  struct BitReader reader = {.data = input, .size = length};
+  uint32_t frames;
+  if (!GetBits(&reader, 16, &frames) || !frames ||
+      (int)frames > max_frames) {
+    return -1;
+  }
+  for (int channel = 0; channel < channels; ++channel) {
+    if (!DecodeChannel(&reader, samples + channel, frames, channels)) {
+      return -1;
+    }
+  }
+  return frames;
+}
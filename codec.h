@@ -0,0 +1,13 @@
+#include <stdint.h>
+
+// Lossless coding of interleaved s16 frames. Every channel is predicted with
+// the best of the fixed polynomial predictors of orders 0 to 4, and residuals
+// are Rice coded in partitions of CODEC_PARTITION samples. Every payload is
+// self-contained, so losing one datagram never affects another.
+#define CODEC_MAX_ORDER 4
+#define CODEC_PARTITION 64
+
+int CodecEncode(const int16_t* samples, int frames, int channels,
+                uint8_t* output, int capacity);
+int CodecDecode(const uint8_t* input, int length, int channels,
+                int16_t* samples, int max_frames);
@@ -0,0 +1,220 @@
+#include "codec.h"
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define SAMPLE_RATE 48000
+#define BUFFER_FRAMES 480
+#define DURATION 20
+#define SEED 1
+#define HARMONICS 24
+#define NOTE_MS 500
+#define NOISE_DBFS -72
+
+// Codes a voice-like and a music-like signal buffer by buffer the way the
+// sender does, and decodes every buffer back the way pamnc does. Prints one
+// line of JSON per signal to stdout and a summary to stderr, with the size of
+// coded payloads against raw samples, both as coded and with the raw samples
+// the sender falls back to whenever coding does not make a buffer smaller,
+// and what encoding and decoding took per sample. Fails if any buffer does
+// not decode to exactly what was coded.
+//
+// The voice-like signal is a train of harmonics on a gliding pitch, shaped by
+// two moving formants, in syllables with pauses in between. The music-like
+// one is chords of three notes with eight harmonics each, changing every
+// NOTE_MS and decaying in between, with channels panned apart. Both carry
+// noise of their own at NOISE_DBFS, about what a phone microphone picks up in
+// a quiet room, as the noise rather than the signal sets how far lossless
+// coding gets.
+enum signal { VOICE, MUSIC, SIGNAL_COUNT };
+
+static const char* const signal_names[] = {"voice", "music"};
+
+// Semitones above A3 of the chords the music-like signal goes through.
+static const int chords[][3] = {{3, 7, 10}, {-2, 2, 5},  {0, 3, 7},
+                                {-4, 0, 3}, {-7, -3, 0}, {-5, -1, 2}};
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static uint32_t next_random(uint32_t* state) {
+  uint32_t x = *state;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  return *state = x;
+}
+
+static double formant(double frequency, double center, double width) {
+  double distance = (frequency - center) / width;
+  return 1 / (1 + distance * distance);
+}
+
+static double voice(double t, double* phase) {
+  double pitch = 170 + 80 * sin(2 * M_PI * 0.7 * t) * sin(2 * M_PI * 0.13 * t);
+  *phase += 2 * M_PI * pitch / SAMPLE_RATE;
+  double syllable = sin(M_PI * fmod(t * 4.7, 1.0));
+  double envelope = syllable > 0.2 ? (syllable - 0.2) / 0.8 : 0;
+  double first = 500 + 300 * sin(2 * M_PI * 1.9 * t);
+  double second = 1500 + 700 * sin(2 * M_PI * 1.3 * t + 1);
+  double sum = 0;
+  for (int k = 1; k <= HARMONICS; ++k) {
+    double frequency = k * pitch;
+    if (frequency > SAMPLE_RATE / 2) {
+      break;
+    }
+    sum += sin(k * *phase) / k *
+           (formant(frequency, first, 150) + formant(frequency, second, 250));
+  }
+  return 0.3 * envelope * sum;
+}
+
+static double music(double t, int channel) {
+  int note = (int)(t * 1000 / NOTE_MS);
+  const int* chord = chords[note % (sizeof(chords) / sizeof(*chords))];
+  double since = t - note * NOTE_MS / 1000.0;
+  double envelope = exp(-3 * since) * (since < 0.01 ? since / 0.01 : 1);
+  double sum = 0;
+  for (int n = 0; n < 3; ++n) {
+    double frequency = 220 * pow(2, chord[n] / 12.0);
+    // Notes sit at different places between the speakers.
+    double pan = channel ? 0.4 + 0.3 * n : 1.0 - 0.3 * n;
+    for (int k = 1; k <= 8; ++k) {
+      sum += pan * sin(2 * M_PI * k * frequency * t) / (k * k);
+    }
+  }
+  return 0.25 * envelope * sum;
+}
+
+static void make_signal(enum signal signal, int16_t* samples, int frames,
+                        int channels, uint32_t seed) {
+  uint32_t state = seed;
+  double phase = 0;
+  // Triangular noise with this peak has a sixth of its square as power.
+  double noise = sqrt(6) * 32767 * pow(10, NOISE_DBFS / 20.0);
+  for (int i = 0; i < frames; ++i) {
+    double t = (double)i / SAMPLE_RATE;
+    double mono = signal == VOICE ? voice(t, &phase) : 0;
+    for (int c = 0; c < channels; ++c) {
+      double value =
+          signal == VOICE ? mono * (1 - 0.1 * c) : music(t, c % 2);
+      value = value * 32767 +
+              noise * ((double)next_random(&state) / UINT32_MAX +
+                       (double)next_random(&state) / UINT32_MAX - 1);
+      value = value > 32767 ? 32767 : value < -32768 ? -32768 : value;
+      samples[i * channels + c] = (int16_t)lrint(value);
+    }
+  }
+}
+
+int main(int argc, char** argv) {
+  int channels = 1;
+  int duration = DURATION;
+  int buffer_frames = BUFFER_FRAMES;
+  uint32_t seed = SEED;
+  for (int opt; (opt = getopt(argc, argv, "c:d:f:s:")) != -1;) {
+    switch (opt) {
+      case 'c':
+        channels = atoi(optarg);
+        break;
+      case 'd':
+        duration = atoi(optarg);
+        break;
+      case 'f':
+        buffer_frames = atoi(optarg);
+        break;
+      case 's':
+        seed = (uint32_t)strtoul(optarg, NULL, 0);
+        break;
+      default:
+        channels = 0;
+        break;
+    }
+  }
+  if (optind != argc || channels <= 0 || duration <= 0 ||
+      buffer_frames <= 0 || !seed) {
+    fprintf(stderr,
+            "Usage: %s [-c channels] [-d seconds] [-f frames per buffer] "
+            "[-s seed]\n",
+            argv[0]);
+    return EXIT_FAILURE;
+  }
+  int buffers = duration * SAMPLE_RATE / buffer_frames;
+  int frames = buffers * buffer_frames;
+  size_t count = (size_t)frames * channels;
+  int raw_size = buffer_frames * channels * (int)sizeof(int16_t);
+  int16_t* samples = malloc(count * sizeof(int16_t));
+  int16_t* decoded = malloc(raw_size);
+  // Room for a buffer that is escape codes all through.
+  int capacity = raw_size * 4 + 64;
+  uint8_t* coded = malloc(capacity);
+  if (!samples || !decoded || !coded) {
+    perror("Failed to allocate signal");
+    return EXIT_FAILURE;
+  }
+  int result = EXIT_SUCCESS;
+  for (int s = 0; s < SIGNAL_COUNT; ++s) {
+    make_signal((enum signal)s, samples, frames, channels, seed);
+    uint64_t encode_time = 0;
+    uint64_t decode_time = 0;
+    uint64_t coded_bytes = 0;
+    uint64_t sent_bytes = 0;
+    int raw_buffers = 0;
+    int mismatches = 0;
+    for (int b = 0; b < buffers; ++b) {
+      const int16_t* buffer = samples + (size_t)b * buffer_frames * channels;
+      uint64_t start = now_ns();
+      int length = CodecEncode(buffer, buffer_frames, channels, coded,
+                               capacity);
+      encode_time += now_ns() - start;
+      start = now_ns();
+      int decoded_frames =
+          CodecDecode(coded, length, channels, decoded, buffer_frames);
+      decode_time += now_ns() - start;
+      if (!length || decoded_frames != buffer_frames ||
+          memcmp(decoded, buffer, raw_size)) {
+        ++mismatches;
+      }
+      coded_bytes += length;
+      if (length && length < raw_size) {
+        sent_bytes += length;
+      } else {
+        sent_bytes += raw_size;
+        ++raw_buffers;
+      }
+    }
+    double raw_bytes = (double)buffers * raw_size;
+    double ratio = coded_bytes / raw_bytes;
+    double sent_ratio = sent_bytes / raw_bytes;
+    double encode_ns = (double)encode_time / count;
+    double decode_ns = (double)decode_time / count;
+    printf("{\"signal\":\"%s\",\"channels\":%d,\"buffer_frames\":%d,"
+           "\"buffers\":%d,\"ratio\":%.3f,\"sent_ratio\":%.3f,"
+           "\"raw_buffers\":%d,\"encode_ns_per_sample\":%.2f,"
+           "\"decode_ns_per_sample\":%.2f,\"mismatches\":%d}\n",
+           signal_names[s], channels, buffer_frames, buffers, ratio,
+           sent_ratio, raw_buffers, encode_ns, decode_ns, mismatches);
+    fprintf(stderr,
+            "%s: %d buffers of %d frames, coded to %.3f of raw and sent as "
+            "%.3f with %d raw, encode %.2f ns and decode %.2f ns per sample, "
+            "%s\n",
+            signal_names[s], buffers, buffer_frames, ratio, sent_ratio,
+            raw_buffers, encode_ns, decode_ns,
+            mismatches ? "NOT LOSSLESS" : "lossless");
+    if (mismatches) {
+      result = EXIT_FAILURE;
+    }
+  }
+  free(samples);
+  free(decoded);
+  free(coded);
+  return result;
+}
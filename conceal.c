@@ -0,0 +1,234 @@
+#include "plc.h"
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define SAMPLE_RATE 48000
+#define PACKET_MS 10
+#define DURATION 20
+#define SEED 1
+#define HARMONICS 24
+#define SEGMENT_FLOOR -10.0
+#define SEGMENT_CEILING 35.0
+
+// Drops packets of a voice-like signal at random at every loss rate, and
+// plays what is left once with losses concealed and once with them filled with
+// silence, the way pamnc does either. Prints one line of JSON per loss rate to
+// stdout and a summary to stderr, with the signal to noise ratio of each
+// against the original, over the whole signal and as the mean over packets
+// that were lost, in dB clamped to between SEGMENT_FLOOR and SEGMENT_CEILING.
+// Whole signal figures take in what the cross-fade out of concealment costs
+// the packet after it. Time is what making up a lost packet took on average,
+// and the share of a core that concealment took along with keeping history.
+// Fails if concealment does not come out ahead of silence at every rate.
+//
+// The signal is a train of harmonics, falling off with frequency and shaped
+// by two formants, on a pitch that glides between 90 and 250 Hz, with
+// syllables of about 200 ms and short pauses in between, so that concealment
+// has to follow changing pitch and level as it would with speech.
+static const int loss_rates[] = {1, 2, 5, 10, 20};
+
+struct quality {
+  double signal;
+  double noise;
+  double segments;
+  int segment_count;
+};
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static uint32_t next_random(uint32_t* state) {
+  uint32_t x = *state;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  return *state = x;
+}
+
+static float formant(double frequency, double center, double width) {
+  double distance = (frequency - center) / width;
+  return (float)(1 / (1 + distance * distance));
+}
+
+static void make_signal(float* samples, int frames, int channels) {
+  double phase = 0;
+  for (int i = 0; i < frames; ++i) {
+    double t = (double)i / SAMPLE_RATE;
+    double pitch =
+        170 + 80 * sin(2 * M_PI * 0.7 * t) * sin(2 * M_PI * 0.13 * t);
+    phase += 2 * M_PI * pitch / SAMPLE_RATE;
+    double syllable = sin(M_PI * fmod(t * 4.7, 1.0));
+    double envelope = syllable > 0.2 ? (syllable - 0.2) / 0.8 : 0;
+    double first = 500 + 300 * sin(2 * M_PI * 1.9 * t);
+    double second = 1500 + 700 * sin(2 * M_PI * 1.3 * t + 1);
+    double sum = 0;
+    for (int k = 1; k <= HARMONICS; ++k) {
+      double frequency = k * pitch;
+      if (frequency > SAMPLE_RATE / 2) {
+        break;
+      }
+      sum += sin(k * phase) / k *
+             (formant(frequency, first, 150) + formant(frequency, second, 250));
+    }
+    for (int c = 0; c < channels; ++c) {
+      // Channels differ a little, like mics a few centimeters apart.
+      samples[i * channels + c] = (float)(0.3 * envelope * sum * (1 - 0.1 * c));
+    }
+  }
+}
+
+static void measure(struct quality* quality, const float* original,
+                    const float* played, int count) {
+  double signal = 0;
+  double noise = 0;
+  for (int i = 0; i < count; ++i) {
+    double error = played[i] - original[i];
+    signal += (double)original[i] * original[i];
+    noise += error * error;
+  }
+  quality->signal += signal;
+  quality->noise += noise;
+  if (signal > 0) {
+    double snr = noise > 0 ? 10 * log10(signal / noise) : SEGMENT_CEILING;
+    snr = snr < SEGMENT_FLOOR ? SEGMENT_FLOOR : snr;
+    quality->segments += snr < SEGMENT_CEILING ? snr : SEGMENT_CEILING;
+    ++quality->segment_count;
+  }
+}
+
+static double snr(const struct quality* quality) {
+  return 10 * log10(quality->signal / quality->noise);
+}
+
+static double segmental_snr(const struct quality* quality) {
+  return quality->segment_count
+             ? quality->segments / quality->segment_count
+             : SEGMENT_CEILING;
+}
+
+int main(int argc, char** argv) {
+  int channels = 1;
+  int duration = DURATION;
+  uint32_t seed = SEED;
+  for (int opt; (opt = getopt(argc, argv, "c:d:s:")) != -1;) {
+    switch (opt) {
+      case 'c':
+        channels = atoi(optarg);
+        break;
+      case 'd':
+        duration = atoi(optarg);
+        break;
+      case 's':
+        seed = (uint32_t)strtoul(optarg, NULL, 0);
+        break;
+      default:
+        channels = 0;
+        break;
+    }
+  }
+  if (optind != argc || channels <= 0 || duration <= 0 || !seed) {
+    fprintf(stderr, "Usage: %s [-c channels] [-d seconds] [-s seed]\n",
+            argv[0]);
+    return EXIT_FAILURE;
+  }
+  int packet = SAMPLE_RATE * PACKET_MS / 1000;
+  int packets = duration * 1000 / PACKET_MS;
+  int frames = packets * packet;
+  size_t count = (size_t)frames * channels;
+  float* original = malloc(count * sizeof(float));
+  float* concealed = malloc(count * sizeof(float));
+  float* silent = malloc(count * sizeof(float));
+  char* lost = malloc(packets);
+  if (!original || !concealed || !silent || !lost) {
+    perror("Failed to allocate signal");
+    return EXIT_FAILURE;
+  }
+  make_signal(original, frames, channels);
+  int result = EXIT_SUCCESS;
+  for (size_t r = 0; r < sizeof(loss_rates) / sizeof(*loss_rates); ++r) {
+    uint32_t state = seed;
+    int lost_count = 0;
+    for (int p = 0; p < packets; ++p) {
+      // First packets always come, as pamnc has to have some to start with.
+      lost[p] = p >= 10 && next_random(&state) % 100 < (uint32_t)loss_rates[r];
+      lost_count += lost[p];
+    }
+    struct plc plc;
+    if (!plc_init(&plc, SAMPLE_RATE, channels)) {
+      perror("Failed to allocate loss concealment");
+      return EXIT_FAILURE;
+    }
+    uint64_t conceal_time = 0;
+    uint64_t receive_time = 0;
+    memcpy(concealed, original, count * sizeof(float));
+    for (int p = 0; p < packets; ++p) {
+      float* samples = concealed + (size_t)p * packet * channels;
+      uint64_t start = now_ns();
+      if (lost[p]) {
+        plc_conceal(&plc, samples, packet);
+        conceal_time += now_ns() - start;
+      } else {
+        plc_receive(&plc, samples, packet);
+        receive_time += now_ns() - start;
+      }
+    }
+    plc_free(&plc);
+    memcpy(silent, original, count * sizeof(float));
+    struct quality concealing = {0};
+    struct quality silence = {0};
+    struct quality lost_concealing = {0};
+    struct quality lost_silence = {0};
+    for (int p = 0; p < packets; ++p) {
+      size_t offset = (size_t)p * packet * channels;
+      int length = packet * channels;
+      if (lost[p]) {
+        memset(silent + offset, 0, length * sizeof(float));
+      }
+      measure(&concealing, original + offset, concealed + offset, length);
+      measure(&silence, original + offset, silent + offset, length);
+      if (lost[p]) {
+        measure(&lost_concealing, original + offset, concealed + offset,
+                length);
+        measure(&lost_silence, original + offset, silent + offset, length);
+      }
+    }
+    double us_per_packet = lost_count ? conceal_time / 1e3 / lost_count : 0;
+    double cpu = 100.0 * (conceal_time + receive_time) / 1e3 / packets /
+                 (PACKET_MS * 1000);
+    printf("{\"loss_percent\":%d,\"channels\":%d,\"packets\":%d,"
+           "\"lost_packets\":%d,\"snr_db\":%.2f,\"silence_snr_db\":%.2f,"
+           "\"segmental_snr_db\":%.2f,\"silence_segmental_snr_db\":%.2f,"
+           "\"us_per_lost_packet\":%.2f,\"cpu_percent\":%.3f}\n",
+           loss_rates[r], channels, packets, lost_count, snr(&concealing),
+           snr(&silence), segmental_snr(&lost_concealing),
+           segmental_snr(&lost_silence), us_per_packet, cpu);
+    int better = segmental_snr(&lost_concealing) >
+                     segmental_snr(&lost_silence) &&
+                 snr(&concealing) > snr(&silence);
+    fprintf(stderr,
+            "%3d%% loss: %4d of %d packets, SNR %5.2f dB vs %5.2f dB silence, "
+            "segmental SNR of lost packets %5.2f dB vs %5.2f dB, "
+            "%.2f us per lost packet, %.3f%% of a core, %s\n",
+            loss_rates[r], lost_count, packets, snr(&concealing),
+            snr(&silence), segmental_snr(&lost_concealing),
+            segmental_snr(&lost_silence), us_per_packet, cpu,
+            better ? "better" : "NOT BETTER");
+    if (!better) {
+      result = EXIT_FAILURE;
+    }
+  }
+  free(original);
+  free(concealed);
+  free(silent);
+  free(lost);
+  return result;
+}
@@ -0,0 +1,319 @@
+#define _GNU_SOURCE
+
+#include "control.h"
+#include "packet.h"
+#include "utils.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <sched.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <arpa/inet.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+
+// Largest datagram a client sends is a clock request.
+#define REQUEST_SIZE (sizeof(struct PacketHeader) + sizeof(struct ClockReport))
+
+static uint64_t ToNanoseconds(const struct timespec* ts) {
+  return (uint64_t)ts->tv_sec * 1000000000 + ts->tv_nsec;
+}
+
+uint64_t MonotonicTime(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ToNanoseconds(&ts);
+}
+
+// Writer sections are bracketed with odd sequence numbers. Readers copy
+// everything out, and take the copy only if the sequence number was even and
+// did not change in the meantime.
+static void SeqlockWriteBegin(atomic_uint* sequence) {
+  atomic_store_explicit(
+      sequence, atomic_load_explicit(sequence, memory_order_relaxed) + 1,
+      memory_order_relaxed);
+  atomic_thread_fence(memory_order_release);
+}
+
+static void SeqlockWriteEnd(atomic_uint* sequence) {
+  atomic_store_explicit(
+      sequence, atomic_load_explicit(sequence, memory_order_relaxed) + 1,
+      memory_order_release);
+}
+
+static int SeqlockReadValid(atomic_uint* sequence, unsigned begin) {
+  atomic_thread_fence(memory_order_acquire);
+  return !(begin & 1) &&
+         atomic_load_explicit(sequence, memory_order_relaxed) == begin;
+}
+
+// IPv4-mapped addresses are written the IPv4 way, and IPv6 ones in brackets.
+const char* FormatAddress(const struct sockaddr_in6* addr, char* buffer,
+                          size_t size) {
+  char address[INET6_ADDRSTRLEN];
+  int mapped = IN6_IS_ADDR_V4MAPPED(&addr->sin6_addr);
+  if (!inet_ntop(mapped ? AF_INET : AF_INET6,
+                 mapped ? (const void*)&addr->sin6_addr.s6_addr[12]
+                        : (const void*)&addr->sin6_addr,
+                 address, sizeof(address))) {
+    strcpy(address, "?");
+  }
+  snprintf(buffer, size, mapped ? "%s:%u" : "[%s]:%u", address,
+           ntohs(addr->sin6_port));
+  return buffer;
+}
+
+static void LogSubscriber(const char* message, const struct Subscriber* it) {
+  char address[INET6_ADDRSTRLEN + 8];
+  LOG(INFO, "%s %s", message,
+      FormatAddress(&it->addr, address, sizeof(address)));
+}
+
+static struct Subscriber* FindSubscriber(struct SubscriberTable* table,
+                                         const struct sockaddr_in6* addr) {
+  for (int i = 0; i < table->count; ++i) {
+    struct Subscriber* it = &table->subscribers[i];
+    if (IN6_ARE_ADDR_EQUAL(&it->addr.sin6_addr, &addr->sin6_addr) &&
+        it->addr.sin6_port == addr->sin6_port) {
+      return it;
+    }
+  }
+  return NULL;
+}
+
+static void Subscribe(struct SubscriberTable* table,
+                      const struct sockaddr_in6* addr, uint64_t now) {
+  struct Subscriber* it = FindSubscriber(table, addr);
+  if (it) {
+    it->last_seen = now;
+    return;
+  }
+  if (table->count == CONTROL_MAX_SUBSCRIBERS) {
+    char address[INET6_ADDRSTRLEN + 8];
+    LOG(WARN, "Too many subscribers, ignoring %s",
+        FormatAddress(addr, address, sizeof(address)));
+    return;
+  }
+  it = &table->subscribers[table->count++];
+  *it = (struct Subscriber){.addr = *addr, .last_seen = now};
+  LogSubscriber("Client subscribed at", it);
+}
+
+void RemoveSubscriber(struct SubscriberTable* table, int index,
+                      const char* reason) {
+  LogSubscriber(reason, &table->subscribers[index]);
+  table->subscribers[index] = table->subscribers[--table->count];
+}
+
+// Kernel stamps datagrams on the realtime clock as they come in, and it only
+// takes to know how long ago that was.
+static uint64_t ReceiveTime(struct msghdr* msg, uint64_t now) {
+  for (struct cmsghdr* it = CMSG_FIRSTHDR(msg); it;
+       it = CMSG_NXTHDR(msg, it)) {
+    if (it->cmsg_level == SOL_SOCKET && it->cmsg_type == SCM_TIMESTAMPNS) {
+      struct timespec stamp, realtime;
+      memcpy(&stamp, CMSG_DATA(it), sizeof(stamp));
+      clock_gettime(CLOCK_REALTIME, &realtime);
+      uint64_t age = ToNanoseconds(&realtime) - ToNanoseconds(&stamp);
+      return age < now ? now - age : now;
+    }
+  }
+  return now;
+}
+
+// Send loop publishes once per buffer, so it is never long before a copy
+// goes through.
+static void ReadCapture(struct Control* control, struct PacketHeader* header,
+                        uint64_t* capture_time) {
+  for (;;) {
+    unsigned begin = atomic_load_explicit(&control->capture_sequence,
+                                          memory_order_acquire);
+    *header = (struct PacketHeader){.format = control->format,
+                                    .timestamp = control->timestamp};
+    *capture_time = control->capture_time;
+    if (SeqlockReadValid(&control->capture_sequence, begin)) {
+      return;
+    }
+    sched_yield();
+  }
+}
+
+// Requests that come before the first buffer are left unanswered.
+static void AnswerClock(struct Control* control,
+                        const struct sockaddr_in6* addr, const void* request,
+                        uint64_t receive_time) {
+  struct PacketHeader header;
+  struct ClockReport report;
+  ReadCapture(control, &header, &report.capture);
+  if (!report.capture) {
+    return;
+  }
+  header.type = PACKET_TYPE_CLOCK;
+  header.length = sizeof(struct ClockReport);
+  memcpy(&report.origin,
+         (const char*)request + sizeof(header) +
+             offsetof(struct ClockReport, origin),
+         sizeof(report.origin));
+  report.receive = receive_time;
+  uint8_t answer[sizeof(header) + sizeof(report)];
+  memcpy(answer, &header, sizeof(header));
+  report.transmit = MonotonicTime();
+  memcpy(answer + sizeof(header), &report, sizeof(report));
+  if (sendto(control->fd, answer, sizeof(answer), 0,
+             (const struct sockaddr*)addr, sizeof(*addr)) == -1) {
+    LOG(WARN, "Failed to answer clock request (%s)", strerror(errno));
+  }
+}
+
+static void HandleRequest(struct Control* control,
+                          const struct sockaddr_in6* addr, const void* request,
+                          ssize_t length, struct msghdr* msg) {
+  uint64_t now = MonotonicTime();
+  const struct PacketHeader* header = request;
+  int complete = (size_t)length >= sizeof(*header) &&
+                 !(msg->msg_flags & MSG_TRUNC) &&
+                 (size_t)length == sizeof(*header) + header->length;
+  if (complete && header->type == PACKET_TYPE_BYE) {
+    struct Subscriber* it = FindSubscriber(&control->table, addr);
+    if (it) {
+      RemoveSubscriber(&control->table, (int)(it - control->table.subscribers),
+                       "Client unsubscribed at");
+    }
+    return;
+  }
+  Subscribe(&control->table, addr, now);
+  if (complete && header->type == PACKET_TYPE_CLOCK &&
+      header->length == sizeof(struct ClockReport)) {
+    AnswerClock(control, addr, request, ReceiveTime(msg, now));
+  }
+}
+
+// Drains the socket, and returns 0 only for errors that will not go away.
+static int ReadRequests(struct Control* control) {
+  for (;;) {
+    struct sockaddr_in6 addr;
+    uint8_t request[REQUEST_SIZE];
+    uint8_t ancillary[CMSG_SPACE(sizeof(struct timespec))];
+    struct iovec iov = {.iov_base = request, .iov_len = sizeof(request)};
+    struct msghdr msg = {.msg_name = &addr,
+                         .msg_namelen = sizeof(addr),
+                         .msg_iov = &iov,
+                         .msg_iovlen = 1,
+                         .msg_control = ancillary,
+                         .msg_controllen = sizeof(ancillary)};
+    ssize_t length = recvmsg(control->fd, &msg, MSG_DONTWAIT);
+    if (length == -1) {
+      switch (errno) {
+        case EAGAIN:
+          return 1;
+        case EINTR:
+        case ECONNREFUSED:
+          // Failed sends of the send loop are reported here too.
+          continue;
+        default:
+          LOG(ERROR, "Failed to read requests (%s)", strerror(errno));
+          return 0;
+      }
+    }
+    if (addr.sin6_family == AF_INET6) {
+      HandleRequest(control, &addr, request, length, &msg);
+    }
+  }
+}
+
+static void Publish(struct Control* control) {
+  SeqlockWriteBegin(&control->table_sequence);
+  control->published = control->table;
+  SeqlockWriteEnd(&control->table_sequence);
+}
+
+static void* ControlThread(void* arg) {
+  struct Control* control = arg;
+  uint64_t timeout = CONTROL_SUBSCRIBER_TIMEOUT * 1000000000ull;
+  struct pollfd fds[] = {{.fd = control->fd, .events = POLLIN},
+                         {.fd = control->wake, .events = POLLIN}};
+  for (;;) {
+    if (poll(fds, LENGTH(fds), 1000) == -1 && errno != EINTR) {
+      LOG(ERROR, "Failed to poll sender socket (%s)", strerror(errno));
+      break;
+    }
+    if (fds[1].revents) {
+      break;
+    }
+    if (fds[0].revents && !ReadRequests(control)) {
+      break;
+    }
+    uint64_t now = MonotonicTime();
+    for (int i = control->table.count - 1; i >= 0; --i) {
+      if (now - control->table.subscribers[i].last_seen > timeout) {
+        RemoveSubscriber(&control->table, i, "Client timed out at");
+      }
+    }
+    // Keepalives republish the table too, so that whoever the send loop
+    // dropped on a failed send comes back as soon as it pings again.
+    Publish(control);
+  }
+  return NULL;
+}
+
+int StartControl(struct Control* control, int fd,
+                 const struct SubscriberTable* subscribers) {
+  *control = (struct Control){.fd = fd, .table = *subscribers};
+  atomic_init(&control->table_sequence, 0);
+  atomic_init(&control->capture_sequence, 0);
+  Publish(control);
+  control->wake = eventfd(0, EFD_CLOEXEC);
+  if (control->wake == -1) {
+    LOG(ERROR, "Failed to create eventfd (%s)", strerror(errno));
+    return 0;
+  }
+  int error = pthread_create(&control->thread, NULL, ControlThread, control);
+  if (error) {
+    LOG(ERROR, "Failed to create control thread (%s)", strerror(error));
+    close(control->wake);
+    return 0;
+  }
+  return 1;
+}
+
+void StopControl(struct Control* control) {
+  uint64_t value = 1;
+  if (write(control->wake, &value, sizeof(value)) == -1) {
+    LOG(ERROR, "Failed to wake control thread (%s)", strerror(errno));
+  }
+  pthread_join(control->thread, NULL);
+  close(control->wake);
+}
+
+// Capture time is the time the frame with the timestamp was captured at.
+void ControlPublishCapture(struct Control* control, uint16_t format,
+                           uint32_t timestamp, uint64_t capture_time) {
+  SeqlockWriteBegin(&control->capture_sequence);
+  control->format = format;
+  control->timestamp = timestamp;
+  control->capture_time = capture_time;
+  SeqlockWriteEnd(&control->capture_sequence);
+}
+
+// Copies subscribers into table if they changed since sequence, and returns 1
+// if they did. A copy that is being written to is left for next time.
+int ControlUpdateSubscribers(struct Control* control, unsigned* sequence,
+                             struct SubscriberTable* table) {
+  unsigned begin =
+      atomic_load_explicit(&control->table_sequence, memory_order_acquire);
+  if (begin == *sequence) {
+    return 0;
+  }
+  struct SubscriberTable copy = control->published;
+  if (!SeqlockReadValid(&control->table_sequence, begin)) {
+    return 0;
+  }
+  *table = copy;
+  *sequence = begin;
+  return 1;
+}
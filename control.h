@@ -0,0 +1,56 @@
+#include <netinet/in.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define CONTROL_MAX_SUBSCRIBERS 16
+#define CONTROL_SUBSCRIBER_TIMEOUT 5
+
+// Every client keeps pinging the sender to stay subscribed, and those that
+// were not heard from for CONTROL_SUBSCRIBER_TIMEOUT seconds are dropped.
+// Sender socket takes both IPv4 and IPv6, and IPv4 clients come in as
+// IPv4-mapped addresses.
+struct Subscriber {
+  struct sockaddr_in6 addr;
+  uint64_t last_seen;
+};
+
+struct SubscriberTable {
+  int count;
+  struct Subscriber subscribers[CONTROL_MAX_SUBSCRIBERS];
+};
+
+// Serves everything that comes in on the sender socket from a thread of its
+// own, so that the send loop never reads the socket. It subscribes whoever
+// sends anything, unsubscribes on request or timeout, and answers clock
+// requests with the capture time the send loop last published. Subscribers
+// and capture time are handed between the two threads with seqlocks, so that
+// neither ever waits for the other. Table holds the subscribers the control
+// thread left once it is stopped.
+struct Control {
+  int fd;
+  int wake;
+  pthread_t thread;
+  struct SubscriberTable table;
+  atomic_uint table_sequence;
+  struct SubscriberTable published;
+  atomic_uint capture_sequence;
+  uint16_t format;
+  uint32_t timestamp;
+  uint64_t capture_time;
+};
+
+uint64_t MonotonicTime(void);
+const char* FormatAddress(const struct sockaddr_in6* addr, char* buffer,
+                          size_t size);
+void RemoveSubscriber(struct SubscriberTable* table, int index,
+                      const char* reason);
+// Starts with the subscribers given, already published to the send loop.
+int StartControl(struct Control* control, int fd,
+                 const struct SubscriberTable* subscribers);
+void StopControl(struct Control* control);
+void ControlPublishCapture(struct Control* control, uint16_t format,
+                           uint32_t timestamp, uint64_t capture_time);
+int ControlUpdateSubscribers(struct Control* control, unsigned* sequence,
+                             struct SubscriberTable* table);
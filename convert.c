@@ -0,0 +1,147 @@
+#include "convert.h"
+#include "packet.h"
+
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+
+#define S16_SCALE 32768.f
+#define S24_SCALE 8388608.f
+
+// Rounds half away from zero, which unlike rintf vectorizes. Rounding goes
+// before the clamps, and those stay separate, for the same reason.
+static inline int32_t Quantize(float sample, float scale) {
+  sample = sample * scale + copysignf(.5f, sample);
+  sample = sample < -scale ? -scale : sample;
+  sample = sample > scale - 1 ? scale - 1 : sample;
+  return (int32_t)sample;
+}
+
+static void S16ToFloat(const void* input, float* output, int count) {
+  const int16_t* restrict samples = input;
+  float* restrict result = output;
+  for (int i = 0; i < count; ++i) {
+    result[i] = samples[i] / S16_SCALE;
+  }
+}
+
+static void FloatToS16(const float* input, void* output, int count) {
+  const float* restrict samples = input;
+  int16_t* restrict result = output;
+  for (int i = 0; i < count; ++i) {
+    result[i] = (int16_t)Quantize(samples[i], S16_SCALE);
+  }
+}
+
+static void S24ToFloat(const void* input, float* output, int count) {
+  const uint8_t* restrict bytes = input;
+  float* restrict result = output;
+  for (int i = 0; i < count; ++i) {
+    int32_t sample = (int32_t)((uint32_t)bytes[i * 3] << 8 |
+                               (uint32_t)bytes[i * 3 + 1] << 16 |
+                               (uint32_t)bytes[i * 3 + 2] << 24);
+    result[i] = (sample >> 8) / S24_SCALE;
+  }
+}
+
+static void FloatToS24(const float* input, void* output, int count) {
+  const float* restrict samples = input;
+  uint8_t* restrict bytes = output;
+  for (int i = 0; i < count; ++i) {
+    int32_t sample = Quantize(samples[i], S24_SCALE);
+    bytes[i * 3] = (uint8_t)sample;
+    bytes[i * 3 + 1] = (uint8_t)(sample >> 8);
+    bytes[i * 3 + 2] = (uint8_t)(sample >> 16);
+  }
+}
+
+static void F32ToFloat(const void* input, float* output, int count) {
+  memcpy(output, input, count * sizeof(float));
+}
+
+static void FloatToF32(const float* input, void* output, int count) {
+  memcpy(output, input, count * sizeof(float));
+}
+
+ConvertToFloat GetConvertToFloat(int encoding) {
+  switch (encoding) {
+    case PACKET_ENCODING_S16LE:
+      return S16ToFloat;
+    case PACKET_ENCODING_S24LE:
+      return S24ToFloat;
+    case PACKET_ENCODING_F32LE:
+      return F32ToFloat;
+    default:
+      return NULL;
+  }
+}
+
+ConvertFromFloat GetConvertFromFloat(int encoding) {
+  switch (encoding) {
+    case PACKET_ENCODING_S16LE:
+      return FloatToS16;
+    case PACKET_ENCODING_S24LE:
+      return FloatToS24;
+    case PACKET_ENCODING_F32LE:
+      return FloatToF32;
+    default:
+      return NULL;
+  }
+}
+
+// Channel count is a constant wherever this is inlined with one.
+static inline void DeinterleaveChannels(const float* restrict input,
+                                        int frames, int channels,
+                                        float* restrict output, int stride) {
+  for (int i = 0; i < frames; ++i) {
+    for (int c = 0; c < channels; ++c) {
+      output[c * stride + i] = input[i * channels + c];
+    }
+  }
+}
+
+static inline void InterleaveChannels(const float* restrict input, int stride,
+                                      int frames, int channels,
+                                      float* restrict output) {
+  for (int i = 0; i < frames; ++i) {
+    for (int c = 0; c < channels; ++c) {
+      output[i * channels + c] = input[c * stride + i];
+    }
+  }
+}
+
+void Deinterleave(const float* input, int frames, int channels, float* output,
+                  int stride) {
+  switch (channels) {
+    case 1:
+      memcpy(output, input, frames * sizeof(float));
+      break;
+    case 2:
+      DeinterleaveChannels(input, frames, 2, output, stride);
+      break;
+    case 4:
+      DeinterleaveChannels(input, frames, 4, output, stride);
+      break;
+    default:
+      DeinterleaveChannels(input, frames, channels, output, stride);
+      break;
+  }
+}
+
+void Interleave(const float* input, int stride, int frames, int channels,
+                float* output) {
+  switch (channels) {
+    case 1:
+      memcpy(output, input, frames * sizeof(float));
+      break;
+    case 2:
+      InterleaveChannels(input, stride, frames, 2, output);
+      break;
+    case 4:
+      InterleaveChannels(input, stride, frames, 4, output);
+      break;
+    default:
+      InterleaveChannels(input, stride, frames, channels, output);
+      break;
+  }
+}
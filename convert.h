@@ -0,0 +1,15 @@
+// Conversions between samples in one of PACKET_ENCODING_* and floats in the
+// range of -1 to 1. Every encoding gets plain loops of its own with the sample
+// conversion inlined, so that the compiler vectorizes them for NEON/SSE.
+typedef void (*ConvertToFloat)(const void* input, float* output, int count);
+typedef void (*ConvertFromFloat)(const float* input, void* output, int count);
+
+ConvertToFloat GetConvertToFloat(int encoding);
+ConvertFromFloat GetConvertFromFloat(int encoding);
+
+// Moves between interleaved frames and planes of samples that start stride
+// floats apart. Mono, stereo and four channels get loops of their own.
+void Deinterleave(const float* input, int frames, int channels, float* output,
+                  int stride);
+void Interleave(const float* input, int stride, int frames, int channels,
+                float* output);
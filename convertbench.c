@@ -0,0 +1,190 @@
+#include "convert.h"
+#include "packet.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define SAMPLES 4096
+#define MIN_TIME_MS 200
+#define SEED 1
+
+// Runs every conversion kernel of convert.c, both ways for every encoding,
+// and deinterleaving and interleaving for every channel count that has loops
+// of its own, over SAMPLES samples per call, as many times as fit in
+// MIN_TIME_MS. Prints one line of JSON per kernel to stdout and a summary to
+// stderr, with the samples per second it went through. Fails if a round trip
+// through float and back does not give back every sample as it was.
+//
+// Samples are random over the whole range of every encoding, and floats are
+// what the samples of the same encoding convert to, so that conversion back
+// never has to clamp.
+static const struct {
+  int encoding;
+  const char* name;
+  int size;
+} encodings[] = {
+    {PACKET_ENCODING_S16LE, "s16le", 2},
+    {PACKET_ENCODING_S24LE, "s24le", 3},
+    {PACKET_ENCODING_F32LE, "f32le", 4},
+};
+
+// As many as there are encodings, so that either takes the same index.
+static const int channel_counts[] = {1, 2, 4};
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static uint32_t next_random(uint32_t* state) {
+  uint32_t x = *state;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  return *state = x;
+}
+
+enum kind { TO_FLOAT, FROM_FLOAT, DEINTERLEAVE, INTERLEAVE };
+
+// One of the kernels over count samples, with index into encodings for
+// conversions and into channel_counts for interleaving.
+struct kernel {
+  enum kind kind;
+  int index;
+  int count;
+  const void* input;
+  void* output;
+};
+
+static void call(const struct kernel* kernel) {
+  int encoding = encodings[kernel->index].encoding;
+  int channels = channel_counts[kernel->index];
+  int frames = kernel->count / channels;
+  switch (kernel->kind) {
+    case TO_FLOAT:
+      GetConvertToFloat(encoding)(kernel->input, kernel->output,
+                                  kernel->count);
+      break;
+    case FROM_FLOAT:
+      GetConvertFromFloat(encoding)(kernel->input, kernel->output,
+                                    kernel->count);
+      break;
+    // Planes are as long as there are frames, one after the other.
+    case DEINTERLEAVE:
+      Deinterleave(kernel->input, frames, channels, kernel->output, frames);
+      break;
+    case INTERLEAVE:
+      Interleave(kernel->input, frames, frames, channels, kernel->output);
+      break;
+  }
+}
+
+// Returns millions of samples per second.
+static double measure(const struct kernel* kernel) {
+  long calls = 0;
+  uint64_t start = now_ns();
+  uint64_t elapsed;
+  do {
+    for (int i = 0; i < 64; ++i) {
+      call(kernel);
+    }
+    calls += 64;
+    elapsed = now_ns() - start;
+  } while (elapsed < MIN_TIME_MS * 1000000ull);
+  return (double)calls * kernel->count / (elapsed / 1e9) / 1e6;
+}
+
+static void report(const char* kernel, const char* encoding, int channels,
+                   int count, double rate, int exact) {
+  printf("{\"kernel\":\"%s\",\"encoding\":\"%s\",\"channels\":%d,"
+         "\"samples_per_call\":%d,\"msamples_per_second\":%.1f,"
+         "\"round_trip_exact\":%s}\n",
+         kernel, encoding, channels, count, rate, exact ? "true" : "false");
+  fprintf(stderr, "%-12s %-5s %d ch: %8.1f Msamples/s%s\n", kernel, encoding,
+          channels, rate, exact ? "" : ", ROUND TRIP NOT EXACT");
+}
+
+int main(int argc, char** argv) {
+  int count = SAMPLES;
+  uint32_t seed = SEED;
+  for (int opt; (opt = getopt(argc, argv, "n:s:")) != -1;) {
+    switch (opt) {
+      case 'n':
+        count = atoi(optarg);
+        break;
+      case 's':
+        seed = (uint32_t)strtoul(optarg, NULL, 0);
+        break;
+      default:
+        count = 0;
+        break;
+    }
+  }
+  // Every channel count has to divide the samples into whole frames.
+  if (optind != argc || count <= 0 || count % 4 || !seed) {
+    fprintf(stderr, "Usage: %s [-n samples, a multiple of 4] [-s seed]\n",
+            argv[0]);
+    return EXIT_FAILURE;
+  }
+  uint8_t* samples = malloc((size_t)count * 4);
+  uint8_t* converted = malloc((size_t)count * 4);
+  float* floats = malloc((size_t)count * sizeof(float));
+  float* planes = malloc((size_t)count * sizeof(float));
+  float* frames = malloc((size_t)count * sizeof(float));
+  if (!samples || !converted || !floats || !planes || !frames) {
+    perror("Failed to allocate samples");
+    return EXIT_FAILURE;
+  }
+  int result = EXIT_SUCCESS;
+  for (size_t e = 0; e < sizeof(encodings) / sizeof(*encodings); ++e) {
+    uint32_t state = seed;
+    int size = encodings[e].size;
+    for (int i = 0; i < count * size; ++i) {
+      samples[i] = (uint8_t)next_random(&state);
+    }
+    if (encodings[e].encoding == PACKET_ENCODING_F32LE) {
+      // Floats within range, rather than random bits that may be NaN.
+      for (int i = 0; i < count; ++i) {
+        float value = (float)((int32_t)next_random(&state) / 2147483648.0);
+        memcpy(samples + i * size, &value, sizeof(value));
+      }
+    }
+    struct kernel to = {TO_FLOAT, (int)e, count, samples, floats};
+    struct kernel from = {FROM_FLOAT, (int)e, count, floats, converted};
+    call(&to);
+    call(&from);
+    int exact = !memcmp(samples, converted, (size_t)count * size);
+    report("to_float", encodings[e].name, 1, count, measure(&to), exact);
+    report("from_float", encodings[e].name, 1, count, measure(&from), exact);
+    if (!exact) {
+      result = EXIT_FAILURE;
+    }
+  }
+  for (size_t c = 0; c < sizeof(channel_counts) / sizeof(*channel_counts);
+       ++c) {
+    struct kernel deinterleave = {DEINTERLEAVE, (int)c, count, floats,
+                                  planes};
+    struct kernel interleave = {INTERLEAVE, (int)c, count, planes, frames};
+    call(&deinterleave);
+    call(&interleave);
+    int exact = !memcmp(floats, frames, (size_t)count * sizeof(float));
+    report("deinterleave", "float", channel_counts[c], count,
+           measure(&deinterleave), exact);
+    report("interleave", "float", channel_counts[c], count,
+           measure(&interleave), exact);
+    if (!exact) {
+      result = EXIT_FAILURE;
+    }
+  }
+  free(samples);
+  free(converted);
+  free(floats);
+  free(planes);
+  free(frames);
+  return result;
+}
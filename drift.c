@@ -0,0 +1,42 @@
+#include "drift.h"
+
+#define DRIFT_WINDOW 1000000000ll
+#define DRIFT_PROPORTIONAL 0.1
+#define DRIFT_INTEGRAL 0.01
+#define DRIFT_LIMIT 0.005
+
+static double clamp(double value) {
+  if (value > DRIFT_LIMIT) {
+    return DRIFT_LIMIT;
+  }
+  if (value < -DRIFT_LIMIT) {
+    return -DRIFT_LIMIT;
+  }
+  return value;
+}
+
+void drift_reset(struct drift* drift) {
+  *drift = (struct drift){.window_min = INT64_MAX, .correction = 1};
+}
+
+int drift_update(struct drift* drift, int64_t value, uint64_t now) {
+  if (!drift->window_start) {
+    drift->window_start = now;
+  }
+  if (value < drift->window_min) {
+    drift->window_min = value;
+  }
+  if (now - drift->window_start < DRIFT_WINDOW) {
+    return 0;
+  }
+  if (!drift->have_reference) {
+    drift->reference = drift->window_min;
+    drift->have_reference = 1;
+  }
+  double error = (drift->window_min - drift->reference) / 1e9;
+  drift->integral = clamp(drift->integral + DRIFT_INTEGRAL * error);
+  drift->correction = 1 + clamp(DRIFT_PROPORTIONAL * error + drift->integral);
+  drift->window_start = now;
+  drift->window_min = INT64_MAX;
+  return 1;
+}
@@ -0,0 +1,18 @@
+#include <stdint.h>
+
+// Proportional-integral estimate of a clock rate ratio. It is fed with a
+// quantity that creeps up when the far clock runs slow, like how late
+// datagrams arrive against the playout schedule, and compares the minimum of
+// every window against the minimum of the first one. Jitter only ever adds to
+// such quantities, so their minimum is the least noisy.
+struct drift {
+  uint64_t window_start;
+  int64_t window_min;
+  int64_t reference;
+  int have_reference;
+  double integral;
+  double correction;
+};
+
+void drift_reset(struct drift* drift);
+int drift_update(struct drift* drift, int64_t value, uint64_t now);
@@ -0,0 +1,393 @@
+#include "convert.h"
+#include "dsp.h"
+#include "packet.h"
+#include "simd.h"
+
+#include <math.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Gain of the agc comes back up with a time constant of DSP_AGC_RELEASE
+// milliseconds, and that of the limiter with one of DSP_LIMIT_RELEASE, while
+// the gate closes with one of DSP_GATE_RELEASE. Each of them goes the other
+// way within a single buffer.
+#define DSP_AGC_RELEASE 1000
+#define DSP_GATE_RELEASE 50
+#define DSP_LIMIT_RELEASE 100
+#define DSP_COST_WEIGHT 8
+// Stage that goes off again within as long as it was last held off is held
+// off twice as long the next time, up to DSP_STAGE_BACKOFF times
+// DSP_STAGE_HOLD, so that one that never fits settles rather than going on
+// and off every hold.
+#define DSP_STAGE_BACKOFF 16
+#define DSP_DENORMAL 1e-20f
+
+struct DspOption {
+  const char* name;
+  size_t offset;
+};
+
+static const struct DspOption dsp_options[] = {
+    {"highpass", offsetof(struct DspConfig, highpass)},
+    {"gain", offsetof(struct DspConfig, gain)},
+    {"agc", offsetof(struct DspConfig, agc)},
+    {"agc_max", offsetof(struct DspConfig, agc_max)},
+    {"gate", offsetof(struct DspConfig, gate)},
+    {"limit", offsetof(struct DspConfig, limit)},
+    {"budget", offsetof(struct DspConfig, budget)},
+};
+
+static const char* const stage_names[DSP_STAGES] = {
+    [DSP_STAGE_HIGHPASS] = "highpass",
+    [DSP_STAGE_GAIN] = "gain",
+    [DSP_STAGE_GATE] = "gate",
+    [DSP_STAGE_LIMIT] = "limit",
+};
+
+static uint64_t Now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static float Decibels(int decibels) {
+  return powf(10, decibels / 20.f);
+}
+
+static float Smooth(float from, float to, int frames, int sample_rate,
+                    int time_constant) {
+  float weight = (float)frames * 1000 / sample_rate / time_constant;
+  return from + (to - from) * (weight < 1 ? weight : 1);
+}
+
+// Mean square of the samples, with full scale at 1.
+static float Energy(const float* samples, int count) {
+  return count ? DotProduct(samples, samples, count) / count : 0;
+}
+
+// Magnitudes of floats order like their bits do, and integer maxima
+// vectorize where float ones do not.
+static float Peak(const float* samples, int count) {
+  const uint32_t* restrict bits = (const uint32_t*)samples;
+  uint32_t peak = 0;
+  for (int i = 0; i < count; ++i) {
+    uint32_t magnitude = bits[i] & 0x7fffffff;
+    peak = magnitude > peak ? magnitude : peak;
+  }
+  float result;
+  memcpy(&result, &peak, sizeof(result));
+  return result;
+}
+
+// Multiplies by a gain that goes from one value to the other across the
+// samples.
+static void Ramp(float* samples, int count, float from, float to) {
+  if (from == to) {
+    if (from == 1) {
+      return;
+    }
+    for (int i = 0; i < count; ++i) {
+      samples[i] *= from;
+    }
+    return;
+  }
+  float* restrict result = samples;
+  float step = (to - from) / count;
+  for (int i = 0; i < count; ++i) {
+    result[i] *= from + step * (i + 1);
+  }
+}
+
+// Mixes what a stage made of the samples with what it was given, by a weight
+// that goes from one value to the other across the samples.
+static void Blend(float* samples, const float* dry, int count, float from,
+                  float to) {
+  float* restrict result = samples;
+  float step = (to - from) / count;
+  for (int i = 0; i < count; ++i) {
+    result[i] = dry[i] + (result[i] - dry[i]) * (from + step * (i + 1));
+  }
+}
+
+static void Clamp(float* samples, int count, float ceiling) {
+  float* restrict result = samples;
+  for (int i = 0; i < count; ++i) {
+    float sample = result[i];
+    sample = sample > ceiling ? ceiling : sample;
+    sample = sample < -ceiling ? -ceiling : sample;
+    result[i] = sample;
+  }
+}
+
+// Computes y[n] = x[n] - x[n-1] + r * y[n-1] four samples at a time. Outputs
+// of a block are the differences of its inputs times the columns of the step
+// response of the feedback, plus the last output of the previous block times
+// its decay, so the only dependency between blocks is that one output.
+static void HighPass(float* samples, int count, const float* taps,
+                     float* state) {
+  v4sf c0 = *(const v4sf_u*)taps, c1 = *(const v4sf_u*)(taps + 4);
+  v4sf c2 = *(const v4sf_u*)(taps + 8), c3 = *(const v4sf_u*)(taps + 12);
+  v4sf decay = *(const v4sf_u*)(taps + 16);
+  float x1 = state[0], y1 = state[1];
+  int i = 0;
+  for (; i + 4 <= count; i += 4) {
+    v4sf x = *(v4sf_u*)(samples + i);
+    v4sf d = x - (v4sf){x1, x[0], x[1], x[2]};
+    v4sf y = d[0] * c0 + d[1] * c1 + d[2] * c2 + d[3] * c3 + y1 * decay;
+    *(v4sf_u*)(samples + i) = y;
+    x1 = x[3];
+    y1 = y[3];
+  }
+  for (float r = taps[16]; i < count; ++i) {
+    float x = samples[i];
+    y1 = x - x1 + r * y1;
+    x1 = x;
+    samples[i] = y1;
+  }
+  // Decaying feedback would otherwise end up in denormals on silence.
+  state[0] = x1;
+  state[1] = y1 < DSP_DENORMAL && y1 > -DSP_DENORMAL ? 0 : y1;
+}
+
+static void RunHighPass(struct Dsp* dsp, float* samples, int frames) {
+  int channels = dsp->channels;
+  if (channels == 1) {
+    HighPass(samples, frames, dsp->highpass_taps, dsp->highpass_state);
+    return;
+  }
+  Deinterleave(samples, frames, channels, dsp->planes, frames);
+  for (int i = 0; i < channels; ++i) {
+    HighPass(dsp->planes + i * frames, frames, dsp->highpass_taps,
+             dsp->highpass_state + i * 2);
+  }
+  Interleave(dsp->planes, frames, frames, channels, samples);
+}
+
+// Agc only follows buffers above its floor, so that it never brings up the
+// noise between words.
+static void RunGain(struct Dsp* dsp, float* samples, int frames) {
+  int count = frames * dsp->channels;
+  float fixed = dsp->fixed_gain;
+  float gain = dsp->gain;
+  if (dsp->config.agc) {
+    float energy = Energy(samples, count) * fixed * fixed;
+    if (energy > dsp->agc_floor) {
+      float target = sqrtf(dsp->agc_target / energy);
+      target = target < dsp->agc_max ? target : dsp->agc_max;
+      gain = target < gain ? target
+                           : Smooth(gain, target, frames, dsp->sample_rate,
+                                    DSP_AGC_RELEASE);
+    }
+  }
+  Ramp(samples, count, fixed * dsp->gain, fixed * gain);
+  dsp->gain = gain;
+}
+
+static void RunGate(struct Dsp* dsp, float* samples, int frames) {
+  int count = frames * dsp->channels;
+  if (Energy(samples, count) > dsp->gate_threshold) {
+    dsp->gate_remaining = dsp->gate_hold;
+  } else {
+    dsp->gate_remaining -= frames < dsp->gate_remaining ? frames
+                                                        : dsp->gate_remaining;
+  }
+  float target = dsp->gate_remaining ? 1 : dsp->gate_range;
+  float gain = target > dsp->gate_gain
+                   ? target
+                   : Smooth(dsp->gate_gain, target, frames, dsp->sample_rate,
+                            DSP_GATE_RELEASE);
+  Ramp(samples, count, dsp->gate_gain, gain);
+  dsp->gate_gain = gain;
+}
+
+// Gain ramps down to what keeps the peak of the buffer under the ceiling, and
+// whatever is still over it on the way is clipped.
+static void RunLimit(struct Dsp* dsp, float* samples, int frames) {
+  int count = frames * dsp->channels;
+  float peak = Peak(samples, count);
+  float target = peak > dsp->limit ? dsp->limit / peak : 1;
+  float gain = target < dsp->limit_gain
+                   ? target
+                   : Smooth(dsp->limit_gain, target, frames, dsp->sample_rate,
+                            DSP_LIMIT_RELEASE);
+  Ramp(samples, count, dsp->limit_gain, gain);
+  if (peak * (gain > dsp->limit_gain ? gain : dsp->limit_gain) > dsp->limit) {
+    Clamp(samples, count, dsp->limit);
+  }
+  dsp->limit_gain = gain;
+}
+
+static int StageEnabled(const struct DspConfig* config, int stage) {
+  switch (stage) {
+    case DSP_STAGE_HIGHPASS:
+      return config->highpass > 0;
+    case DSP_STAGE_GAIN:
+      return config->gain || config->agc;
+    case DSP_STAGE_GATE:
+      return config->gate;
+    case DSP_STAGE_LIMIT:
+      return config->limit;
+    default:
+      return 0;
+  }
+}
+
+int SetDspOption(struct DspConfig* config, const char* option) {
+  const char* value = strchr(option, '=');
+  if (!value) {
+    return 0;
+  }
+  size_t name_length = (size_t)(value++ - option);
+  for (size_t i = 0; i < sizeof(dsp_options) / sizeof(*dsp_options); ++i) {
+    if (strlen(dsp_options[i].name) == name_length &&
+        !strncmp(dsp_options[i].name, option, name_length)) {
+      *(int*)((char*)config + dsp_options[i].offset) = atoi(value);
+      return 1;
+    }
+  }
+  return 0;
+}
+
+int DspEnabled(const struct DspConfig* config) {
+  for (int i = 0; i < DSP_STAGES; ++i) {
+    if (StageEnabled(config, i)) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+int DspInit(struct Dsp* dsp, const struct DspConfig* config, int sample_rate,
+            int channels, int encoding, int max_frames) {
+  memset(dsp, 0, sizeof(*dsp));
+  dsp->config = *config;
+  dsp->sample_rate = sample_rate;
+  dsp->channels = channels;
+  dsp->max_frames = max_frames;
+  dsp->frame_size = PacketEncodingSampleSize(encoding) * channels;
+  dsp->to_float = GetConvertToFloat(encoding);
+  dsp->from_float = GetConvertFromFloat(encoding);
+  dsp->samples = malloc((size_t)max_frames * channels * sizeof(float));
+  dsp->planes = malloc((size_t)max_frames * channels * sizeof(float));
+  dsp->dry = malloc((size_t)max_frames * channels * sizeof(float));
+  dsp->highpass_state = calloc((size_t)channels * 2, sizeof(float));
+  if (!dsp->to_float || !dsp->samples || !dsp->planes || !dsp->dry ||
+      !dsp->highpass_state) {
+    DspFree(dsp);
+    return 0;
+  }
+  float r = expf(-2 * (float)M_PI * config->highpass / sample_rate);
+  for (int row = 0; row < 4; ++row) {
+    for (int k = 0; k < 4; ++k) {
+      dsp->highpass_taps[row * 4 + k] =
+          k < row ? 0 : powf(r, (float)(k - row));
+    }
+    dsp->highpass_taps[16 + row] = powf(r, (float)(row + 1));
+  }
+  dsp->fixed_gain = Decibels(config->gain);
+  dsp->gain = 1;
+  dsp->agc_target = powf(10, config->agc / 10.f);
+  dsp->agc_max = Decibels(config->agc_max ? config->agc_max : DSP_AGC_MAX);
+  dsp->agc_floor =
+      powf(10, (config->gate ? config->gate : DSP_AGC_FLOOR) / 10.f);
+  dsp->gate_threshold = powf(10, config->gate / 10.f);
+  dsp->gate_range = Decibels(-DSP_GATE_RANGE);
+  dsp->gate_gain = 1;
+  dsp->gate_hold = (int)((int64_t)DSP_GATE_HOLD * sample_rate / 1000);
+  dsp->limit = Decibels(config->limit);
+  dsp->limit_gain = 1;
+  dsp->budget = (uint64_t)config->budget * 1000;
+  dsp->hold = (uint64_t)DSP_STAGE_HOLD * sample_rate / 1000;
+  for (int i = 0; i < DSP_STAGES; ++i) {
+    dsp->on[i] = 1;
+    dsp->mix[i] = 1;
+  }
+  return 1;
+}
+
+void DspFree(struct Dsp* dsp) {
+  free(dsp->samples);
+  free(dsp->planes);
+  free(dsp->dry);
+  free(dsp->highpass_state);
+  dsp->samples = dsp->planes = dsp->dry = dsp->highpass_state = NULL;
+}
+
+void DspProcess(struct Dsp* dsp, void* samples, int frames) {
+  static void (*const stages[DSP_STAGES])(struct Dsp*, float*, int) = {
+      [DSP_STAGE_HIGHPASS] = RunHighPass,
+      [DSP_STAGE_GAIN] = RunGain,
+      [DSP_STAGE_GATE] = RunGate,
+      [DSP_STAGE_LIMIT] = RunLimit,
+  };
+  for (; frames > dsp->max_frames; frames -= dsp->max_frames) {
+    DspProcess(dsp, samples, dsp->max_frames);
+    samples = (uint8_t*)samples + dsp->max_frames * dsp->frame_size;
+  }
+  uint64_t start = Now();
+  uint64_t budget = dsp->budget ? dsp->budget
+                                : (uint64_t)frames * DSP_BUDGET * 10000000 /
+                                      dsp->sample_rate;
+  int count = frames * dsp->channels;
+  dsp->to_float(samples, dsp->samples, count);
+  // Limiter always runs, so what it takes is not there for the others.
+  uint64_t reserved =
+      StageEnabled(&dsp->config, DSP_STAGE_LIMIT)
+          ? dsp->cost[DSP_STAGE_LIMIT] * (uint64_t)frames / 1000
+          : 0;
+  for (int i = 0; i < DSP_STAGES; ++i) {
+    if (!StageEnabled(&dsp->config, i)) {
+      continue;
+    }
+    uint64_t now = Now();
+    int due = dsp->on[i] || dsp->frames >= dsp->retry[i];
+    if (i != DSP_STAGE_LIMIT && due) {
+      uint64_t expected = dsp->cost[i] * (uint64_t)frames / 1000;
+      int on = now - start + expected + reserved <= budget;
+      if (on != dsp->on[i]) {
+        if (!on && dsp->frames >= dsp->retry[i]) {
+          dsp->held[i] = dsp->hold;
+        } else if (!on && dsp->held[i] < dsp->hold * DSP_STAGE_BACKOFF) {
+          dsp->held[i] *= 2;
+        }
+        dsp->retry[i] = dsp->frames + dsp->held[i];
+        dsp->on[i] = on;
+      }
+    }
+    float mix = dsp->on[i] ? 1 : 0;
+    if (mix == 0 && dsp->mix[i] == 0) {
+      dsp->stats.skipped[i]++;
+      continue;
+    }
+    if (mix != dsp->mix[i]) {
+      memcpy(dsp->dry, dsp->samples, count * sizeof(float));
+    }
+    if (mix > dsp->mix[i] && i == DSP_STAGE_HIGHPASS) {
+      // Whatever the high-pass last saw is long gone.
+      for (int c = 0; c < dsp->channels; ++c) {
+        dsp->highpass_state[c * 2] = dsp->samples[c];
+        dsp->highpass_state[c * 2 + 1] = 0;
+      }
+    }
+    stages[i](dsp, dsp->samples, frames);
+    if (mix != dsp->mix[i]) {
+      Blend(dsp->samples, dsp->dry, count, dsp->mix[i], mix);
+      dsp->mix[i] = mix;
+    }
+    uint64_t took = Now() - now;
+    // Cost is kept in picoseconds per frame, which buffers of any size share.
+    uint64_t cost = took * 1000 / frames;
+    dsp->cost[i] += ((int64_t)cost - (int64_t)dsp->cost[i]) / DSP_COST_WEIGHT;
+    dsp->stats.time[i] += took;
+    dsp->stats.samples[i] += count;
+  }
+  dsp->frames += frames;
+  dsp->from_float(dsp->samples, samples, count);
+  dsp->stats.buffers++;
+}
+
+const char* DspStageName(int stage) {
+  return stage_names[stage];
+}
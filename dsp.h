@@ -0,0 +1,101 @@
+#include <stdint.h>
+
+#define DSP_STAGES 4
+#define DSP_STAGE_HIGHPASS 0
+#define DSP_STAGE_GAIN 1
+#define DSP_STAGE_GATE 2
+#define DSP_STAGE_LIMIT 3
+
+// Signal conditioning on interleaved frames in one of PACKET_ENCODING_*, in
+// place. Stages run in this order, and every one of them is off while its
+// option is 0:
+//  - highpass: first order DC-blocking high-pass with a corner at that many
+//    Hz, per channel;
+//  - gain: fixed gain in dB, and agc: target level in dBFS that the gain
+//    follows within agc_max dB (default DSP_AGC_MAX) of it, for buffers above
+//    the gate or DSP_AGC_FLOOR otherwise;
+//  - gate: level in dBFS below which buffers are attenuated by DSP_GATE_RANGE
+//    dB, after DSP_GATE_HOLD milliseconds below it;
+//  - limit: ceiling in dBFS that peaks never go above.
+// Gain of every stage ramps across a buffer rather than stepping between
+// buffers, and channels share gains. Whole chain stays within budget
+// microseconds per buffer (default DSP_BUDGET percent of its duration), by
+// turning off stages before the limiter that would not fit in it going by
+// what they took before, from the last one on. Those fade out across a buffer
+// and stay off for DSP_STAGE_HOLD milliseconds, and then fade back in if they
+// fit with what it takes now, for longer every time they do not last that
+// long back on. Limiter is what keeps agc from clipping, so it
+// always runs, and its cost is set aside from the budget first.
+#define DSP_AGC_MAX 30
+#define DSP_AGC_FLOOR -60
+#define DSP_GATE_RANGE 20
+#define DSP_GATE_HOLD 100
+#define DSP_BUDGET 10
+#define DSP_STAGE_HOLD 1000
+
+struct DspConfig {
+  int highpass;
+  int gain;
+  int agc;
+  int agc_max;
+  int gate;
+  int limit;
+  int budget;
+};
+
+struct DspStats {
+  unsigned buffers;
+  unsigned long samples[DSP_STAGES];
+  uint64_t time[DSP_STAGES];
+  unsigned skipped[DSP_STAGES];
+};
+
+struct Dsp {
+  struct DspConfig config;
+  int channels;
+  int frame_size;
+  int max_frames;
+  int sample_rate;
+  ConvertToFloat to_float;
+  ConvertFromFloat from_float;
+  float* samples;
+  float* planes;
+  float* dry;
+  // Four columns of the step response of the high-pass across four samples,
+  // its decay across them, and its state for every channel.
+  float highpass_taps[20];
+  float* highpass_state;
+  float fixed_gain;
+  float gain;
+  float agc_target;
+  float agc_max;
+  float agc_floor;
+  float gate_threshold;
+  float gate_range;
+  float gate_gain;
+  int gate_hold;
+  int gate_remaining;
+  float limit;
+  float limit_gain;
+  uint64_t budget;
+  // Running average of what every stage took per frame, in picoseconds.
+  uint64_t cost[DSP_STAGES];
+  // Whether every stage is on, how far it is mixed in, after how many frames
+  // one that is off gets another try or one that is on has lasted, and for how
+  // many it was last held off.
+  int on[DSP_STAGES];
+  float mix[DSP_STAGES];
+  uint64_t retry[DSP_STAGES];
+  uint64_t held[DSP_STAGES];
+  uint64_t frames;
+  uint64_t hold;
+  struct DspStats stats;
+};
+
+int SetDspOption(struct DspConfig* config, const char* option);
+int DspEnabled(const struct DspConfig* config);
+int DspInit(struct Dsp* dsp, const struct DspConfig* config, int sample_rate,
+            int channels, int encoding, int max_frames);
+void DspFree(struct Dsp* dsp);
+void DspProcess(struct Dsp* dsp, void* samples, int frames);
+const char* DspStageName(int stage);
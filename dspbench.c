@@ -0,0 +1,236 @@
+#include "convert.h"
+#include "dsp.h"
+#include "packet.h"
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define SAMPLE_RATE 48000
+#define BUFFER_FRAMES 480
+#define DURATION 20
+#define SEED 1
+#define HARMONICS 24
+#define NOISE_DBFS -60
+#define DC_OFFSET 0.05
+#define TIGHT_BUDGET 1
+
+// Runs a voice-like signal through dsp.c buffer by buffer the way the sender
+// does, with every stage on its own, with all of them, and with all of them
+// on a budget of TIGHT_BUDGET microseconds per buffer, too little for the
+// chain. Prints one line of JSON per run to stdout and a summary to stderr,
+// with what every stage and the whole chain took per sample, how many buffers
+// every stage sat out, how often stages went off and back on, and the peak
+// that came out. Fails if the limiter ever sat out a buffer, if anything came
+// out above its ceiling, or if a stage went off or on more often than once
+// every DSP_STAGE_HOLD milliseconds.
+//
+// The voice-like signal is a train of harmonics on a gliding pitch, shaped by
+// two moving formants, in syllables with pauses in between, sitting on a DC
+// offset and with noise at NOISE_DBFS. Agc brings it up to -12 dBFS, within
+// 30 dB, which takes peaks past full scale for the limiter to hold at -1.
+struct run {
+  const char* name;
+  struct DspConfig config;
+};
+
+static const struct run runs[] = {
+    {"highpass", {.highpass = 80}},
+    {"gain", {.gain = 6}},
+    {"agc", {.agc = -12, .agc_max = 30}},
+    {"gate", {.gate = -50}},
+    {"limit", {.gain = 12, .limit = -1}},
+    {"chain",
+     {.highpass = 80, .agc = -12, .agc_max = 30, .gate = -50, .limit = -1}},
+    {"budget",
+     {.highpass = 80,
+      .agc = -12,
+      .agc_max = 30,
+      .gate = -50,
+      .limit = -1,
+      .budget = TIGHT_BUDGET}},
+};
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static uint32_t next_random(uint32_t* state) {
+  uint32_t x = *state;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  return *state = x;
+}
+
+static double formant(double frequency, double center, double width) {
+  double distance = (frequency - center) / width;
+  return 1 / (1 + distance * distance);
+}
+
+static double voice(double t, double* phase) {
+  double pitch = 170 + 80 * sin(2 * M_PI * 0.7 * t) * sin(2 * M_PI * 0.13 * t);
+  *phase += 2 * M_PI * pitch / SAMPLE_RATE;
+  double syllable = sin(M_PI * fmod(t * 4.7, 1.0));
+  double envelope = syllable > 0.2 ? (syllable - 0.2) / 0.8 : 0;
+  double first = 500 + 300 * sin(2 * M_PI * 1.9 * t);
+  double second = 1500 + 700 * sin(2 * M_PI * 1.3 * t + 1);
+  double sum = 0;
+  for (int k = 1; k <= HARMONICS; ++k) {
+    double frequency = k * pitch;
+    if (frequency > SAMPLE_RATE / 2) {
+      break;
+    }
+    sum += sin(k * *phase) / k *
+           (formant(frequency, first, 150) + formant(frequency, second, 250));
+  }
+  return 0.1 * envelope * sum;
+}
+
+static void make_signal(int16_t* samples, int frames, int channels,
+                        uint32_t seed) {
+  uint32_t state = seed;
+  double phase = 0;
+  // Triangular noise with this peak has a sixth of its square as power.
+  double noise = sqrt(6) * pow(10, NOISE_DBFS / 20.0);
+  for (int i = 0; i < frames; ++i) {
+    double mono = voice((double)i / SAMPLE_RATE, &phase) + DC_OFFSET;
+    for (int c = 0; c < channels; ++c) {
+      double value = mono * (1 - 0.1 * c) +
+                     noise * ((double)next_random(&state) / UINT32_MAX +
+                              (double)next_random(&state) / UINT32_MAX - 1);
+      value *= 32767;
+      value = value > 32767 ? 32767 : value < -32768 ? -32768 : value;
+      samples[i * channels + c] = (int16_t)lrint(value);
+    }
+  }
+}
+
+static double stage_ns(const struct DspStats* stats, int stage) {
+  return stats->samples[stage]
+             ? (double)stats->time[stage] / stats->samples[stage]
+             : 0;
+}
+
+int main(int argc, char** argv) {
+  int channels = 1;
+  int duration = DURATION;
+  uint32_t seed = SEED;
+  for (int opt; (opt = getopt(argc, argv, "c:d:s:")) != -1;) {
+    switch (opt) {
+      case 'c':
+        channels = atoi(optarg);
+        break;
+      case 'd':
+        duration = atoi(optarg);
+        break;
+      case 's':
+        seed = (uint32_t)strtoul(optarg, NULL, 0);
+        break;
+      default:
+        channels = 0;
+        break;
+    }
+  }
+  if (optind != argc || channels <= 0 || channels > 16 || duration <= 0 ||
+      !seed) {
+    fprintf(stderr, "Usage: %s [-c channels] [-d seconds] [-s seed]\n",
+            argv[0]);
+    return EXIT_FAILURE;
+  }
+  int buffers = duration * SAMPLE_RATE / BUFFER_FRAMES;
+  size_t count = (size_t)buffers * BUFFER_FRAMES * channels;
+  int16_t* signal = malloc(count * sizeof(int16_t));
+  int16_t* buffer = malloc(BUFFER_FRAMES * channels * sizeof(int16_t));
+  if (!signal || !buffer) {
+    perror("Failed to allocate signal");
+    return EXIT_FAILURE;
+  }
+  make_signal(signal, buffers * BUFFER_FRAMES, channels, seed);
+  int result = EXIT_SUCCESS;
+  for (size_t r = 0; r < sizeof(runs) / sizeof(*runs); ++r) {
+    const struct run* run = &runs[r];
+    struct Dsp dsp;
+    if (!DspInit(&dsp, &run->config, SAMPLE_RATE, channels,
+                 PACKET_ENCODING_S16LE, BUFFER_FRAMES)) {
+      perror("Failed to allocate signal processing");
+      return EXIT_FAILURE;
+    }
+    int on[DSP_STAGES];
+    memcpy(on, dsp.on, sizeof(on));
+    int toggles[DSP_STAGES] = {0};
+    int peak = 0;
+    uint64_t time = 0;
+    for (int b = 0; b < buffers; ++b) {
+      memcpy(buffer, signal + (size_t)b * BUFFER_FRAMES * channels,
+             BUFFER_FRAMES * channels * sizeof(int16_t));
+      uint64_t start = now_ns();
+      DspProcess(&dsp, buffer, BUFFER_FRAMES);
+      time += now_ns() - start;
+      for (int i = 0; i < BUFFER_FRAMES * channels; ++i) {
+        int magnitude = abs(buffer[i]);
+        peak = magnitude > peak ? magnitude : peak;
+      }
+      for (int i = 0; i < DSP_STAGES; ++i) {
+        toggles[i] += dsp.on[i] != on[i];
+        on[i] = dsp.on[i];
+      }
+    }
+    const struct DspStats* stats = &dsp.stats;
+    // Stage that goes off stays off for a hold period, and one that comes
+    // back on and goes off again before another has passed stays off longer,
+    // so every toggle takes a hold period at the least.
+    int max_toggles = duration * 1000 / DSP_STAGE_HOLD + 1;
+    int flapping = 0;
+    int all_toggles = 0;
+    unsigned skipped = 0;
+    for (int i = 0; i < DSP_STAGES; ++i) {
+      flapping |= toggles[i] > max_toggles;
+      all_toggles += toggles[i];
+      skipped += stats->skipped[i];
+    }
+    // Full scale is 32768, and conversion rounds to the nearest sample.
+    int ceiling =
+        run->config.limit
+            ? (int)(32768 * pow(10, run->config.limit / 20.0) + 0.5)
+            : 32768;
+    int clipped = peak > ceiling;
+    int limiter_skipped = stats->skipped[DSP_STAGE_LIMIT] != 0;
+    double total_ns = (double)time / count;
+    double peak_dbfs = 20 * log10((peak ? peak : 1) / 32768.0);
+    printf("{\"run\":\"%s\",\"channels\":%d,\"buffer_frames\":%d,"
+           "\"buffers\":%d,\"highpass_ns_per_sample\":%.2f,"
+           "\"gain_ns_per_sample\":%.2f,\"gate_ns_per_sample\":%.2f,"
+           "\"limit_ns_per_sample\":%.2f,\"total_ns_per_sample\":%.2f,"
+           "\"skipped\":%u,\"limit_skipped\":%u,\"toggles\":%d,"
+           "\"peak_dbfs\":%.2f}\n",
+           run->name, channels, BUFFER_FRAMES, buffers,
+           stage_ns(stats, DSP_STAGE_HIGHPASS), stage_ns(stats, DSP_STAGE_GAIN),
+           stage_ns(stats, DSP_STAGE_GATE), stage_ns(stats, DSP_STAGE_LIMIT),
+           total_ns, skipped, stats->skipped[DSP_STAGE_LIMIT], all_toggles,
+           peak_dbfs);
+    fprintf(stderr,
+            "%-8s %d ch: highpass %5.2f, gain %5.2f, gate %5.2f, limit %5.2f, "
+            "chain %5.2f ns per sample, %5u buffers skipped, %2d toggles, "
+            "peak %6.2f dBFS%s%s%s\n",
+            run->name, channels, stage_ns(stats, DSP_STAGE_HIGHPASS),
+            stage_ns(stats, DSP_STAGE_GAIN), stage_ns(stats, DSP_STAGE_GATE),
+            stage_ns(stats, DSP_STAGE_LIMIT), total_ns, skipped, all_toggles,
+            peak_dbfs, clipped ? ", OVER THE CEILING" : "",
+            limiter_skipped ? ", LIMITER SKIPPED" : "",
+            flapping ? ", FLAPPING" : "");
+    if (clipped || limiter_skipped || flapping) {
+      result = EXIT_FAILURE;
+    }
+    DspFree(&dsp);
+  }
+  free(signal);
+  free(buffer);
+  return result;
+}
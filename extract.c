@@ -0,0 +1,201 @@
+#define _GNU_SOURCE
+
+#include "archive.h"
+#include "packet.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define WAVE_FORMAT_PCM 1
+#define WAVE_FORMAT_IEEE_FLOAT 3
+
+struct wav_header {
+  char riff[4];
+  uint32_t riff_size;
+  char wave[4];
+  char fmt[4];
+  uint32_t fmt_size;
+  uint16_t format;
+  uint16_t channels;
+  uint32_t rate;
+  uint32_t byte_rate;
+  uint16_t block_align;
+  uint16_t bits;
+  char data[4];
+  uint32_t data_size;
+};
+
+static const char* prefix;
+static size_t prefix_length;
+
+static int is_segment(const struct dirent* entry) {
+  size_t length = strlen(entry->d_name);
+  size_t suffix_length = sizeof(ARCHIVE_SUFFIX) - 1;
+  return length > prefix_length + suffix_length &&
+         !strncmp(entry->d_name, prefix, prefix_length) &&
+         !strcmp(entry->d_name + length - suffix_length, ARCHIVE_SUFFIX);
+}
+
+static int open_segment(struct archive_segment* segment, const char* dir,
+                        const char* name) {
+  char path[PATH_MAX];
+  snprintf(path, sizeof(path), "%s/%s", dir, name);
+  if (!archive_open(segment, path)) {
+    fprintf(stderr, "Failed to open %s: %s\n", path, strerror(errno));
+    return 0;
+  }
+  return 1;
+}
+
+static uint64_t parse_time(const char* arg) {
+  char* end;
+  double seconds = strtod(arg, &end);
+  return *end || seconds <= 0 ? 0 : (uint64_t)(seconds * 1e9);
+}
+
+static int write_header(FILE* out, const struct archive_header* format,
+                        uint64_t length) {
+  int sample_size = PacketEncodingSampleSize(format->encoding);
+  if (length > UINT32_MAX - sizeof(struct wav_header)) {
+    length = UINT32_MAX - sizeof(struct wav_header);
+  }
+  struct wav_header header = {
+      .riff = "RIFF",
+      .riff_size = sizeof(header) - 8 + length,
+      .wave = "WAVE",
+      .fmt = "fmt ",
+      .fmt_size = 16,
+      .format = format->encoding == PACKET_ENCODING_F32LE
+                    ? WAVE_FORMAT_IEEE_FLOAT
+                    : WAVE_FORMAT_PCM,
+      .channels = format->channels,
+      .rate = format->rate,
+      .byte_rate = format->rate * format->channels * sample_size,
+      .block_align = format->channels * sample_size,
+      .bits = sample_size * 8,
+      .data = "data",
+      .data_size = length};
+  return fseek(out, 0, SEEK_SET) == 0 &&
+         fwrite(&header, sizeof(header), 1, out) == 1;
+}
+
+// Writes audio between two wall clock times from the archive of a stream to
+// a WAV file. Segment that takes the start is found by binary search over
+// their names, which sort in time order, and data within segments by binary
+// search over their index. Segments go on until the end, as long as they keep
+// the format of the first one. Gaps in the archive are left out.
+int main(int argc, char** argv) {
+  if (argc != 6) {
+    fprintf(stderr,
+            "Usage: %s archive_dir stream_name start_time end_time out.wav\n"
+            "Times are in seconds since the epoch.\n",
+            argv[0]);
+    return EXIT_FAILURE;
+  }
+  const char* dir = argv[1];
+  uint64_t start = parse_time(argv[3]);
+  uint64_t end = parse_time(argv[4]);
+  if (!start || end <= start) {
+    fprintf(stderr, "Invalid time range %s to %s\n", argv[3], argv[4]);
+    return EXIT_FAILURE;
+  }
+  char name_prefix[96];
+  snprintf(name_prefix, sizeof(name_prefix), "%s-", argv[2]);
+  prefix = name_prefix;
+  prefix_length = strlen(name_prefix);
+  struct dirent** names;
+  int count = scandir(dir, &names, is_segment, alphasort);
+  if (count == -1) {
+    perror("Failed to read archive directory");
+    return EXIT_FAILURE;
+  }
+  int result = EXIT_FAILURE;
+  FILE* out = NULL;
+  struct archive_segment segment = {.fd = -1};
+  do {
+    // Last segment that starts at or before the start, if any.
+    int low = 0, high = count;
+    while (low < high) {
+      int middle = low + (high - low) / 2;
+      if (!open_segment(&segment, dir, names[middle]->d_name)) {
+        break;
+      }
+      uint64_t time = archive_start_time(segment.header);
+      archive_close(&segment);
+      if (time && time <= start) {
+        low = middle + 1;
+      } else {
+        high = middle;
+      }
+    }
+    if (low < high) {
+      break;
+    }
+    out = fopen(argv[5], "wb");
+    if (!out) {
+      perror("Failed to open output");
+      break;
+    }
+    struct archive_header format = {0};
+    uint64_t length = 0;
+    int failed = 0;
+    for (int i = low ? low - 1 : 0; i < count && !failed; ++i) {
+      if (!open_segment(&segment, dir, names[i]->d_name)) {
+        failed = 1;
+        break;
+      }
+      const struct archive_header* header = segment.header;
+      if (archive_start_time(header) >= end) {
+        break;
+      }
+      if (!format.rate) {
+        format = *header;
+        failed = !write_header(out, &format, 0);
+      } else if (header->rate != format.rate ||
+                 header->channels != format.channels ||
+                 header->encoding != format.encoding) {
+        fprintf(stderr, "Format changes at %s, stopping there\n",
+                names[i]->d_name);
+        break;
+      }
+      uint64_t from = archive_find(header, start);
+      uint64_t to = archive_find(header, end);
+      const uint8_t* data = (const uint8_t*)header + header->data_offset;
+      if (!failed && to > from) {
+        failed = fwrite(data + from, to - from, 1, out) != 1;
+        length += to - from;
+      }
+      archive_close(&segment);
+    }
+    if (failed) {
+      perror("Failed to extract");
+      break;
+    }
+    if (!format.rate) {
+      fprintf(stderr, "Nothing archived for %s in that range\n", argv[2]);
+      break;
+    }
+    if (!write_header(out, &format, length)) {
+      perror("Failed to write output");
+      break;
+    }
+    fprintf(stderr, "Extracted %.3f s\n",
+            (double)length / (format.rate * format.channels *
+                              PacketEncodingSampleSize(format.encoding)));
+    result = EXIT_SUCCESS;
+  } while (0);
+  archive_close(&segment);
+  if (out && fclose(out) == EOF) {
+    perror("Failed to close output");
+    result = EXIT_FAILURE;
+  }
+  while (count) {
+    free(names[--count]);
+  }
+  free(names);
+  return result;
+}
@@ -0,0 +1,144 @@
+#include "fec.h"
+#include "packet.h"
+#include "simd.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define PARITY_OVERHEAD FEC_PARITY_SIZE(0)
+
+static uint8_t* ParityAt(const struct FecEncoder* encoder, int index) {
+  return encoder->storage + index * FEC_PARITY_SIZE(encoder->capacity);
+}
+
+void FecEncoderInit(struct FecEncoder* encoder, int group, int interleave,
+                    void* storage, int capacity) {
+  memset(encoder, 0, sizeof(*encoder));
+  encoder->group = group;
+  encoder->interleave = interleave;
+  encoder->capacity = capacity;
+  encoder->storage = storage;
+}
+
+// Returns the number of parity packets that are ready once a block is
+// complete, and 0 otherwise.
+int FecEncoderAdd(struct FecEncoder* encoder, const void* packet, int size) {
+  int index = encoder->count % encoder->interleave;
+  uint8_t* parity = ParityAt(encoder, index);
+  uint8_t* body = parity + PARITY_OVERHEAD;
+  if (encoder->count < encoder->interleave) {
+    const struct PacketHeader* header = packet;
+    *(struct PacketHeader*)parity = (struct PacketHeader){
+        .sequence = header->sequence, .type = PACKET_TYPE_PARITY};
+    *(struct ParityHeader*)(parity + sizeof(struct PacketHeader)) =
+        (struct ParityHeader){.count = encoder->group,
+                              .stride = encoder->interleave};
+    encoder->lengths[index] = 0;
+  }
+  // Shorter packets are implicitly padded with zeros.
+  if (size > encoder->lengths[index]) {
+    memset(body + encoder->lengths[index], 0, size - encoder->lengths[index]);
+    encoder->lengths[index] = size;
+  }
+  XorBytes(body, packet, size);
+  if (++encoder->count < encoder->group * encoder->interleave) {
+    return 0;
+  }
+  encoder->count = 0;
+  for (int i = 0; i < encoder->interleave; ++i) {
+    struct PacketHeader* header = (struct PacketHeader*)ParityAt(encoder, i);
+    header->length = sizeof(struct ParityHeader) + encoder->lengths[i];
+  }
+  return encoder->interleave;
+}
+
+const void* FecEncoderParity(const struct FecEncoder* encoder, int index,
+                             int* size) {
+  *size = PARITY_OVERHEAD + encoder->lengths[index];
+  return ParityAt(encoder, index);
+}
+
+void FecDecoderInit(struct FecDecoder* decoder, int capacity) {
+  memset(decoder, 0, sizeof(*decoder));
+  decoder->capacity = capacity;
+}
+
+void FecDecoderFree(struct FecDecoder* decoder) { free(decoder->history); }
+
+void FecDecoderAdd(struct FecDecoder* decoder, const void* packet, int size) {
+  if (!decoder->history || size < (int)sizeof(struct PacketHeader) ||
+      size > decoder->capacity) {
+    return;
+  }
+  uint16_t sequence = ((const struct PacketHeader*)packet)->sequence;
+  if (!decoder->kept) {
+    decoder->first_sequence = sequence;
+  }
+  if (decoder->kept < FEC_HISTORY) {
+    decoder->kept++;
+  }
+  int slot = sequence % FEC_HISTORY;
+  memcpy(decoder->history + slot * decoder->capacity, packet, size);
+  decoder->lengths[slot] = size;
+  decoder->sequences[slot] = sequence;
+}
+
+// Rebuilds the one packet of a group that is missing from the history into
+// packet, which takes up to capacity bytes. Returns its size, or 0 if there
+// was nothing to rebuild, or too much was missing.
+int FecDecoderRecover(struct FecDecoder* decoder, const void* parity, int size,
+                      void* packet) {
+  const struct PacketHeader* header = parity;
+  const struct ParityHeader* info = (const void*)(header + 1);
+  int length = size - PARITY_OVERHEAD;
+  if (length <= 0 || length > decoder->capacity || !info->count ||
+      !info->stride || info->count * info->stride > FEC_MAX_BLOCK) {
+    return 0;
+  }
+  if (!decoder->history) {
+    // Whatever this parity covers was not kept, it only helps from now on.
+    decoder->history = calloc(FEC_HISTORY, decoder->capacity);
+    return 0;
+  }
+  // Groups that started before the history did are not missing anything.
+  if (!decoder->kept ||
+      (decoder->kept < FEC_HISTORY &&
+       (int16_t)(header->sequence - decoder->first_sequence) < 0)) {
+    return 0;
+  }
+  int missing = -1;
+  for (int i = 0; i < info->count; ++i) {
+    uint16_t sequence = header->sequence + i * info->stride;
+    int slot = sequence % FEC_HISTORY;
+    if (decoder->lengths[slot] && decoder->sequences[slot] == sequence) {
+      continue;
+    }
+    if (missing != -1) {
+      decoder->unrecoverable++;
+      return 0;
+    }
+    missing = sequence;
+  }
+  if (missing == -1) {
+    return 0;
+  }
+  memcpy(packet, (const uint8_t*)parity + PARITY_OVERHEAD, length);
+  for (int i = 0; i < info->count; ++i) {
+    int slot = (uint16_t)(header->sequence + i * info->stride) % FEC_HISTORY;
+    if (slot != missing % FEC_HISTORY) {
+      int member = decoder->lengths[slot];
+      XorBytes(packet, decoder->history + slot * decoder->capacity,
+               member < length ? member : length);
+    }
+  }
+  const struct PacketHeader* rebuilt = packet;
+  int rebuilt_size = (int)sizeof(*rebuilt) + rebuilt->length;
+  if (length < (int)sizeof(*rebuilt) || rebuilt->sequence != missing ||
+      rebuilt_size > length) {
+    decoder->unrecoverable++;
+    return 0;
+  }
+  decoder->recovered++;
+  FecDecoderAdd(decoder, packet, rebuilt_size);
+  return rebuilt_size;
+}
@@ -0,0 +1,52 @@
+#include <stdint.h>
+
+// Blocks are limited so that the receiver can keep every packet of one block
+// around, and the one before it, while waiting for the parity.
+#define FEC_MAX_BLOCK 16
+#define FEC_HISTORY (FEC_MAX_BLOCK * 2)
+
+// Parity packet protecting audio packets of up to size bytes each.
+#define FEC_PARITY_SIZE(size) \
+  ((int)(sizeof(struct PacketHeader) + sizeof(struct ParityHeader)) + (size))
+
+// Protects blocks of group times interleave consecutive audio packets with
+// interleave parity packets of PACKET_TYPE_PARITY. Parity number i of a block
+// covers every interleave-th packet starting from the i-th one, so a burst of
+// up to interleave losses leaves at most one packet missing from every group,
+// and that one can be rebuilt. Storage holds interleave parity packets, each
+// FEC_PARITY_SIZE of the largest audio packet.
+struct FecEncoder {
+  int group;
+  int interleave;
+  int count;
+  int capacity;
+  uint8_t* storage;
+  int lengths[FEC_MAX_BLOCK];
+};
+
+// Keeps copies of the last FEC_HISTORY audio packets of up to capacity bytes,
+// so that the one missing from a group can be rebuilt when its parity arrives.
+// History is allocated for the first parity packet, so that streams without
+// any cost nothing.
+struct FecDecoder {
+  int capacity;
+  uint8_t* history;
+  int lengths[FEC_HISTORY];
+  uint16_t sequences[FEC_HISTORY];
+  int kept;
+  uint16_t first_sequence;
+  unsigned recovered;
+  unsigned unrecoverable;
+};
+
+void FecEncoderInit(struct FecEncoder* encoder, int group, int interleave,
+                    void* storage, int capacity);
+int FecEncoderAdd(struct FecEncoder* encoder, const void* packet, int size);
+const void* FecEncoderParity(const struct FecEncoder* encoder, int index,
+                             int* size);
+
+void FecDecoderInit(struct FecDecoder* decoder, int capacity);
+void FecDecoderFree(struct FecDecoder* decoder);
+void FecDecoderAdd(struct FecDecoder* decoder, const void* packet, int size);
+int FecDecoderRecover(struct FecDecoder* decoder, const void* parity, int size,
+                      void* packet);
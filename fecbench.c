@@ -0,0 +1,222 @@
+#include "fec.h"
+#include "packet.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define PACKETS 200000
+#define PACKET_SIZE 972
+#define MAX_DATAGRAM 1472
+#define SEED 1
+
+// Sends packets of PACKET_SIZE bytes through fec.c the way the sender does,
+// one per datagram, with the parity of every block packed into datagrams of
+// up to MAX_DATAGRAM bytes of their own, loses datagrams on the way, and has
+// what is left go through fec.c the way pamnc does. Prints one line of JSON
+// per block shape, loss rate and loss model to stdout and a summary to
+// stderr, with the overhead parity takes and the share of lost packets that
+// were rebuilt. Fails if any packet is rebuilt other than as it was sent.
+//
+// Loss is random, or bursty by a Gilbert-Elliott model that loses every
+// datagram while bad and none while good, at the same mean rate and with
+// bursts the given number of datagrams long on average. Parity datagrams are
+// lost the same way as any other.
+struct shape {
+  int group;
+  int interleave;
+};
+
+struct loss {
+  double rate;
+  double burst;
+};
+
+static const struct shape shapes[] = {{2, 1}, {4, 1}, {8, 1}, {4, 4}, {2, 8}};
+static const struct loss losses[] = {{0.01, 1}, {0.01, 1.5}, {0.01, 3},
+                                     {0.05, 1}, {0.05, 1.5}, {0.05, 3}};
+
+static uint32_t next_random(uint32_t* state) {
+  uint32_t x = *state;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  return *state = x;
+}
+
+static double uniform(uint32_t* state) {
+  return next_random(state) / 4294967296.0;
+}
+
+struct channel {
+  const struct loss* loss;
+  uint32_t state;
+  int bad;
+};
+
+// Bursts of mean length b end with probability 1 / b, and start as often as
+// keeps the mean rate at r, with probability r / (b * (1 - r)).
+static int lose(struct channel* channel) {
+  const struct loss* loss = channel->loss;
+  if (loss->burst <= 1) {
+    return uniform(&channel->state) < loss->rate;
+  }
+  double change = channel->bad ? 1 / loss->burst
+                               : loss->rate / (loss->burst * (1 - loss->rate));
+  if (uniform(&channel->state) < change) {
+    channel->bad = !channel->bad;
+  }
+  return channel->bad;
+}
+
+static void make_packet(uint8_t* packet, uint16_t sequence) {
+  struct PacketHeader* header = (struct PacketHeader*)packet;
+  *header = (struct PacketHeader){
+      .sequence = sequence,
+      .type = PACKET_TYPE_AUDIO,
+      .length = PACKET_SIZE - sizeof(*header),
+  };
+  uint32_t state = sequence * 2654435761u + 1;
+  for (int i = sizeof(*header); i < PACKET_SIZE; i += sizeof(state)) {
+    next_random(&state);
+    memcpy(packet + i, &state, sizeof(state));
+  }
+}
+
+struct counts {
+  long lost;
+  long recovered;
+  long mismatched;
+  long parity_bytes;
+};
+
+static void receive_parity(struct FecDecoder* decoder, const uint8_t* parity,
+                           int size, uint8_t* rebuilt, uint8_t* expected,
+                           struct counts* counts) {
+  int length = FecDecoderRecover(decoder, parity, size, rebuilt);
+  if (!length) {
+    return;
+  }
+  counts->recovered++;
+  make_packet(expected, ((const struct PacketHeader*)rebuilt)->sequence);
+  if (length != PACKET_SIZE || memcmp(rebuilt, expected, PACKET_SIZE)) {
+    counts->mismatched++;
+  }
+}
+
+static int simulate(const struct shape* shape, const struct loss* loss,
+                    int packets, uint32_t seed, struct counts* counts) {
+  int parity_size = FEC_PARITY_SIZE(PACKET_SIZE);
+  uint8_t* storage = malloc((size_t)shape->interleave * parity_size);
+  uint8_t* datagram = malloc(MAX_DATAGRAM > parity_size ? MAX_DATAGRAM
+                                                        : parity_size);
+  uint8_t packet[PACKET_SIZE];
+  uint8_t rebuilt[PACKET_SIZE];
+  uint8_t expected[PACKET_SIZE];
+  if (!storage || !datagram) {
+    free(storage);
+    free(datagram);
+    return 0;
+  }
+  struct FecEncoder encoder;
+  struct FecDecoder decoder;
+  FecEncoderInit(&encoder, shape->group, shape->interleave, storage,
+                 PACKET_SIZE);
+  FecDecoderInit(&decoder, PACKET_SIZE);
+  struct channel channel = {.loss = loss, .state = seed};
+  memset(counts, 0, sizeof(*counts));
+  for (int p = 0; p < packets; ++p) {
+    make_packet(packet, (uint16_t)p);
+    int parities = FecEncoderAdd(&encoder, packet, PACKET_SIZE);
+    if (lose(&channel)) {
+      counts->lost++;
+    } else {
+      FecDecoderAdd(&decoder, packet, PACKET_SIZE);
+    }
+    int size = 0;
+    for (int i = 0; i <= parities; ++i) {
+      int length = 0;
+      const void* parity =
+          i < parities ? FecEncoderParity(&encoder, i, &length) : NULL;
+      // Send what is there once the next one does not fit, or at the end.
+      if (size && (!parity || size + length > MAX_DATAGRAM)) {
+        if (!lose(&channel)) {
+          for (int offset = 0; offset < size;) {
+            const struct PacketHeader* header =
+                (const void*)(datagram + offset);
+            int packet_size = (int)sizeof(*header) + header->length;
+            receive_parity(&decoder, datagram + offset, packet_size, rebuilt,
+                           expected, counts);
+            offset += packet_size;
+          }
+        }
+        size = 0;
+      }
+      if (parity) {
+        memcpy(datagram + size, parity, length);
+        size += length;
+        counts->parity_bytes += length;
+      }
+    }
+  }
+  FecDecoderFree(&decoder);
+  free(storage);
+  free(datagram);
+  return 1;
+}
+
+int main(int argc, char** argv) {
+  int packets = PACKETS;
+  uint32_t seed = SEED;
+  for (int opt; (opt = getopt(argc, argv, "n:s:")) != -1;) {
+    switch (opt) {
+      case 'n':
+        packets = atoi(optarg);
+        break;
+      case 's':
+        seed = (uint32_t)strtoul(optarg, NULL, 0);
+        break;
+      default:
+        packets = 0;
+        break;
+    }
+  }
+  if (optind != argc || packets <= 0 || !seed) {
+    fprintf(stderr, "Usage: %s [-n packets] [-s seed]\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+  int result = EXIT_SUCCESS;
+  for (size_t s = 0; s < sizeof(shapes) / sizeof(*shapes); ++s) {
+    for (size_t l = 0; l < sizeof(losses) / sizeof(*losses); ++l) {
+      struct counts counts;
+      if (!simulate(&shapes[s], &losses[l], packets, seed, &counts)) {
+        perror("Failed to allocate parity");
+        return EXIT_FAILURE;
+      }
+      double overhead =
+          100.0 * counts.parity_bytes / ((double)packets * PACKET_SIZE);
+      double recovered =
+          counts.lost ? 100.0 * counts.recovered / counts.lost : 100;
+      double residual = 100.0 * (counts.lost - counts.recovered) / packets;
+      printf("{\"group\":%d,\"interleave\":%d,\"loss_percent\":%.1f,"
+             "\"burst\":%.1f,\"packets\":%d,\"overhead_percent\":%.2f,"
+             "\"lost\":%ld,\"recovered\":%ld,\"recovered_percent\":%.2f,"
+             "\"residual_loss_percent\":%.3f,\"mismatched\":%ld}\n",
+             shapes[s].group, shapes[s].interleave, losses[l].rate * 100,
+             losses[l].burst, packets, overhead, counts.lost,
+             counts.recovered, recovered, residual, counts.mismatched);
+      fprintf(stderr,
+              "k=%d d=%d, %.0f%% loss in bursts of %.1f: %5.1f%% overhead, "
+              "%6ld lost, %5.1f%% recovered, %.3f%% left lost%s\n",
+              shapes[s].group, shapes[s].interleave, losses[l].rate * 100,
+              losses[l].burst, overhead, counts.lost, recovered, residual,
+              counts.mismatched ? ", REBUILT WRONG" : "");
+      if (counts.mismatched) {
+        result = EXIT_FAILURE;
+      }
+    }
+  }
+  return result;
+}
@@ -0,0 +1,175 @@
+#include "fft.h"
+#include "simd.h"
+
+#include <math.h>
+#include <stdlib.h>
+
+int fft_init(struct fft* fft, int size) {
+  *fft = (struct fft){.size = size, .half = size / 2};
+  int half = fft->half;
+  int bits = 0;
+  while ((1 << bits) < half) {
+    ++bits;
+  }
+  if (size < 8 || (1 << bits) != half) {
+    return 0;
+  }
+  fft->reversed = malloc(half * sizeof(int));
+  // Butterflies that are span apart take the twiddles from span on, and the
+  // ones that split the real spectrum out take the last half.
+  fft->twiddle_re = malloc((half + half / 2 + 1) * sizeof(float));
+  fft->twiddle_im = malloc((half + half / 2 + 1) * sizeof(float));
+  fft->split_re = malloc(half * sizeof(float));
+  fft->split_im = malloc(half * sizeof(float));
+  fft->work_re = malloc((half + 1) * sizeof(float));
+  fft->work_im = malloc((half + 1) * sizeof(float));
+  if (!fft->reversed || !fft->twiddle_re || !fft->twiddle_im ||
+      !fft->split_re || !fft->split_im || !fft->work_re || !fft->work_im) {
+    fft_free(fft);
+    return 0;
+  }
+  for (int i = 0; i < half; ++i) {
+    int reversed = 0;
+    for (int b = 0; b < bits; ++b) {
+      reversed |= ((i >> b) & 1) << (bits - 1 - b);
+    }
+    fft->reversed[i] = reversed;
+  }
+  for (int span = 1; span < half; span *= 2) {
+    for (int j = 0; j < span; ++j) {
+      double angle = -M_PI * j / span;
+      fft->twiddle_re[span + j] = (float)cos(angle);
+      fft->twiddle_im[span + j] = (float)sin(angle);
+    }
+  }
+  for (int k = 0; k <= half / 2; ++k) {
+    double angle = -2 * M_PI * k / size;
+    fft->twiddle_re[half + k] = (float)cos(angle);
+    fft->twiddle_im[half + k] = (float)sin(angle);
+  }
+  return 1;
+}
+
+void fft_free(struct fft* fft) {
+  free(fft->reversed);
+  free(fft->twiddle_re);
+  free(fft->twiddle_im);
+  free(fft->split_re);
+  free(fft->split_im);
+  free(fft->work_re);
+  free(fft->work_im);
+}
+
+// Decimation in time over data already in bit reversed order. Butterflies of
+// the same group sit next to each other from a span of four on, so those go
+// four at a time.
+static void transform(const struct fft* fft, float* re, float* im) {
+  int half = fft->half;
+  for (int span = 1; span < half; span *= 2) {
+    const float* twiddle_re = fft->twiddle_re + span;
+    const float* twiddle_im = fft->twiddle_im + span;
+    for (int start = 0; start < half; start += 2 * span) {
+      float* a_re = re + start;
+      float* a_im = im + start;
+      float* b_re = a_re + span;
+      float* b_im = a_im + span;
+      int j = 0;
+      for (; span >= 4 && j < span; j += 4) {
+        v4sf w_re = *(const v4sf_u*)(twiddle_re + j);
+        v4sf w_im = *(const v4sf_u*)(twiddle_im + j);
+        v4sf x_re = *(v4sf_u*)(b_re + j);
+        v4sf x_im = *(v4sf_u*)(b_im + j);
+        v4sf t_re = x_re * w_re - x_im * w_im;
+        v4sf t_im = x_re * w_im + x_im * w_re;
+        v4sf u_re = *(v4sf_u*)(a_re + j);
+        v4sf u_im = *(v4sf_u*)(a_im + j);
+        *(v4sf_u*)(b_re + j) = u_re - t_re;
+        *(v4sf_u*)(b_im + j) = u_im - t_im;
+        *(v4sf_u*)(a_re + j) = u_re + t_re;
+        *(v4sf_u*)(a_im + j) = u_im + t_im;
+      }
+      for (; j < span; ++j) {
+        float t_re = b_re[j] * twiddle_re[j] - b_im[j] * twiddle_im[j];
+        float t_im = b_re[j] * twiddle_im[j] + b_im[j] * twiddle_re[j];
+        b_re[j] = a_re[j] - t_re;
+        b_im[j] = a_im[j] - t_im;
+        a_re[j] += t_re;
+        a_im[j] += t_im;
+      }
+    }
+  }
+}
+
+// Even samples go in as the real parts and odd ones as the imaginary parts,
+// and the spectra of both are told apart by symmetry, then put together.
+void fft_forward(struct fft* fft, const float* signal, float* re, float* im) {
+  int half = fft->half;
+  float* z_re = fft->split_re;
+  float* z_im = fft->split_im;
+  for (int i = 0; i < half; ++i) {
+    int k = fft->reversed[i];
+    z_re[k] = signal[2 * i];
+    z_im[k] = signal[2 * i + 1];
+  }
+  transform(fft, z_re, z_im);
+  const float* w_re = fft->twiddle_re + half;
+  const float* w_im = fft->twiddle_im + half;
+  for (int k = 0; k <= half / 2; ++k) {
+    int m = k ? half - k : 0;
+    float even_re = (z_re[k] + z_re[m]) / 2;
+    float even_im = (z_im[k] - z_im[m]) / 2;
+    float odd_re = (z_im[k] + z_im[m]) / 2;
+    float odd_im = (z_re[m] - z_re[k]) / 2;
+    float t_re = odd_re * w_re[k] - odd_im * w_im[k];
+    float t_im = odd_re * w_im[k] + odd_im * w_re[k];
+    re[k] = even_re + t_re;
+    im[k] = even_im + t_im;
+    // Twiddle of half - k is that of k mirrored, which makes the bin across
+    // from this one out of the same halves.
+    re[half - k] = even_re - t_re;
+    im[half - k] = t_im - even_im;
+  }
+  im[0] = 0;
+  im[half] = 0;
+}
+
+// Undoes what the forward transform put together, and runs it again on the
+// conjugate to go back.
+void fft_inverse(struct fft* fft, const float* re, const float* im,
+                 float* signal) {
+  int half = fft->half;
+  float* z_re = fft->work_re;
+  float* z_im = fft->work_im;
+  const float* w_re = fft->twiddle_re + half;
+  const float* w_im = fft->twiddle_im + half;
+  for (int k = 0; k <= half / 2; ++k) {
+    int m = half - k;
+    float even_re = (re[k] + re[m]) / 2;
+    float even_im = (im[k] - im[m]) / 2;
+    float diff_re = (re[k] - re[m]) / 2;
+    float diff_im = (im[k] + im[m]) / 2;
+    // Odd spectrum is the difference over the twiddle, which is times its
+    // conjugate, as twiddles are of unit length.
+    float odd_re = diff_re * w_re[k] + diff_im * w_im[k];
+    float odd_im = diff_im * w_re[k] - diff_re * w_im[k];
+    // Bin across takes the conjugates of both halves, and its twiddle
+    // mirrored, which turns the odd spectrum around as well.
+    z_re[k] = even_re - odd_im;
+    z_im[k] = even_im + odd_re;
+    z_re[m] = even_re + odd_im;
+    z_im[m] = odd_re - even_im;
+  }
+  float* x_re = fft->split_re;
+  float* x_im = fft->split_im;
+  for (int i = 0; i < half; ++i) {
+    int k = fft->reversed[i];
+    x_re[k] = z_re[i];
+    x_im[k] = -z_im[i];
+  }
+  transform(fft, x_re, x_im);
+  float scale = 1.f / half;
+  for (int i = 0; i < half; ++i) {
+    signal[2 * i] = x_re[i] * scale;
+    signal[2 * i + 1] = -x_im[i] * scale;
+  }
+}
@@ -0,0 +1,21 @@
+// Radix-2 FFT of real signals of a power of two length, done as a complex one
+// of half the length. Spectra are split into real and imaginary parts of
+// size / 2 + 1 bins each, from DC up to Nyquist, and the inverse gives back
+// the signal as it was, scaled already.
+struct fft {
+  int size;
+  int half;
+  int* reversed;
+  float* twiddle_re;
+  float* twiddle_im;
+  float* split_re;
+  float* split_im;
+  float* work_re;
+  float* work_im;
+};
+
+int fft_init(struct fft* fft, int size);
+void fft_free(struct fft* fft);
+void fft_forward(struct fft* fft, const float* signal, float* re, float* im);
+void fft_inverse(struct fft* fft, const float* re, const float* im,
+                 float* signal);
@@ -0,0 +1,60 @@
+#include "histogram.h"
+
+#define SUB_BUCKETS (1u << HISTOGRAM_SUB_BITS)
+
+static int bucket_index(uint32_t value) {
+  if (value < SUB_BUCKETS) {
+    return (int)value;
+  }
+  int exponent = 31 - __builtin_clz(value);
+  int shift = exponent - HISTOGRAM_SUB_BITS;
+  return ((shift + 1) << HISTOGRAM_SUB_BITS) +
+         (int)(value >> shift & (SUB_BUCKETS - 1));
+}
+
+// Largest value that falls into the bucket.
+static uint32_t bucket_limit(int index) {
+  if (index < (int)SUB_BUCKETS) {
+    return (uint32_t)index;
+  }
+  int shift = (index >> HISTOGRAM_SUB_BITS) - 1;
+  uint32_t base = SUB_BUCKETS + (index & (SUB_BUCKETS - 1));
+  return (uint32_t)((((uint64_t)base + 1) << shift) - 1);
+}
+
+void histogram_add(struct histogram* histogram, uint32_t value) {
+  histogram->counts[bucket_index(value)]++;
+  histogram->total++;
+  if (value > histogram->max) {
+    histogram->max = value;
+  }
+}
+
+// Returns the upper bound of the bucket the percentile falls into, which is
+// never above the largest value added so far.
+uint32_t histogram_percentile(const struct histogram* histogram,
+                              double percentile) {
+  unsigned long rank =
+      (unsigned long)(histogram->total * percentile / 100 + 0.5);
+  if (rank < 1) {
+    rank = 1;
+  }
+  unsigned long seen = 0;
+  for (int i = 0; i < HISTOGRAM_BUCKETS; ++i) {
+    seen += histogram->counts[i];
+    if (seen >= rank) {
+      uint32_t limit = bucket_limit(i);
+      return limit < histogram->max ? limit : histogram->max;
+    }
+  }
+  return histogram->max;
+}
+
+unsigned long histogram_count_below(const struct histogram* histogram,
+                                    uint32_t value) {
+  unsigned long count = 0;
+  for (int i = 0; i < bucket_index(value); ++i) {
+    count += histogram->counts[i];
+  }
+  return count;
+}
@@ -0,0 +1,22 @@
+#include <stdint.h>
+
+#define HISTOGRAM_SUB_BITS 5
+#define HISTOGRAM_BUCKETS ((32 - HISTOGRAM_SUB_BITS + 1) << HISTOGRAM_SUB_BITS)
+
+// Counts values in buckets that are exact for small values and then double in
+// width with every power of two, with 1 << HISTOGRAM_SUB_BITS buckets to each
+// power. Percentiles are then never off by more than about 3%, whatever the
+// scale of values is, and adding one is a couple of instructions.
+struct histogram {
+  unsigned long counts[HISTOGRAM_BUCKETS];
+  unsigned long total;
+  uint32_t max;
+};
+
+void histogram_add(struct histogram* histogram, uint32_t value);
+uint32_t histogram_percentile(const struct histogram* histogram,
+                              double percentile);
+// Returns how many of the values added were below value, which is exact for
+// powers of two, as those start buckets of their own.
+unsigned long histogram_count_below(const struct histogram* histogram,
+                                    uint32_t value);
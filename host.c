@@ -0,0 +1,124 @@
+#include "capture.h"
+#include "hostcap.h"
+#include "sender.h"
+#include "utils.h"
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+static struct Sender sender;
+static volatile sig_atomic_t stopped;
+static volatile sig_atomic_t paused;
+
+static void handler(int sig) {
+  (void)sig;
+  stopped = 1;
+  atomic_flag_clear(&sender.running);
+}
+
+// Pauses and resumes the sender the way the phone app does as it goes to the
+// background and comes back, which stops the sender loop and runs it anew
+// with the same capture device.
+static void pause_handler(int sig) {
+  (void)sig;
+  paused = !paused;
+  if (paused) {
+    atomic_flag_clear(&sender.running);
+  }
+}
+
+static struct CaptureBackend* CreateCapture(const char* source,
+                                            double frequency) {
+  if (!strcmp(source, "tone")) {
+    return CreateToneCapture(sender.sample_rate, sender.channels,
+                             sender.encoding, SENDER_MAX_BUFFERS, frequency,
+                             SenderCallback, &sender);
+  }
+  if (!strcmp(source, "noise")) {
+    return CreateNoiseCapture(sender.sample_rate, sender.channels,
+                              sender.encoding, SENDER_MAX_BUFFERS, 1,
+                              SenderCallback, &sender);
+  }
+  return CreateFileCapture(sender.sample_rate, sender.channels,
+                           sender.encoding, SENDER_MAX_BUFFERS, source,
+                           SenderCallback, &sender);
+}
+
+int main(int argc, char** argv) {
+  int frames_per_buffer = 480;
+  double frequency = 440;
+  const char* source = "tone";
+  sender.sample_rate = 48000;
+  sender.channels = 1;
+  for (int opt; (opt = getopt(argc, argv, "r:n:t:o:")) != -1;) {
+    switch (opt) {
+      case 'r':
+        sender.sample_rate = atoi(optarg);
+        break;
+      case 'n':
+        frames_per_buffer = atoi(optarg);
+        break;
+      case 't':
+        frequency = atof(optarg);
+        break;
+      case 'o':
+        if (!SetSenderOption(&sender, optarg)) {
+          return EXIT_FAILURE;
+        }
+        break;
+      default:
+        sender.sample_rate = 0;
+        break;
+    }
+  }
+  if (optind < argc) {
+    source = argv[optind];
+  }
+  int frame_size = SenderFrameSize(&sender);
+  if (sender.sample_rate <= 0 || frames_per_buffer <= 0 || !frame_size) {
+    fprintf(stderr,
+            "Usage: %s [-r sample_rate] [-n frames_per_buffer] "
+            "[-t tone_frequency] [-o key=value]... "
+            "[tone|noise|<wav or raw file>]\n",
+            argv[0]);
+    return EXIT_FAILURE;
+  }
+  sender.buffer_size = frames_per_buffer * frame_size;
+  struct sigaction act = {.sa_handler = handler};
+  struct sigaction pause_act = {.sa_handler = pause_handler};
+  sigset_t blocked, unblocked;
+  sigemptyset(&blocked);
+  sigaddset(&blocked, SIGINT);
+  sigaddset(&blocked, SIGTERM);
+  sigaddset(&blocked, SIGUSR1);
+  if (sigaction(SIGINT, &act, NULL) == -1 ||
+      sigaction(SIGTERM, &act, NULL) == -1 ||
+      sigaction(SIGUSR1, &pause_act, NULL) == -1) {
+    perror("Failed to set up signal handler");
+    return EXIT_FAILURE;
+  }
+  struct CaptureBackend* capture = CreateCapture(source, frequency);
+  if (!capture) {
+    LOG(ERROR, "Failed to create capture backend");
+    return EXIT_FAILURE;
+  }
+  int result;
+  do {
+    atomic_flag_test_and_set(&sender.running);
+    result = RunSender(&sender, capture);
+    // Every other thread is gone by now, so signals only come here.
+    sigprocmask(SIG_BLOCK, &blocked, &unblocked);
+    if (paused && !stopped) {
+      LOG(INFO, "Sender paused");
+    }
+    while (paused && !stopped) {
+      sigsuspend(&unblocked);
+    }
+    sigprocmask(SIG_SETMASK, &unblocked, NULL);
+  } while (result && !stopped);
+  capture->Destroy(capture);
+  return result ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,351 @@
+#include "hostcap.h"
+#include "bufqueue.h"
+#include "capture.h"
+#include "convert.h"
+#include "packet.h"
+#include "utils.h"
+
+#include <errno.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <pthread.h>
+
+#define TONE_AMPLITUDE 0.25
+#define NOISE_AMPLITUDE 0.125
+
+// Host capture backends replace the audio device with a generator thread that
+// fills one enqueued buffer per buffer period of the wall clock, so that the
+// sender sees the same cadence as on a phone. Synthetic signals are generated
+// as planes of floats, one per channel, and converted to the capture format.
+struct HostCapture {
+  struct CaptureBackend backend;
+  int sample_rate;
+  int channels;
+  int encoding;
+  int frame_size;
+  int buffer_size;
+  CaptureCallback callback;
+  void* callback_arg;
+  int (*Generate)(struct HostCapture* capture, void* buffer, int frames);
+  ConvertFromFloat from_float;
+  float* planes;
+  float* interleaved;
+  atomic_flag running;
+  int started;
+  pthread_t thread;
+  struct BufferQueue queue;
+  double phase;
+  double step;
+  uint32_t seed;
+  FILE* file;
+  long data_offset;
+  long data_size;
+  long data_left;
+  void* queue_storage[];
+};
+
+static void ConvertPlanes(struct HostCapture* capture, void* buffer,
+                          int frames) {
+  Interleave(capture->planes, frames, frames, capture->channels,
+             capture->interleaved);
+  capture->from_float(capture->interleaved, buffer,
+                      frames * capture->channels);
+}
+
+// Every channel gets the next harmonic of the tone, so that they can be told
+// apart on the receiving end.
+static int GenerateTone(struct HostCapture* capture, void* buffer,
+                        int frames) {
+  for (int i = 0; i < frames; ++i) {
+    for (int c = 0; c < capture->channels; ++c) {
+      capture->planes[c * frames + i] =
+          (float)(TONE_AMPLITUDE * sin((c + 1) * capture->phase));
+    }
+    capture->phase = fmod(capture->phase + capture->step, 2 * M_PI);
+  }
+  ConvertPlanes(capture, buffer, frames);
+  return 1;
+}
+
+static int GenerateNoise(struct HostCapture* capture, void* buffer,
+                         int frames) {
+  for (int i = 0; i < frames * capture->channels; ++i) {
+    capture->seed ^= capture->seed << 13;
+    capture->seed ^= capture->seed >> 17;
+    capture->seed ^= capture->seed << 5;
+    capture->planes[i] =
+        (float)(NOISE_AMPLITUDE * (capture->seed / 2147483648.0 - 1));
+  }
+  ConvertPlanes(capture, buffer, frames);
+  return 1;
+}
+
+// Files are already in the capture format.
+static int GenerateFile(struct HostCapture* capture, void* buffer,
+                        int frames) {
+  uint8_t* data = buffer;
+  int frame_size = capture->frame_size;
+  for (int done = 0, rewound = 0; done < frames;) {
+    size_t wanted = frames - done;
+    if (wanted > capture->data_left / (size_t)frame_size) {
+      wanted = capture->data_left / frame_size;
+    }
+    size_t result = wanted ? fread(data + done * frame_size, frame_size,
+                                   wanted, capture->file)
+                           : 0;
+    if (result) {
+      capture->data_left -= result * frame_size;
+      done += result;
+      rewound = 0;
+      continue;
+    }
+    if (ferror(capture->file) || rewound) {
+      LOG(ERROR, "Failed to read capture file");
+      return 0;
+    }
+    // Loop the file so that it can drive sessions of any length.
+    if (fseek(capture->file, capture->data_offset, SEEK_SET) == -1) {
+      LOG(ERROR, "Failed to rewind capture file (%s)", strerror(errno));
+      return 0;
+    }
+    capture->data_left = capture->data_size;
+    rewound = 1;
+  }
+  return 1;
+}
+
+static void TimespecAdd(struct timespec* time, long long nsec) {
+  nsec += time->tv_nsec;
+  time->tv_sec += nsec / 1000000000;
+  time->tv_nsec = nsec % 1000000000;
+}
+
+static void* CaptureThread(void* arg) {
+  struct HostCapture* capture = (struct HostCapture*)arg;
+  int count = capture->buffer_size / capture->frame_size;
+  float scratch[2 * count * capture->channels];
+  capture->planes = scratch;
+  capture->interleaved = scratch + count * capture->channels;
+  struct timespec origin, deadline;
+  clock_gettime(CLOCK_MONOTONIC, &origin);
+  for (long long frames = count;
+       atomic_flag_test_and_set(&capture->running); frames += count) {
+    // Like a real device, a buffer is being filled during the whole period.
+    void* buffer = BufferQueueTryPop(&capture->queue);
+    deadline = origin;
+    TimespecAdd(&deadline, frames * 1000000000 / capture->sample_rate);
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL))
+      ;
+    if (!buffer) {
+      LOG(WARN, "Capture overrun, no buffer was enqueued");
+      continue;
+    }
+    if (!capture->Generate(capture, buffer, count)) {
+      // Keep the cadence going, there is no way to signal the consumer.
+      memset(buffer, 0, capture->buffer_size);
+    }
+    capture->callback(capture->callback_arg);
+  }
+  return NULL;
+}
+
+static int HostEnqueue(struct CaptureBackend* backend, void* buffer,
+                       int size) {
+  struct HostCapture* capture = (struct HostCapture*)backend;
+  if (BufferQueueSize(&capture->queue) == capture->queue.length) {
+    LOG(ERROR, "Failed to enqueue buffer (queue is full)");
+    return 0;
+  }
+  capture->buffer_size = size;
+  BufferQueuePush(&capture->queue, buffer);
+  return 1;
+}
+
+static int HostStart(struct CaptureBackend* backend) {
+  struct HostCapture* capture = (struct HostCapture*)backend;
+  atomic_flag_test_and_set(&capture->running);
+  int result =
+      pthread_create(&capture->thread, NULL, CaptureThread, capture);
+  if (result) {
+    LOG(ERROR, "Failed to create capture thread (%s)", strerror(result));
+    return 0;
+  }
+  capture->started = 1;
+  return 1;
+}
+
+static void HostStop(struct CaptureBackend* backend) {
+  struct HostCapture* capture = (struct HostCapture*)backend;
+  atomic_flag_clear(&capture->running);
+  if (capture->started) {
+    pthread_join(capture->thread, NULL);
+    capture->started = 0;
+  }
+  while (BufferQueueTryPop(&capture->queue))
+    ;
+}
+
+static void HostDestroy(struct CaptureBackend* backend) {
+  struct HostCapture* capture = (struct HostCapture*)backend;
+  HostStop(backend);
+  if (capture->file) {
+    fclose(capture->file);
+  }
+  free(capture);
+}
+
+static struct HostCapture* CreateHostCapture(int sample_rate, int channels,
+                                             int encoding, int queue_length,
+                                             CaptureCallback callback,
+                                             void* callback_arg) {
+  struct HostCapture* capture = (struct HostCapture*)calloc(
+      1, sizeof(struct HostCapture) + queue_length * sizeof(void*));
+  if (!capture) {
+    LOG(ERROR, "Failed to allocate capture backend");
+    return NULL;
+  }
+  capture->backend.Enqueue = HostEnqueue;
+  capture->backend.Start = HostStart;
+  capture->backend.Stop = HostStop;
+  capture->backend.Destroy = HostDestroy;
+  capture->sample_rate = sample_rate;
+  capture->channels = channels;
+  capture->encoding = encoding;
+  capture->frame_size = PacketEncodingSampleSize(encoding) * channels;
+  capture->from_float = GetConvertFromFloat(encoding);
+  capture->callback = callback;
+  capture->callback_arg = callback_arg;
+  InitBufferQueue(&capture->queue, queue_length, capture->queue_storage);
+  return capture;
+}
+
+struct CaptureBackend* CreateToneCapture(int sample_rate, int channels,
+                                         int encoding, int queue_length,
+                                         double frequency,
+                                         CaptureCallback callback,
+                                         void* callback_arg) {
+  struct HostCapture* capture = CreateHostCapture(
+      sample_rate, channels, encoding, queue_length, callback, callback_arg);
+  if (!capture) {
+    return NULL;
+  }
+  capture->Generate = GenerateTone;
+  capture->step = 2 * M_PI * frequency / sample_rate;
+  return &capture->backend;
+}
+
+struct CaptureBackend* CreateNoiseCapture(int sample_rate, int channels,
+                                          int encoding, int queue_length,
+                                          unsigned seed,
+                                          CaptureCallback callback,
+                                          void* callback_arg) {
+  struct HostCapture* capture = CreateHostCapture(
+      sample_rate, channels, encoding, queue_length, callback, callback_arg);
+  if (!capture) {
+    return NULL;
+  }
+  capture->Generate = GenerateNoise;
+  capture->seed = seed ? seed : 1;
+  return &capture->backend;
+}
+
+// Wave files have to be in the capture format, and anything else is taken for
+// raw samples in it.
+static long ReadWaveHeader(FILE* file, const struct HostCapture* capture) {
+  struct {
+    char id[4];
+    uint32_t size;
+    char format[4];
+  } riff;
+  if (fread(&riff, sizeof(riff), 1, file) != 1 ||
+      memcmp(riff.id, "RIFF", 4) || memcmp(riff.format, "WAVE", 4)) {
+    // Not a wave file, treat the whole of it as raw samples.
+    if (fseek(file, 0, SEEK_END) == -1) {
+      LOG(ERROR, "Failed to seek capture file (%s)", strerror(errno));
+      return -1;
+    }
+    long size = ftell(file);
+    return fseek(file, 0, SEEK_SET) == -1 ? -1 : size;
+  }
+  for (;;) {
+    struct {
+      char id[4];
+      uint32_t size;
+    } chunk;
+    if (fread(&chunk, sizeof(chunk), 1, file) != 1) {
+      LOG(ERROR, "Failed to find wave data chunk");
+      return -1;
+    }
+    if (!memcmp(chunk.id, "data", 4)) {
+      return chunk.size;
+    }
+    if (!memcmp(chunk.id, "fmt ", 4)) {
+      struct {
+        uint16_t format;
+        uint16_t channels;
+        uint32_t sample_rate;
+        uint32_t byte_rate;
+        uint16_t block_align;
+        uint16_t bits_per_sample;
+      } fmt;
+      if (chunk.size < sizeof(fmt) || fread(&fmt, sizeof(fmt), 1, file) != 1) {
+        LOG(ERROR, "Failed to read wave format chunk");
+        return -1;
+      }
+      // Integer samples are tagged 1, and floating point ones are tagged 3.
+      int encoding = fmt.format == 3 && fmt.bits_per_sample == 32
+                         ? PACKET_ENCODING_F32LE
+                     : fmt.format == 1 && fmt.bits_per_sample == 24
+                         ? PACKET_ENCODING_S24LE
+                     : fmt.format == 1 && fmt.bits_per_sample == 16
+                         ? PACKET_ENCODING_S16LE
+                         : -1;
+      if (encoding != capture->encoding ||
+          fmt.channels != capture->channels ||
+          (int)fmt.sample_rate != capture->sample_rate) {
+        LOG(ERROR, "Unsupported wave format (%u, %u channels, %u bits, %u Hz)",
+            fmt.format, fmt.channels, fmt.bits_per_sample, fmt.sample_rate);
+        return -1;
+      }
+      chunk.size -= sizeof(fmt);
+    }
+    if (fseek(file, chunk.size + (chunk.size & 1), SEEK_CUR) == -1) {
+      LOG(ERROR, "Failed to skip wave chunk (%s)", strerror(errno));
+      return -1;
+    }
+  }
+}
+
+struct CaptureBackend* CreateFileCapture(int sample_rate, int channels,
+                                         int encoding, int queue_length,
+                                         const char* path,
+                                         CaptureCallback callback,
+                                         void* callback_arg) {
+  struct HostCapture* capture = CreateHostCapture(
+      sample_rate, channels, encoding, queue_length, callback, callback_arg);
+  if (!capture) {
+    return NULL;
+  }
+  capture->Generate = GenerateFile;
+  do {
+    capture->file = fopen(path, "rb");
+    if (!capture->file) {
+      LOG(ERROR, "Failed to open %s (%s)", path, strerror(errno));
+      break;
+    }
+    capture->data_size = ReadWaveHeader(capture->file, capture);
+    if (capture->data_size < capture->frame_size) {
+      LOG(ERROR, "Failed to find audio data in %s", path);
+      break;
+    }
+    capture->data_offset = ftell(capture->file);
+    capture->data_left = capture->data_size;
+    return &capture->backend;
+  } while (0);
+  HostDestroy(&capture->backend);
+  return NULL;
+}
@@ -0,0 +1,15 @@
+struct CaptureBackend* CreateToneCapture(int sample_rate, int channels,
+                                         int encoding, int queue_length,
+                                         double frequency,
+                                         void (*callback)(void*),
+                                         void* callback_arg);
+struct CaptureBackend* CreateNoiseCapture(int sample_rate, int channels,
+                                          int encoding, int queue_length,
+                                          unsigned seed,
+                                          void (*callback)(void*),
+                                          void* callback_arg);
+struct CaptureBackend* CreateFileCapture(int sample_rate, int channels,
+                                         int encoding, int queue_length,
+                                         const char* path,
+                                         void (*callback)(void*),
+                                         void* callback_arg);
@@ -19,73 +19,161 @@
     break;                                              \
   }
 
-static jobject GetSystemService(JNIEnv* env, jobject activity,
-                                const char* name) {
-  jobject result = 0;
+// Method and field IDs stay valid for as long as their classes are loaded,
+// so they are looked up once, on first use, rather than on every resume. The
+// classes whose static fields are read later are held on to for that.
+static struct {
+  int found;
+  jclass activity_class;
+  jclass audio_manager_class;
+  jfieldID wifi_service;
+  jfieldID audio_service;
+  jmethodID get_system_service;
+  jmethodID create_multicast_lock;
+  jmethodID acquire;
+  jmethodID release;
+  jmethodID is_held;
+  jmethodID get_property;
+  jfieldID output_sample_rate;
+  jfieldID output_frames_per_buffer;
+} ids;
+
+static jclass FindSystemClass(JNIEnv* env, const char* name) {
+  jclass result = UNEXCEPT(FindClass, env, name);
+  if (!result) {
+    LOG(ERROR, "Failed to find class %s", name);
+  }
+  return result;
+}
+
+static int FindIds(JNIEnv* env, jobject activity) {
+  if (ids.found) {
+    return 1;
+  }
   jclass activity_class = NULL;
+  jclass wifi_manager_class = NULL;
+  jclass lock_class = NULL;
+  jclass audio_manager_class = NULL;
   do {
     activity_class = UNEXCEPT(GetObjectClass, env, activity);
     if (!activity_class) {
       LOG(ERROR, "Failed to get activity class");
       break;
     }
-    jfieldID service_name_field =
-        FIND_OR_BREAK(service_name_field, StaticField, env, activity_class,
-                      name, "Ljava/lang/String;");
-    jmethodID get_system_service = FIND_OR_BREAK(
-        get_system_service, Method, env, activity_class, "getSystemService",
-        "(Ljava/lang/String;)Ljava/lang/Object;");
-    jobject service_name =
-        UNEXCEPT(GetStaticObjectField, env, activity_class, service_name_field);
-    if (!service_name) {
-      LOG(ERROR, "Failed to get name of system service %s", name);
+    wifi_manager_class = FindSystemClass(env, "android/net/wifi/WifiManager");
+    lock_class =
+        FindSystemClass(env, "android/net/wifi/WifiManager$MulticastLock");
+    audio_manager_class = FindSystemClass(env, "android/media/AudioManager");
+    if (!wifi_manager_class || !lock_class || !audio_manager_class) {
       break;
     }
-    result = UNEXCEPT(CallObjectMethod, env, activity, get_system_service,
-                      service_name);
-    UNEXCEPT(DeleteLocalRef, env, service_name);
-    if (!result) {
-      LOG(ERROR, "Failed to get system service %s", name);
+    ids.wifi_service =
+        FIND_OR_BREAK(ids.wifi_service, StaticField, env, activity_class,
+                      "WIFI_SERVICE", "Ljava/lang/String;");
+    ids.audio_service =
+        FIND_OR_BREAK(ids.audio_service, StaticField, env, activity_class,
+                      "AUDIO_SERVICE", "Ljava/lang/String;");
+    ids.get_system_service = FIND_OR_BREAK(
+        ids.get_system_service, Method, env, activity_class,
+        "getSystemService", "(Ljava/lang/String;)Ljava/lang/Object;");
+    ids.create_multicast_lock = FIND_OR_BREAK(
+        ids.create_multicast_lock, Method, env, wifi_manager_class,
+        "createMulticastLock",
+        "(Ljava/lang/String;)Landroid/net/wifi/WifiManager$MulticastLock;");
+    ids.acquire =
+        FIND_OR_BREAK(ids.acquire, Method, env, lock_class, "acquire", "()V");
+    ids.release =
+        FIND_OR_BREAK(ids.release, Method, env, lock_class, "release", "()V");
+    ids.is_held =
+        FIND_OR_BREAK(ids.is_held, Method, env, lock_class, "isHeld", "()Z");
+    ids.get_property = FIND_OR_BREAK(
+        ids.get_property, Method, env, audio_manager_class, "getProperty",
+        "(Ljava/lang/String;)Ljava/lang/String;");
+    ids.output_sample_rate = FIND_OR_BREAK(
+        ids.output_sample_rate, StaticField, env, audio_manager_class,
+        "PROPERTY_OUTPUT_SAMPLE_RATE", "Ljava/lang/String;");
+    ids.output_frames_per_buffer = FIND_OR_BREAK(
+        ids.output_frames_per_buffer, StaticField, env, audio_manager_class,
+        "PROPERTY_OUTPUT_FRAMES_PER_BUFFER", "Ljava/lang/String;");
+    ids.activity_class = UNEXCEPT(NewGlobalRef, env, activity_class);
+    ids.audio_manager_class = UNEXCEPT(NewGlobalRef, env, audio_manager_class);
+    if (!ids.activity_class || !ids.audio_manager_class) {
+      LOG(ERROR, "Failed to create global class references");
+      if (ids.activity_class) {
+        UNEXCEPT(DeleteGlobalRef, env, ids.activity_class);
+        ids.activity_class = NULL;
+      }
+      if (ids.audio_manager_class) {
+        UNEXCEPT(DeleteGlobalRef, env, ids.audio_manager_class);
+        ids.audio_manager_class = NULL;
+      }
       break;
     }
+    ids.found = 1;
   } while (0);
-  if (activity_class) {
-    UNEXCEPT(DeleteLocalRef, env, activity_class);
+  jclass locals[] = {activity_class, wifi_manager_class, lock_class,
+                     audio_manager_class};
+  FOR_EACH(jclass * it, locals) {
+    if (*it) {
+      UNEXCEPT(DeleteLocalRef, env, *it);
+    }
+  }
+  return ids.found;
+}
+
+static jobject GetSystemService(JNIEnv* env, jobject activity,
+                                jfieldID service_name_field,
+                                const char* name) {
+  jobject service_name = UNEXCEPT(GetStaticObjectField, env,
+                                  ids.activity_class, service_name_field);
+  if (!service_name) {
+    LOG(ERROR, "Failed to get name of system service %s", name);
+    return NULL;
+  }
+  jobject result = UNEXCEPT(CallObjectMethod, env, activity,
+                            ids.get_system_service, service_name);
+  UNEXCEPT(DeleteLocalRef, env, service_name);
+  if (!result) {
+    LOG(ERROR, "Failed to get system service %s", name);
   }
   return result;
 }
 
-static jobject CreateMulticastLock(JNIEnv* env, jobject activity,
-                                   const char* tag_value) {
+jobject CreateMulticastLock(JNIEnv* env, jobject activity,
+                            const char* tag_value) {
+  LOG(DEBUG, "Entering %s()", __func__);
   jobject result = NULL;
   jobject wifi_manager = NULL;
-  jclass manager_class = NULL;
+  jobject multicast_lock = NULL;
   do {
-    wifi_manager = GetSystemService(env, activity, "WIFI_SERVICE");
-    if (!wifi_manager) {
-      LOG(ERROR, "Failed to get wifi manager service");
+    if (!FindIds(env, activity)) {
       break;
     }
-    manager_class = UNEXCEPT(GetObjectClass, env, wifi_manager);
-    if (!manager_class) {
-      LOG(ERROR, "Failed to get wifi manager class");
+    wifi_manager =
+        GetSystemService(env, activity, ids.wifi_service, "WIFI_SERVICE");
+    if (!wifi_manager) {
+      LOG(ERROR, "Failed to get wifi manager service");
       break;
     }
-    jmethodID create_multicast_lock = FIND_OR_BREAK(
-        create_multicast_lock, Method, env, manager_class,
-        "createMulticastLock",
-        "(Ljava/lang/String;)Landroid/net/wifi/WifiManager$MulticastLock;");
     jobject tag = UNEXCEPT(NewStringUTF, env, tag_value);
     if (!tag) {
       LOG(ERROR, "Failed to create tag string");
       break;
     }
-    result = UNEXCEPT(CallObjectMethod, env, wifi_manager,
-                      create_multicast_lock, tag);
+    multicast_lock = UNEXCEPT(CallObjectMethod, env, wifi_manager,
+                              ids.create_multicast_lock, tag);
     UNEXCEPT(DeleteLocalRef, env, tag);
+    if (!multicast_lock) {
+      LOG(ERROR, "Failed to create multicast lock");
+      break;
+    }
+    result = UNEXCEPT(NewGlobalRef, env, multicast_lock);
+    if (!result) {
+      LOG(ERROR, "Failed to create global multicast lock reference");
+    }
   } while (0);
-  if (manager_class) {
-    UNEXCEPT(DeleteLocalRef, env, manager_class);
+  if (multicast_lock) {
+    UNEXCEPT(DeleteLocalRef, env, multicast_lock);
   }
   if (wifi_manager) {
     UNEXCEPT(DeleteLocalRef, env, wifi_manager);
@@ -104,75 +192,30 @@ static int StringToInt(JNIEnv* env, jobject str) {
   return result;
 }
 
-int AcquireMulticastLock(JNIEnv* env, jobject activity, const char* tag,
-                         jobject* multicast_lock_out) {
+int AcquireMulticastLock(JNIEnv* env, jobject multicast_lock) {
   LOG(DEBUG, "Entering %s()", __func__);
-  int result = 0;
-  jobject multicast_lock = NULL;
-  jobject lock_class = NULL;
-  do {
-    multicast_lock = CreateMulticastLock(env, activity, tag);
-    if (!multicast_lock) {
-      LOG(ERROR, "Failed to create multicast lock");
-      break;
-    }
-    lock_class = UNEXCEPT(GetObjectClass, env, multicast_lock);
-    if (!lock_class) {
-      LOG(ERROR, "Failed to get class of multicast lock");
-      break;
-    }
-    jmethodID acquire =
-        FIND_OR_BREAK(acquire, Method, env, lock_class, "acquire", "()V");
-    jmethodID is_held =
-        FIND_OR_BREAK(is_held, Method, env, lock_class, "isHeld", "()Z");
-    UNEXCEPT(CallVoidMethod, env, multicast_lock, acquire);
-    jboolean held = UNEXCEPT(CallBooleanMethod, env, multicast_lock, is_held);
-    if (held != JNI_TRUE) {
-      LOG(ERROR, "Failed to acquire multicast lock");
-      break;
-    }
-    jobject multicast_lock_global = UNEXCEPT(NewGlobalRef, env, multicast_lock);
-    if (!multicast_lock_global) {
-      LOG(ERROR, "Failed to create global multicast lock reference");
-      break;
-    }
-    *multicast_lock_out = multicast_lock_global;
-  } while (result = 1, 0);
-  if (lock_class) {
-    UNEXCEPT(DeleteLocalRef, env, lock_class);
-  }
-  if (multicast_lock) {
-    UNEXCEPT(DeleteLocalRef, env, multicast_lock);
+  UNEXCEPT(CallVoidMethod, env, multicast_lock, ids.acquire);
+  jboolean held = UNEXCEPT(CallBooleanMethod, env, multicast_lock, ids.is_held);
+  if (held != JNI_TRUE) {
+    LOG(ERROR, "Failed to acquire multicast lock");
+    return 0;
   }
-  return result;
+  return 1;
 }
 
 int ReleaseMulticastLock(JNIEnv* env, jobject multicast_lock) {
   LOG(DEBUG, "Entering %s()", __func__);
-  int result = 0;
-  jclass lock_class = NULL;
-  do {
-    lock_class = UNEXCEPT(GetObjectClass, env, multicast_lock);
-    if (!lock_class) {
-      LOG(ERROR, "Failed to get class of multicast lock");
-      break;
-    }
-    jmethodID release =
-        FIND_OR_BREAK(release, Method, env, lock_class, "release", "()V");
-    jmethodID is_held =
-        FIND_OR_BREAK(is_held, Method, env, lock_class, "isHeld", "()Z");
-    UNEXCEPT(CallVoidMethod, env, multicast_lock, release);
-    jboolean held = UNEXCEPT(CallBooleanMethod, env, multicast_lock, is_held);
-    if (held) {
-      LOG(ERROR, "Failed to release multicast lock");
-      break;
-    }
-    UNEXCEPT(DeleteGlobalRef, env, multicast_lock);
-  } while (result = 1, 0);
-  if (lock_class) {
-    UNEXCEPT(DeleteLocalRef, env, lock_class);
+  UNEXCEPT(CallVoidMethod, env, multicast_lock, ids.release);
+  jboolean held = UNEXCEPT(CallBooleanMethod, env, multicast_lock, ids.is_held);
+  if (held) {
+    LOG(ERROR, "Failed to release multicast lock");
+    return 0;
   }
-  return result;
+  return 1;
+}
+
+void DeleteMulticastLock(JNIEnv* env, jobject multicast_lock) {
+  UNEXCEPT(DeleteGlobalRef, env, multicast_lock);
 }
 
 int GetBufferConfig(JNIEnv* env, jobject activity, int* sample_rate_out,
@@ -180,38 +223,33 @@ int GetBufferConfig(JNIEnv* env, jobject activity, int* sample_rate_out,
   LOG(DEBUG, "Entering %s()", __func__);
   struct Pair {
     const char* const key;
+    jfieldID field;
     int value;
   } values_map[] = {{.key = "PROPERTY_OUTPUT_SAMPLE_RATE"},
                     {.key = "PROPERTY_OUTPUT_FRAMES_PER_BUFFER"}};
   int result = 0;
   jobject audio_manager = NULL;
-  jclass manager_class = NULL;
   do {
-    audio_manager = GetSystemService(env, activity, "AUDIO_SERVICE");
-    if (!audio_manager) {
-      LOG(ERROR, "Failed to get audio manager service");
+    if (!FindIds(env, activity)) {
       break;
     }
-    manager_class = UNEXCEPT(GetObjectClass, env, audio_manager);
-    if (!manager_class) {
-      LOG(ERROR, "Failed to get audio manager class");
+    values_map[0].field = ids.output_sample_rate;
+    values_map[1].field = ids.output_frames_per_buffer;
+    audio_manager =
+        GetSystemService(env, activity, ids.audio_service, "AUDIO_SERVICE");
+    if (!audio_manager) {
+      LOG(ERROR, "Failed to get audio manager service");
       break;
     }
-    jmethodID get_property =
-        FIND_OR_BREAK(get_property, Method, env, manager_class, "getProperty",
-                      "(Ljava/lang/String;)Ljava/lang/String;");
     FOR_EACH(struct Pair * it, values_map) {
-      jfieldID property_name_field =
-          FIND_OR_BREAK(property_name_field, StaticField, env, manager_class,
-                        it->key, "Ljava/lang/String;");
-      jobject property_name = UNEXCEPT(GetStaticObjectField, env, manager_class,
-                                       property_name_field);
+      jobject property_name = UNEXCEPT(
+          GetStaticObjectField, env, ids.audio_manager_class, it->field);
       if (!property_name) {
         LOG(ERROR, "Failed to get name of audio property %s", it->key);
         break;
       }
       jobject value = UNEXCEPT(CallObjectMethod, env, audio_manager,
-                               get_property, property_name);
+                               ids.get_property, property_name);
       UNEXCEPT(DeleteLocalRef, env, property_name);
       if (!value) {
         LOG(ERROR, "Failed to get audio property %s", it->key);
@@ -229,9 +267,6 @@ int GetBufferConfig(JNIEnv* env, jobject activity, int* sample_rate_out,
       *frames_per_buffer_out = values_map[1].value;
     }
   } while (result = 1, 0);
-  if (manager_class) {
-    UNEXCEPT(DeleteLocalRef, env, manager_class);
-  }
   if (audio_manager) {
     UNEXCEPT(DeleteLocalRef, env, audio_manager);
   }
@@ -1,7 +1,11 @@
 #include <jni.h>
 
-int AcquireMulticastLock(JNIEnv* env, jobject activity, const char* tag,
-                         jobject* multicast_lock_out);
+// Returns a global reference to a multicast lock that is not held yet, or
+// NULL. The lock is acquired and released as many times as needed, and
+// deleted once no longer.
+jobject CreateMulticastLock(JNIEnv* env, jobject activity, const char* tag);
+int AcquireMulticastLock(JNIEnv* env, jobject multicast_lock);
 int ReleaseMulticastLock(JNIEnv* env, jobject multicast_lock);
+void DeleteMulticastLock(JNIEnv* env, jobject multicast_lock);
 int GetBufferConfig(JNIEnv* env, jobject activity, int* sample_rate_out,
                     int* frames_per_buffer_out);
@@ -0,0 +1,169 @@
+#include "drift.h"
+#include "jitter.h"
+#include "packet.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+static struct jitter_slot* slot_at(const struct jitter_buffer* jitter,
+                                   uint16_t sequence) {
+  return &jitter->slots[sequence % jitter->capacity];
+}
+
+static const struct PacketHeader* slot_header(const struct jitter_slot* slot) {
+  return (const struct PacketHeader*)slot->data;
+}
+
+static uint64_t release_time(const struct jitter_buffer* jitter,
+                             uint32_t timestamp) {
+  int64_t frames = (int32_t)(timestamp - jitter->anchor_timestamp);
+  int64_t offset =
+      (int64_t)(frames * 1e9 / jitter->sample_rate * jitter->period);
+  uint64_t base = jitter->anchor_time;
+  return offset < 0 && (uint64_t)-offset > base ? 0 : base + offset;
+}
+
+// Finds the earliest buffered datagram, starting from the one to be played
+// next. Returns its distance from the playout cursor, or -1 if there is none.
+static int find_next(const struct jitter_buffer* jitter) {
+  if (!jitter->count) {
+    return -1;
+  }
+  for (int i = 0; i < jitter->capacity; ++i) {
+    uint16_t sequence = jitter->next_sequence + i;
+    const struct jitter_slot* slot = slot_at(jitter, sequence);
+    if (slot->length && slot_header(slot)->sequence == sequence) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+int jitter_init(struct jitter_buffer* jitter, int capacity, int depth_ms,
+                void (*release)(void* packet, void* user), void* user) {
+  memset(jitter, 0, sizeof(*jitter));
+  jitter->slots = calloc(capacity, sizeof(struct jitter_slot));
+  if (!jitter->slots) {
+    return 0;
+  }
+  jitter->capacity = capacity;
+  jitter->depth = (uint64_t)depth_ms * 1000000;
+  jitter->release = release;
+  jitter->user = user;
+  return 1;
+}
+
+void jitter_free(struct jitter_buffer* jitter) {
+  jitter_reset(jitter);
+  free(jitter->slots);
+}
+
+void jitter_reset(struct jitter_buffer* jitter) {
+  for (int i = 0; i < jitter->capacity; ++i) {
+    if (jitter->slots[i].length) {
+      jitter->release(jitter->slots[i].data, jitter->user);
+      jitter->slots[i].length = 0;
+    }
+  }
+  jitter->count = 0;
+  jitter->started = 0;
+  jitter->playing = 0;
+}
+
+void jitter_put(struct jitter_buffer* jitter, void* packet, int length,
+                uint64_t now) {
+  const struct PacketHeader* header = packet;
+  if (length < (int)sizeof(*header) || header->type != PACKET_TYPE_AUDIO ||
+      header->length + (int)sizeof(*header) != length ||
+      !PacketFormatRate(header->format) ||
+      !PacketFormatFrameSize(header->format)) {
+    jitter->stats.invalid++;
+    jitter->release(packet, jitter->user);
+    return;
+  }
+  int16_t distance = header->sequence - jitter->next_sequence;
+  if (jitter->started &&
+      (header->format != jitter->format || distance >= jitter->capacity ||
+       distance < -jitter->capacity)) {
+    // Sender restarted or was away for too long, start over.
+    jitter_reset(jitter);
+    jitter->stats.resync++;
+  }
+  if (!jitter->started) {
+    jitter->started = 1;
+    jitter->next_sequence = header->sequence;
+    jitter->highest_sequence = header->sequence;
+    jitter->format = header->format;
+    jitter->sample_rate = PacketFormatRate(header->format);
+    jitter->anchor_timestamp = header->timestamp;
+    jitter->anchor_time = now + jitter->depth;
+    jitter->period = 1;
+    drift_reset(&jitter->drift);
+    distance = 0;
+  }
+  if (distance < 0 && !jitter->playing) {
+    // Nothing was played yet, so an earlier datagram can still make it.
+    jitter->next_sequence = header->sequence;
+    distance = 0;
+  }
+  struct jitter_slot* slot = slot_at(jitter, header->sequence);
+  if (distance < 0 || slot->length) {
+    if (distance < 0) {
+      jitter->stats.late++;
+    } else {
+      jitter->stats.duplicate++;
+    }
+    jitter->release(packet, jitter->user);
+    return;
+  }
+  // Restart the schedule from this datagram whenever the period changes, so
+  // that the new one does not move the datagrams around it.
+  uint64_t release = release_time(jitter, header->timestamp);
+  if (drift_update(&jitter->drift, (int64_t)(now - release), now)) {
+    jitter->anchor_timestamp = header->timestamp;
+    jitter->anchor_time = release;
+    jitter->period = jitter->drift.correction;
+  }
+  slot->data = packet;
+  slot->length = length;
+  jitter->count++;
+  jitter->stats.received++;
+  if ((int16_t)(header->sequence - jitter->highest_sequence) < 0) {
+    jitter->stats.reordered++;
+  } else {
+    jitter->highest_sequence = header->sequence;
+  }
+}
+
+struct PacketHeader* jitter_get(struct jitter_buffer* jitter, uint64_t now) {
+  int distance = find_next(jitter);
+  if (distance == -1) {
+    return NULL;
+  }
+  struct jitter_slot* slot = slot_at(jitter, jitter->next_sequence + distance);
+  if (release_time(jitter, slot_header(slot)->timestamp) > now) {
+    return NULL;
+  }
+  // Whatever was missing before this datagram will never be played now.
+  jitter->playing = 1;
+  jitter->stats.lost += distance;
+  jitter->next_sequence += distance + 1;
+  jitter->count--;
+  slot->length = 0;
+  return slot->data;
+}
+
+uint64_t jitter_release_time(const struct jitter_buffer* jitter,
+                             uint32_t timestamp) {
+  return release_time(jitter, timestamp);
+}
+
+uint64_t jitter_deadline(const struct jitter_buffer* jitter) {
+  int distance = find_next(jitter);
+  if (distance == -1) {
+    return UINT64_MAX;
+  }
+  uint16_t sequence = jitter->next_sequence + distance;
+  const struct PacketHeader* header = slot_header(slot_at(jitter, sequence));
+  return release_time(jitter, header->timestamp);
+}
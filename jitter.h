@@ -0,0 +1,57 @@
+#include <stdint.h>
+
+struct PacketHeader;
+
+struct jitter_slot {
+  int length;
+  void* data;
+};
+
+struct jitter_stats {
+  unsigned received;
+  unsigned lost;
+  unsigned late;
+  unsigned duplicate;
+  unsigned reordered;
+  unsigned invalid;
+  unsigned resync;
+};
+
+// Reorders datagrams by sequence number and releases them on a playout
+// schedule that starts depth nanoseconds after the first one arrived. Frames
+// are scheduled period times the nominal frame duration apart, where period
+// tracks the clock of the sender from how late datagrams arrive against the
+// schedule. Datagrams are kept by pointer. Those that are dropped are handed
+// to the release callback, and those returned by get belong to the caller.
+struct jitter_buffer {
+  int capacity;
+  int count;
+  uint64_t depth;
+  struct jitter_slot* slots;
+  void (*release)(void* packet, void* user);
+  void* user;
+  int started;
+  int playing;
+  uint16_t next_sequence;
+  uint16_t highest_sequence;
+  uint16_t format;
+  int sample_rate;
+  uint32_t anchor_timestamp;
+  uint64_t anchor_time;
+  double period;
+  struct drift drift;
+  struct jitter_stats stats;
+};
+
+int jitter_init(struct jitter_buffer* jitter, int capacity, int depth_ms,
+                void (*release)(void* packet, void* user), void* user);
+void jitter_free(struct jitter_buffer* jitter);
+void jitter_reset(struct jitter_buffer* jitter);
+void jitter_put(struct jitter_buffer* jitter, void* packet, int length,
+                uint64_t now);
+struct PacketHeader* jitter_get(struct jitter_buffer* jitter, uint64_t now);
+// Time the frame with the timestamp plays at on the current schedule, which
+// only exists once the buffer is started.
+uint64_t jitter_release_time(const struct jitter_buffer* jitter,
+                             uint32_t timestamp);
+uint64_t jitter_deadline(const struct jitter_buffer* jitter);
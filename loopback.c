@@ -0,0 +1,752 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <glob.h>
+#include <limits.h>
+#include <math.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/prctl.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#define LOOPBACK_PORT 12400
+#define LOOPBACK_GROUP_PORT 12399
+#define MAX_RUNS 16
+#define MAX_STREAMS 64
+#define MAX_RECEIVERS 16
+#define MAX_LOAD 16
+#define DURATION 5
+#define SETTLE_TIME 200
+#define PATTERN_TAPS 0xb400u
+#define PATTERN_LENGTH 65535
+#define RESUME_GAP 50
+
+// Runs senders and pamnc as they are, over loopback, for every combination of
+// buffer size, stream count and receiver count, and prints one line of JSON per
+// run to stdout and a summary to stderr. Every receiver is a pamnc of its own
+// that takes every stream, either from the senders directly or from a multicast
+// group they all send to. Senders capture a file of 16-bit samples from a
+// maximal-length LFSR, which never yields 0 and loops seamlessly. This very
+// program stands in for pactl, by way of a symlink early in PATH, and reads
+// every pipe pamnc opens, checking that each sample is the one that follows the
+// last, or silence that pamnc filled in for lost packets, which it is told to
+// do rather than conceal them. Latency and jitter are what pamnc measured from
+// capture to the pipe, as a mean of p50 and the worst p99 and max across
+// streams and receivers. CPU is per stream and process, as a percentage of one
+// core over the lifetime of the process. Wakeup latency is how late pamnc
+// found its timer to wake it up, as a mean of p50 and the worst of the rest
+// across receivers, and the worst p99 of how late sender loops woke up to
+// captured buffers, which senders only measure in power of two steps. With a
+// priority given, senders and pamnc run real-time at it, and with load given,
+// that many processes spin at default priority all along every run.
+//
+// First audio is how long after pamnc started the first sample came out of a
+// pipe. With an outage given, senders are taken away halfway through every
+// run for that many milliseconds, either paused the way the phone app is when
+// it goes to the background, or killed and started anew, and resume is how
+// long after they came back the first sample came out of a pipe that had none
+// for RESUME_GAP milliseconds. Either way every pipe is only checked to go on
+// seamlessly up to the outage and from where it resumes.
+enum outage { OUTAGE_NONE, OUTAGE_PAUSE, OUTAGE_RESTART };
+
+struct run_options {
+  const char* group;
+  int priority;
+  int load;
+  enum outage outage;
+  int outage_ms;
+  int duration;
+};
+
+struct run_result {
+  unsigned long samples;
+  unsigned long silent;
+  unsigned long mismatched;
+  double active_seconds;
+  int reported;
+  int latency_count;
+  double latency_p50;
+  double latency_p99;
+  double latency_max;
+  double jitter_p50;
+  double jitter_p99;
+  double jitter_max;
+  int wakeup_count;
+  double wakeup_p50;
+  double wakeup_p99;
+  double wakeup_p999;
+  double wakeup_max;
+  double sender_wakeup_p99;
+  int first_audio_count;
+  double first_audio;
+  double first_audio_max;
+  int resumed;
+  double resume;
+  double resume_max;
+  double receiver_cpu;
+  double sender_cpu;
+};
+
+static uint16_t pattern_next(uint16_t value) {
+  return (value >> 1) ^ (-(value & 1u) & PATTERN_TAPS);
+}
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void sleep_ms(int ms) {
+  struct timespec ts = {.tv_sec = ms / 1000, .tv_nsec = ms % 1000 * 1000000};
+  while (nanosleep(&ts, &ts) == -1 && errno == EINTR)
+    ;
+}
+
+static const char* arg_value(int argc, char** argv, const char* key) {
+  size_t length = strlen(key);
+  for (int i = 1; i < argc; ++i) {
+    if (!strncmp(argv[i], key, length) && argv[i][length] == '=') {
+      return argv[i] + length + 1;
+    }
+  }
+  return NULL;
+}
+
+// Reads the pipe until pamnc closes it, and leaves a line with the counts
+// next to the capture file, named after the pipe, which pamnc names after the
+// stream and itself.
+static void sink(int fd, const char* name) {
+  static int16_t buffer[32768];
+  unsigned long samples = 0, silent = 0, mismatched = 0;
+  uint64_t first = 0, last = 0, first_audio = 0, last_audio = 0, resume = 0;
+  uint16_t expected = 0;
+  int synced = 0;
+  int resync = getenv("LOOPBACK_RESYNC") != NULL;
+  for (ssize_t length; (length = read(fd, buffer, sizeof(buffer))) != 0;) {
+    if (length == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      perror("Failed to read pipe");
+      break;
+    }
+    last = now_ns();
+    if (!first) {
+      first = last;
+    }
+    for (int i = 0; i < (int)(length / sizeof(*buffer)); ++i) {
+      uint16_t value = buffer[i];
+      samples++;
+      if (!value) {
+        silent++;
+        expected = pattern_next(expected);
+        continue;
+      }
+      if (!first_audio) {
+        first_audio = last;
+      } else if (last - last_audio >= RESUME_GAP * 1000000ull) {
+        resume = last;
+        synced = synced && !resync;
+      }
+      last_audio = last;
+      mismatched += synced && value != expected;
+      synced = 1;
+      expected = pattern_next(value);
+    }
+  }
+  char path[PATH_MAX * 2];
+  snprintf(path, sizeof(path), "%s/%s.result", getenv("LOOPBACK_DIR"), name);
+  FILE* result = fopen(path, "w");
+  if (!result) {
+    perror("Failed to write result");
+    return;
+  }
+  fprintf(result, "%lu %lu %lu %.6f %llu %llu\n", samples, silent,
+          mismatched, (last - first) / 1e9, (unsigned long long)first_audio,
+          (unsigned long long)resume);
+  fclose(result);
+}
+
+// Takes load-module with the arguments of module-pipe-source, makes the fifo
+// and leaves a sink reading it, with its pid for the module index. Unloading
+// is up to the sink, which stops when the pipe closes.
+static int pactl(int argc, char** argv) {
+  if (argc < 2 || strcmp(argv[1], "load-module")) {
+    return EXIT_SUCCESS;
+  }
+  const char* file = arg_value(argc, argv, "file");
+  const char* format = arg_value(argc, argv, "format");
+  if (!file || !format || strcmp(format, "s16le")) {
+    fprintf(stderr, "Only s16le pipes can be checked\n");
+    return EXIT_FAILURE;
+  }
+  char name[PATH_MAX];
+  const char* base = strrchr(file, '/');
+  snprintf(name, sizeof(name), "%s", base ? base + 1 : file);
+  char* suffix = strstr(name, ".pipe");
+  if (suffix) {
+    *suffix = 0;
+  }
+  if (mkfifo(file, 0600) == -1) {
+    perror("Failed to make fifo");
+    return EXIT_FAILURE;
+  }
+  fflush(stdout);
+  pid_t pid = fork();
+  switch (pid) {
+    case -1:
+      perror("Failed to fork");
+      return EXIT_FAILURE;
+    case 0: {
+      int null = open("/dev/null", O_WRONLY);
+      dup2(null, STDOUT_FILENO);
+      close(null);
+      int fd = open(file, O_RDONLY);
+      if (fd == -1) {
+        perror("Failed to open fifo");
+        _exit(EXIT_FAILURE);
+      }
+      sink(fd, name);
+      _exit(EXIT_SUCCESS);
+    }
+    default:
+      printf("%d\n", pid);
+      return EXIT_SUCCESS;
+  }
+}
+
+static pid_t spawn(char** argv, const char* log) {
+  pid_t pid = fork();
+  if (pid) {
+    if (pid == -1) {
+      perror("Failed to fork");
+    }
+    return pid;
+  }
+  int fd = open(log, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd != -1) {
+    dup2(fd, STDOUT_FILENO);
+    dup2(fd, STDERR_FILENO);
+    close(fd);
+  }
+  execv(argv[0], argv);
+  perror("Failed to exec");
+  _exit(EXIT_FAILURE);
+}
+
+// Returns seconds of CPU the process took, and what fraction of the time
+// since start that was.
+static double reap(pid_t pid, uint64_t start) {
+  struct rusage usage;
+  int status;
+  while (wait4(pid, &status, 0, &usage) == -1) {
+    if (errno != EINTR) {
+      perror("Failed to wait");
+      return 0;
+    }
+  }
+  double cpu = usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6 +
+               usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+  return cpu / ((now_ns() - start) / 1e9);
+}
+
+static void read_latency(const char* path, struct run_result* result,
+                         int streams) {
+  FILE* log = fopen(path, "r");
+  if (!log) {
+    return;
+  }
+  // Only the last report of every stream counts, and so does the last one of
+  // the receiver.
+  double latest[MAX_STREAMS][6];
+  int seen[MAX_STREAMS] = {0};
+  double wakeup[4];
+  int woke = 0;
+  char line[2048];
+  while (fgets(line, sizeof(line), log)) {
+    int port;
+    double v[6];
+    if (sscanf(line,
+               "timer wakeup latency p50 %lf ms, p99 %lf ms, p99.9 %lf ms, "
+               "max %lf ms",
+               &v[0], &v[1], &v[2], &v[3]) == 4) {
+      memcpy(wakeup, v, sizeof(wakeup));
+      woke = 1;
+      continue;
+    }
+    char* loop = strstr(line, "loop wakeup p50 <");
+    if (loop && sscanf(loop, "loop wakeup p50 < %lf ms, p99 < %lf ms", &v[0],
+                       &v[1]) == 2) {
+      result->sender_wakeup_p99 = fmax(result->sender_wakeup_p99, v[1]);
+    }
+    char* colon = strstr(line, ": latency");
+    if (!colon) {
+      continue;
+    }
+    *colon = 0;
+    char* underscore = strrchr(line, '_');
+    if (underscore && sscanf(underscore, "_%d", &port) == 1 &&
+        sscanf(colon + 1,
+               " latency p50 %lf ms, p99 %lf ms, max %lf ms, jitter p50 %lf "
+               "ms, p99 %lf ms, max %lf ms",
+               &v[0], &v[1], &v[2], &v[3], &v[4], &v[5]) == 6 &&
+        port >= LOOPBACK_PORT && port < LOOPBACK_PORT + streams) {
+      memcpy(latest[port - LOOPBACK_PORT], v, sizeof(v));
+      seen[port - LOOPBACK_PORT] = 1;
+    }
+  }
+  fclose(log);
+  if (woke) {
+    result->wakeup_count++;
+    result->wakeup_p50 += wakeup[0];
+    result->wakeup_p99 = fmax(result->wakeup_p99, wakeup[1]);
+    result->wakeup_p999 = fmax(result->wakeup_p999, wakeup[2]);
+    result->wakeup_max = fmax(result->wakeup_max, wakeup[3]);
+  }
+  for (int i = 0; i < streams; ++i) {
+    if (!seen[i]) {
+      continue;
+    }
+    const double* v = latest[i];
+    result->latency_count++;
+    result->latency_p50 += v[0];
+    result->jitter_p50 += v[3];
+    result->latency_p99 = fmax(result->latency_p99, v[1]);
+    result->latency_max = fmax(result->latency_max, v[2]);
+    result->jitter_p99 = fmax(result->jitter_p99, v[4]);
+    result->jitter_max = fmax(result->jitter_max, v[5]);
+  }
+}
+
+// Streams are named after whatever address the senders send from, which is
+// not loopback for multicast, so only the port tells them apart.
+static void read_sinks(const char* dir, struct run_result* result,
+                       int streams, pid_t receiver, uint64_t start,
+                       uint64_t back) {
+  for (int i = 0; i < streams; ++i) {
+    char pattern[PATH_MAX + 64];
+    snprintf(pattern, sizeof(pattern), "%s/pamnc_*_%d.%d.result", dir,
+             LOOPBACK_PORT + i, (int)receiver);
+    glob_t paths;
+    if (glob(pattern, 0, NULL, &paths)) {
+      continue;
+    }
+    const char* path = paths.gl_pathv[0];
+    FILE* file = fopen(path, "r");
+    if (!file) {
+      globfree(&paths);
+      continue;
+    }
+    unsigned long samples, silent, mismatched;
+    unsigned long long first_audio, resume;
+    double seconds;
+    if (fscanf(file, "%lu %lu %lu %lf %llu %llu", &samples, &silent,
+               &mismatched, &seconds, &first_audio, &resume) == 6) {
+      result->samples += samples;
+      result->silent += silent;
+      result->mismatched += mismatched;
+      result->active_seconds += seconds;
+      result->reported++;
+      if (first_audio > start) {
+        double ms = (first_audio - start) / 1e6;
+        result->first_audio_count++;
+        result->first_audio += ms;
+        result->first_audio_max = fmax(result->first_audio_max, ms);
+      }
+      if (back && resume > back) {
+        double ms = (resume - back) / 1e6;
+        result->resumed++;
+        result->resume += ms;
+        result->resume_max = fmax(result->resume_max, ms);
+      }
+    }
+    fclose(file);
+    unlink(path);
+    globfree(&paths);
+  }
+}
+
+// Keeps a core busy at default priority, the way other apps would.
+static pid_t spawn_load(void) {
+  pid_t pid = fork();
+  if (pid == -1) {
+    perror("Failed to fork");
+  } else if (!pid) {
+    for (;;)
+      ;
+  }
+  return pid;
+}
+
+// Takes senders away and brings them back, and returns when they were back.
+// Senders that are started anew count the CPU of the ones before them too.
+static uint64_t outage(const char* dir, pid_t* senders,
+                       char* (*sender_argv)[16], uint64_t* sender_start,
+                       int count, const struct run_options* options,
+                       struct run_result* result) {
+  for (int i = 0; i < count; ++i) {
+    if (options->outage == OUTAGE_PAUSE) {
+      kill(senders[i], SIGUSR1);
+    } else {
+      kill(senders[i], SIGINT);
+      result->sender_cpu += reap(senders[i], sender_start[i]);
+      senders[i] = -1;
+    }
+  }
+  sleep_ms(options->outage_ms);
+  uint64_t back = now_ns();
+  for (int i = 0; i < count; ++i) {
+    if (options->outage == OUTAGE_PAUSE) {
+      kill(senders[i], SIGUSR1);
+      continue;
+    }
+    char log[PATH_MAX + 16];
+    snprintf(log, sizeof(log), "%s/sender%d.restart.log", dir, i);
+    sender_start[i] = now_ns();
+    senders[i] = spawn(sender_argv[i], log);
+  }
+  return back;
+}
+
+// Senders send to the group when there is one, and receivers join it. Either
+// way receivers ping every sender, which keeps them sending.
+static int run(const char* bin, const char* dir, int frames, int streams,
+               int receivers, const struct run_options* options,
+               struct run_result* result) {
+  memset(result, 0, sizeof(*result));
+  const char* group = options->group;
+  int priority = options->priority;
+  char capture[PATH_MAX], pamnc[PATH_MAX + 16], host[PATH_MAX + 16];
+  char log[PATH_MAX + 16];
+  snprintf(capture, sizeof(capture), "%s/capture.raw", dir);
+  snprintf(pamnc, sizeof(pamnc), "%s/pamnc", bin);
+  snprintf(host, sizeof(host), "%s/andrecord-host", bin);
+  char frames_arg[16], streams_arg[16], multicast[64], group_arg[64];
+  snprintf(frames_arg, sizeof(frames_arg), "%d", frames);
+  snprintf(streams_arg, sizeof(streams_arg), "%d", streams);
+  snprintf(multicast, sizeof(multicast), "multicast=%s", group ? group : "");
+  snprintf(group_arg, sizeof(group_arg), "%s:%d", group ? group : "",
+           LOOPBACK_GROUP_PORT);
+  pid_t senders[MAX_STREAMS];
+  uint64_t sender_start[MAX_STREAMS];
+  char ports[MAX_STREAMS][32], peers[MAX_STREAMS][32];
+  char group_port[32];
+  snprintf(group_port, sizeof(group_port), "multicast_port=%d",
+           LOOPBACK_GROUP_PORT);
+  char priority_arg[16], realtime[32];
+  snprintf(priority_arg, sizeof(priority_arg), "%d", priority);
+  snprintf(realtime, sizeof(realtime), "realtime=%d", priority);
+  char* receiver_argv[2 * MAX_STREAMS + 9] = {pamnc, "-n", streams_arg,
+                                               "-z"};
+  int argc = 4;
+  if (group) {
+    receiver_argv[argc++] = "-g";
+    receiver_argv[argc++] = group_arg;
+  }
+  if (priority) {
+    receiver_argv[argc++] = "-R";
+    receiver_argv[argc++] = priority_arg;
+  }
+  pid_t loaders[MAX_LOAD];
+  int loading = 0;
+  for (; loading < options->load; ++loading) {
+    if ((loaders[loading] = spawn_load()) == -1) {
+      break;
+    }
+  }
+  char* sender_argv[MAX_STREAMS][16];
+  int count = 0;
+  for (; count < streams; ++count) {
+    int port = LOOPBACK_PORT + count;
+    snprintf(ports[count], sizeof(ports[count]), "port=%d", port);
+    snprintf(peers[count], sizeof(peers[count]), "127.0.0.1:%d", port);
+    receiver_argv[argc++] = "-p";
+    receiver_argv[argc++] = peers[count];
+    char** argv = sender_argv[count];
+    argv[0] = host;
+    argv[1] = "-n";
+    argv[2] = frames_arg;
+    argv[3] = "-o";
+    argv[4] = ports[count];
+    int sender_argc = 5;
+    if (group) {
+      argv[sender_argc++] = "-o";
+      argv[sender_argc++] = multicast;
+      argv[sender_argc++] = "-o";
+      argv[sender_argc++] = group_port;
+    }
+    if (priority) {
+      argv[sender_argc++] = "-o";
+      argv[sender_argc++] = realtime;
+    }
+    argv[sender_argc++] = capture;
+    argv[sender_argc] = NULL;
+    snprintf(log, sizeof(log), "%s/sender%d.log", dir, count);
+    sender_start[count] = now_ns();
+    if ((senders[count] = spawn(argv, log)) == -1) {
+      break;
+    }
+  }
+  int ok = loading == options->load && count == streams;
+  pid_t receiver_pids[MAX_RECEIVERS];
+  uint64_t receiver_start[MAX_RECEIVERS];
+  int started = 0;
+  if (ok) {
+    sleep_ms(SETTLE_TIME);
+    for (; started < receivers; ++started) {
+      snprintf(log, sizeof(log), "%s/pamnc%d.log", dir, started);
+      receiver_start[started] = now_ns();
+      if ((receiver_pids[started] = spawn(receiver_argv, log)) == -1) {
+        break;
+      }
+    }
+    ok = started == receivers;
+  }
+  uint64_t back = 0;
+  if (ok && options->outage != OUTAGE_NONE) {
+    sleep_ms(options->duration * 500);
+    back = outage(dir, senders, sender_argv, sender_start, count, options,
+                  result);
+    sleep_ms(options->duration * 500);
+  } else if (ok) {
+    sleep_ms(options->duration * 1000);
+  }
+  if (ok) {
+    for (int i = 0; i < started; ++i) {
+      kill(receiver_pids[i], SIGUSR1);
+    }
+    sleep_ms(SETTLE_TIME);
+  }
+  for (int i = 0; i < count; ++i) {
+    if (senders[i] != -1) {
+      kill(senders[i], SIGINT);
+      result->sender_cpu += reap(senders[i], sender_start[i]);
+    }
+  }
+  result->sender_cpu /= streams;
+  for (int i = 0; i < started; ++i) {
+    kill(receiver_pids[i], SIGINT);
+    result->receiver_cpu +=
+        reap(receiver_pids[i], receiver_start[i]) / streams / receivers;
+  }
+  for (int i = 0; i < loading; ++i) {
+    kill(loaders[i], SIGKILL);
+  }
+  // Sinks are orphans of pactl, and this process reaps them, along with the
+  // load.
+  while (wait(NULL) != -1 || errno == EINTR)
+    ;
+  for (int i = 0; i < started; ++i) {
+    read_sinks(dir, result, streams, receiver_pids[i], receiver_start[i],
+               back);
+    snprintf(log, sizeof(log), "%s/pamnc%d.log", dir, i);
+    read_latency(log, result, streams);
+  }
+  if (result->latency_count) {
+    result->latency_p50 /= result->latency_count;
+    result->jitter_p50 /= result->latency_count;
+  }
+  if (result->wakeup_count) {
+    result->wakeup_p50 /= result->wakeup_count;
+  }
+  if (result->first_audio_count) {
+    result->first_audio /= result->first_audio_count;
+  }
+  if (result->resumed) {
+    result->resume /= result->resumed;
+  }
+  return ok;
+}
+
+static int parse_list(const char* arg, int* values, int max) {
+  int count = 0;
+  for (char* end; *arg && count < max; arg = *end ? end + 1 : end) {
+    values[count] = (int)strtol(arg, &end, 10);
+    if (end == arg || values[count] <= 0 || (*end && *end != ',')) {
+      return 0;
+    }
+    count++;
+  }
+  return *arg ? 0 : count;
+}
+
+static int write_pattern(const char* dir) {
+  char path[PATH_MAX];
+  snprintf(path, sizeof(path), "%s/capture.raw", dir);
+  FILE* file = fopen(path, "wb");
+  if (!file) {
+    perror("Failed to create capture file");
+    return 0;
+  }
+  uint16_t value = 1;
+  for (int i = 0; i < PATTERN_LENGTH; ++i) {
+    fwrite(&value, sizeof(value), 1, file);
+    value = pattern_next(value);
+  }
+  return fclose(file) == 0;
+}
+
+int main(int argc, char** argv) {
+  const char* self = strrchr(argv[0], '/');
+  if (!strcmp(self ? self + 1 : argv[0], "pactl")) {
+    return pactl(argc, argv);
+  }
+  int frames[MAX_RUNS] = {120, 480, 960};
+  int streams[MAX_RUNS] = {1, 4, 16};
+  int receivers[MAX_RUNS] = {1};
+  int frames_count = 3, streams_count = 3, receivers_count = 1;
+  const char* bin = ".";
+  struct run_options options = {.duration = DURATION};
+  for (int opt; (opt = getopt(argc, argv, "t:n:c:r:g:R:l:u:k:b:")) != -1;) {
+    switch (opt) {
+      case 't':
+        options.duration = atoi(optarg);
+        break;
+      case 'n':
+        frames_count = parse_list(optarg, frames, MAX_RUNS);
+        break;
+      case 'c':
+        streams_count = parse_list(optarg, streams, MAX_RUNS);
+        for (int i = 0; i < streams_count; ++i) {
+          if (streams[i] > MAX_STREAMS) {
+            streams_count = 0;
+          }
+        }
+        break;
+      case 'r':
+        receivers_count = parse_list(optarg, receivers, MAX_RUNS);
+        for (int i = 0; i < receivers_count; ++i) {
+          if (receivers[i] > MAX_RECEIVERS) {
+            receivers_count = 0;
+          }
+        }
+        break;
+      case 'g':
+        options.group = optarg;
+        break;
+      case 'R':
+        options.priority = atoi(optarg);
+        if (options.priority <= 0) {
+          options.duration = 0;
+        }
+        break;
+      case 'l':
+        options.load = atoi(optarg);
+        if (options.load < 0 || options.load > MAX_LOAD) {
+          options.duration = 0;
+        }
+        break;
+      case 'u':
+      case 'k':
+        options.outage = opt == 'u' ? OUTAGE_PAUSE : OUTAGE_RESTART;
+        options.outage_ms = atoi(optarg);
+        if (options.outage_ms <= 0) {
+          options.duration = 0;
+        }
+        break;
+      case 'b':
+        bin = optarg;
+        break;
+      default:
+        options.duration = 0;
+        break;
+    }
+  }
+  if (optind != argc || options.duration <= 0 || !frames_count ||
+      !streams_count || !receivers_count) {
+    fprintf(stderr,
+            "Usage: %s [-t seconds] [-n frames_per_buffer,...] "
+            "[-c streams,...] [-r receivers,...] [-g multicast_group] "
+            "[-R priority] [-l load_processes] [-u pause_ms|-k restart_ms] "
+            "[-b binary_dir]\n",
+            argv[0]);
+    return EXIT_FAILURE;
+  }
+  char bin_path[PATH_MAX], self_path[PATH_MAX], dir[] = "/tmp/loopback.XXXXXX";
+  if (!realpath(bin, bin_path) || !realpath("/proc/self/exe", self_path) ||
+      !mkdtemp(dir)) {
+    perror("Failed to set up");
+    return EXIT_FAILURE;
+  }
+  char pactl_path[PATH_MAX], path[PATH_MAX * 2];
+  snprintf(pactl_path, sizeof(pactl_path), "%s/pactl", dir);
+  snprintf(path, sizeof(path), "%s:%s", dir, getenv("PATH"));
+  if (symlink(self_path, pactl_path) == -1 || !write_pattern(dir) ||
+      setenv("PATH", path, 1) == -1 || setenv("LOOPBACK_DIR", dir, 1) == -1 ||
+      (options.outage && setenv("LOOPBACK_RESYNC", "1", 1) == -1) ||
+      prctl(PR_SET_CHILD_SUBREAPER, 1) == -1) {
+    perror("Failed to set up");
+    return EXIT_FAILURE;
+  }
+  signal(SIGPIPE, SIG_IGN);
+  fprintf(stderr, "Logs are in %s\n", dir);
+  int result = EXIT_SUCCESS;
+  for (int i = 0; i < frames_count * streams_count * receivers_count; ++i) {
+    int f = frames[i / (streams_count * receivers_count)];
+    int c = streams[i / receivers_count % streams_count];
+    int n = receivers[i % receivers_count];
+    struct run_result r;
+    int ok = run(bin_path, dir, f, c, n, &options, &r);
+    double rate = r.active_seconds ? r.samples / r.active_seconds : 0;
+    int exact = ok && r.reported == c * n && r.samples && !r.mismatched &&
+                (!options.outage || r.resumed == c * n);
+    static const char* const outages[] = {"none", "pause", "restart"};
+    printf(
+        "{\"frames\":%d,\"streams\":%d,\"receivers\":%d,"
+        "\"multicast\":%s,\"seconds\":%d,\"samples\":%lu,"
+        "\"silent_samples\":%lu,\"mismatched_samples\":%lu,"
+        "\"throughput_samples_per_second\":%.0f,"
+        "\"throughput_mbps\":%.3f,\"latency_p50_ms\":%.3f,"
+        "\"latency_p99_ms\":%.3f,\"latency_max_ms\":%.3f,"
+        "\"jitter_p50_ms\":%.3f,\"jitter_p99_ms\":%.3f,"
+        "\"jitter_max_ms\":%.3f,\"realtime_priority\":%d,\"load\":%d,"
+        "\"wakeup_p50_ms\":%.3f,\"wakeup_p99_ms\":%.3f,"
+        "\"wakeup_p999_ms\":%.3f,\"wakeup_max_ms\":%.3f,"
+        "\"sender_wakeup_p99_ms\":%.3f,\"first_audio_ms\":%.3f,"
+        "\"first_audio_max_ms\":%.3f,\"outage\":\"%s\",\"outage_ms\":%d,"
+        "\"resumed\":%d,\"resume_ms\":%.3f,\"resume_max_ms\":%.3f,"
+        "\"receiver_cpu_percent\":%.3f,\"sender_cpu_percent\":%.3f,"
+        "\"bit_exact\":%s}\n",
+        f, c, n, options.group ? "true" : "false", options.duration,
+        r.samples, r.silent, r.mismatched, rate * c * n,
+        rate * c * n * 16 / 1e6, r.latency_p50, r.latency_p99, r.latency_max,
+        r.jitter_p50, r.jitter_p99, r.jitter_max, options.priority,
+        options.load, r.wakeup_p50, r.wakeup_p99, r.wakeup_p999,
+        r.wakeup_max, r.sender_wakeup_p99, r.first_audio, r.first_audio_max,
+        outages[options.outage], options.outage_ms, r.resumed, r.resume,
+        r.resume_max, r.receiver_cpu * 100, r.sender_cpu * 100,
+        exact ? "true" : "false");
+    fflush(stdout);
+    fprintf(stderr,
+            "%4d frames x %2d streams x %2d %s receivers: %lu samples, %lu "
+            "silent, %lu mismatched, latency p50 %.1f ms p99 %.1f ms, jitter "
+            "p99 %.2f ms, wakeup p99 %.3f ms max %.3f ms, first audio %.1f "
+            "ms max %.1f ms, ",
+            f, c, n, options.group ? "multicast" : "unicast", r.samples,
+            r.silent, r.mismatched, r.latency_p50, r.latency_p99,
+            r.jitter_p99, r.wakeup_p99, r.wakeup_max, r.first_audio,
+            r.first_audio_max);
+    if (options.outage) {
+      fprintf(stderr, "%d of %d resumed after %s, in %.1f ms max %.1f ms, ",
+              r.resumed, c * n, outages[options.outage], r.resume,
+              r.resume_max);
+    }
+    fprintf(stderr, "cpu per stream %.2f%% receiver %.2f%% sender, %s\n",
+            r.receiver_cpu * 100, r.sender_cpu * 100,
+            exact ? "bit-exact" : "NOT bit-exact");
+    if (!exact) {
+      result = EXIT_FAILURE;
+    }
+  }
+  return result;
+}
@@ -0,0 +1,77 @@
+#include "metrics.h"
+#include "packet.h"
+
+_Static_assert(METRICS_BUCKETS == PACKET_STATS_BUCKETS &&
+                   METRICS_QUEUES == PACKET_STATS_QUEUES &&
+                   METRICS_DEPTHS == PACKET_STATS_DEPTHS &&
+                   METRICS_BUFFERS == PACKET_STATS_BUFFERS,
+               "Metrics layout mismatch");
+
+static void InitCounters(atomic_uint* counters, int count) {
+  for (int i = 0; i < count; ++i) {
+    atomic_init(&counters[i], 0);
+  }
+}
+
+static void LoadCounters(const atomic_uint* counters, int count,
+                         uint32_t* output) {
+  for (int i = 0; i < count; ++i) {
+    output[i] = atomic_load_explicit((atomic_uint*)&counters[i],
+                                     memory_order_relaxed);
+  }
+}
+
+void InitMetrics(struct CallbackMetrics* callback, struct LoopMetrics* loop,
+                 uint64_t period) {
+  atomic_init(&callback->callbacks, 0);
+  atomic_init(&callback->overruns, 0);
+  atomic_init(&callback->stalls, 0);
+  atomic_init(&callback->enqueue_failures, 0);
+  InitCounters(callback->interval, METRICS_BUCKETS);
+  atomic_init(&callback->depth, 0);
+  atomic_init(&callback->depth_increases, 0);
+  atomic_init(&callback->depth_decreases, 0);
+  InitCounters(callback->depth_history, METRICS_BUFFERS);
+  callback->period = period;
+  callback->last_time = 0;
+  atomic_init(&loop->buffers, 0);
+  atomic_init(&loop->send_errors, 0);
+  InitCounters(loop->send_latency, METRICS_BUCKETS);
+  InitCounters(loop->wakeup_latency, METRICS_BUCKETS);
+  InitCounters(&loop->queue_depth[0][0],
+               METRICS_QUEUES * METRICS_DEPTHS);
+}
+
+void MetricsRecord(atomic_uint* histogram, uint64_t nanoseconds) {
+  uint64_t microseconds = nanoseconds / 1000;
+  int bucket = microseconds ? 64 - __builtin_clzll(microseconds) : 0;
+  MetricsCount(&histogram[bucket < METRICS_BUCKETS
+                              ? bucket
+                              : METRICS_BUCKETS - 1]);
+}
+
+// Counters of the other thread may be a few updates behind, but each one is
+// read whole.
+void MetricsReport(const struct CallbackMetrics* callback,
+                   const struct LoopMetrics* loop, struct StatsReport* report) {
+  LoadCounters(&callback->callbacks, 1, &report->callbacks);
+  LoadCounters(&callback->overruns, 1, &report->overruns);
+  LoadCounters(&callback->stalls, 1, &report->stalls);
+  LoadCounters(&callback->enqueue_failures, 1, &report->enqueue_failures);
+  LoadCounters(&loop->buffers, 1, &report->buffers);
+  LoadCounters(&loop->send_errors, 1, &report->send_errors);
+  LoadCounters(callback->interval, METRICS_BUCKETS,
+               report->callback_interval);
+  LoadCounters(&callback->depth, 1, &report->buffer_depth);
+  LoadCounters(&callback->depth_increases, 1, &report->depth_increases);
+  LoadCounters(&callback->depth_decreases, 1, &report->depth_decreases);
+  LoadCounters(callback->depth_history, METRICS_BUFFERS,
+               report->depth_history);
+  LoadCounters(loop->send_latency, METRICS_BUCKETS,
+               report->send_latency);
+  LoadCounters(loop->wakeup_latency, METRICS_BUCKETS,
+               report->wakeup_latency);
+  LoadCounters(&loop->queue_depth[0][0],
+               METRICS_QUEUES * METRICS_DEPTHS,
+               &report->queue_depth[0][0]);
+}
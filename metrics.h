@@ -0,0 +1,58 @@
+#include <stdatomic.h>
+#include <stdint.h>
+
+#define METRICS_BUCKETS 24
+#define METRICS_QUEUES 3
+#define METRICS_DEPTHS 8
+#define METRICS_BUFFERS 16
+
+struct StatsReport;
+
+// Runtime metrics of the sender. Callback and sender loop run on threads of
+// their own, and each one only ever writes its own part, so that updates
+// take no more than relaxed loads and stores, and neither thread is ever held
+// up by a reader. Histograms and queue depths are laid out as in
+// StatsReport.
+struct CallbackMetrics {
+  atomic_uint callbacks;
+  // Callbacks that came in more than half a buffer late.
+  atomic_uint overruns;
+  // Callbacks that had to wait for the sender loop to return a buffer.
+  atomic_uint stalls;
+  atomic_uint enqueue_failures;
+  atomic_uint interval[METRICS_BUCKETS];
+  // Capture buffers that go around, how many times that changed either way,
+  // and callbacks at every depth from one on.
+  atomic_uint depth;
+  atomic_uint depth_increases;
+  atomic_uint depth_decreases;
+  atomic_uint depth_history[METRICS_BUFFERS];
+  // Nominal and last time between callbacks, only ever touched by the
+  // callback once capture starts.
+  uint64_t period;
+  uint64_t last_time;
+};
+
+struct LoopMetrics {
+  atomic_uint buffers;
+  atomic_uint send_errors;
+  // Time from the end of capture of the oldest buffer in a datagram to the
+  // datagram going out.
+  atomic_uint send_latency[METRICS_BUCKETS];
+  // Time from a buffer being filled to the sender loop waking up to it.
+  atomic_uint wakeup_latency[METRICS_BUCKETS];
+  atomic_uint queue_depth[METRICS_QUEUES][METRICS_DEPTHS];
+};
+
+void InitMetrics(struct CallbackMetrics* callback, struct LoopMetrics* loop,
+                 uint64_t period);
+void MetricsRecord(atomic_uint* histogram, uint64_t nanoseconds);
+void MetricsReport(const struct CallbackMetrics* callback,
+                   const struct LoopMetrics* loop, struct StatsReport* report);
+
+// Only the thread that owns the counter may call this.
+static inline void MetricsCount(atomic_uint* counter) {
+  atomic_store_explicit(
+      counter, atomic_load_explicit(counter, memory_order_relaxed) + 1,
+      memory_order_relaxed);
+}
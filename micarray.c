@@ -0,0 +1,501 @@
+#include "fft.h"
+#include "micarray.h"
+#include "simd.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Alpha-beta gains of the offset filter per block, which settle in about a
+// second and follow drift without lagging behind it. Offsets that are off by
+// more than RESYNC_LIMIT milliseconds are taken as they are.
+#define OFFSET_ALPHA 0.02
+#define OFFSET_BETA 0.0002
+#define RESYNC_LIMIT 20
+// Weight of every new frame in the averaged cross spectrum, the share of
+// what is left over of a lag taken in, and of drift per sample, and how high
+// the normalized correlation has to peak to be taken at all. Frames with less
+// energy per sample than MIN_ENERGY are left out.
+#define CROSS_WEIGHT 0.25f
+#define LAG_WEIGHT 0.5
+#define DRIFT_WEIGHT 0.05
+#define MIN_PEAK 0.08f
+#define MIN_ENERGY 1e-8f
+
+int array_init(struct mic_array* array, int channels) {
+  memset(array, 0, sizeof(*array));
+  array->channels = channels;
+  array->beam = !channels;
+  array->correlate = 1;
+  array->reference = -1;
+  if (!fft_init(&array->fft, ARRAY_FRAME)) {
+    return 0;
+  }
+  int bins = ARRAY_FRAME / 2 + 1;
+  int max_block = ARRAY_MAX_RATE * ARRAY_BLOCK / 1000;
+  array->window = malloc(ARRAY_FRAME * sizeof(float));
+  array->windowed = malloc(ARRAY_FRAME * sizeof(float));
+  array->correlation = malloc(ARRAY_FRAME * sizeof(float));
+  array->span = malloc((max_block + 3) * sizeof(float));
+  array->mixed = malloc(max_block * sizeof(float));
+  int failed = !array->window || !array->windowed || !array->correlation ||
+               !array->span || !array->mixed;
+  for (int i = 0; i < ARRAY_MAX_INPUTS && !failed; ++i) {
+    struct array_input* input = &array->inputs[i];
+    input->ring = calloc(ARRAY_HISTORY, sizeof(float));
+    input->frame = calloc(ARRAY_FRAME, sizeof(float));
+    input->spectrum_re = malloc(bins * sizeof(float));
+    input->spectrum_im = malloc(bins * sizeof(float));
+    input->cross_re = calloc(bins, sizeof(float));
+    input->cross_im = calloc(bins, sizeof(float));
+    failed = !input->ring || !input->frame || !input->spectrum_re ||
+             !input->spectrum_im || !input->cross_re || !input->cross_im;
+  }
+  if (failed) {
+    array_free(array);
+    return 0;
+  }
+  for (int i = 0; i < ARRAY_FRAME; ++i) {
+    array->window[i] = (float)(0.5 - 0.5 * cos(2 * M_PI * i / ARRAY_FRAME));
+  }
+  return 1;
+}
+
+void array_free(struct mic_array* array) {
+  fft_free(&array->fft);
+  free(array->window);
+  free(array->windowed);
+  free(array->correlation);
+  free(array->span);
+  free(array->mixed);
+  for (int i = 0; i < ARRAY_MAX_INPUTS; ++i) {
+    struct array_input* input = &array->inputs[i];
+    free(input->ring);
+    free(input->frame);
+    free(input->spectrum_re);
+    free(input->spectrum_im);
+    free(input->cross_re);
+    free(input->cross_im);
+  }
+}
+
+static void unlock(struct array_input* input) {
+  int bins = ARRAY_FRAME / 2 + 1;
+  input->locked = 0;
+  input->relative = 0;
+  input->drift = 0;
+  input->placed = 0;
+  input->lag = 0;
+  input->peak = 0;
+  memset(input->cross_re, 0, bins * sizeof(float));
+  memset(input->cross_im, 0, bins * sizeof(float));
+}
+
+static void clear(struct array_input* input) {
+  input->started = 0;
+  input->synced = 0;
+  input->tracking = 0;
+  input->present = 0;
+  memset(input->ring, 0, ARRAY_HISTORY * sizeof(float));
+  memset(input->frame, 0, ARRAY_FRAME * sizeof(float));
+  unlock(input);
+}
+
+int array_join(struct mic_array* array, int sample_rate) {
+  if (sample_rate > ARRAY_MAX_RATE ||
+      (array->count && sample_rate != array->rate)) {
+    return -1;
+  }
+  for (int i = 0; i < ARRAY_MAX_INPUTS; ++i) {
+    struct array_input* input = &array->inputs[i];
+    if (input->joined) {
+      continue;
+    }
+    if (!array->count) {
+      array->rate = sample_rate;
+      array->block = sample_rate * ARRAY_BLOCK / 1000;
+      array->max_lag = sample_rate * ARRAY_MAX_LAG / 1000;
+      if (array->max_lag > ARRAY_FRAME / 2 - 1) {
+        array->max_lag = ARRAY_FRAME / 2 - 1;
+      }
+      array->started = 0;
+      array->hop_filled = 0;
+    }
+    clear(input);
+    input->joined = 1;
+    array->count++;
+    return i;
+  }
+  return -1;
+}
+
+void array_leave(struct mic_array* array, int input) {
+  array->inputs[input].joined = 0;
+  array->count--;
+}
+
+void array_write(struct mic_array* array, int index, uint32_t timestamp,
+                 uint64_t capture_time, const float* samples, int frames,
+                 int channels) {
+  struct array_input* input = &array->inputs[index];
+  int32_t gap = (int32_t)(timestamp - input->timestamp);
+  if (!input->started || gap < 0 || gap > ARRAY_HISTORY) {
+    // Sender started over, or was away for longer than is kept.
+    clear(input);
+    input->started = 1;
+    input->written = timestamp;
+    gap = 0;
+  }
+  float* ring = input->ring;
+  for (; gap; --gap) {
+    ring[input->written++ & (ARRAY_HISTORY - 1)] = 0;
+  }
+  if (capture_time) {
+    input->synced = 1;
+    input->anchor = input->written;
+    input->anchor_time = capture_time;
+    if (!array->started) {
+      array->started = 1;
+      array->position = 0;
+      array->start_time = capture_time;
+    }
+  }
+  float scale = 1.f / channels;
+  for (int i = 0; i < frames; ++i) {
+    float sum = 0;
+    if (samples) {
+      for (int c = 0; c < channels; ++c) {
+        sum += samples[i * channels + c];
+      }
+    }
+    ring[input->written++ & (ARRAY_HISTORY - 1)] = sum * scale;
+  }
+  input->timestamp = timestamp + frames;
+}
+
+static uint64_t block_time(const struct mic_array* array, int64_t position) {
+  return array->start_time +
+         (uint64_t)((double)position * 1e9 / array->rate);
+}
+
+uint64_t array_deadline(const struct mic_array* array, uint64_t delay) {
+  if (!array->started || !array->count) {
+    return UINT64_MAX;
+  }
+  return block_time(array, array->position + array->block) + delay;
+}
+
+int array_output_channels(const struct mic_array* array) {
+  return array->beam ? 1 : array->channels;
+}
+
+// Follows where the input sits on the timeline from where its last capture
+// time puts it, as an offset from the position of the block in samples.
+static void track(struct mic_array* array, struct array_input* input) {
+  int64_t since = (int64_t)(block_time(array, array->position) -
+                            input->anchor_time);
+  double measured = (double)(input->anchor - array->position) +
+                    (double)since * array->rate / 1e9;
+  if (input->tracking) {
+    input->offset += input->velocity * array->block;
+    double error = measured - input->offset;
+    if (fabs(error) <= (double)array->rate * RESYNC_LIMIT / 1000) {
+      input->offset += OFFSET_ALPHA * error;
+      input->velocity += OFFSET_BETA * error / array->block;
+      return;
+    }
+    array->resyncs++;
+  }
+  input->tracking = 1;
+  input->offset = measured;
+  input->velocity = 0;
+}
+
+// Tells whether the input has the block that starts at position, which
+// takes a sample more before it and two more after it to interpolate.
+static int available(const struct mic_array* array,
+                     const struct array_input* input, double position) {
+  int64_t first = (int64_t)floor(position) - 1;
+  return first >= input->written - ARRAY_HISTORY &&
+         first + array->block + 3 <= input->written;
+}
+
+// Locked inputs are placed against the reference, and the rest by capture
+// time.
+static double aligned(const struct mic_array* array,
+                      const struct array_input* input) {
+  if (!input->locked) {
+    return array->position + input->offset;
+  }
+  return array->position + array->inputs[array->reference].offset +
+         input->relative;
+}
+
+// Moves locked inputs along by the drift against the reference, and lets go
+// of the ones capture time puts further away than any lag could be, as
+// after their sender clock was set.
+static void follow(struct mic_array* array) {
+  const struct array_input* reference = &array->inputs[array->reference];
+  for (int i = 0; i < ARRAY_MAX_INPUTS; ++i) {
+    struct array_input* input = &array->inputs[i];
+    if (!input->locked) {
+      continue;
+    }
+    if (!input->tracking) {
+      unlock(input);
+      continue;
+    }
+    input->relative += input->drift * array->block;
+    input->lag = input->relative - (input->offset - reference->offset);
+    if (fabs(input->lag) > 2 * array->max_lag) {
+      unlock(input);
+      array->resyncs++;
+    }
+  }
+}
+
+// Adds the block of the input that starts at position, a fraction of a
+// sample in all likelihood, by cubic Lagrange interpolation.
+static void mix(const struct mic_array* array, const struct array_input* input,
+                double position, float gain, float* out) {
+  double floor_position = floor(position);
+  int64_t first = (int64_t)floor_position - 1;
+  int length = array->block + 3;
+  float t = (float)(position - floor_position);
+  float taps[4] = {-t * (t - 1) * (t - 2) / 6 * gain,
+                   (t + 1) * (t - 1) * (t - 2) / 2 * gain,
+                   -(t + 1) * t * (t - 2) / 2 * gain,
+                   (t + 1) * t * (t - 1) / 6 * gain};
+  int start = (int)(first & (ARRAY_HISTORY - 1));
+  int head = ARRAY_HISTORY - start < length ? ARRAY_HISTORY - start : length;
+  float* span = array->span;
+  memcpy(span, input->ring + start, head * sizeof(float));
+  memcpy(span + head, input->ring, (length - head) * sizeof(float));
+  MixTaps(out, span, taps, array->block);
+}
+
+static float energy(const float* samples, int count) {
+  return DotProduct(samples, samples, count) / count;
+}
+
+static void transform(struct mic_array* array, struct array_input* input) {
+  const float* window = array->window;
+  float* windowed = array->windowed;
+  for (int i = 0; i < ARRAY_FRAME; i += 4) {
+    *(v4sf_u*)(windowed + i) =
+        *(const v4sf_u*)(input->frame + i) * *(const v4sf_u*)(window + i);
+  }
+  fft_forward(&array->fft, windowed, input->spectrum_re, input->spectrum_im);
+}
+
+// Turns the averaged cross spectrum to what it would have been had frames
+// of the input been placed shift samples further on all along, so that
+// frames from before and after the input moved average in line.
+static void rotate(struct array_input* input, double shift) {
+  if (shift == 0) {
+    return;
+  }
+  double angle = 2 * M_PI * shift / ARRAY_FRAME;
+  double step_re = cos(angle), step_im = sin(angle);
+  double turn_re = 1, turn_im = 0;
+  for (int k = 0; k <= ARRAY_FRAME / 2; ++k) {
+    float re = input->cross_re[k], im = input->cross_im[k];
+    input->cross_re[k] = (float)(re * turn_re - im * turn_im);
+    input->cross_im[k] = (float)(re * turn_im + im * turn_re);
+    double next = turn_re * step_re - turn_im * step_im;
+    turn_im = turn_re * step_im + turn_im * step_re;
+    turn_re = next;
+  }
+}
+
+// Averages in the cross spectrum of the frame against the one of the
+// reference, and whitens the average for GCC-PHAT, as every bin divided by
+// its magnitude. Bins past the last group of four are never more than the
+// Nyquist one, which carries nothing of use anyway.
+static void cross(struct array_input* input,
+                  const struct array_input* reference, float* white_re,
+                  float* white_im) {
+  int bins = ARRAY_FRAME / 2 + 1;
+  v4sf keep = {1 - CROSS_WEIGHT, 1 - CROSS_WEIGHT, 1 - CROSS_WEIGHT,
+               1 - CROSS_WEIGHT};
+  v4sf weight = {CROSS_WEIGHT, CROSS_WEIGHT, CROSS_WEIGHT, CROSS_WEIGHT};
+  int k = 0;
+  for (; k + 4 <= bins; k += 4) {
+    v4sf a_re = *(const v4sf_u*)(input->spectrum_re + k);
+    v4sf a_im = *(const v4sf_u*)(input->spectrum_im + k);
+    v4sf b_re = *(const v4sf_u*)(reference->spectrum_re + k);
+    v4sf b_im = *(const v4sf_u*)(reference->spectrum_im + k);
+    v4sf c_re = keep * *(v4sf_u*)(input->cross_re + k) +
+                weight * (a_re * b_re + a_im * b_im);
+    v4sf c_im = keep * *(v4sf_u*)(input->cross_im + k) +
+                weight * (a_im * b_re - a_re * b_im);
+    *(v4sf_u*)(input->cross_re + k) = c_re;
+    *(v4sf_u*)(input->cross_im + k) = c_im;
+    v4sf magnitude = c_re * c_re + c_im * c_im;
+    v4sf scale;
+    for (int j = 0; j < 4; ++j) {
+      scale[j] = magnitude[j] > 0 ? 1 / sqrtf(magnitude[j]) : 0;
+    }
+    *(v4sf_u*)(white_re + k) = c_re * scale;
+    *(v4sf_u*)(white_im + k) = c_im * scale;
+  }
+  for (; k < bins; ++k) {
+    input->cross_re[k] = 0;
+    input->cross_im[k] = 0;
+    white_re[k] = 0;
+    white_im[k] = 0;
+  }
+}
+
+// Finds the lag the whitened cross correlation peaks at, with the peak
+// between samples found from a parabola through the best one and its
+// neighbours, and moves the input by it. Lags past half the frame are
+// negative ones.
+static void find_lag(struct mic_array* array, struct array_input* input,
+                     const struct array_input* reference) {
+  const float* correlation = array->correlation;
+  int best = 0;
+  for (int lag = -array->max_lag; lag <= array->max_lag; ++lag) {
+    if (correlation[lag & (ARRAY_FRAME - 1)] >
+        correlation[best & (ARRAY_FRAME - 1)]) {
+      best = lag;
+    }
+  }
+  float peak = correlation[best & (ARRAY_FRAME - 1)];
+  input->peak = peak;
+  if (peak < MIN_PEAK) {
+    return;
+  }
+  float before = correlation[(best - 1) & (ARRAY_FRAME - 1)];
+  float after = correlation[(best + 1) & (ARRAY_FRAME - 1)];
+  float curve = before - 2 * peak + after;
+  double lag = best + (curve < 0 ? 0.5 * (before - after) / curve : 0);
+  if (!input->locked) {
+    input->locked = 1;
+    input->relative = input->placed + lag;
+    input->drift = input->velocity - reference->velocity;
+  } else {
+    input->relative += LAG_WEIGHT * lag;
+    input->drift += DRIFT_WEIGHT * lag / ARRAY_HOP;
+  }
+  input->lag = input->relative - (input->offset - reference->offset);
+}
+
+static void analyze(struct mic_array* array) {
+  array->analyses++;
+  struct array_input* reference = &array->inputs[array->reference];
+  if (energy(reference->frame, ARRAY_FRAME) < MIN_ENERGY) {
+    return;
+  }
+  transform(array, reference);
+  // Whitened spectrum goes where the windowed frame was, which is done with.
+  float* white_re = array->windowed;
+  float* white_im = array->windowed + ARRAY_FRAME / 2 + 1;
+  for (int i = 0; i < ARRAY_MAX_INPUTS; ++i) {
+    struct array_input* input = &array->inputs[i];
+    if (i == array->reference || !input->joined || !input->tracking ||
+        energy(input->frame, ARRAY_FRAME) < MIN_ENERGY) {
+      continue;
+    }
+    double placed = input->locked ? input->relative
+                                  : input->offset - reference->offset;
+    rotate(input, placed - input->placed);
+    input->placed = placed;
+    transform(array, input);
+    cross(input, reference, white_re, white_im);
+    fft_inverse(&array->fft, white_re, white_im, array->correlation);
+    find_lag(array, input, reference);
+  }
+}
+
+// Reference is the first input that is placed on the timeline, and lags are
+// measured again from scratch against every new one.
+static void pick_reference(struct mic_array* array) {
+  int reference = -1;
+  for (int i = 0; i < ARRAY_MAX_INPUTS && reference == -1; ++i) {
+    if (array->inputs[i].joined && array->inputs[i].tracking) {
+      reference = i;
+    }
+  }
+  if (reference == array->reference) {
+    return;
+  }
+  array->reference = reference;
+  for (int i = 0; i < ARRAY_MAX_INPUTS; ++i) {
+    unlock(&array->inputs[i]);
+  }
+}
+
+int array_render(struct mic_array* array, float* out) {
+  int block = array->block;
+  for (int i = 0; i < ARRAY_MAX_INPUTS; ++i) {
+    struct array_input* input = &array->inputs[i];
+    if (input->joined && input->synced) {
+      track(array, input);
+    } else {
+      input->tracking = 0;
+    }
+  }
+  pick_reference(array);
+  if (array->reference != -1) {
+    follow(array);
+  }
+  for (int i = 0; i < ARRAY_MAX_INPUTS; ++i) {
+    struct array_input* input = &array->inputs[i];
+    if (!array->correlate || !input->tracking) {
+      continue;
+    }
+    float* tail = input->frame + ARRAY_FRAME - block;
+    memmove(input->frame, input->frame + block,
+            (ARRAY_FRAME - block) * sizeof(float));
+    memset(tail, 0, block * sizeof(float));
+    double position = aligned(array, input);
+    if (available(array, input, position)) {
+      mix(array, input, position, 1, tail);
+    }
+  }
+  array->hop_filled += block;
+  if (array->hop_filled >= ARRAY_HOP && array->reference != -1 &&
+      array->correlate) {
+    array->hop_filled = 0;
+    analyze(array);
+  }
+  int channels = array_output_channels(array);
+  memset(out, 0, (size_t)block * channels * sizeof(float));
+  if (array->beam) {
+    // Inputs that are not aligned yet would only blur the beam.
+    int count = 0;
+    for (int i = 0; i < ARRAY_MAX_INPUTS; ++i) {
+      struct array_input* input = &array->inputs[i];
+      input->present = input->tracking &&
+                       (input->locked || i == array->reference ||
+                        !array->correlate) &&
+                       available(array, input, aligned(array, input));
+      count += input->present;
+    }
+    for (int i = 0; i < ARRAY_MAX_INPUTS; ++i) {
+      struct array_input* input = &array->inputs[i];
+      if (input->present) {
+        mix(array, input, aligned(array, input), 1.f / count, out);
+      }
+    }
+  } else {
+    for (int c = 0; c < channels && c < ARRAY_MAX_INPUTS; ++c) {
+      struct array_input* input = &array->inputs[c];
+      input->present = input->tracking &&
+                       available(array, input, aligned(array, input));
+      if (!input->present) {
+        continue;
+      }
+      float* mixed = array->mixed;
+      memset(mixed, 0, block * sizeof(float));
+      mix(array, input, aligned(array, input), 1, mixed);
+      for (int i = 0; i < block; ++i) {
+        out[i * channels + c] = mixed[i];
+      }
+    }
+  }
+  array->position += block;
+  array->blocks++;
+  return block;
+}
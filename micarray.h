@@ -0,0 +1,101 @@
+#include <stdint.h>
+
+// Inputs an array takes at most, samples every input keeps, and the frames
+// correlated and how far apart they start, in samples. Lags are looked for up
+// to ARRAY_MAX_LAG milliseconds either way, or half a frame at high rates,
+// and blocks are ARRAY_BLOCK milliseconds long.
+#define ARRAY_MAX_INPUTS 8
+#define ARRAY_HISTORY 65536
+#define ARRAY_FRAME 4096
+#define ARRAY_HOP 2048
+#define ARRAY_MAX_LAG 25
+#define ARRAY_BLOCK 10
+#define ARRAY_MAX_RATE 192000
+
+struct array_input {
+  int joined;
+  int started;
+  float* ring;
+  int64_t written;
+  uint32_t timestamp;
+  int synced;
+  int64_t anchor;
+  uint64_t anchor_time;
+  int tracking;
+  double offset;
+  double velocity;
+  int locked;
+  double relative;
+  double drift;
+  double placed;
+  double lag;
+  float peak;
+  int present;
+  float* frame;
+  float* spectrum_re;
+  float* spectrum_im;
+  float* cross_re;
+  float* cross_im;
+};
+
+// Puts streams of phones spread around a room together as if they were one
+// microphone array. Every input is written mono at its capture timestamps,
+// with the capture time of the first frame on the local clock once that is
+// known, and blocks are rendered on a timeline of capture time. Capture
+// times place every input on the timeline to within the clock sync error,
+// through an alpha-beta filter of the offset between the two, which also
+// tracks the drift of every sender clock. GCC-PHAT then finds where every
+// input sits against the first one, from the cross spectrum of frames of
+// both averaged over frames, which takes in the time sound takes from phone
+// to phone as well. Once found, that is where the input stays, as relative
+// to the reference, following the drift between the two and whatever
+// correlation finds left over, so that clock sync error no longer moves it.
+// Lag is how far that is from where capture time alone would put it. Blocks
+// are either a channel per input, in the order they joined, or a
+// delay-and-sum beam of every input aligned so far. Inputs take the rate of
+// the first one, and without correlate every input stays where capture time
+// puts it.
+struct mic_array {
+  int channels;
+  int beam;
+  int correlate;
+  int rate;
+  int block;
+  int max_lag;
+  int count;
+  struct array_input inputs[ARRAY_MAX_INPUTS];
+  int reference;
+  int started;
+  int64_t position;
+  uint64_t start_time;
+  int hop_filled;
+  struct fft fft;
+  float* window;
+  float* windowed;
+  float* correlation;
+  float* span;
+  float* mixed;
+  unsigned long blocks;
+  unsigned long analyses;
+  unsigned resyncs;
+};
+
+// Channels of 0 make for a beam.
+int array_init(struct mic_array* array, int channels);
+void array_free(struct mic_array* array);
+// Returns the input the stream goes to, or -1 if the array is full or runs at
+// another rate.
+int array_join(struct mic_array* array, int sample_rate);
+void array_leave(struct mic_array* array, int input);
+// Samples are interleaved, or silence if NULL, and capture time is 0 while it
+// is not known.
+void array_write(struct mic_array* array, int input, uint32_t timestamp,
+                 uint64_t capture_time, const float* samples, int frames,
+                 int channels);
+// Time the next block is due at when rendered delay nanoseconds after its
+// capture time, or UINT64_MAX before any input has a capture time.
+uint64_t array_deadline(const struct mic_array* array, uint64_t delay);
+// Renders the next block into out, interleaved, and returns its frames.
+int array_render(struct mic_array* array, float* out);
+// Channels of rendered blocks.
+int array_output_channels(const struct mic_array* array);
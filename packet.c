@@ -0,0 +1,38 @@
+#include "packet.h"
+#include "utils.h"
+
+static const int sample_rates[] = {8000,  11025, 12000, 16000,  22050,
+                                   24000, 32000, 44100, 48000,  64000,
+                                   88200, 96000, 176400, 192000};
+
+int PacketRateIndex(int sample_rate) {
+  for (int i = 0; i < (int)LENGTH(sample_rates); ++i) {
+    if (sample_rates[i] == sample_rate) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+int PacketFormatRate(uint16_t format) {
+  unsigned index = PACKET_FORMAT_RATE_INDEX(format);
+  return index < LENGTH(sample_rates) ? sample_rates[index] : 0;
+}
+
+int PacketEncodingSampleSize(int encoding) {
+  switch (encoding) {
+    case PACKET_ENCODING_S16LE:
+      return 2;
+    case PACKET_ENCODING_S24LE:
+      return 3;
+    case PACKET_ENCODING_F32LE:
+      return 4;
+    default:
+      return 0;
+  }
+}
+
+int PacketFormatFrameSize(uint16_t format) {
+  return PacketEncodingSampleSize(PACKET_FORMAT_ENCODING(format)) *
+         PACKET_FORMAT_CHANNELS(format);
+}
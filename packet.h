@@ -0,0 +1,105 @@
+#include <stdint.h>
+
+#define PACKET_TYPE_AUDIO 1
+#define PACKET_TYPE_PARITY 2
+#define PACKET_TYPE_CLOCK 3
+#define PACKET_TYPE_STATS 4
+#define PACKET_TYPE_BYE 5
+
+// Payload is compressed with CodecEncode rather than raw samples.
+#define PACKET_FLAG_CODED 0x01
+// Payload is a silence descriptor rather than samples: a single byte with the
+// level of the background noise in decibels below full scale, as in RFC 3389.
+// Receivers play comfort noise at that level from its timestamp on, until the
+// next packet. Senders send one every now and then while there is nothing
+// else to send, and those count by sequence numbers like any audio packet.
+#define PACKET_FLAG_SID 0x02
+
+#define PACKET_ENCODING_S16LE 0
+#define PACKET_ENCODING_S24LE 1
+#define PACKET_ENCODING_F32LE 2
+
+// Format id packs an index into the table of sample rates, sample encoding
+// and channel count into 16 bits. Every packet carries it, so receivers
+// follow whatever format the sender negotiated with its capture device.
+// Samples of 24 bits are packed into 3 bytes.
+#define PACKET_FORMAT(rate_index, encoding, channels) \
+  ((rate_index) | (encoding) << 4 | ((channels)-1) << 8)
+#define PACKET_FORMAT_RATE_INDEX(format) ((format)&0xf)
+#define PACKET_FORMAT_ENCODING(format) ((format) >> 4 & 0xf)
+#define PACKET_FORMAT_CHANNELS(format) (((format) >> 8 & 0xf) + 1)
+
+// Every packet starts with this header, followed by length bytes of payload,
+// and a datagram carries one or more packets back to back. Fields are
+// little-endian, as is the payload itself. Sequence numbers count packets,
+// not datagrams, timestamps count frames since capture started, and both wrap
+// around.
+struct PacketHeader {
+  uint16_t sequence;
+  uint8_t type;
+  uint8_t flags;
+  uint16_t format;
+  uint16_t length;
+  uint32_t timestamp;
+};
+
+int PacketRateIndex(int sample_rate);
+int PacketFormatRate(uint16_t format);
+int PacketEncodingSampleSize(int encoding);
+int PacketFormatFrameSize(uint16_t format);
+
+// Parity packets follow their PacketHeader with this one, and then with the
+// XOR of count whole packets, headers included, zero-padded to the longest.
+// Those are the audio packets with sequence numbers from the one in the
+// PacketHeader of the parity packet, stride apart. Parity packets are not
+// counted by sequence numbers of the audio packets.
+struct ParityHeader {
+  uint8_t count;
+  uint8_t stride;
+  uint16_t reserved;
+};
+
+// Clock packets follow their PacketHeader with this one, and make for an
+// NTP-style exchange. Receivers send one with origin set to their own clock,
+// and senders answer with origin echoed back, their clock when the request
+// came in and when the answer went out, and the capture time of the frame
+// with the timestamp in the PacketHeader of the answer. Times are in
+// nanoseconds of a monotonic clock of either side. Any other datagram sent to
+// a sender only subscribes its source, as does this one, except for a bye
+// packet with no payload, which unsubscribes it.
+struct ClockReport {
+  uint64_t origin;
+  uint64_t receive;
+  uint64_t transmit;
+  uint64_t capture;
+};
+
+#define PACKET_STATS_BUCKETS 24
+#define PACKET_STATS_QUEUES 3
+#define PACKET_STATS_DEPTHS 8
+#define PACKET_STATS_BUFFERS 16
+
+// Stats packets follow their PacketHeader with this one. Counters run since
+// capture started and wrap around. Histograms count durations in microseconds
+// with bucket i taking those below 1 << i that did not fit into the previous
+// one, and the last bucket taking everything longer. Queue depths count how
+// many buffers every queue of the sender held, sampled once per buffer.
+// Buffer depth is how many capture buffers go around, and depth history
+// counts callbacks at every depth, from a single buffer on. Wakeup latency is
+// the time from a buffer being filled to the sender loop waking up to it.
+struct StatsReport {
+  uint32_t callbacks;
+  uint32_t overruns;
+  uint32_t stalls;
+  uint32_t enqueue_failures;
+  uint32_t buffers;
+  uint32_t send_errors;
+  uint32_t callback_interval[PACKET_STATS_BUCKETS];
+  uint32_t send_latency[PACKET_STATS_BUCKETS];
+  uint32_t queue_depth[PACKET_STATS_QUEUES][PACKET_STATS_DEPTHS];
+  uint32_t buffer_depth;
+  uint32_t depth_increases;
+  uint32_t depth_decreases;
+  uint32_t depth_history[PACKET_STATS_BUFFERS];
+  uint32_t wakeup_latency[PACKET_STATS_BUCKETS];
+};
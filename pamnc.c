@@ -1,91 +1,683 @@
-#include <fcntl.h>
-#include <stdarg.h>
+#define _GNU_SOURCE
+
+#include "archive.h"
+#include "arena.h"
+#include "clocksync.h"
+#include "convert.h"
+#include "drift.h"
+#include "dsp.h"
+#include "fec.h"
+#include "fft.h"
+#include "histogram.h"
+#include "jitter.h"
+#include "micarray.h"
+#include "packet.h"
+#include "pipeout.h"
+#include "plc.h"
+#include "realtime.h"
+#include "resample.h"
+#include "shmring.h"
+#include "stream.h"
+
+#include <errno.h>
+#include <signal.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
 #include <unistd.h>
 
+#include <arpa/inet.h>
 #include <netinet/in.h>
-#include <sys/poll.h>
-#include <sys/wait.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <sys/un.h>
 
-#define PIPE_FILE "/tmp/pamnc.pipe"
+#define SENDER_PORT 12345
+#define SENDER_MULTICAST_PORT 12346
+#define HOUSEKEEPING_INTERVAL 1000
 #define UNDERFLOW_TIMEOUT 1000
+#define PROBE_INTERVAL 100
+#define PROBE_FIRST 10
+#define DISCOVERY_FIRST 10
+#define STREAM_TIMEOUT 5000
+#define JITTER_DEPTH 50
+#define MAX_STREAMS 32
+#define MAX_PEERS 64
+#define STREAM_SLOTS 32
+#define RECV_BATCH 32
+#define WAKEUP_INTERVAL 10000
+#define WAKEUP_OCTAVES 11
+#define WAKEUP_FIRST_OCTAVE 16
+#define ARRAY_MARGIN 60
+#define ARRAY_INTERVAL 10000
+#define ARRAY_SOURCE "pamnc_array"
+
+static volatile sig_atomic_t latency_requested;
 
 static void handler(int sig) { (void)sig; }
 
-static int loop(int in, int out, int buffer_size, const struct sockaddr* addr) {
-  char buffer[buffer_size];
-  struct pollfd fds = {.fd = in, .events = POLLIN};
-  int result = poll(&fds, 1, UNDERFLOW_TIMEOUT);
-  switch (result) {
-    case -1:
-      perror("Failed to poll socket");
-      return 0;
-    case 0:
-      if (sendto(in, NULL, 0, 0, addr, sizeof(*addr))) {
-        perror("Failed to send broadcast");
-        return 0;
+static void latency_handler(int sig) {
+  (void)sig;
+  latency_requested = 1;
+}
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// Serves every sender from a single thread, over IPv4 and IPv6 alike, and
+// from a multicast group as well with one given. Datagrams are told apart by
+// their source address, IPv4-mapped for IPv4, and a single timer is kept
+// armed for whatever comes first: the earliest playout deadline of all
+// streams, the next probe or discovery, or the next housekeeping. Losses are
+// concealed unless turned off.
+// With a priority set, the receiver runs real-time, on cpus if set, and either
+// way it measures how late the timer wakes it up, in microseconds.
+// With an array, every stream is one of its inputs, and blocks of the array
+// go to a pipe source of its own ARRAY_MARGIN milliseconds after streams
+// play them, which leaves room for whatever lag and clock sync error there is
+// between streams.
+struct receiver {
+  int sock;
+  int group;
+  int timer;
+  int epoll;
+  int rings;
+  int depth;
+  int out_rate;
+  int ring_ms;
+  int max_streams;
+  struct DspConfig dsp;
+  int conceal;
+  int priority;
+  const char* cpus;
+  const char* archive_dir;
+  int segment_size;
+  struct sockaddr_in6 peers[MAX_PEERS];
+  struct sockaddr_in6 group_addr;
+  int peer_count;
+  // Signals are only let in while waiting for events, so that none of them
+  // comes in between checking for it and going to wait.
+  sigset_t wait_mask;
+  struct arena arena;
+  struct stream** streams;
+  int count;
+  unsigned long receive_calls;
+  unsigned long datagrams;
+  uint64_t housekeeping_time;
+  uint64_t discovery_time;
+  uint64_t discovery_interval;
+  uint64_t armed_time;
+  struct histogram wakeup;
+  uint64_t wakeup_time;
+  int arraying;
+  struct mic_array array;
+  float* array_block;
+  int array_out;
+  struct pipe_out array_pipe;
+  int array_module;
+  int array_rate;
+  uint64_t array_busy;
+  uint64_t array_start;
+  uint64_t array_time;
+};
+
+static void map_addr(const struct in_addr* in, struct in6_addr* out) {
+  *out = (struct in6_addr){0};
+  out->s6_addr[10] = out->s6_addr[11] = 0xff;
+  memcpy(&out->s6_addr[12], in, sizeof(*in));
+}
+
+static int same_addr(const struct sockaddr_in6* a,
+                     const struct sockaddr_in6* b) {
+  return IN6_ARE_ADDR_EQUAL(&a->sin6_addr, &b->sin6_addr) &&
+         a->sin6_port == b->sin6_port;
+}
+
+// Only data makes a new stream, as a sender that sends it to an IPv6 group
+// answers pings over IPv4 from an address of another family.
+static struct stream* find_stream(struct receiver* receiver,
+                                  const struct sockaddr_in6* addr, int create,
+                                  uint64_t now) {
+  for (int i = 0; i < receiver->count; ++i) {
+    if (same_addr(&receiver->streams[i]->addr, addr)) {
+      return receiver->streams[i];
+    }
+  }
+  if (!create || receiver->count == receiver->max_streams) {
+    return NULL;
+  }
+  struct stream* stream = malloc(sizeof(struct stream));
+  if (!stream) {
+    perror("Failed to allocate stream");
+    return NULL;
+  }
+  if (!stream_init(stream, addr, &receiver->arena, receiver->depth,
+                   receiver->out_rate, receiver->ring_ms, &receiver->dsp,
+                   receiver->conceal, receiver->archive_dir,
+                   (size_t)receiver->segment_size << 20,
+                   receiver->arraying ? &receiver->array : NULL, now)) {
+    free(stream);
+    return NULL;
+  }
+  fprintf(stderr, "Stream %s started\n", stream->name);
+  receiver->streams[receiver->count++] = stream;
+  return stream;
+}
+
+// Lets the sender know this receiver is gone, so that it stops sending at
+// once rather than after a timeout.
+static void send_bye(struct receiver* receiver, struct stream* stream) {
+  struct PacketHeader bye = {.type = PACKET_TYPE_BYE};
+  if (sendto(receiver->sock, &bye, sizeof(bye), 0,
+             (struct sockaddr*)&stream->addr,
+             sizeof(stream->addr)) != sizeof(bye)) {
+    perror("Failed to send bye");
+  }
+}
+
+static void send_ping(struct receiver* receiver, struct stream* stream) {
+  char request[CLOCK_SYNC_REQUEST_SIZE];
+  uint64_t now = now_ns();
+  int size = clock_sync_request(request, now);
+  if (sendto(receiver->sock, request, size, 0,
+             (struct sockaddr*)&stream->addr,
+             sizeof(stream->addr)) != size) {
+    perror("Failed to send keepalive");
+  }
+  stream->ping_time = now;
+}
+
+static void remove_stream(struct receiver* receiver, int index,
+                          uint64_t now) {
+  struct stream* stream = receiver->streams[index];
+  send_bye(receiver, stream);
+  stream_print_stats(stream, now);
+  stream_print_latency(stream, now);
+  stream_print_sender_stats(stream);
+  fprintf(stderr, "Stream %s stopped\n", stream->name);
+  stream_free(stream);
+  free(stream);
+  receiver->streams[index] = receiver->streams[--receiver->count];
+}
+
+// Group sockets of IPv4 groups are IPv4 only, and what comes in on those is
+// taken as coming from the IPv4-mapped address, the way the main socket sees
+// the same sender.
+static void receive(struct receiver* receiver, int sock) {
+  struct mmsghdr msgs[RECV_BATCH];
+  struct iovec iov[RECV_BATCH];
+  struct sockaddr_in6 addrs[RECV_BATCH];
+  int count = 0;
+  for (void* slot; count < RECV_BATCH &&
+                   (slot = arena_alloc(&receiver->arena));
+       ++count) {
+    iov[count] = (struct iovec){.iov_base = slot, .iov_len = STREAM_SLOT_SIZE};
+    msgs[count] = (struct mmsghdr){
+        .msg_hdr = {.msg_name = &addrs[count],
+                    .msg_namelen = sizeof(addrs[count]),
+                    .msg_iov = &iov[count],
+                    .msg_iovlen = 1}};
+  }
+  int received = recvmmsg(sock, msgs, count, MSG_DONTWAIT, NULL);
+  if (received == -1) {
+    if (errno != EAGAIN) {
+      perror("Failed to read socket");
+    }
+    received = 0;
+  } else {
+    receiver->receive_calls++;
+    receiver->datagrams += received;
+  }
+  uint64_t now = now_ns();
+  // Consecutive datagrams mostly come from the same sender.
+  struct stream* stream = NULL;
+  for (int i = 0; i < count; ++i) {
+    if (i < received && addrs[i].sin6_family == AF_INET) {
+      struct sockaddr_in addr;
+      memcpy(&addr, &addrs[i], sizeof(addr));
+      addrs[i] = (struct sockaddr_in6){.sin6_family = AF_INET6,
+                                       .sin6_port = addr.sin_port};
+      map_addr(&addr.sin_addr, &addrs[i].sin6_addr);
+    }
+    if (i < received && (!stream || !same_addr(&stream->addr, &addrs[i]))) {
+      const struct PacketHeader* header = iov[i].iov_base;
+      int data = msgs[i].msg_len < sizeof(*header) ||
+                 header->type != PACKET_TYPE_CLOCK;
+      stream = find_stream(receiver, &addrs[i], data, now);
+    }
+    if (i < received && stream) {
+      stream_put(stream, iov[i].iov_base, msgs[i].msg_len, now);
+    } else {
+      arena_release(&receiver->arena, iov[i].iov_base);
+    }
+  }
+}
+
+// Answers every request for a ring with the one of the stream of that name,
+// or of the first stream that has one for an empty name, and with nothing if
+// there is no such stream.
+static void serve_rings(struct receiver* receiver) {
+  for (;;) {
+    char name[SHM_RING_NAME_SIZE];
+    struct sockaddr_un addr;
+    socklen_t addr_len = sizeof(addr);
+    ssize_t length = recvfrom(receiver->rings, name, sizeof(name) - 1, 0,
+                              (struct sockaddr*)&addr, &addr_len);
+    if (length == -1) {
+      if (errno != EAGAIN) {
+        perror("Failed to read ring request");
       }
-      return 1;
-    default:
-      break;
+      return;
+    }
+    name[length] = 0;
+    struct stream* stream = NULL;
+    for (int i = 0; i < receiver->count && !stream; ++i) {
+      if (receiver->streams[i]->ring.ring &&
+          (!length || !strcmp(receiver->streams[i]->name, name))) {
+        stream = receiver->streams[i];
+      }
+    }
+    union {
+      struct cmsghdr header;
+      char buffer[CMSG_SPACE(sizeof(int))];
+    } control;
+    struct iovec iov = {.iov_base = stream ? stream->name : NULL,
+                        .iov_len = stream ? strlen(stream->name) : 0};
+    struct msghdr msg = {.msg_name = &addr,
+                         .msg_namelen = addr_len,
+                         .msg_iov = &iov,
+                         .msg_iovlen = 1};
+    if (stream) {
+      msg.msg_control = control.buffer;
+      msg.msg_controllen = sizeof(control.buffer);
+      struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+      cmsg->cmsg_level = SOL_SOCKET;
+      cmsg->cmsg_type = SCM_RIGHTS;
+      cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+      memcpy(CMSG_DATA(cmsg), &stream->ring.fd, sizeof(int));
+    }
+    if (sendmsg(receiver->rings, &msg, MSG_DONTWAIT) == -1) {
+      perror("Failed to answer ring request");
+    }
+  }
+}
+
+// Prints percentiles of how late the timer woke the receiver up, and how many
+// of the wakeups were late by less than every power of two from
+// WAKEUP_FIRST_OCTAVE microseconds on, WAKEUP_OCTAVES of them, and by more.
+static void print_wakeup(struct receiver* receiver, uint64_t now) {
+  const struct histogram* wakeup = &receiver->wakeup;
+  receiver->wakeup_time = now;
+  if (!wakeup->total) {
+    return;
+  }
+  char octaves[WAKEUP_OCTAVES * 24];
+  int length = 0;
+  unsigned long previous = 0;
+  uint32_t limit = WAKEUP_FIRST_OCTAVE;
+  for (int i = 0; i < WAKEUP_OCTAVES; ++i, limit *= 2) {
+    unsigned long below = histogram_count_below(wakeup, limit);
+    length += snprintf(octaves + length, sizeof(octaves) - length,
+                       "%s<%u us %.2f%%", i ? ", " : "", limit,
+                       100.0 * (below - previous) / wakeup->total);
+    previous = below;
   }
-  int length = read(in, buffer, buffer_size);
-  if (length == -1) {
-    perror("Failed to read socket");
+  fprintf(stderr,
+          "timer wakeup latency p50 %.3f ms, p99 %.3f ms, p99.9 %.3f ms, "
+          "max %.3f ms over %lu wakeups, %s, more %.2f%%\n",
+          histogram_percentile(wakeup, 50) / 1e3,
+          histogram_percentile(wakeup, 99) / 1e3,
+          histogram_percentile(wakeup, 99.9) / 1e3, wakeup->max / 1e3,
+          wakeup->total, octaves,
+          100.0 * (wakeup->total - previous) / wakeup->total);
+}
+
+// Prints where every input of the array sits, as the lag correlation found
+// on top of capture time in milliseconds, the drift of its clock, and how
+// high its correlation peaked, and how much of a core rendering took.
+static void print_array(struct receiver* receiver, uint64_t now) {
+  const struct mic_array* array = &receiver->array;
+  receiver->array_time = now;
+  if (!receiver->arraying || !array->count) {
+    return;
+  }
+  for (int i = 0; i < receiver->count; ++i) {
+    const struct stream* stream = receiver->streams[i];
+    if (stream->array_input == -1) {
+      continue;
+    }
+    const struct array_input* input = &array->inputs[stream->array_input];
+    const char* state = stream->array_input == array->reference ? "reference"
+                        : input->locked                          ? "locked"
+                                                                 : "searching";
+    fprintf(stderr,
+            "array input %d %s: %s, lag %.3f ms, drift %+.1f ppm, peak "
+            "%.2f\n",
+            stream->array_input, stream->name, state,
+            input->lag * 1e3 / array->rate, input->velocity * 1e6,
+            input->peak);
+  }
+  fprintf(stderr,
+          "array of %d inputs at %d Hz, %lu blocks, %lu analyses, %u "
+          "resyncs, %lu bytes dropped, rendering took %.2f%% of a core\n",
+          array->count, array->rate, array->blocks, array->analyses,
+          array->resyncs, receiver->array_pipe.dropped_bytes,
+          now > receiver->array_start
+              ? 100.0 * receiver->array_busy / (now - receiver->array_start)
+              : 0);
+}
+
+static void close_array_source(struct receiver* receiver) {
+  if (receiver->array_out != -1) {
+    stream_close_source(ARRAY_SOURCE, receiver->array_out,
+                        receiver->array_module);
+    receiver->array_out = -1;
+  }
+}
+
+// Renders every block of the array that is due, into a pipe source that is
+// opened for the first one and opened again whenever the array changes rate.
+// Pipe is non-blocking, and whatever does not fit is lost in whole frames.
+// Returns when the next block is due.
+static uint64_t play_array(struct receiver* receiver, uint64_t now) {
+  struct mic_array* array = &receiver->array;
+  uint64_t delay = (receiver->depth + ARRAY_MARGIN) * 1000000ull;
+  int channels = array_output_channels(array);
+  while (receiver->arraying && array_deadline(array, delay) <= now) {
+    if (receiver->array_out != -1 && receiver->array_rate != array->rate) {
+      close_array_source(receiver);
+    }
+    if (receiver->array_out == -1) {
+      fprintf(stderr, "Opening %s at %d Hz, %d channels, %s\n", ARRAY_SOURCE,
+              array->rate, channels, "float32le");
+      receiver->array_out = stream_open_source(
+          ARRAY_SOURCE, &receiver->array_module, array->rate, channels,
+          PACKET_ENCODING_F32LE);
+      if (receiver->array_out == -1) {
+        fprintf(stderr, "Array failed\n");
+        receiver->arraying = 0;
+        break;
+      }
+      receiver->array_rate = array->rate;
+      pipe_out_open(&receiver->array_pipe, receiver->array_out,
+                    channels * (int)sizeof(float));
+    }
+    uint64_t start = now_ns();
+    int frames = array_render(array, receiver->array_block);
+    receiver->array_busy += now_ns() - start;
+    struct iovec iov = {.iov_base = receiver->array_block,
+                        .iov_len = (size_t)frames * channels * sizeof(float)};
+    if (!pipe_out_write(&receiver->array_pipe, &iov, 1)) {
+      fprintf(stderr, "Failed to write array\n");
+    }
+  }
+  return receiver->arraying ? array_deadline(array, delay) : UINT64_MAX;
+}
+
+// Discovery pings go to everyone, so that new senders can be found at any
+// time, or go to the peers given instead, and a peer that is not up yet is
+// not an error. They go out right away whenever a sender goes missing, since
+// it could come back at another address, and then less and less often down
+// to once every housekeeping.
+static int discover(struct receiver* receiver, uint64_t now) {
+  struct sockaddr_in6 broadcast = {.sin6_family = AF_INET6,
+                                   .sin6_port = htons(SENDER_PORT)};
+  map_addr(&(struct in_addr){.s_addr = INADDR_BROADCAST},
+           &broadcast.sin6_addr);
+  char request[CLOCK_SYNC_REQUEST_SIZE];
+  int size = clock_sync_request(request, now);
+  if (!receiver->peer_count &&
+      sendto(receiver->sock, request, size, 0, (struct sockaddr*)&broadcast,
+             sizeof(broadcast)) != size) {
+    perror("Failed to send broadcast");
     return 0;
   }
-  for (char* ptr = buffer; length > 0;) {
-    int written = write(out, ptr, length);
-    if (written == -1) {
-      perror("Failed to write pipe");
-      return 0;
+  for (int i = 0; i < receiver->peer_count; ++i) {
+    if (sendto(receiver->sock, request, size, 0,
+               (struct sockaddr*)&receiver->peers[i],
+               sizeof(receiver->peers[i])) != size &&
+        errno != ECONNREFUSED) {
+      perror("Failed to send discovery");
     }
-    length -= written;
-    ptr += written;
+  }
+  receiver->discovery_time = now + receiver->discovery_interval;
+  receiver->discovery_interval *= 2;
+  if (receiver->discovery_interval > HOUSEKEEPING_INTERVAL * 1000000ull) {
+    receiver->discovery_interval = HOUSEKEEPING_INTERVAL * 1000000ull;
   }
   return 1;
 }
 
-static int pactl(int argc, ...) {
-  va_list args;
-  va_start(args, argc);
-  char* argv[argc + 2];
-  argv[0] = "pactl";
-  for (int i = 1; i < argc + 1; ++i) {
-    argv[i] = va_arg(args, char*);
+static void restart_discovery(struct receiver* receiver, uint64_t now) {
+  receiver->discovery_time = now;
+  receiver->discovery_interval = DISCOVERY_FIRST * 1000000ull;
+}
+
+// Every known sender gets a ping of its own, to keep this receiver
+// subscribed even if discovery pings get lost. Pings are clock requests, and
+// the answers keep the clock offset of every sender up to date.
+static void housekeeping(struct receiver* receiver, uint64_t now) {
+  for (int i = receiver->count - 1; i >= 0; --i) {
+    struct stream* stream = receiver->streams[i];
+    uint64_t silence = now - stream->last_seen;
+    if (silence >= STREAM_TIMEOUT * 1000000ull ||
+        (stream->failed_time &&
+         now - stream->failed_time >= STREAM_TIMEOUT * 1000000ull)) {
+      remove_stream(receiver, i, now);
+      restart_discovery(receiver, now);
+      continue;
+    }
+    if (silence >= UNDERFLOW_TIMEOUT * 1000000ull && stream->jitter.started &&
+        stream_deadline(stream) == UINT64_MAX) {
+      stream_reset(stream);
+    }
+    stream_report(stream, now);
+    stream_prepare_archive(stream);
+    send_ping(receiver, stream);
+  }
+  if (now - receiver->wakeup_time >= WAKEUP_INTERVAL * 1000000ull) {
+    print_wakeup(receiver, now);
+  }
+  if (now - receiver->array_time >= ARRAY_INTERVAL * 1000000ull) {
+    print_array(receiver, now);
+  }
+  receiver->housekeeping_time = now + HOUSEKEEPING_INTERVAL * 1000000ull;
+}
+
+static int dispatch(struct receiver* receiver) {
+  uint64_t now = now_ns();
+  uint64_t next = receiver->housekeeping_time;
+  if (now >= next) {
+    housekeeping(receiver, now);
+    next = receiver->housekeeping_time;
+  }
+  for (int i = receiver->count - 1; i >= 0; --i) {
+    struct stream* stream = receiver->streams[i];
+    // Sender that went silent could have lost this receiver, like when it
+    // restarts, so remind it well before the next housekeeping: soon after
+    // it went quiet, and then less and less often down to every
+    // PROBE_INTERVAL.
+    uint64_t quiet_time = stream->last_seen + PROBE_INTERVAL * 1000000ull;
+    if (stream->ping_time < quiet_time) {
+      stream->probe_interval = 0;
+    }
+    int probing = stream->probe_interval != 0;
+    uint64_t probe_time =
+        probing ? stream->ping_time + stream->probe_interval : quiet_time;
+    if (probe_time <= now) {
+      if (probing) {
+        stream->probe_interval *= 2;
+        if (stream->probe_interval > PROBE_INTERVAL * 1000000ull) {
+          stream->probe_interval = PROBE_INTERVAL * 1000000ull;
+        }
+      } else {
+        stream->probe_interval = PROBE_FIRST * 1000000ull;
+        restart_discovery(receiver, now);
+      }
+      send_ping(receiver, stream);
+      probe_time = stream->ping_time + stream->probe_interval;
+    }
+    if (probe_time < next) {
+      next = probe_time;
+    }
+    uint64_t deadline = stream_deadline(stream);
+    if (deadline <= now) {
+      if (!stream_play(stream, now)) {
+        // Keep failing streams around for a while, so that their datagrams
+        // do not recreate them over and over.
+        fprintf(stderr, "Stream %s failed\n", stream->name);
+        stream_reset(stream);
+        stream->failed_time = now;
+      }
+      deadline = stream_deadline(stream);
+    }
+    if (deadline < next) {
+      next = deadline;
+    }
+  }
+  uint64_t array_deadline = play_array(receiver, now);
+  if (array_deadline < next) {
+    next = array_deadline;
   }
-  argv[argc + 1] = NULL;
-  va_end(args);
-  switch (fork()) {
-    case -1:
-      perror("Failed to fork");
+  if (receiver->discovery_time <= now) {
+    if (!discover(receiver, now)) {
       return 0;
-    case 0:
-      execvp(argv[0], argv);
-      perror("Failed to exec");
+    }
+  }
+  if (receiver->discovery_time < next) {
+    next = receiver->discovery_time;
+  }
+  if (next != receiver->armed_time) {
+    struct itimerspec spec = {
+        .it_value = {.tv_sec = next / 1000000000,
+                     .tv_nsec = next % 1000000000}};
+    if (timerfd_settime(receiver->timer, TFD_TIMER_ABSTIME, &spec, NULL)) {
+      perror("Failed to arm timer");
       return 0;
-    default:
-      break;
+    }
+    receiver->armed_time = next;
+  }
+  struct epoll_event events[4];
+  int count =
+      epoll_pwait(receiver->epoll, events, 4, -1, &receiver->wait_mask);
+  uint64_t woken = now_ns();
+  if (count == -1 && errno == EINTR && latency_requested) {
+    latency_requested = 0;
+    for (int i = 0; i < receiver->count; ++i) {
+      stream_print_latency(receiver->streams[i], woken);
+      stream_print_sender_stats(receiver->streams[i]);
+    }
+    print_wakeup(receiver, woken);
+    print_array(receiver, woken);
+    return 1;
+  }
+  if (count == -1) {
+    perror("Failed to wait for events");
+    return 0;
+  }
+  for (int i = 0; i < count; ++i) {
+    if (events[i].data.fd == receiver->sock ||
+        events[i].data.fd == receiver->group) {
+      receive(receiver, events[i].data.fd);
+      continue;
+    }
+    if (events[i].data.fd == receiver->rings) {
+      serve_rings(receiver);
+      continue;
+    }
+    uint64_t expirations;
+    if (read(receiver->timer, &expirations, sizeof(expirations)) == -1 &&
+        errno != EAGAIN) {
+      perror("Failed to read timer");
+      return 0;
+    }
+    // Timer only fires once it is due, so whatever time went by since is how
+    // late it woke this thread up.
+    if (receiver->armed_time && woken >= receiver->armed_time) {
+      uint64_t late = (woken - receiver->armed_time) / 1000;
+      histogram_add(&receiver->wakeup,
+                    late < UINT32_MAX ? (uint32_t)late : UINT32_MAX);
+    }
+    // Timer is disarmed now, so make sure it is armed again.
+    receiver->armed_time = 0;
+  }
+  return 1;
+}
+
+// Takes an IPv4 address or an IPv6 one in brackets, either with an optional
+// port, or a bare IPv6 address, and gives it as IPv6, IPv4-mapped for IPv4.
+static int parse_addr(const char* arg, int port, struct sockaddr_in6* addr) {
+  char address[INET6_ADDRSTRLEN];
+  const char* colon = strchr(arg, ':');
+  const char* end;
+  if (*arg == '[') {
+    end = strchr(++arg, ']');
+    if (!end || (end[1] && end[1] != ':')) {
+      return 0;
+    }
+    colon = end[1] ? end + 1 : NULL;
+  } else if (colon && strchr(colon + 1, ':')) {
+    end = arg + strlen(arg);
+    colon = NULL;
+  } else {
+    end = colon ? colon : arg + strlen(arg);
   }
-  int result;
-  if (wait(&result) == -1) {
-    perror("Failed to wait");
+  if ((size_t)(end - arg) >= sizeof(address)) {
     return 0;
   }
-  return result == EXIT_SUCCESS;
+  memcpy(address, arg, end - arg);
+  address[end - arg] = 0;
+  if (colon) {
+    port = atoi(colon + 1);
+  }
+  *addr = (struct sockaddr_in6){.sin6_family = AF_INET6,
+                                .sin6_port = htons(port)};
+  struct in_addr addr4;
+  if (inet_pton(AF_INET, address, &addr4) == 1) {
+    map_addr(&addr4, &addr->sin6_addr);
+  } else if (inet_pton(AF_INET6, address, &addr->sin6_addr) != 1) {
+    return 0;
+  }
+  return port > 0 && port <= 65535;
 }
 
-static int make_socket(int* bufsize) {
-  int sock = socket(AF_INET, SOCK_DGRAM, 0);
+static int add_peer(struct receiver* receiver, const char* arg) {
+  if (receiver->peer_count == MAX_PEERS ||
+      !parse_addr(arg, SENDER_PORT, &receiver->peers[receiver->peer_count])) {
+    return 0;
+  }
+  receiver->peer_count++;
+  return 1;
+}
+
+static int set_group(struct receiver* receiver, const char* arg) {
+  struct sockaddr_in6* group = &receiver->group_addr;
+  if (!parse_addr(arg, SENDER_MULTICAST_PORT, group)) {
+    return 0;
+  }
+  return IN6_IS_ADDR_V4MAPPED(&group->sin6_addr)
+             ? IN_MULTICAST(ntohl(group->sin6_addr.s6_addr32[3]))
+             : IN6_IS_ADDR_MULTICAST(&group->sin6_addr);
+}
+
+// Takes both IPv4 and IPv6, so that the same socket talks to every sender.
+static int make_socket(void) {
+  int sock = socket(AF_INET6, SOCK_DGRAM, 0);
   if (sock == -1) {
     perror("Failed to create socket");
     return -1;
   }
   do {
-    socklen_t len = sizeof(*bufsize);
-    if (getsockopt(sock, SOL_SOCKET, SO_RCVBUF, bufsize, &len) == -1) {
-      perror("Failed to get socket buffer size");
+    int v6only = 0;
+    if (setsockopt(sock, IPPROTO_IPV6, IPV6_V6ONLY, &v6only,
+                   sizeof(v6only)) == -1) {
+      perror("Failed to accept IPv4");
       break;
     }
     int broadcast = 1;
@@ -102,56 +694,293 @@ static int make_socket(int* bufsize) {
   return -1;
 }
 
-static int make_pipe(int sample_rate) {
-  char rate[16];
-  snprintf(rate, sizeof(rate), "rate=%d", sample_rate);
-  int pares = pactl(7, "load-module", "module-pipe-source", "source_name=pamnc",
-                    "file=" PIPE_FILE, "format=s16le", rate, "channels=1");
-  if (!pares) {
+// Binds to the group itself, so that nothing else sent to the port comes in,
+// and shares the port with other receivers on the host. Group is joined on
+// the interface the route to it goes through.
+static int make_group_socket(const struct sockaddr_in6* group) {
+  int v4 = IN6_IS_ADDR_V4MAPPED(&group->sin6_addr);
+  int sock = socket(v4 ? AF_INET : AF_INET6, SOCK_DGRAM, 0);
+  if (sock == -1) {
+    perror("Failed to create group socket");
+    return -1;
+  }
+  struct sockaddr_in addr4 = {.sin_family = AF_INET,
+                              .sin_port = group->sin6_port};
+  memcpy(&addr4.sin_addr, &group->sin6_addr.s6_addr[12],
+         sizeof(addr4.sin_addr));
+  struct ip_mreqn request4 = {.imr_multiaddr = addr4.sin_addr};
+  struct ipv6_mreq request6 = {.ipv6mr_multiaddr = group->sin6_addr,
+                               .ipv6mr_interface = group->sin6_scope_id};
+  do {
+    int reuse = 1;
+    if (setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse)) ==
+        -1) {
+      perror("Failed to share group port");
+      break;
+    }
+    if (bind(sock,
+             v4 ? (const struct sockaddr*)&addr4
+                : (const struct sockaddr*)group,
+             v4 ? sizeof(addr4) : sizeof(*group)) == -1) {
+      perror("Failed to bind group socket");
+      break;
+    }
+    if ((v4 ? setsockopt(sock, IPPROTO_IP, IP_ADD_MEMBERSHIP, &request4,
+                         sizeof(request4))
+            : setsockopt(sock, IPPROTO_IPV6, IPV6_JOIN_GROUP, &request6,
+                         sizeof(request6))) == -1) {
+      perror("Failed to join group");
+      break;
+    }
+    return sock;
+  } while (0);
+  if (close(sock) == -1) {
+    perror("Failed to close group socket");
+  }
+  return -1;
+}
+
+static void close_fd(int fd, const char* name) {
+  if (fd != -1 && close(fd) == -1) {
+    fprintf(stderr, "Failed to close %s: %s\n", name, strerror(errno));
+  }
+}
+
+static int make_ring_socket(void) {
+  int sock = socket(AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (sock == -1) {
+    perror("Failed to create ring socket");
     return -1;
   }
-  int pipe = open(PIPE_FILE, O_WRONLY);
-  if (pipe == -1) {
-    perror("Failed to open pipe");
+  struct sockaddr_un addr = {.sun_family = AF_UNIX};
+  memcpy(addr.sun_path + 1, SHM_RING_SOCKET, sizeof(SHM_RING_SOCKET) - 1);
+  if (bind(sock, (struct sockaddr*)&addr,
+           offsetof(struct sockaddr_un, sun_path) + sizeof(SHM_RING_SOCKET)) ==
+      -1) {
+    perror("Failed to bind ring socket");
+    close_fd(sock, "ring socket");
     return -1;
   }
-  if (unlink(PIPE_FILE) == -1) {
-    perror("Failed to unlink pipe");
+  return sock;
+}
+
+static int make_epoll(struct receiver* receiver) {
+  receiver->epoll = epoll_create1(0);
+  if (receiver->epoll == -1) {
+    perror("Failed to create epoll");
+    return 0;
+  }
+  int fds[] = {receiver->sock, receiver->group, receiver->timer,
+               receiver->rings};
+  for (int i = 0; i < (int)(sizeof(fds) / sizeof(*fds)); ++i) {
+    if (fds[i] == -1) {
+      continue;
+    }
+    struct epoll_event event = {.events = EPOLLIN, .data.fd = fds[i]};
+    if (epoll_ctl(receiver->epoll, EPOLL_CTL_ADD, fds[i], &event) == -1) {
+      perror("Failed to add to epoll");
+      return 0;
+    }
   }
-  return pipe;
+  return 1;
 }
 
 int main(int argc, char** argv) {
-  int sample_rate = argc > 1 ? atoi(argv[1]) : 0;
-  if (!sample_rate) {
-    fprintf(stderr, "Usage: %s <sample_rate>\n", argv[0]);
+  struct receiver receiver = {.sock = -1,
+                              .group = -1,
+                              .timer = -1,
+                              .epoll = -1,
+                              .rings = -1,
+                              .discovery_interval = DISCOVERY_FIRST * 1000000ull,
+                              .depth = JITTER_DEPTH,
+                              .max_streams = MAX_STREAMS,
+                              .conceal = 1,
+                              .segment_size = ARCHIVE_SEGMENT_SIZE,
+                              .array_out = -1,
+                              .array_module = -1};
+  int array_channels = -1;
+  for (int opt; (opt = getopt(argc, argv, "j:r:n:m:d:za:s:p:g:R:C:A:")) !=
+                -1;) {
+    switch (opt) {
+      case 'j':
+        receiver.depth = atoi(optarg);
+        break;
+      case 'r':
+        receiver.out_rate = atoi(optarg);
+        if (receiver.out_rate <= 0) {
+          receiver.depth = -1;
+        }
+        break;
+      case 'n':
+        receiver.max_streams = atoi(optarg);
+        break;
+      case 'm':
+        receiver.ring_ms = atoi(optarg);
+        if (receiver.ring_ms <= 0) {
+          receiver.depth = -1;
+        }
+        break;
+      case 'd':
+        if (!SetDspOption(&receiver.dsp, optarg)) {
+          receiver.depth = -1;
+        }
+        break;
+      case 'z':
+        receiver.conceal = 0;
+        break;
+      case 'a':
+        receiver.archive_dir = optarg;
+        break;
+      case 's':
+        receiver.segment_size = atoi(optarg);
+        if (receiver.segment_size <= 0 ||
+            receiver.segment_size > ARCHIVE_MAX_SEGMENT_SIZE) {
+          receiver.depth = -1;
+        }
+        break;
+      case 'p':
+        if (!add_peer(&receiver, optarg)) {
+          receiver.depth = -1;
+        }
+        break;
+      case 'g':
+        if (!set_group(&receiver, optarg)) {
+          receiver.depth = -1;
+        }
+        break;
+      case 'R':
+        receiver.priority = atoi(optarg);
+        if (receiver.priority <= 0) {
+          receiver.depth = -1;
+        }
+        break;
+      case 'C':
+        receiver.cpus = optarg;
+        break;
+      case 'A':
+        receiver.arraying = 1;
+        array_channels = strcmp(optarg, "beam") ? atoi(optarg) : 0;
+        if (strcmp(optarg, "beam") &&
+            (array_channels <= 0 || array_channels > ARRAY_MAX_INPUTS)) {
+          receiver.depth = -1;
+        }
+        break;
+      default:
+        receiver.depth = -1;
+        break;
+    }
+  }
+  if (optind != argc || receiver.depth < 0 || receiver.max_streams <= 0 ||
+      (receiver.cpus && !receiver.priority)) {
+    fprintf(stderr,
+            "Usage: %s [-j jitter_depth_ms] [-r output_rate] "
+            "[-n max_streams] [-m ring_ms] [-d dsp_option=value]... [-z] "
+            "[-a archive_dir] [-s segment_mib] [-p address[:port]]... "
+            "[-g group[:port]] [-R priority [-C cpus]] "
+            "[-A beam|channels]\n",
+            argv[0]);
     return EXIT_FAILURE;
   }
   struct sigaction act = {.sa_handler = handler};
-  act.sa_handler = handler;
-  if (sigaction(SIGINT, &act, NULL) == -1) {
+  struct sigaction latency = {.sa_handler = latency_handler};
+  struct sigaction ignore = {.sa_handler = SIG_IGN};
+  sigset_t blocked;
+  sigemptyset(&blocked);
+  sigaddset(&blocked, SIGINT);
+  sigaddset(&blocked, SIGUSR1);
+  if (sigaction(SIGINT, &act, NULL) == -1 ||
+      sigaction(SIGUSR1, &latency, NULL) == -1 ||
+      sigaction(SIGPIPE, &ignore, NULL) == -1 ||
+      sigprocmask(SIG_BLOCK, &blocked, &receiver.wait_mask) == -1) {
     perror("Failed to set up signal handler");
     return EXIT_FAILURE;
   }
-  int buffer_size;
-  int in = make_socket(&buffer_size);
-  if (in == -1) {
+  receiver.streams = calloc(receiver.max_streams, sizeof(struct stream*));
+  if (!receiver.streams) {
+    perror("Failed to allocate streams");
     return EXIT_FAILURE;
   }
-  int out = make_pipe(sample_rate);
-  if (out != -1) {
-    struct sockaddr_in addr = {.sin_family = AF_INET,
-                               .sin_port = htons(12345),
-                               .sin_addr.s_addr = INADDR_BROADCAST};
-    while (loop(in, out, buffer_size, (struct sockaddr*)&addr))
-      ;
-    if (close(out) == -1) {
-      perror("Failed to close pipe");
+  // Every datagram in a jitter buffer or being received takes a slot, and so
+  // does every datagram being decoded on its way to a pipe.
+  if (!arena_init(&receiver.arena,
+                  receiver.max_streams * STREAM_SLOTS + RECV_BATCH +
+                      STREAM_WRITE_BATCH,
+                  STREAM_SLOT_SIZE)) {
+    perror("Failed to allocate packet arena");
+    free(receiver.streams);
+    return EXIT_FAILURE;
+  }
+  if (receiver.arraying) {
+    size_t block = ARRAY_MAX_RATE * ARRAY_BLOCK / 1000;
+    receiver.array_block =
+        malloc(block * (array_channels ? array_channels : 1) * sizeof(float));
+    if (!receiver.array_block ||
+        !array_init(&receiver.array, array_channels)) {
+      perror("Failed to allocate array");
+      free(receiver.array_block);
+      arena_free(&receiver.arena);
+      free(receiver.streams);
+      return EXIT_FAILURE;
     }
+    receiver.array_start = now_ns();
+    receiver.array_time = receiver.array_start;
   }
-  if (close(in) == -1) {
-    perror("Failed to close socket");
+  int result = EXIT_FAILURE;
+  do {
+    receiver.sock = make_socket();
+    if (receiver.sock == -1) {
+      break;
+    }
+    if (receiver.group_addr.sin6_family &&
+        (receiver.group = make_group_socket(&receiver.group_addr)) == -1) {
+      break;
+    }
+    receiver.timer = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+    if (receiver.timer == -1) {
+      perror("Failed to create timer");
+      break;
+    }
+    if (receiver.ring_ms && (receiver.rings = make_ring_socket()) == -1) {
+      break;
+    }
+    if (!make_epoll(&receiver)) {
+      break;
+    }
+    // Everything up front is locked and faulted in by now, and whatever
+    // streams allocate later is locked as it comes.
+    if (receiver.priority) {
+      struct RealtimeStatus realtime;
+      EnterRealtime(receiver.priority, receiver.cpus, &realtime);
+      char description[256];
+      DescribeRealtime(&realtime, description, sizeof(description));
+      fprintf(stderr, "Receiving with %s\n", description);
+    }
+    while (dispatch(&receiver))
+      ;
+    result = EXIT_SUCCESS;
+  } while (0);
+  uint64_t now = now_ns();
+  while (receiver.count) {
+    remove_stream(&receiver, receiver.count - 1, now);
+  }
+  print_wakeup(&receiver, now);
+  print_array(&receiver, now);
+  if (receiver.array_block) {
+    close_array_source(&receiver);
+    array_free(&receiver.array);
+    free(receiver.array_block);
+  }
+  if (receiver.receive_calls) {
+    fprintf(stderr, "datagrams %lu, datagrams per receive %.2f\n",
+            receiver.datagrams,
+            (double)receiver.datagrams / receiver.receive_calls);
   }
-  pactl(2, "unload-module", "module-pipe-source");
-  return in == -1 || out == -1 ? EXIT_FAILURE : EXIT_SUCCESS;
+  close_fd(receiver.epoll, "epoll");
+  close_fd(receiver.rings, "ring socket");
+  close_fd(receiver.timer, "timer");
+  close_fd(receiver.group, "group socket");
+  close_fd(receiver.sock, "socket");
+  arena_free(&receiver.arena);
+  free(receiver.streams);
+  return result;
 }
@@ -0,0 +1,82 @@
+#include "pipeout.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+void pipe_out_open(struct pipe_out* out, int fd, int frame_size) {
+  out->fd = fd;
+  out->frame_size = frame_size;
+  out->pending = 0;
+}
+
+// Returns -1 on failure, and 0 if the pipe is full.
+static ssize_t write_some(struct pipe_out* out, const struct iovec* iov,
+                          int count) {
+  ssize_t written = writev(out->fd, iov, count);
+  out->write_calls++;
+  if (written == -1) {
+    if (errno != EAGAIN) {
+      perror("Failed to write pipe");
+      return -1;
+    }
+    return 0;
+  }
+  return written;
+}
+
+int pipe_out_write(struct pipe_out* out, struct iovec* iov, int count) {
+  size_t total = 0;
+  for (int i = 0; i < count; ++i) {
+    total += iov[i].iov_len;
+  }
+  if (out->pending) {
+    ssize_t written = write_some(
+        out, &(struct iovec){.iov_base = out->tail, .iov_len = out->pending},
+        1);
+    if (written == -1) {
+      return 0;
+    }
+    out->pending -= (int)written;
+    memmove(out->tail, out->tail + written, out->pending);
+    if (out->pending) {
+      out->dropped_bytes += total;
+      return 1;
+    }
+  }
+  size_t done = 0;
+  while (count) {
+    ssize_t written = write_some(out, iov, count);
+    if (written == -1) {
+      return 0;
+    }
+    if (!written) {
+      break;
+    }
+    done += written;
+    for (; count && (size_t)written >= iov->iov_len; ++iov) {
+      written -= iov->iov_len;
+      count--;
+    }
+    if (count) {
+      iov->iov_base = (char*)iov->iov_base + written;
+      iov->iov_len -= written;
+    }
+  }
+  if (!count) {
+    return 1;
+  }
+  // Rest of the frame that went in partly, which may span buffers.
+  int partial = (int)(done % out->frame_size);
+  int rest = partial ? out->frame_size - partial : 0;
+  for (; out->pending < rest; ++iov) {
+    size_t chunk = iov->iov_len < (size_t)(rest - out->pending)
+                       ? iov->iov_len
+                       : (size_t)(rest - out->pending);
+    memcpy(out->tail + out->pending, iov->iov_base, chunk);
+    out->pending += (int)chunk;
+  }
+  out->dropped_bytes += total - done - rest;
+  return 1;
+}
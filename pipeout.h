@@ -0,0 +1,25 @@
+#include <sys/uio.h>
+
+// Sixteen channels of four bytes.
+#define PIPE_OUT_MAX_FRAME 64
+
+// Non-blocking pipe into a PulseAudio pipe source, which takes frames one
+// after the other from wherever the last one ended. Whatever does not fit is
+// lost in whole frames, and a frame that only went in partly is finished
+// first thing on the next write, so that the source never goes out of frame
+// alignment. Counters go on across pipes.
+struct pipe_out {
+  int fd;
+  int frame_size;
+  int pending;
+  char tail[PIPE_OUT_MAX_FRAME];
+  unsigned long write_calls;
+  unsigned long dropped_bytes;
+};
+
+// Starts writing frames of that size to a pipe that was just opened.
+void pipe_out_open(struct pipe_out* out, int fd, int frame_size);
+// Writes count buffers that add up to whole frames, though any of them may end
+// part way through one, with as few syscalls as possible, and uses up iov.
+// Returns 0 on failure.
+int pipe_out_write(struct pipe_out* out, struct iovec* iov, int count);
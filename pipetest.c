@@ -0,0 +1,152 @@
+#define _GNU_SOURCE
+
+#include "pipeout.h"
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define ROUNDS 10000
+#define PIPE_SIZE 16384
+#define FRAME_SIZE 6
+#define MAX_FRAMES 2000
+#define MAX_BUFFERS 8
+#define MAX_READ 8192
+#define SEED 1
+
+// Writes s24le stereo frames through pipe_out to a pipe of PIPE_SIZE bytes
+// that is read less than is written, so that most writes only go in partly
+// and a frame of 6 bytes gets split at the page boundaries of the pipe. Every
+// round writes up to MAX_FRAMES frames, split into up to MAX_BUFFERS buffers
+// at random points, the way silence and resampled chunks end up, from a
+// buffer that the next round overwrites, and then reads up to MAX_READ bytes.
+// Frames count up in the left channel and carry the count inverted in the
+// right. Fails if the reader ever sees a frame that does not hold together or
+// comes before one it saw, as it does once out of frame alignment, if no write
+// ever left a frame partly written, or if what was dropped does not add up to
+// the frames missing. Prints one line of JSON to stdout and a summary to
+// stderr, with how often a frame was left partly written.
+static uint32_t next_random(uint32_t* state) {
+  uint32_t x = *state;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  return *state = x;
+}
+
+static void make_frame(uint8_t* frame, uint32_t index) {
+  uint32_t left = index & 0xffffff;
+  uint32_t right = ~index & 0xffffff;
+  for (int i = 0; i < 3; ++i) {
+    frame[i] = (uint8_t)(left >> 8 * i);
+    frame[3 + i] = (uint8_t)(right >> 8 * i);
+  }
+}
+
+struct reader {
+  uint8_t frame[FRAME_SIZE];
+  int have;
+  long frames;
+  long missing;
+  long errors;
+  uint32_t next;
+};
+
+static void take(struct reader* reader, const uint8_t* data, long length) {
+  for (long i = 0; i < length; ++i) {
+    reader->frame[reader->have++] = data[i];
+    if (reader->have < FRAME_SIZE) {
+      continue;
+    }
+    reader->have = 0;
+    uint32_t left = reader->frame[0] | reader->frame[1] << 8 |
+                    (uint32_t)reader->frame[2] << 16;
+    uint32_t right = reader->frame[3] | reader->frame[4] << 8 |
+                     (uint32_t)reader->frame[5] << 16;
+    if (right != (~left & 0xffffff) || left < reader->next) {
+      reader->errors++;
+      continue;
+    }
+    reader->missing += left - reader->next;
+    reader->next = left + 1;
+    reader->frames++;
+  }
+}
+
+static void drain(int fd, struct reader* reader, long limit) {
+  static uint8_t buffer[MAX_READ];
+  while (limit > 0) {
+    ssize_t length =
+        read(fd, buffer, limit < MAX_READ ? (size_t)limit : MAX_READ);
+    if (length <= 0) {
+      break;
+    }
+    take(reader, buffer, length);
+    limit -= length;
+  }
+}
+
+int main(void) {
+  int fds[2];
+  if (pipe2(fds, O_NONBLOCK) == -1 ||
+      fcntl(fds[1], F_SETPIPE_SZ, PIPE_SIZE) == -1) {
+    perror("Failed to create pipe");
+    return EXIT_FAILURE;
+  }
+  static uint8_t frames[MAX_FRAMES * FRAME_SIZE];
+  struct pipe_out out = {0};
+  pipe_out_open(&out, fds[1], FRAME_SIZE);
+  struct reader reader = {0};
+  uint32_t state = SEED;
+  uint32_t index = 0;
+  long partial = 0;
+  for (long round = 0; round < ROUNDS; ++round) {
+    int count = 1 + next_random(&state) % MAX_FRAMES;
+    for (int i = 0; i < count; ++i) {
+      make_frame(frames + i * FRAME_SIZE, index++);
+    }
+    struct iovec iov[MAX_BUFFERS];
+    int buffers = 0;
+    int length = count * FRAME_SIZE;
+    for (int offset = 0; offset < length; ++buffers) {
+      int chunk = buffers == MAX_BUFFERS - 1
+                      ? length - offset
+                      : 1 + (int)(next_random(&state) % length);
+      if (chunk > length - offset) {
+        chunk = length - offset;
+      }
+      iov[buffers] =
+          (struct iovec){.iov_base = frames + offset, .iov_len = chunk};
+      offset += chunk;
+    }
+    if (!pipe_out_write(&out, iov, buffers)) {
+      return EXIT_FAILURE;
+    }
+    partial += out.pending != 0;
+    drain(fds[0], &reader, next_random(&state) % MAX_READ);
+  }
+  // Finish whatever frame is left partly written.
+  while (out.pending) {
+    drain(fds[0], &reader, MAX_READ);
+    if (!pipe_out_write(&out, NULL, 0)) {
+      return EXIT_FAILURE;
+    }
+  }
+  drain(fds[0], &reader, (long)PIPE_SIZE * 2);
+  reader.missing += index - reader.next;
+  int good = !reader.errors && !reader.have && partial &&
+             (unsigned long)reader.missing * FRAME_SIZE == out.dropped_bytes;
+  printf("{\"frames\":%u,\"read\":%ld,\"missing\":%ld,\"dropped_bytes\":%lu,"
+         "\"partial_writes\":%ld,\"misaligned\":%ld}\n",
+         index, reader.frames, reader.missing, out.dropped_bytes, partial,
+         reader.errors);
+  fprintf(stderr,
+          "%u frames, %ld read, %ld dropped, %ld writes left a frame partly "
+          "written, %ld frames out of alignment: %s\n",
+          index, reader.frames, reader.missing, partial, reader.errors,
+          good ? "ok" : "FAILED");
+  return good ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,246 @@
+#include "plc.h"
+#include "simd.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// Pattern is overlap-added into the waveform that leads into it over this
+// fraction of a period.
+#define OVERLAP_DIVISOR 4
+
+int plc_init(struct plc* plc, int sample_rate, int channels) {
+  memset(plc, 0, sizeof(*plc));
+  plc->channels = channels;
+  plc->min_period = (int)((long long)sample_rate * PLC_MIN_PERIOD / 1000000);
+  plc->max_period = (int)((long long)sample_rate * PLC_MAX_PERIOD / 1000000);
+  plc->window = sample_rate * PLC_WINDOW / 1000;
+  plc->hold = sample_rate * PLC_HOLD / 1000;
+  plc->fade = sample_rate * PLC_FADE / 1000;
+  plc->merge = sample_rate * PLC_MERGE / 1000;
+  plc->decimation = sample_rate / PLC_SEARCH_RATE;
+  if (plc->decimation < 1) {
+    plc->decimation = 1;
+  }
+  // Longest pattern along with what leads into it, which is also more than
+  // the search takes.
+  plc->capacity = PLC_MAX_PERIODS * plc->max_period +
+                  plc->max_period / OVERLAP_DIVISOR;
+  int span = plc->window + plc->max_period;
+  plc->history = calloc((size_t)plc->capacity * channels, sizeof(float));
+  plc->mono = malloc(span * sizeof(float));
+  plc->decimated = malloc(span * sizeof(float));
+  plc->pattern = malloc((size_t)PLC_MAX_PERIODS * plc->max_period *
+                        channels * sizeof(float));
+  plc->scratch = malloc((size_t)plc->merge * channels * sizeof(float));
+  if (!plc->history || !plc->mono || !plc->decimated || !plc->pattern ||
+      !plc->scratch) {
+    plc_free(plc);
+    return 0;
+  }
+  return 1;
+}
+
+void plc_free(struct plc* plc) {
+  free(plc->history);
+  free(plc->mono);
+  free(plc->decimated);
+  free(plc->pattern);
+  free(plc->scratch);
+}
+
+void plc_reset(struct plc* plc) {
+  plc->filled = 0;
+  plc->concealed = 0;
+}
+
+static void remember(struct plc* plc, const float* samples, int frames) {
+  int channels = plc->channels;
+  int capacity = plc->capacity;
+  if (frames >= capacity) {
+    memcpy(plc->history, samples + (size_t)(frames - capacity) * channels,
+           (size_t)capacity * channels * sizeof(float));
+  } else {
+    memmove(plc->history, plc->history + (size_t)frames * channels,
+            (size_t)(capacity - frames) * channels * sizeof(float));
+    memcpy(plc->history + (size_t)(capacity - frames) * channels, samples,
+           (size_t)frames * channels * sizeof(float));
+  }
+  plc->filled = plc->filled + frames < capacity ? plc->filled + frames
+                                                : capacity;
+}
+
+// Finds the lag between min_lag and max_lag at which the signal best matches
+// its last window, by normalized correlation. Candidates that correlate
+// negatively never match, and the longest lag stands in when none does.
+static int search(const float* signal, int end, int window, int min_lag,
+                  int max_lag) {
+  const float* target = signal + end - window;
+  int best = max_lag;
+  float best_score = 0;
+  for (int lag = min_lag; lag <= max_lag; ++lag) {
+    const float* candidate = target - lag;
+    float correlation = DotProduct(target, candidate, window);
+    float energy = DotProduct(candidate, candidate, window);
+    if (correlation > 0 && energy > 0 &&
+        correlation * correlation > best_score * energy) {
+      best_score = correlation * correlation / energy;
+      best = lag;
+    }
+  }
+  return best;
+}
+
+// Searches the decimated history first, and the full rate one only around
+// what that finds, which takes a fraction of the work of searching at full
+// rate all along. Channels are searched together as one.
+static int find_period(struct plc* plc) {
+  int channels = plc->channels;
+  int span = plc->window + plc->max_period;
+  const float* from =
+      plc->history + (size_t)(plc->capacity - span) * channels;
+  float* restrict mono = plc->mono;
+  if (channels == 1) {
+    memcpy(mono, from, span * sizeof(float));
+  } else {
+    for (int i = 0; i < span; ++i) {
+      float sum = 0;
+      for (int c = 0; c < channels; ++c) {
+        sum += from[i * channels + c];
+      }
+      mono[i] = sum;
+    }
+  }
+  int factor = plc->decimation;
+  int count = span / factor;
+  // Decimated frames line up with the end of the history.
+  const float* source = mono + span - count * factor;
+  float* restrict decimated = plc->decimated;
+  for (int i = 0; i < count; ++i) {
+    float sum = 0;
+    for (int k = 0; k < factor; ++k) {
+      sum += source[i * factor + k];
+    }
+    decimated[i] = sum;
+  }
+  int coarse = search(decimated, count, plc->window / factor,
+                      (plc->min_period + factor - 1) / factor,
+                      plc->max_period / factor);
+  int low = (coarse - 1) * factor;
+  int high = (coarse + 1) * factor;
+  return search(mono, span, plc->window,
+                low > plc->min_period ? low : plc->min_period,
+                high < plc->max_period ? high : plc->max_period);
+}
+
+// Takes the last periods of the history, and blends the end of them into
+// what leads into their start, so that they loop the way the history went.
+static void build_pattern(struct plc* plc) {
+  int channels = plc->channels;
+  int length = plc->period * plc->periods;
+  int overlap = plc->period / OVERLAP_DIVISOR;
+  const float* start =
+      plc->history + (size_t)(plc->capacity - length) * channels;
+  memcpy(plc->pattern, start, (size_t)length * channels * sizeof(float));
+  float* restrict tail =
+      plc->pattern + (size_t)(length - overlap) * channels;
+  const float* lead = start - (size_t)overlap * channels;
+  for (int i = 0; i < overlap; ++i) {
+    float weight = (float)(i + 1) / (overlap + 1);
+    for (int c = 0; c < channels; ++c) {
+      int k = i * channels + c;
+      tail[k] += (lead[k] - tail[k]) * weight;
+    }
+  }
+  plc->length = length;
+}
+
+// Loops over the pattern, over more periods the longer the loss goes on,
+// which sounds less buzzy. Switching only where the pattern wraps keeps the
+// loop seamless.
+static void generate(struct plc* plc, float* samples, int frames) {
+  int channels = plc->channels;
+  while (frames) {
+    int faded = plc->concealed - plc->hold;
+    if (faded >= plc->fade) {
+      memset(samples, 0, (size_t)frames * channels * sizeof(float));
+      plc->concealed += frames;
+      return;
+    }
+    if (plc->position == plc->length) {
+      int periods = 1 + plc->concealed / plc->hold;
+      periods = periods < PLC_MAX_PERIODS ? periods : PLC_MAX_PERIODS;
+      if (periods != plc->periods) {
+        plc->periods = periods;
+        build_pattern(plc);
+      }
+      plc->position = 0;
+    }
+    int chunk = plc->length - plc->position;
+    chunk = chunk < frames ? chunk : frames;
+    const float* restrict source =
+        plc->pattern + (size_t)plc->position * channels;
+    float* restrict target = samples;
+    if (faded < 0) {
+      chunk = chunk < -faded ? chunk : -faded;
+      memcpy(target, source, (size_t)chunk * channels * sizeof(float));
+    } else {
+      chunk = chunk < plc->fade - faded ? chunk : plc->fade - faded;
+      float gain = 1 - (float)faded / plc->fade;
+      float step = -1.f / plc->fade;
+      for (int i = 0; i < chunk; ++i) {
+        for (int c = 0; c < channels; ++c) {
+          target[i * channels + c] =
+              source[i * channels + c] * (gain + step * i);
+        }
+      }
+    }
+    plc->position += chunk;
+    plc->concealed += chunk;
+    samples += (size_t)chunk * channels;
+    frames -= chunk;
+  }
+}
+
+int plc_receive(struct plc* plc, float* samples, int frames) {
+  int merged = 0;
+  if (plc->concealed && frames) {
+    merged = frames < plc->merge ? frames : plc->merge;
+    generate(plc, plc->scratch, merged);
+    int channels = plc->channels;
+    const float* restrict concealed = plc->scratch;
+    for (int i = 0; i < merged; ++i) {
+      float weight = (float)(i + 1) / (merged + 1);
+      for (int c = 0; c < channels; ++c) {
+        float* sample = &samples[i * channels + c];
+        *sample = concealed[i * channels + c] +
+                  (*sample - concealed[i * channels + c]) * weight;
+      }
+    }
+    plc->concealed = 0;
+  }
+  remember(plc, samples, frames);
+  return merged;
+}
+
+// Losses before there is enough history to search are silence.
+void plc_conceal(struct plc* plc, float* samples, int frames) {
+  if (frames <= 0) {
+    return;
+  }
+  if (!plc->concealed) {
+    plc->position = 0;
+    plc->periods = 1;
+    if (plc->filled < plc->capacity) {
+      plc->concealed = plc->hold + plc->fade;
+    } else {
+      plc->period = find_period(plc);
+      build_pattern(plc);
+    }
+  }
+  generate(plc, samples, frames);
+}
+
+int plc_audible(const struct plc* plc) {
+  int audible = plc->hold + plc->fade - plc->concealed;
+  return audible > 0 ? audible : 0;
+}
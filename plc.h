@@ -0,0 +1,57 @@
+// Packet loss concealment for interleaved float frames, by pitch-synchronous
+// waveform extrapolation. Frames that were received are kept as history, and
+// when some are lost, the history is searched for the pitch period whose
+// waveform best continues its last PLC_WINDOW milliseconds. Lost frames then
+// repeat the last period, or the last two or three of them as the loss goes
+// on for more than PLC_HOLD milliseconds each, with the end of the repeated
+// stretch overlap-added into the waveform that leads into its start, so that
+// it loops without a seam. Concealment keeps its level for PLC_HOLD
+// milliseconds and then fades to silence over PLC_FADE more, and frames that
+// end a loss are cross-faded in from its continuation over PLC_MERGE
+// milliseconds.
+//
+// Pitch is searched between PLC_MIN_PERIOD and PLC_MAX_PERIOD microseconds,
+// on a mono copy of the history decimated to about PLC_SEARCH_RATE first, and
+// then at the full rate around the best period found there.
+#define PLC_MIN_PERIOD 2500
+#define PLC_MAX_PERIOD 15000
+#define PLC_WINDOW 10
+#define PLC_SEARCH_RATE 8000
+#define PLC_HOLD 10
+#define PLC_FADE 50
+#define PLC_MERGE 4
+#define PLC_MAX_PERIODS 3
+
+struct plc {
+  int channels;
+  int capacity;
+  int filled;
+  int min_period;
+  int max_period;
+  int window;
+  int hold;
+  int fade;
+  int merge;
+  int decimation;
+  float* history;
+  float* mono;
+  float* decimated;
+  float* pattern;
+  float* scratch;
+  int period;
+  int periods;
+  int length;
+  int position;
+  int concealed;
+};
+
+int plc_init(struct plc* plc, int sample_rate, int channels);
+void plc_free(struct plc* plc);
+void plc_reset(struct plc* plc);
+// Takes frames that were received, and returns how many of them from the
+// start it cross-faded in place from concealment that went before them.
+int plc_receive(struct plc* plc, float* samples, int frames);
+// Makes up frames in place of ones that were lost.
+void plc_conceal(struct plc* plc, float* samples, int frames);
+// Returns how many more frames concealment takes to fade to silence.
+int plc_audible(const struct plc* plc);
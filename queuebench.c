@@ -0,0 +1,217 @@
+#include "bufqueue.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define ROUNDS 200000
+#define WAKEUPS 2000
+#define INTERVAL_US 1000
+#define LENGTH 16
+
+// Runs the queue the sender uses now and the one it used before, which spun
+// on sched_yield until an item came, through two measurements each. Ping-pong
+// passes one item back and forth between two threads ROUNDS times through a
+// pair of queues, and gives pops per second. Wakeup has the producer sleep
+// for INTERVAL_US before every one of WAKEUPS pushes, and gives the time from
+// the push to the pop returning on the other thread, at the median, the 99th
+// percentile and worst, along with the share of a core the consumer took all
+// the while it was waiting. Prints one line of JSON per queue and measurement
+// to stdout and a summary to stderr.
+//
+// The items never number more than one, so the old queue does not get to
+// lose track of the ones behind the first when its indices wrap around.
+struct OldQueue {
+  int length;
+  void** buffers;
+  int head;
+  atomic_int tail;
+  atomic_flag empty;
+};
+
+static void InitOldQueue(struct OldQueue* queue, int length, void** storage) {
+  queue->length = length;
+  queue->buffers = storage;
+  queue->head = 0;
+  atomic_init(&queue->tail, 0);
+  atomic_flag_test_and_set(&queue->empty);
+}
+
+static void OldQueuePush(struct OldQueue* queue, void* buffer) {
+  int tail = atomic_load(&queue->tail);
+  queue->buffers[tail] = buffer;
+  atomic_store(&queue->tail, (tail + 1) % queue->length);
+  atomic_flag_clear(&queue->empty);
+}
+
+static void* OldQueuePop(struct OldQueue* queue, int blocking) {
+  while (atomic_flag_test_and_set(&queue->empty)) {
+    if (!blocking) {
+      return NULL;
+    }
+    sched_yield();
+  }
+  void* result = queue->buffers[queue->head];
+  queue->head = (queue->head + 1) % queue->length;
+  if (atomic_load(&queue->tail) > queue->head) {
+    atomic_flag_clear(&queue->empty);
+  }
+  return result;
+}
+
+struct queues {
+  int old;
+  struct BufferQueue forward;
+  struct BufferQueue backward;
+  struct OldQueue old_forward;
+  struct OldQueue old_backward;
+  void* storage[4][LENGTH];
+  uint64_t* latencies;
+  uint64_t consumer_cpu_ns;
+};
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static uint64_t thread_cpu_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void init_queues(struct queues* queues, int old) {
+  memset(queues, 0, sizeof(*queues));
+  queues->old = old;
+  InitBufferQueue(&queues->forward, LENGTH, queues->storage[0]);
+  InitBufferQueue(&queues->backward, LENGTH, queues->storage[1]);
+  InitOldQueue(&queues->old_forward, LENGTH, queues->storage[2]);
+  InitOldQueue(&queues->old_backward, LENGTH, queues->storage[3]);
+}
+
+static void push(struct queues* queues, int backward, void* item) {
+  if (queues->old) {
+    OldQueuePush(backward ? &queues->old_backward : &queues->old_forward,
+                 item);
+  } else {
+    BufferQueuePush(backward ? &queues->backward : &queues->forward, item);
+  }
+}
+
+static void* pop(struct queues* queues, int backward) {
+  if (queues->old) {
+    return OldQueuePop(
+        backward ? &queues->old_backward : &queues->old_forward, 1);
+  }
+  return BufferQueuePop(backward ? &queues->backward : &queues->forward);
+}
+
+static void* echo(void* arg) {
+  struct queues* queues = arg;
+  for (int i = 0; i < ROUNDS; ++i) {
+    push(queues, 1, pop(queues, 0));
+  }
+  return NULL;
+}
+
+static void* receive(void* arg) {
+  struct queues* queues = arg;
+  uint64_t start = thread_cpu_ns();
+  for (int i = 0; i < WAKEUPS; ++i) {
+    uint64_t* sent = pop(queues, 0);
+    queues->latencies[i] = now_ns() - *sent;
+  }
+  queues->consumer_cpu_ns = thread_cpu_ns() - start;
+  return NULL;
+}
+
+static int compare(const void* a, const void* b) {
+  uint64_t x = *(const uint64_t*)a;
+  uint64_t y = *(const uint64_t*)b;
+  return (x > y) - (x < y);
+}
+
+static int ping_pong(struct queues* queues, const char* name) {
+  pthread_t thread;
+  if (pthread_create(&thread, NULL, echo, queues)) {
+    perror("Failed to start thread");
+    return 0;
+  }
+  int item = 0;
+  uint64_t start = now_ns();
+  for (int i = 0; i < ROUNDS; ++i) {
+    push(queues, 0, &item);
+    pop(queues, 1);
+  }
+  uint64_t elapsed = now_ns() - start;
+  pthread_join(thread, NULL);
+  double ops = 2.0 * ROUNDS / (elapsed / 1e9);
+  printf("{\"queue\":\"%s\",\"test\":\"ping_pong\",\"rounds\":%d,"
+         "\"ops_per_second\":%.0f,\"ns_per_round\":%.1f}\n",
+         name, ROUNDS, ops, (double)elapsed / ROUNDS);
+  fprintf(stderr, "%-4s queue ping-pong: %9.0f pops/s, %7.1f ns per round\n",
+          name, ops, (double)elapsed / ROUNDS);
+  return 1;
+}
+
+static int wakeup(struct queues* queues, const char* name) {
+  uint64_t* sent = malloc(WAKEUPS * sizeof(uint64_t));
+  queues->latencies = malloc(WAKEUPS * sizeof(uint64_t));
+  if (!sent || !queues->latencies) {
+    perror("Failed to allocate latencies");
+    return 0;
+  }
+  pthread_t thread;
+  if (pthread_create(&thread, NULL, receive, queues)) {
+    perror("Failed to start thread");
+    return 0;
+  }
+  uint64_t start = now_ns();
+  for (int i = 0; i < WAKEUPS; ++i) {
+    usleep(INTERVAL_US);
+    sent[i] = now_ns();
+    push(queues, 0, &sent[i]);
+  }
+  pthread_join(thread, NULL);
+  uint64_t elapsed = now_ns() - start;
+  qsort(queues->latencies, WAKEUPS, sizeof(uint64_t), compare);
+  double median = queues->latencies[WAKEUPS / 2] / 1e3;
+  double p99 = queues->latencies[WAKEUPS * 99 / 100] / 1e3;
+  double worst = queues->latencies[WAKEUPS - 1] / 1e3;
+  double cpu = 100.0 * queues->consumer_cpu_ns / elapsed;
+  printf("{\"queue\":\"%s\",\"test\":\"wakeup\",\"wakeups\":%d,"
+         "\"interval_us\":%d,\"median_us\":%.1f,\"p99_us\":%.1f,"
+         "\"max_us\":%.1f,\"consumer_cpu_percent\":%.1f}\n",
+         name, WAKEUPS, INTERVAL_US, median, p99, worst, cpu);
+  fprintf(stderr,
+          "%-4s queue wakeup: median %6.1f us, 99%% %6.1f us, worst %7.1f us, "
+          "consumer took %5.1f%% of a core waiting\n",
+          name, median, p99, worst, cpu);
+  free(sent);
+  free(queues->latencies);
+  return 1;
+}
+
+int main(void) {
+  static struct queues queues;
+  static const char* const names[] = {"new", "old"};
+  for (int old = 0; old < 2; ++old) {
+    init_queues(&queues, old);
+    if (!ping_pong(&queues, names[old])) {
+      return EXIT_FAILURE;
+    }
+    init_queues(&queues, old);
+    if (!wakeup(&queues, names[old])) {
+      return EXIT_FAILURE;
+    }
+  }
+  return EXIT_SUCCESS;
+}
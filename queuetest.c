@@ -0,0 +1,131 @@
+#include "bufqueue.h"
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#define ITEMS 2000000
+#define LENGTH 4
+#define PAUSE_EVERY 4096
+#define PAUSE_US 200
+
+// Passes ITEMS numbered items from one thread to another through a queue of
+// LENGTH slots, with the other thread handing every slot back through a
+// second queue, the way the sender passes buffers around. As only LENGTH
+// slots go around, either queue goes from full to empty and back and wraps
+// around all along. The producer takes slots back with BufferQueueTryPop and
+// falls back to BufferQueuePop when none are there, and stops for PAUSE_US
+// every PAUSE_EVERY items, long enough for the consumer to park in the futex.
+// Fails if an item comes out of order, if a slot comes back with anything but
+// what the consumer last saw in it, or if a queue ever looks fuller than
+// LENGTH. Prints one line of JSON to stdout and a summary to stderr, with how
+// often either queue was seen full or empty and how often either side had to
+// block.
+//
+// Build with -DBUFFER_QUEUE_SPIN_COUNT=0 to have every blocking pop park
+// without spinning first.
+struct slot {
+  uint64_t sequence;
+  uint64_t seen;
+};
+
+struct counts {
+  long full;
+  long empty;
+  long blocked;
+  long errors;
+};
+
+static struct BufferQueue filled;
+static struct BufferQueue spare;
+static struct counts consumer_counts;
+
+static void check_size(struct BufferQueue* queue, struct counts* counts) {
+  int size = BufferQueueSize(queue);
+  if (size < 0 || size > LENGTH) {
+    ++counts->errors;
+  } else if (size == LENGTH) {
+    ++counts->full;
+  } else if (!size) {
+    ++counts->empty;
+  }
+}
+
+static void* consume(void* arg) {
+  (void)arg;
+  struct counts* counts = &consumer_counts;
+  for (uint64_t expected = 0; expected < ITEMS; ++expected) {
+    check_size(&filled, counts);
+    struct slot* slot = BufferQueueTryPop(&filled);
+    if (!slot) {
+      ++counts->blocked;
+      slot = BufferQueuePop(&filled);
+    }
+    if (!slot || slot->sequence != expected) {
+      ++counts->errors;
+      if (!slot) {
+        break;
+      }
+    }
+    slot->seen = slot->sequence;
+    BufferQueuePush(&spare, slot);
+  }
+  return NULL;
+}
+
+int main(void) {
+  void* filled_storage[LENGTH];
+  void* spare_storage[LENGTH];
+  struct slot slots[LENGTH];
+  InitBufferQueue(&filled, LENGTH, filled_storage);
+  InitBufferQueue(&spare, LENGTH, spare_storage);
+  for (int i = 0; i < LENGTH; ++i) {
+    slots[i].sequence = slots[i].seen = UINT64_MAX;
+    BufferQueuePush(&spare, &slots[i]);
+  }
+  struct counts counts = {0};
+  pthread_t consumer;
+  if (pthread_create(&consumer, NULL, consume, NULL)) {
+    perror("Failed to start consumer");
+    return EXIT_FAILURE;
+  }
+  for (uint64_t i = 0; i < ITEMS; ++i) {
+    if (i && !(i % PAUSE_EVERY)) {
+      usleep(PAUSE_US);
+    }
+    check_size(&spare, &counts);
+    struct slot* slot = BufferQueueTryPop(&spare);
+    if (!slot) {
+      ++counts.blocked;
+      slot = BufferQueuePop(&spare);
+    }
+    if (slot->seen != slot->sequence) {
+      ++counts.errors;
+    }
+    slot->sequence = i;
+    BufferQueuePush(&filled, slot);
+  }
+  pthread_join(consumer, NULL);
+  for (int i = 0; i < LENGTH; ++i) {
+    if (slots[i].seen != slots[i].sequence) {
+      ++counts.errors;
+    }
+  }
+  long errors = counts.errors + consumer_counts.errors;
+  printf("{\"items\":%d,\"length\":%d,\"spare_full\":%ld,"
+         "\"spare_empty\":%ld,\"filled_full\":%ld,\"filled_empty\":%ld,"
+         "\"producer_blocked\":%ld,\"consumer_blocked\":%ld,\"errors\":%ld}\n",
+         ITEMS, LENGTH, counts.full, counts.empty, consumer_counts.full,
+         consumer_counts.empty, counts.blocked, consumer_counts.blocked,
+         errors);
+  fprintf(stderr,
+          "%d items through %d slots: spare queue full %ld and empty %ld "
+          "times, filled queue full %ld and empty %ld times, producer "
+          "blocked %ld and consumer %ld times, %ld errors, %s\n",
+          ITEMS, LENGTH, counts.full, counts.empty, consumer_counts.full,
+          consumer_counts.empty, counts.blocked, consumer_counts.blocked,
+          errors, errors ? "FAILED" : "passed");
+  return errors ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,126 @@
+#define _GNU_SOURCE
+
+#include "realtime.h"
+
+#include <errno.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+
+static int ParseCpus(const char* list, cpu_set_t* set) {
+  CPU_ZERO(set);
+  for (const char* it = list; *it;) {
+    char* end;
+    long first = strtol(it, &end, 10);
+    if (end == it) {
+      return 0;
+    }
+    long last = first;
+    if (*end == '-') {
+      it = end + 1;
+      last = strtol(it, &end, 10);
+      if (end == it) {
+        return 0;
+      }
+    }
+    if (first < 0 || last < first || last >= CPU_SETSIZE) {
+      return 0;
+    }
+    for (long cpu = first; cpu <= last; ++cpu) {
+      CPU_SET(cpu, set);
+    }
+    if (*end == ',') {
+      ++end;
+    } else if (*end) {
+      return 0;
+    }
+    it = end;
+  }
+  return CPU_COUNT(set) > 0;
+}
+
+// Stack that was touched once stays mapped, and with memory locked it stays
+// resident as well.
+static void PrefaultStack(void) {
+  char stack[REALTIME_STACK];
+  volatile char* touch = stack;
+  long page_size = sysconf(_SC_PAGESIZE);
+  for (long i = 0; i < REALTIME_STACK; i += page_size) {
+    touch[i] = 0;
+  }
+}
+
+// Scheduling calls with a pid of 0 only change the calling thread on Linux,
+// and nice takes the thread id to do the same.
+void EnterRealtime(int priority, const char* cpus,
+                   struct RealtimeStatus* status) {
+  *status = (struct RealtimeStatus){.priority = priority, .cpus = cpus};
+  struct sched_param param = {.sched_priority = priority};
+  if (sched_setscheduler(0, SCHED_FIFO, &param) == -1) {
+    status->policy_error = errno;
+    if (setpriority(PRIO_PROCESS, (id_t)syscall(SYS_gettid), REALTIME_NICE) ==
+        -1) {
+      status->nice_error = errno;
+    } else {
+      status->nice = REALTIME_NICE;
+    }
+  }
+  if (cpus) {
+    cpu_set_t set;
+    if (!ParseCpus(cpus, &set)) {
+      status->affinity_error = EINVAL;
+    } else if (sched_setaffinity(0, sizeof(set), &set) == -1) {
+      status->affinity_error = errno;
+    }
+  }
+  if (mlockall(MCL_CURRENT | MCL_FUTURE) == -1) {
+    status->lock_error = errno;
+  } else {
+    status->locked = 1;
+  }
+  PrefaultStack();
+}
+
+void DescribeRealtime(const struct RealtimeStatus* status, char* buffer,
+                      int size) {
+  int length;
+  if (!status->policy_error) {
+    length = snprintf(buffer, size, "SCHED_FIFO priority %d",
+                      status->priority);
+  } else if (!status->nice_error) {
+    length = snprintf(buffer, size, "nice %d, SCHED_FIFO failed (%s)",
+                      status->nice, strerror(status->policy_error));
+  } else {
+    length = snprintf(buffer, size,
+                      "default scheduling, SCHED_FIFO failed (%s), nice "
+                      "failed (%s)",
+                      strerror(status->policy_error),
+                      strerror(status->nice_error));
+  }
+  if (length < 0 || length >= size) {
+    return;
+  }
+  if (status->cpus && !status->affinity_error) {
+    length += snprintf(buffer + length, size - length, ", cpus %s",
+                       status->cpus);
+  } else if (status->cpus) {
+    length += snprintf(buffer + length, size - length,
+                       ", cpus %s failed (%s)", status->cpus,
+                       strerror(status->affinity_error));
+  }
+  if (length >= size) {
+    return;
+  }
+  if (status->locked) {
+    snprintf(buffer + length, size - length, ", memory locked");
+  } else {
+    snprintf(buffer + length, size - length, ", memory lock failed (%s)",
+             strerror(status->lock_error));
+  }
+}
@@ -0,0 +1,30 @@
+// Nice value threads fall back to where real-time scheduling is not allowed,
+// and how much of its stack a thread touches up front so that it does not
+// fault it in later.
+#define REALTIME_NICE -10
+#define REALTIME_STACK (256 * 1024)
+
+// What entering real-time took, with errno values of whatever failed and 0
+// for whatever was not asked for or went fine.
+struct RealtimeStatus {
+  int priority;
+  int policy_error;
+  int nice;
+  int nice_error;
+  const char* cpus;
+  int affinity_error;
+  int locked;
+  int lock_error;
+};
+
+// Makes the calling thread SCHED_FIFO at priority, or failing that gives it
+// REALTIME_NICE, pins it to cpus unless that is NULL, locks every page of the
+// process in memory, the ones it maps later included, and touches
+// REALTIME_STACK of its stack. Threads it creates later inherit all but the
+// stack. Cpus are given as a list of numbers and ranges like 0-1,3. Nothing
+// is fatal, and the status tells what took.
+void EnterRealtime(int priority, const char* cpus,
+                   struct RealtimeStatus* status);
+// Writes a line about the status to buffer, without a newline.
+void DescribeRealtime(const struct RealtimeStatus* status, char* buffer,
+                      int size);
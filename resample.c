@@ -0,0 +1,129 @@
+#include "resample.h"
+#include "convert.h"
+#include "simd.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define KAISER_BETA 8.0
+
+static double bessel_i0(double x) {
+  double sum = 1, term = 1;
+  for (int k = 1; k < 32; ++k) {
+    term *= x * x / (4.0 * k * k);
+    sum += term;
+  }
+  return sum;
+}
+
+// Every row holds the filter shifted by a fraction of a sample, and one more
+// row past the last phase saves a bounds check when blending neighbours.
+static void design_filter(float* filter, double cutoff) {
+  const int half = RESAMPLE_TAPS / 2;
+  for (int phase = 0; phase <= RESAMPLE_PHASES; ++phase) {
+    float* row = filter + phase * RESAMPLE_TAPS;
+    for (int k = 0; k < RESAMPLE_TAPS; ++k) {
+      double t = k - half + 1 - (double)phase / RESAMPLE_PHASES;
+      double x = cutoff * t;
+      double sinc = x == 0 ? 1 : sin(M_PI * x) / (M_PI * x);
+      double w = t / half;
+      double window = w <= -1 || w >= 1
+                          ? 0
+                          : bessel_i0(KAISER_BETA * sqrt(1 - w * w)) /
+                                bessel_i0(KAISER_BETA);
+      row[k] = (float)(cutoff * sinc * window);
+    }
+  }
+}
+
+int resampler_init(struct resampler* resampler, int channels, int in_rate,
+                   int out_rate, int max_frames) {
+  memset(resampler, 0, sizeof(*resampler));
+  resampler->channels = channels;
+  resampler->capacity = max_frames + RESAMPLE_TAPS;
+  resampler->ratio = (double)in_rate / out_rate;
+  resampler->step = resampler->ratio;
+  resampler->filter =
+      aligned_alloc(16, (RESAMPLE_PHASES + 1) * RESAMPLE_TAPS * sizeof(float));
+  resampler->history =
+      calloc((size_t)channels * resampler->capacity, sizeof(float));
+  if (!resampler->filter || !resampler->history) {
+    resampler_free(resampler);
+    return 0;
+  }
+  // Cut off below the lower of both Nyquist frequencies.
+  design_filter(resampler->filter, 0.9 * (out_rate < in_rate
+                                              ? (double)out_rate / in_rate
+                                              : 1));
+  // Leading silence centers the filter on the first input frame.
+  resampler->count = RESAMPLE_TAPS / 2 - 1;
+  resampler->position = RESAMPLE_TAPS / 2 - 1;
+  return 1;
+}
+
+void resampler_free(struct resampler* resampler) {
+  free(resampler->filter);
+  free(resampler->history);
+  resampler->filter = NULL;
+  resampler->history = NULL;
+}
+
+void resampler_set_drift(struct resampler* resampler, double drift) {
+  resampler->step = resampler->ratio * drift;
+}
+
+int resampler_max_output(const struct resampler* resampler, int frames) {
+  return (int)((resampler->count + frames) / resampler->step) + 1;
+}
+
+int resampler_process(struct resampler* resampler, const float* input,
+                      int frames, float* output) {
+  const int channels = resampler->channels;
+  const int capacity = resampler->capacity;
+  const int half = RESAMPLE_TAPS / 2;
+  int produced = 0;
+  while (frames) {
+    int chunk = capacity - resampler->count;
+    if (chunk > frames) {
+      chunk = frames;
+    }
+    Deinterleave(input, chunk, channels,
+                 resampler->history + resampler->count, capacity);
+    resampler->count += chunk;
+    input += chunk * channels;
+    frames -= chunk;
+    for (;;) {
+      int index = (int)resampler->position;
+      if (index + half >= resampler->count) {
+        break;
+      }
+      double phase = (resampler->position - index) * RESAMPLE_PHASES;
+      int row = (int)phase;
+      float blend = (float)(phase - row);
+      const float* early = resampler->filter + row * RESAMPLE_TAPS;
+      const float* late = early + RESAMPLE_TAPS;
+      for (int c = 0; c < channels; ++c) {
+        const float* window =
+            resampler->history + c * capacity + index - half + 1;
+        float a = DotProduct(early, window, RESAMPLE_TAPS);
+        float b = DotProduct(late, window, RESAMPLE_TAPS);
+        *output++ = a + (b - a) * blend;
+      }
+      resampler->position += resampler->step;
+      produced++;
+    }
+    // Drop what the filter no longer reaches.
+    int consumed = (int)resampler->position - half + 1;
+    if (consumed > 0) {
+      int remaining = resampler->count - consumed;
+      for (int c = 0; c < channels; ++c) {
+        float* history = resampler->history + c * capacity;
+        memmove(history, history + consumed, remaining * sizeof(float));
+      }
+      resampler->count = remaining;
+      resampler->position -= consumed;
+    }
+  }
+  return produced;
+}
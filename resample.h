@@ -0,0 +1,25 @@
+// Polyphase windowed-sinc resampler for interleaved float frames. The filter
+// bank holds RESAMPLE_PHASES fractional delays, and the coefficients of the
+// two nearest ones are blended, so the ratio can be changed by a few parts
+// per million at any time to follow the clocks on both ends.
+#define RESAMPLE_TAPS 32
+#define RESAMPLE_PHASES 256
+
+struct resampler {
+  int channels;
+  int capacity;
+  int count;
+  double step;
+  double ratio;
+  double position;
+  float* filter;
+  float* history;
+};
+
+int resampler_init(struct resampler* resampler, int channels, int in_rate,
+                   int out_rate, int max_frames);
+void resampler_free(struct resampler* resampler);
+void resampler_set_drift(struct resampler* resampler, double drift);
+int resampler_max_output(const struct resampler* resampler, int frames);
+int resampler_process(struct resampler* resampler, const float* input,
+                      int frames, float* output);
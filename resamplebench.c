@@ -0,0 +1,219 @@
+#include "drift.h"
+#include "resample.h"
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define DURATION 60
+#define SETTLE 20
+#define TICK_MS 10
+#define PREFILL_MS 20
+#define SLACK_MS 5
+#define AMPLITUDE 0.5
+#define QUALITY_BAR -80.0
+
+// Plays a tone through the resampler between 44.1 and 48 kHz both ways, the
+// way pamnc does with -r, with the ratio following how full the pipe gets
+// through drift.c. Input comes TICK_MS at a time at its nominal rate, and the
+// pipe starts out holding PREFILL_MS and is read at the output rate, running
+// some parts per million slow, first not at all and then by as much as given
+// with -p. Prints
+// one line of JSON per rate pair, tone and reader clock to stdout and a
+// summary to stderr, with the time resampling took per output sample of every
+// channel, THD+N of the output, the mean correction drift.c made and how full
+// the pipe got, all over what comes after the first SETTLE seconds. Fails if
+// THD+N is not below QUALITY_BAR dB, or if the pipe gets further than
+// SLACK_MS from where it started, as it would within 20 seconds at 300 ppm
+// uncorrected.
+//
+// THD+N is the power of what is left once the best fitting sine is taken out
+// of the output, against the power of that sine. The sine follows the input
+// position of every output sample, so that changes in the ratio do not count
+// as distortion.
+struct run {
+  int in_rate;
+  int out_rate;
+  double frequency;
+  double ppm;
+};
+
+struct result {
+  double ns_per_sample;
+  double thd_n_db;
+  double correction_ppm;
+  double fill_min_ms;
+  double fill_max_ms;
+};
+
+static const int rates[][2] = {{44100, 48000}, {48000, 44100}};
+static const double frequencies[] = {1000, 10000};
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int simulate(const struct run* run, int channels, int duration,
+                    struct result* result) {
+  int tick = run->in_rate * TICK_MS / 1000;
+  struct resampler resampler;
+  if (!resampler_init(&resampler, channels, run->in_rate, run->out_rate,
+                      tick)) {
+    return 0;
+  }
+  int max_output = resampler_max_output(&resampler, tick) * 2;
+  float* input = malloc((size_t)tick * channels * sizeof(float));
+  float* output = malloc((size_t)max_output * channels * sizeof(float));
+  if (!input || !output) {
+    free(input);
+    free(output);
+    resampler_free(&resampler);
+    return 0;
+  }
+  struct drift drift;
+  drift_reset(&drift);
+  double reader_rate = run->out_rate * (1 - run->ppm * 1e-6);
+  double omega = 2 * M_PI * run->frequency / run->in_rate;
+  // Sums for the least squares fit of a sine, and the power of the output.
+  double ss = 0, sc = 0, cc = 0, ys = 0, yc = 0, yy = 0;
+  // Input position of the next output sample, in whole frames and a
+  // fraction kept small, as summing steps into one large double drifts.
+  int64_t whole = 0;
+  double fraction = 0;
+  int64_t written = (int64_t)run->out_rate * PREFILL_MS / 1000;
+  int64_t fed = 0;
+  int settled_ticks = SETTLE * 1000 / TICK_MS;
+  int ticks = duration * 1000 / TICK_MS;
+  uint64_t elapsed = 0;
+  int64_t produced_total = 0;
+  double correction_sum = 0;
+  result->fill_min_ms = INFINITY;
+  result->fill_max_ms = -INFINITY;
+  for (int t = 0; t < ticks; ++t) {
+    for (int i = 0; i < tick; ++i, ++fed) {
+      float value = (float)(AMPLITUDE * sin(omega * fed));
+      for (int c = 0; c < channels; ++c) {
+        input[i * channels + c] = value;
+      }
+    }
+    double step = resampler.step;
+    uint64_t start = now_ns();
+    int produced = resampler_process(&resampler, input, tick, output);
+    elapsed += now_ns() - start;
+    produced_total += produced;
+    written += produced;
+    for (int i = 0; i < produced; ++i, fraction += step) {
+      if (t < settled_ticks) {
+        continue;
+      }
+      double angle = omega * whole + omega * fraction;
+      double s = sin(angle);
+      double c = cos(angle);
+      double y = output[i * channels];
+      ss += s * s;
+      sc += s * c;
+      cc += c * c;
+      ys += y * s;
+      yc += y * c;
+      yy += y * y;
+    }
+    whole += (int64_t)fraction;
+    fraction -= (int64_t)fraction;
+    uint64_t now = (uint64_t)(t + 1) * TICK_MS * 1000000;
+    int64_t fill = written - (int64_t)(now / 1e9 * reader_rate);
+    drift_update(&drift, fill * 1000000000 / run->out_rate, now);
+    resampler_set_drift(&resampler, drift.correction);
+    if (t >= settled_ticks) {
+      correction_sum += drift.correction - 1;
+      double fill_ms = fill * 1000.0 / run->out_rate;
+      result->fill_min_ms = fmin(result->fill_min_ms, fill_ms);
+      result->fill_max_ms = fmax(result->fill_max_ms, fill_ms);
+    }
+  }
+  // Solve for the sine that fits best, and take out what it explains.
+  double det = ss * cc - sc * sc;
+  double a = (ys * cc - yc * sc) / det;
+  double b = (yc * ss - ys * sc) / det;
+  double signal = a * a * ss + 2 * a * b * sc + b * b * cc;
+  double noise = yy - (a * ys + b * yc);
+  result->ns_per_sample = (double)elapsed / produced_total / channels;
+  result->thd_n_db = 10 * log10(noise / signal);
+  result->correction_ppm = correction_sum / (ticks - settled_ticks) * 1e6;
+  free(input);
+  free(output);
+  resampler_free(&resampler);
+  return 1;
+}
+
+int main(int argc, char** argv) {
+  int channels = 1;
+  int duration = DURATION;
+  double ppm = 300;
+  for (int opt; (opt = getopt(argc, argv, "c:d:p:")) != -1;) {
+    switch (opt) {
+      case 'c':
+        channels = atoi(optarg);
+        break;
+      case 'd':
+        duration = atoi(optarg);
+        break;
+      case 'p':
+        ppm = atof(optarg);
+        break;
+      default:
+        channels = 0;
+        break;
+    }
+  }
+  if (optind != argc || channels <= 0 || duration <= SETTLE) {
+    fprintf(stderr,
+            "Usage: %s [-c channels] [-d seconds, over %d] [-p ppm]\n",
+            argv[0], SETTLE);
+    return EXIT_FAILURE;
+  }
+  const double clocks[] = {0, ppm};
+  int result = EXIT_SUCCESS;
+  for (size_t r = 0; r < sizeof(rates) / sizeof(*rates); ++r) {
+    for (size_t f = 0; f < sizeof(frequencies) / sizeof(*frequencies); ++f) {
+      for (size_t p = 0; p < sizeof(clocks) / sizeof(*clocks); ++p) {
+        struct run run = {rates[r][0], rates[r][1], frequencies[f],
+                          clocks[p]};
+        struct result measured;
+        if (!simulate(&run, channels, duration, &measured)) {
+          perror("Failed to allocate resampler");
+          return EXIT_FAILURE;
+        }
+        int good = measured.thd_n_db < QUALITY_BAR &&
+                   measured.fill_min_ms > PREFILL_MS - SLACK_MS &&
+                   measured.fill_max_ms < PREFILL_MS + SLACK_MS;
+        printf("{\"in_rate\":%d,\"out_rate\":%d,\"frequency\":%.0f,"
+               "\"channels\":%d,\"reader_ppm\":%.1f,"
+               "\"ns_per_sample\":%.2f,\"thd_n_db\":%.2f,"
+               "\"correction_ppm\":%.1f,\"fill_min_ms\":%.2f,"
+               "\"fill_max_ms\":%.2f}\n",
+               run.in_rate, run.out_rate, run.frequency, channels, run.ppm,
+               measured.ns_per_sample, measured.thd_n_db,
+               measured.correction_ppm, measured.fill_min_ms,
+               measured.fill_max_ms);
+        fprintf(stderr,
+                "%5d -> %5d Hz, %5.0f Hz tone, reader %4.0f ppm slow: "
+                "%5.2f ns per sample, THD+N %6.2f dB, correction %+6.1f "
+                "ppm, pipe %.2f to %.2f ms, %s\n",
+                run.in_rate, run.out_rate, run.frequency, run.ppm,
+                measured.ns_per_sample, measured.thd_n_db,
+                measured.correction_ppm, measured.fill_min_ms,
+                measured.fill_max_ms, good ? "good" : "NOT GOOD");
+        if (!good) {
+          result = EXIT_FAILURE;
+        }
+      }
+    }
+  }
+  return result;
+}
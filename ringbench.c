@@ -0,0 +1,331 @@
+#define _GNU_SOURCE
+
+#include "shmring.h"
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#define MAX_RUNS 16
+#define MAX_READERS 16
+#define DURATION 5
+#define SAMPLE_RATE 48000
+#define BUFFER_FRAMES 512
+#define RING_MS 1000
+#define WAIT_MS 100
+
+// Stands in for pamnc with one mono s16le stream, whose ring it hands out to
+// readers the way pamnc does and writes into every BUFFER_FRAMES at the real
+// time cadence, for every reader count in turn. Readers are processes of
+// their own that only use shmring.h: they connect, park in shm_ring_wait
+// whenever they are through with what was written, and check every sample
+// they read. Prints one line of JSON per reader count to stdout and a summary
+// to stderr, with how long after a write readers woke up to it, as the p50,
+// p99 and max over all readers, what every reader and the writer took of the
+// CPU, and how much readers lost or saw overwritten. Fails if any reader got
+// a sample wrong, lost data or saw data overwritten.
+//
+// Samples count up from 0, so that every one can be checked against its
+// position in the stream.
+struct reader_result {
+  int wakeups;
+  long bytes;
+  long mismatched;
+  long torn;
+  uint64_t lost;
+  uint64_t latencies[];
+};
+
+struct shared {
+  atomic_int ready;
+  atomic_int done;
+  int max_wakeups;
+  size_t result_size;
+  uint8_t results[];
+};
+
+static struct reader_result* result_of(struct shared* shared, int index) {
+  return (struct reader_result*)(shared->results +
+                                 index * shared->result_size);
+}
+
+static int parse_list(const char* arg, int* values, int max) {
+  int count = 0;
+  for (char* end; *arg && count < max; arg = *end ? end + 1 : end) {
+    values[count] = (int)strtol(arg, &end, 10);
+    if (end == arg || values[count] <= 0 || (*end && *end != ',')) {
+      return 0;
+    }
+    count++;
+  }
+  return *arg ? 0 : count;
+}
+
+static int compare(const void* a, const void* b) {
+  uint64_t x = *(const uint64_t*)a;
+  uint64_t y = *(const uint64_t*)b;
+  return (x > y) - (x < y);
+}
+
+static void check(struct reader_result* result, const uint8_t* data,
+                  uint64_t position, size_t length) {
+  // Writes are whole samples, so reads start on one too.
+  for (size_t i = 0; i < length; i += 2) {
+    uint16_t sample = (uint16_t)(data[i] | data[i + 1] << 8);
+    if (sample != (uint16_t)((position + i) / 2)) {
+      result->mismatched++;
+    }
+  }
+}
+
+static void read_ring(struct shared* shared, struct reader_result* result) {
+  struct shm_ring_reader reader;
+  char name[SHM_RING_NAME_SIZE];
+  if (!shm_ring_connect(&reader, NULL, name)) {
+    perror("Failed to connect to ring");
+    exit(EXIT_FAILURE);
+  }
+  atomic_fetch_add(&shared->ready, 1);
+  int woken = 0;
+  for (;;) {
+    size_t length;
+    const uint8_t* data = shm_ring_peek(&reader, &length);
+    if (!length) {
+      if (atomic_load(&shared->done)) {
+        break;
+      }
+      woken = shm_ring_wait(&reader, WAIT_MS);
+      continue;
+    }
+    if (woken && result->wakeups < shared->max_wakeups) {
+      result->latencies[result->wakeups++] =
+          shm_ring_now() - atomic_load_explicit(&reader.ring->write_time,
+                                                memory_order_relaxed);
+    }
+    woken = 0;
+    // After skipping ahead, the cursor is wherever the writer was.
+    check(result, data, reader.cursor, length);
+    if (!shm_ring_consume(&reader, length)) {
+      result->torn++;
+    }
+    result->bytes += length;
+  }
+  result->lost = reader.lost;
+  shm_ring_close(&reader);
+}
+
+static int open_socket(void) {
+  int sock = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+  struct sockaddr_un addr = {.sun_family = AF_UNIX};
+  memcpy(addr.sun_path + 1, SHM_RING_SOCKET, sizeof(SHM_RING_SOCKET) - 1);
+  if (sock == -1 ||
+      bind(sock, (struct sockaddr*)&addr,
+           offsetof(struct sockaddr_un, sun_path) + sizeof(SHM_RING_SOCKET)) ==
+          -1) {
+    perror("Failed to bind ring socket, is pamnc running");
+    return -1;
+  }
+  return sock;
+}
+
+// Answers one request for a ring the way pamnc does.
+static int serve(int sock, int fd, const char* name) {
+  char request[SHM_RING_NAME_SIZE];
+  struct sockaddr_un addr;
+  socklen_t addr_len = sizeof(addr);
+  if (recvfrom(sock, request, sizeof(request), 0, (struct sockaddr*)&addr,
+               &addr_len) == -1) {
+    perror("Failed to read ring request");
+    return 0;
+  }
+  union {
+    struct cmsghdr header;
+    char buffer[CMSG_SPACE(sizeof(int))];
+  } control;
+  struct iovec iov = {.iov_base = (void*)name, .iov_len = strlen(name)};
+  struct msghdr msg = {.msg_name = &addr,
+                       .msg_namelen = addr_len,
+                       .msg_iov = &iov,
+                       .msg_iovlen = 1,
+                       .msg_control = control.buffer,
+                       .msg_controllen = sizeof(control.buffer)};
+  struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+  memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+  if (sendmsg(sock, &msg, 0) == -1) {
+    perror("Failed to answer ring request");
+    return 0;
+  }
+  return 1;
+}
+
+static double thread_cpu_ms(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+  return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+static int run(int sock, struct shared* shared, int readers, int duration) {
+  struct shm_ring_writer writer;
+  if (!shm_ring_create(&writer, "ringbench",
+                       (size_t)SAMPLE_RATE * 2 * RING_MS / 1000)) {
+    perror("Failed to create ring");
+    return 0;
+  }
+  shm_ring_set_format(&writer, SAMPLE_RATE, 1, 0);
+  memset(shared->results, 0, readers * shared->result_size);
+  atomic_store(&shared->ready, 0);
+  atomic_store(&shared->done, 0);
+  pid_t pids[MAX_READERS];
+  int ok = 1;
+  for (int i = 0; i < readers; ++i) {
+    pids[i] = fork();
+    if (!pids[i]) {
+      read_ring(shared, result_of(shared, i));
+      _exit(EXIT_SUCCESS);
+    }
+    if (pids[i] == -1 || !serve(sock, writer.fd, "ringbench")) {
+      perror("Failed to start reader");
+      readers = i + (pids[i] != -1);
+      ok = 0;
+      break;
+    }
+  }
+  while (ok && atomic_load(&shared->ready) < readers) {
+    usleep(1000);
+  }
+  int16_t buffer[BUFFER_FRAMES];
+  uint16_t sample = 0;
+  int buffers = duration * SAMPLE_RATE / BUFFER_FRAMES;
+  uint64_t period = (uint64_t)BUFFER_FRAMES * 1000000000 / SAMPLE_RATE;
+  struct timespec next;
+  clock_gettime(CLOCK_MONOTONIC, &next);
+  double cpu = thread_cpu_ms();
+  for (int b = 0; ok && b < buffers; ++b) {
+    for (int i = 0; i < BUFFER_FRAMES; ++i) {
+      buffer[i] = (int16_t)sample++;
+    }
+    shm_ring_write(&writer, buffer, sizeof(buffer));
+    next.tv_nsec += period;
+    if (next.tv_nsec >= 1000000000) {
+      next.tv_sec++;
+      next.tv_nsec -= 1000000000;
+    }
+    clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+  }
+  cpu = thread_cpu_ms() - cpu;
+  atomic_store(&shared->done, 1);
+  double reader_cpu = 0;
+  for (int i = 0; i < readers; ++i) {
+    int status;
+    struct rusage usage;
+    if (wait4(pids[i], &status, 0, &usage) == -1 || !WIFEXITED(status) ||
+        WEXITSTATUS(status)) {
+      ok = 0;
+    }
+    reader_cpu += (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1e3 +
+                  (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e3;
+  }
+  shm_ring_destroy(&writer);
+  if (!ok) {
+    return 0;
+  }
+  uint64_t* latencies =
+      malloc((size_t)readers * shared->max_wakeups * sizeof(uint64_t));
+  if (!latencies) {
+    perror("Failed to allocate latencies");
+    return 0;
+  }
+  int count = 0;
+  long mismatched = 0, torn = 0, bytes = 0;
+  uint64_t lost = 0;
+  for (int i = 0; i < readers; ++i) {
+    struct reader_result* result = result_of(shared, i);
+    memcpy(latencies + count, result->latencies,
+           result->wakeups * sizeof(uint64_t));
+    count += result->wakeups;
+    mismatched += result->mismatched;
+    torn += result->torn;
+    lost += result->lost;
+    bytes += result->bytes;
+  }
+  qsort(latencies, count, sizeof(uint64_t), compare);
+  double p50 = count ? latencies[count / 2] / 1e3 : 0;
+  double p99 = count ? latencies[count * 99 / 100] / 1e3 : 0;
+  double max = count ? latencies[count - 1] / 1e3 : 0;
+  free(latencies);
+  long expected = (long)readers * buffers * sizeof(buffer);
+  int good = !mismatched && !torn && !lost && bytes == expected;
+  printf("{\"readers\":%d,\"seconds\":%d,\"buffer_frames\":%d,"
+         "\"wakeups\":%d,\"wake_p50_us\":%.1f,\"wake_p99_us\":%.1f,"
+         "\"wake_max_us\":%.1f,\"reader_cpu_ms\":%.2f,"
+         "\"writer_cpu_ms\":%.2f,\"bytes\":%ld,\"lost_bytes\":%llu,"
+         "\"torn_reads\":%ld,\"mismatched_samples\":%ld}\n",
+         readers, duration, BUFFER_FRAMES, count, p50, p99, max,
+         reader_cpu / readers, cpu, bytes, (unsigned long long)lost, torn,
+         mismatched);
+  fprintf(stderr,
+          "%2d readers: wake p50 %6.1f us p99 %6.1f us max %7.1f us, "
+          "%6.2f ms CPU per reader, %6.2f ms writer, %s\n",
+          readers, p50, p99, max, reader_cpu / readers, cpu,
+          good ? "intact" : "NOT INTACT");
+  return good;
+}
+
+int main(int argc, char** argv) {
+  int counts[MAX_RUNS] = {1, 2, 4, 8, 16};
+  int runs = 5;
+  int duration = DURATION;
+  for (int opt; (opt = getopt(argc, argv, "r:t:")) != -1;) {
+    switch (opt) {
+      case 'r':
+        runs = parse_list(optarg, counts, MAX_RUNS);
+        for (int i = 0; i < runs; ++i) {
+          if (counts[i] > MAX_READERS) {
+            runs = 0;
+          }
+        }
+        break;
+      case 't':
+        duration = atoi(optarg);
+        break;
+      default:
+        runs = 0;
+        break;
+    }
+  }
+  if (optind != argc || !runs || duration <= 0) {
+    fprintf(stderr, "Usage: %s [-r readers,...] [-t seconds]\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+  int sock = open_socket();
+  if (sock == -1) {
+    return EXIT_FAILURE;
+  }
+  // Readers wake up to data at most once for every buffer.
+  int max_wakeups = duration * SAMPLE_RATE / BUFFER_FRAMES;
+  size_t result_size =
+      sizeof(struct reader_result) + max_wakeups * sizeof(uint64_t);
+  result_size = (result_size + 63) / 64 * 64;
+  struct shared* shared =
+      mmap(NULL, sizeof(*shared) + MAX_READERS * result_size,
+           PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (shared == MAP_FAILED) {
+    perror("Failed to map results");
+    return EXIT_FAILURE;
+  }
+  shared->max_wakeups = max_wakeups;
+  shared->result_size = result_size;
+  int result = EXIT_SUCCESS;
+  for (int r = 0; r < runs; ++r) {
+    if (!run(sock, shared, counts[r], duration)) {
+      result = EXIT_FAILURE;
+    }
+  }
+  close(sock);
+  return result;
+}
@@ -0,0 +1,192 @@
+#define _GNU_SOURCE
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAX_RUNS 16
+#define MAX_SUBSCRIBERS 16
+#define DATAGRAMS 20000
+#define DATAGRAM_SIZE 972
+
+// Sends datagrams over loopback to every subscriber of a sweep of subscriber
+// counts, once with a single sendmmsg per datagram the way the sender does,
+// and once with a loop of sendto, the way it did before. Every subscriber is
+// a socket of its own, drained after every datagram outside of the time
+// measured, so that none ever drops anything. Prints one line of JSON per
+// subscriber count and way of sending to stdout and a summary to stderr, with
+// the wall and CPU time per datagram and per copy sent. Fails if any copy
+// does not go out.
+//
+// On loopback the kernel delivers every copy within the call, so the time
+// taken is about what both ends take in the kernel. Over a network interface
+// the receive side would not count, and the syscall entries sendmmsg saves
+// would weigh a little more.
+enum method { SENDMMSG, SENDTO, METHOD_COUNT };
+
+static const char* const method_names[] = {"sendmmsg", "sendto"};
+
+static uint64_t clock_ns(clockid_t clock) {
+  struct timespec ts;
+  clock_gettime(clock, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int parse_list(const char* arg, int* values, int max) {
+  int count = 0;
+  for (char* end; *arg && count < max; arg = *end ? end + 1 : end) {
+    values[count] = (int)strtol(arg, &end, 10);
+    if (end == arg || values[count] <= 0 || (*end && *end != ',')) {
+      return 0;
+    }
+    count++;
+  }
+  return *arg ? 0 : count;
+}
+
+static int open_subscriber(struct sockaddr_in* addr) {
+  int fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+  socklen_t length = sizeof(*addr);
+  *addr = (struct sockaddr_in){.sin_family = AF_INET,
+                               .sin_addr.s_addr = htonl(INADDR_LOOPBACK)};
+  if (fd == -1 || bind(fd, (struct sockaddr*)addr, sizeof(*addr)) == -1 ||
+      getsockname(fd, (struct sockaddr*)addr, &length) == -1) {
+    perror("Failed to open subscriber");
+    if (fd != -1) {
+      close(fd);
+    }
+    return -1;
+  }
+  return fd;
+}
+
+// Returns how many copies went out.
+static int send_copies(enum method method, int fd,
+                       const struct sockaddr_in* addrs, int count,
+                       const void* data, int size) {
+  if (method == SENDTO) {
+    int sent = 0;
+    for (int i = 0; i < count; ++i) {
+      sent += sendto(fd, data, size, 0, (const struct sockaddr*)&addrs[i],
+                     sizeof(addrs[i])) == size;
+    }
+    return sent;
+  }
+  struct iovec iov = {.iov_base = (void*)(uintptr_t)data, .iov_len = size};
+  struct mmsghdr msgs[MAX_SUBSCRIBERS];
+  for (int i = 0; i < count; ++i) {
+    msgs[i] = (struct mmsghdr){
+        .msg_hdr = {.msg_name = (void*)(uintptr_t)&addrs[i],
+                    .msg_namelen = sizeof(addrs[i]),
+                    .msg_iov = &iov,
+                    .msg_iovlen = 1}};
+  }
+  int sent = 0;
+  while (sent < count) {
+    int result = sendmmsg(fd, msgs + sent, count - sent, 0);
+    if (result <= 0) {
+      break;
+    }
+    sent += result;
+  }
+  return sent;
+}
+
+int main(int argc, char** argv) {
+  int counts[MAX_RUNS] = {1, 2, 4, 8, 16};
+  int runs = 5;
+  int datagrams = DATAGRAMS;
+  int size = DATAGRAM_SIZE;
+  for (int opt; (opt = getopt(argc, argv, "n:r:s:")) != -1;) {
+    switch (opt) {
+      case 'n':
+        datagrams = atoi(optarg);
+        break;
+      case 'r':
+        runs = parse_list(optarg, counts, MAX_RUNS);
+        for (int i = 0; i < runs; ++i) {
+          if (counts[i] > MAX_SUBSCRIBERS) {
+            runs = 0;
+          }
+        }
+        break;
+      case 's':
+        size = atoi(optarg);
+        break;
+      default:
+        runs = 0;
+        break;
+    }
+  }
+  if (optind != argc || !runs || datagrams <= 0 || size <= 0 ||
+      size > 65507) {
+    fprintf(stderr,
+            "Usage: %s [-n datagrams] [-r subscribers,...] [-s bytes]\n",
+            argv[0]);
+    return EXIT_FAILURE;
+  }
+  struct sockaddr_in addrs[MAX_SUBSCRIBERS];
+  int fds[MAX_SUBSCRIBERS];
+  for (int i = 0; i < MAX_SUBSCRIBERS; ++i) {
+    if ((fds[i] = open_subscriber(&addrs[i])) == -1) {
+      return EXIT_FAILURE;
+    }
+  }
+  int fd = socket(AF_INET, SOCK_DGRAM, 0);
+  char* data = calloc(1, size);
+  char* drain = malloc(size);
+  if (fd == -1 || !data || !drain) {
+    perror("Failed to set up");
+    return EXIT_FAILURE;
+  }
+  int result = EXIT_SUCCESS;
+  for (int r = 0; r < runs; ++r) {
+    int count = counts[r];
+    for (int m = 0; m < METHOD_COUNT; ++m) {
+      uint64_t wall = 0;
+      uint64_t cpu = 0;
+      long sent = 0;
+      for (int d = 0; d < datagrams; ++d) {
+        uint64_t wall_start = clock_ns(CLOCK_MONOTONIC);
+        uint64_t cpu_start = clock_ns(CLOCK_PROCESS_CPUTIME_ID);
+        sent += send_copies((enum method)m, fd, addrs, count, data, size);
+        cpu += clock_ns(CLOCK_PROCESS_CPUTIME_ID) - cpu_start;
+        wall += clock_ns(CLOCK_MONOTONIC) - wall_start;
+        for (int i = 0; i < count; ++i) {
+          while (recv(fds[i], drain, size, 0) > 0) {
+          }
+        }
+      }
+      double us = wall / 1e3 / datagrams;
+      double cpu_us = cpu / 1e3 / datagrams;
+      int complete = sent == (long)count * datagrams;
+      printf("{\"method\":\"%s\",\"subscribers\":%d,\"datagrams\":%d,"
+             "\"bytes\":%d,\"us_per_datagram\":%.3f,"
+             "\"cpu_us_per_datagram\":%.3f,\"us_per_copy\":%.3f,"
+             "\"copies_sent\":%ld}\n",
+             method_names[m], count, datagrams, size, us, cpu_us, us / count,
+             sent);
+      fprintf(stderr,
+              "%2d subscribers, %-8s: %7.2f us per datagram, %7.2f us of CPU, "
+              "%5.2f us per copy%s\n",
+              count, method_names[m], us, cpu_us, us / count,
+              complete ? "" : ", NOT ALL SENT");
+      if (!complete) {
+        result = EXIT_FAILURE;
+      }
+    }
+  }
+  for (int i = 0; i < MAX_SUBSCRIBERS; ++i) {
+    close(fds[i]);
+  }
+  close(fd);
+  free(data);
+  free(drain);
+  return result;
+}
@@ -0,0 +1,818 @@
+#define _GNU_SOURCE
+
+#include "sender.h"
+#include "bufqueue.h"
+#include "buftune.h"
+#include "capture.h"
+#include "codec.h"
+#include "control.h"
+#include "convert.h"
+#include "dsp.h"
+#include "fec.h"
+#include "metrics.h"
+#include "packet.h"
+#include "realtime.h"
+#include "utils.h"
+#include "vad.h"
+
+#include <errno.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <arpa/inet.h>
+
+// Options can be given as key=value strings, either from the command line of
+// the host build or from a configuration file on the phone. Options with a
+// list of values take the index of the one that was given, and options with a
+// size are strings of up to that many bytes, terminator included.
+struct SenderOption {
+  const char* name;
+  size_t offset;
+  const char* const* values;
+  size_t size;
+};
+
+static const char* const encodings[] = {
+    [PACKET_ENCODING_S16LE] = "s16le",
+    [PACKET_ENCODING_S24LE] = "s24le",
+    [PACKET_ENCODING_F32LE] = "f32le",
+    NULL,
+};
+
+static const struct SenderOption sender_options[] = {
+    {"channels", offsetof(struct Sender, channels), NULL, 0},
+    {"encoding", offsetof(struct Sender, encoding), encodings, 0},
+    {"codec", offsetof(struct Sender, codec), NULL, 0},
+    {"port", offsetof(struct Sender, port), NULL, 0},
+    {"multicast", offsetof(struct Sender, multicast), NULL,
+     sizeof(((struct Sender*)0)->multicast)},
+    {"multicast_port", offsetof(struct Sender, multicast_port), NULL, 0},
+    {"multicast_ttl", offsetof(struct Sender, multicast_ttl), NULL, 0},
+    {"mtu", offsetof(struct Sender, mtu), NULL, 0},
+    {"max_latency", offsetof(struct Sender, max_latency), NULL, 0},
+    {"fec", offsetof(struct Sender, fec), NULL, 0},
+    {"fec_interleave", offsetof(struct Sender, fec_interleave), NULL, 0},
+    {"vad", offsetof(struct Sender, vad), NULL, 0},
+    {"vad_threshold", offsetof(struct Sender, vad_threshold), NULL, 0},
+    {"vad_hangover", offsetof(struct Sender, vad_hangover), NULL, 0},
+    {"dsp_highpass", offsetof(struct Sender, dsp_highpass), NULL, 0},
+    {"dsp_gain", offsetof(struct Sender, dsp_gain), NULL, 0},
+    {"dsp_agc", offsetof(struct Sender, dsp_agc), NULL, 0},
+    {"dsp_agc_max", offsetof(struct Sender, dsp_agc_max), NULL, 0},
+    {"dsp_gate", offsetof(struct Sender, dsp_gate), NULL, 0},
+    {"dsp_limit", offsetof(struct Sender, dsp_limit), NULL, 0},
+    {"dsp_budget", offsetof(struct Sender, dsp_budget), NULL, 0},
+    {"buffers", offsetof(struct Sender, buffers), NULL, 0},
+    {"realtime", offsetof(struct Sender, realtime), NULL, 0},
+    {"realtime_cpus", offsetof(struct Sender, realtime_cpus), NULL,
+     sizeof(((struct Sender*)0)->realtime_cpus)},
+};
+
+_Static_assert(SENDER_MAX_SUBSCRIBERS == CONTROL_MAX_SUBSCRIBERS,
+               "Subscriber table size mismatch");
+
+// IPv4 and UDP headers take this much of every datagram, and IPv6 and UDP
+// headers this much.
+#define UDP_OVERHEAD 28
+#define UDP6_OVERHEAD 48
+
+// Datagrams go to every subscriber from the socket, or only to the group
+// while multicast is set. Overhead is that of the headers on the way.
+struct Destination {
+  int fd;
+  int multicast;
+  struct sockaddr_in6 group;
+  int overhead;
+};
+
+struct SenderStats {
+  unsigned datagrams;
+  unsigned long payload_bytes;
+  unsigned long wire_bytes;
+  unsigned buffers;
+  unsigned silent_buffers;
+  uint64_t vad_time;
+  uint32_t timestamp;
+};
+
+// Sends a datagram to the multicast group once, as long as anyone subscribed.
+// A failed send only counts as such, there is no one to drop for it.
+static void SendMulticast(const struct Destination* destination,
+                          const void* data, int size, int payload,
+                          struct SenderStats* stats,
+                          struct LoopMetrics* metrics) {
+  if (sendto(destination->fd, data, size, 0,
+             (const struct sockaddr*)&destination->group,
+             sizeof(destination->group)) == -1) {
+    LOG(ERROR, "Failed to send data to group (%s)", strerror(errno));
+    MetricsCount(&metrics->send_errors);
+    return;
+  }
+  stats->datagrams++;
+  stats->payload_bytes += payload;
+  stats->wire_bytes += size + destination->overhead;
+}
+
+// Sends the same datagram to every subscriber in one call. A subscriber that
+// cannot be sent to is dropped, and is back as soon as it pings again, which
+// makes the control thread publish its subscribers anew.
+static void SendUnicast(const struct Destination* destination,
+                        struct SubscriberTable* table, const void* data,
+                        int size, int payload, struct SenderStats* stats,
+                        struct LoopMetrics* metrics) {
+  struct iovec iov = {.iov_base = (void*)(uintptr_t)data, .iov_len = size};
+  struct mmsghdr msgs[CONTROL_MAX_SUBSCRIBERS];
+  for (int i = 0; i < table->count; ++i) {
+    msgs[i] = (struct mmsghdr){
+        .msg_hdr = {.msg_name = &table->subscribers[i].addr,
+                    .msg_namelen = sizeof(table->subscribers[i].addr),
+                    .msg_iov = &iov,
+                    .msg_iovlen = 1}};
+  }
+  for (int i = 0; i < table->count;) {
+    int sent = sendmmsg(destination->fd, msgs + i, table->count - i, 0);
+    if (sent == -1) {
+      LOG(ERROR, "Failed to send data (%s)", strerror(errno));
+      MetricsCount(&metrics->send_errors);
+      // Last subscriber moves into this slot, and so does its message.
+      RemoveSubscriber(table, i, "Dropped client at");
+      continue;
+    }
+    stats->datagrams += sent;
+    stats->payload_bytes += (unsigned long)sent * payload;
+    stats->wire_bytes += (unsigned long)sent * (size + destination->overhead);
+    i += sent;
+  }
+}
+
+// Unless filled_time is 0, it is when the oldest buffer in the datagram was
+// filled.
+static void SendDatagram(const struct Destination* destination,
+                         struct SubscriberTable* table, const void* data,
+                         int size, int payload, struct SenderStats* stats,
+                         struct LoopMetrics* metrics, uint64_t filled_time) {
+  if (!destination->multicast) {
+    SendUnicast(destination, table, data, size, payload, stats, metrics);
+  } else if (table->count) {
+    SendMulticast(destination, data, size, payload, stats, metrics);
+  }
+  if (filled_time) {
+    MetricsRecord(metrics->send_latency, MonotonicTime() - filled_time);
+  }
+}
+
+static double StageCost(const struct DspStats* stats, int stage) {
+  return stats->samples[stage]
+             ? (double)stats->time[stage] / stats->samples[stage]
+             : 0;
+}
+
+static void ReportStats(struct SenderStats* stats, struct Dsp* dsp,
+                        uint32_t timestamp, int sample_rate) {
+  double seconds = (double)(timestamp - stats->timestamp) / sample_rate;
+  if (seconds < SENDER_STATS_INTERVAL) {
+    return;
+  }
+  if (dsp) {
+    const struct DspStats* dsp_stats = &dsp->stats;
+    unsigned skipped = 0;
+    for (int i = 0; i < DSP_STAGES; ++i) {
+      skipped += dsp_stats->skipped[i];
+    }
+    LOG(INFO,
+        "DSP took %.2f ns per sample for highpass, %.2f for gain, %.2f for "
+        "gate, %.2f for limit, skipped %u stages over budget",
+        StageCost(dsp_stats, DSP_STAGE_HIGHPASS),
+        StageCost(dsp_stats, DSP_STAGE_GAIN),
+        StageCost(dsp_stats, DSP_STAGE_GATE),
+        StageCost(dsp_stats, DSP_STAGE_LIMIT), skipped);
+    dsp->stats = (struct DspStats){0};
+  }
+  if (stats->datagrams) {
+    LOG(INFO, "Sent %.1f datagrams/s, %.1f kbit/s, payload efficiency %.1f%%",
+        stats->datagrams / seconds, stats->wire_bytes * 8 / seconds / 1000,
+        100.0 * stats->payload_bytes / stats->wire_bytes);
+  }
+  if (stats->vad_time) {
+    LOG(INFO,
+        "Held back %u of %u buffers as silence, detector took %.2f us per "
+        "buffer",
+        stats->silent_buffers, stats->buffers,
+        stats->vad_time / 1e3 / stats->buffers);
+  }
+  *stats = (struct SenderStats){.timestamp = timestamp};
+}
+
+static void SendMetrics(const struct Destination* destination,
+                        struct SubscriberTable* table,
+                        const struct PacketHeader* header,
+                        const struct CallbackMetrics* callback_metrics,
+                        struct LoopMetrics* metrics,
+                        struct SenderStats* stats) {
+  struct PacketHeader report_header = *header;
+  report_header.type = PACKET_TYPE_STATS;
+  report_header.flags = 0;
+  report_header.length = sizeof(struct StatsReport);
+  struct StatsReport report;
+  MetricsReport(callback_metrics, metrics, &report);
+  uint8_t datagram[sizeof(report_header) + sizeof(report)];
+  memcpy(datagram, &report_header, sizeof(report_header));
+  memcpy(datagram + sizeof(report_header), &report, sizeof(report));
+  SendDatagram(destination, table, datagram, sizeof(datagram), 0, stats,
+               metrics, 0);
+}
+
+// Takes back subscribers the last run of the loop had, but for those that
+// timed out meanwhile.
+static void ResumeSubscribers(const struct Sender* sender,
+                              struct SubscriberTable* table) {
+  uint64_t now = MonotonicTime();
+  uint64_t timeout = CONTROL_SUBSCRIBER_TIMEOUT * 1000000000ull;
+  *table = (struct SubscriberTable){0};
+  for (int i = 0; i < sender->resume_count; ++i) {
+    if (now - sender->resume_seen[i] <= timeout) {
+      table->subscribers[table->count++] = (struct Subscriber){
+          .addr = sender->resume_addrs[i], .last_seen = sender->resume_seen[i]};
+    }
+  }
+  if (table->count) {
+    LOG(INFO, "Resuming streaming to %d subscribers", table->count);
+  }
+}
+
+// Frame with the timestamp of the header is the first one of the buffer
+// after the last one filled, so it would have been captured as that one was
+// filled.
+static void SaveSession(struct Sender* sender,
+                        const struct SubscriberTable* table,
+                        const struct PacketHeader* header,
+                        uint64_t filled_time) {
+  sender->resume_count = table->count;
+  for (int i = 0; i < table->count; ++i) {
+    sender->resume_addrs[i] = table->subscribers[i].addr;
+    sender->resume_seen[i] = table->subscribers[i].last_seen;
+  }
+  sender->resume_sequence = header->sequence;
+  sender->resume_timestamp = header->timestamp;
+  sender->resume_time = filled_time;
+}
+
+// Nothing gives the callback free buffers once the loop is done, so a callback
+// that parked waiting for one gets a NULL one instead, and later ones no
+// longer park, before the device is stopped, which waits for the callback to
+// return. This thread alone pushes free buffers, so room there is now stays.
+static void StopCapture(struct Sender* sender) {
+  struct BufferQueue* free_buffers = &sender->queue_impl[0];
+  atomic_store(&sender->stopping, 1);
+  if (BufferQueueSize(free_buffers) < free_buffers->length) {
+    BufferQueuePush(free_buffers, NULL);
+  }
+  sender->capture->Stop(sender->capture);
+}
+
+static void SenderLoop(struct Sender* sender,
+                       const struct Destination* destination) {
+  uint64_t start_time = MonotonicTime();
+  struct CaptureBackend* capture = sender->capture;
+  int rate_index = PacketRateIndex(sender->sample_rate);
+  if (rate_index == -1) {
+    LOG(ERROR, "Unsupported sample rate %d", sender->sample_rate);
+    return;
+  }
+  if (!SenderFrameSize(sender)) {
+    LOG(ERROR, "Unsupported format of %d channels, encoding %d",
+        sender->channels, sender->encoding);
+    return;
+  }
+  struct PacketHeader header = {
+      .type = PACKET_TYPE_AUDIO,
+      .format =
+          PACKET_FORMAT(rate_index, sender->encoding, sender->channels)};
+  int frames_per_buffer =
+      sender->buffer_size / PacketFormatFrameSize(header.format);
+  struct BufferQueue queue_impl[3];
+  void* queue_storage[LENGTH(queue_impl)][SENDER_MAX_BUFFERS];
+  for (unsigned i = 0; i < LENGTH(queue_impl); ++i) {
+    InitBufferQueue(&queue_impl[i], LENGTH(queue_storage[i]), queue_storage[i]);
+  }
+  sender->queue_impl = queue_impl;
+  sender->pending = NULL;
+  atomic_store(&sender->stopping, 0);
+  int interleave = sender->fec_interleave ? sender->fec_interleave : 1;
+  if (sender->fec < 0 || interleave < 0 ||
+      sender->fec * interleave > FEC_MAX_BLOCK) {
+    LOG(ERROR, "Unsupported fec block of %d times %d packets", sender->fec,
+        interleave);
+    return;
+  }
+  // Packets keep their headers when several are sent in one datagram, and a
+  // single one that does not fit into the mtu is sent anyway.
+  int max_datagram =
+      (sender->mtu ? sender->mtu : SENDER_MTU) - destination->overhead;
+  int max_packet = (int)sizeof(header) + sender->buffer_size;
+  int max_parity = sender->fec ? FEC_PARITY_SIZE(max_packet) : 0;
+  if (max_datagram < max_packet) {
+    max_datagram = max_packet;
+  }
+  if (max_datagram < max_parity) {
+    max_datagram = max_parity;
+  }
+  long max_latency = (long)sender->max_latency * sender->sample_rate / 1000;
+  uint64_t buffer_duration =
+      (uint64_t)frames_per_buffer * 1000000000 / sender->sample_rate;
+  int hangover_ms =
+      sender->vad_hangover ? sender->vad_hangover : SENDER_VAD_HANGOVER;
+  struct Vad vad;
+  VadInit(&vad, sender->channels, sender->encoding,
+          sender->vad_threshold ? sender->vad_threshold
+                                : SENDER_VAD_THRESHOLD,
+          (int)(((uint64_t)hangover_ms * 1000000 + buffer_duration - 1) /
+                buffer_duration));
+  uint32_t sid_interval = SENDER_SID_INTERVAL * sender->sample_rate / 1000;
+  uint32_t sid_timestamp = 0;
+  int silent = 0;
+  struct CallbackMetrics callback_metrics;
+  struct LoopMetrics metrics;
+  InitMetrics(&callback_metrics, &metrics, buffer_duration);
+  sender->metrics = &callback_metrics;
+  struct DspConfig dsp_config = {.highpass = sender->dsp_highpass,
+                                 .gain = sender->dsp_gain,
+                                 .agc = sender->dsp_agc,
+                                 .agc_max = sender->dsp_agc_max,
+                                 .gate = sender->dsp_gate,
+                                 .limit = sender->dsp_limit,
+                                 .budget = sender->dsp_budget};
+  struct Dsp dsp_impl;
+  struct Dsp* dsp = DspEnabled(&dsp_config) ? &dsp_impl : NULL;
+  if (dsp && !DspInit(dsp, &dsp_config, sender->sample_rate,
+                      sender->channels, sender->encoding,
+                      frames_per_buffer)) {
+    LOG(ERROR, "Failed to allocate signal processing");
+    return;
+  }
+  uint8_t coded[sender->buffer_size];
+  uint8_t datagram[max_datagram];
+  uint8_t parity_storage[sender->fec ? interleave * max_parity : 1];
+  struct FecEncoder fec;
+  FecEncoderInit(&fec, sender->fec, interleave, parity_storage, max_packet);
+  // Every buffer is made in advance, and only depth of them go around.
+  uint8_t* pool = NULL;
+  int depth = sender->buffers ? sender->buffers : SENDER_BUFFERS;
+  if (depth < SENDER_MIN_BUFFERS || depth > SENDER_MAX_BUFFERS) {
+    LOG(ERROR, "Unsupported number of %d buffers", depth);
+    goto shortcut;
+  }
+  struct BufferTuner tuner;
+  InitBufferTuner(&tuner, depth, sender->buffers ? depth : SENDER_MIN_BUFFERS,
+                  sender->buffers ? depth : SENDER_MAX_BUFFERS,
+                  buffer_duration);
+  sender->tuner = &tuner;
+  sender->buffer_stride = (sender->buffer_size + SENDER_BUFFER_ALIGN - 1) &
+                          -SENDER_BUFFER_ALIGN;
+  int error =
+      posix_memalign((void**)&pool, (size_t)sysconf(_SC_PAGESIZE),
+                     (size_t)SENDER_MAX_BUFFERS * sender->buffer_stride);
+  if (error) {
+    LOG(ERROR, "Failed to allocate buffers (%s)", strerror(error));
+    goto shortcut;
+  }
+  // Pool is touched all over up front, so that no buffer faults in capture.
+  memset(pool, 0, (size_t)SENDER_MAX_BUFFERS * sender->buffer_stride);
+  sender->pool = pool;
+  sender->depth = sender->circulating = depth;
+  sender->reserve_count = 0;
+  atomic_store_explicit(&callback_metrics.depth, depth, memory_order_relaxed);
+  // All but one of the buffers that go around start out with the device, and
+  // the rest wait in reserve.
+  for (int i = SENDER_MAX_BUFFERS - 1; i >= depth; --i) {
+    sender->reserve[sender->reserve_count++] =
+        pool + (size_t)i * sender->buffer_stride;
+  }
+  for (int i = 0; i < depth; ++i) {
+    uint8_t* buffer = pool + (size_t)i * sender->buffer_stride;
+    if (i < depth - 1 &&
+        !capture->Enqueue(capture, buffer, sender->buffer_size)) {
+      LOG(ERROR, "Failed to enqueue kickstart buffer");
+      goto shortcut;
+    }
+    BufferQueuePush(i < depth - 1 ? &sender->queue_impl[1]
+                                  : &sender->queue_impl[0],
+                    buffer);
+  }
+  struct SubscriberTable resumed = {0};
+  if (sender->resume_time) {
+    ResumeSubscribers(sender, &resumed);
+    header.sequence = sender->resume_sequence;
+  } else {
+    // Numbers of a fresh session go by the clock, so that those of a sender
+    // that restarted are ahead of any a receiver played before, much as RTP
+    // picks random ones for the same reason.
+    uint64_t frames = MonotonicTime() / 1000 * sender->sample_rate / 1000000;
+    header.sequence = (uint16_t)(frames / frames_per_buffer);
+    header.timestamp = (uint32_t)frames;
+  }
+  struct Control control;
+  if (!StartControl(&control, destination->fd, &resumed)) {
+    goto shortcut;
+  }
+  // Control thread is started before, so that it keeps default scheduling,
+  // and the capture thread after, so that it inherits real-time scheduling.
+  if (sender->realtime) {
+    struct RealtimeStatus realtime;
+    EnterRealtime(sender->realtime,
+                  *sender->realtime_cpus ? sender->realtime_cpus : NULL,
+                  &realtime);
+    char description[256];
+    DescribeRealtime(&realtime, description, sizeof(description));
+    LOG(INFO, "Sender loop runs with %s", description);
+  }
+  if (sender->resume_time) {
+    uint64_t paused = MonotonicTime() - sender->resume_time;
+    header.timestamp = sender->resume_timestamp +
+                       (uint32_t)(paused / 1000 * sender->sample_rate /
+                                  1000000);
+  }
+  if (!capture->Start(capture)) {
+    LOG(ERROR, "Failed to start capture");
+    StopControl(&control);
+    goto shortcut;
+  }
+  // Local copy of the subscribers, so that the control thread can go on
+  // changing them meanwhile.
+  struct SubscriberTable table = {0};
+  unsigned table_sequence = 0;
+  uint32_t metrics_interval = SENDER_METRICS_INTERVAL * sender->sample_rate;
+  uint32_t metrics_timestamp = header.timestamp;
+  struct SenderStats stats = {.timestamp = header.timestamp};
+  uint64_t oldest_time = 0;
+  uint64_t last_filled_time = 0;
+  uint64_t first_sent_time = 0;
+  int size = 0;
+  int count = 0;
+  for (; atomic_flag_test_and_set(&sender->running);
+       header.timestamp += frames_per_buffer) {
+    void* buffer = BufferQueuePop(&sender->queue_impl[2]);
+    uint64_t wakeup_time = MonotonicTime();
+    // Buffer is filled when its last frame is captured.
+    uint64_t filled_time =
+        sender->capture_times[((uint8_t*)buffer - pool) /
+                              sender->buffer_stride];
+    // Loop that kept up wakes up as soon as the buffer is filled, and one
+    // that fell behind finds it waiting, which counts as late all the same.
+    MetricsRecord(metrics.wakeup_latency, wakeup_time - filled_time);
+    last_filled_time = filled_time;
+    MetricsCount(&metrics.buffers);
+    for (int i = 0; i < METRICS_QUEUES; ++i) {
+      int depth = BufferQueueSize(&sender->queue_impl[i]);
+      MetricsCount(&metrics.queue_depth[i][depth < METRICS_DEPTHS
+                                               ? depth
+                                               : METRICS_DEPTHS - 1]);
+    }
+    ControlPublishCapture(&control, header.format, header.timestamp,
+                          filled_time - buffer_duration);
+    ControlUpdateSubscribers(&control, &table_sequence, &table);
+    if (dsp) {
+      DspProcess(dsp, buffer, frames_per_buffer);
+    }
+    // First buffer of every silence gets a descriptor right away, so that
+    // receivers switch to comfort noise where the voice ends.
+    int active = 1;
+    if (sender->vad) {
+      uint64_t vad_start = MonotonicTime();
+      active = VadProcess(&vad, buffer, frames_per_buffer);
+      stats.vad_time += MonotonicTime() - vad_start;
+    }
+    int sid = !active &&
+              (!silent || header.timestamp - sid_timestamp >= sid_interval);
+    if (sid) {
+      sid_timestamp = header.timestamp;
+    }
+    silent = !active;
+    stats.buffers++;
+    stats.silent_buffers += silent;
+    if (table.count && (active || sid)) {
+      // Fall back to raw samples whenever coding does not make them smaller.
+      // Codec only takes s16 samples.
+      int length = 0;
+      if (sid) {
+        coded[0] = (uint8_t)VadNoiseLevel(&vad);
+        length = 1;
+      } else if (sender->codec &&
+                 sender->encoding == PACKET_ENCODING_S16LE) {
+        length = CodecEncode(buffer, frames_per_buffer, sender->channels,
+                             coded, sender->buffer_size - 1);
+      }
+      header.flags = sid ? PACKET_FLAG_SID : length ? PACKET_FLAG_CODED : 0;
+      header.length = length ? length : sender->buffer_size;
+      int packet_size = (int)sizeof(header) + header.length;
+      if (size + packet_size > max_datagram) {
+        SendDatagram(destination, &table, datagram, size,
+                     size - count * (int)sizeof(header), &stats, &metrics,
+                     oldest_time);
+        size = count = 0;
+      }
+      if (!size) {
+        oldest_time = filled_time;
+      }
+      uint8_t* packet = datagram + size;
+      memcpy(packet, &header, sizeof(header));
+      memcpy(packet + sizeof(header), length ? coded : buffer, header.length);
+      size += packet_size;
+      header.sequence++;
+      int parities =
+          sender->fec ? FecEncoderAdd(&fec, packet, packet_size) : 0;
+      // Waiting for one more buffer would hold the first one back for as
+      // long as all of the buffers collected so far take to play, and the
+      // next one after a descriptor can be a long while away.
+      if ((long)++count * frames_per_buffer > max_latency || parities ||
+          sid) {
+        SendDatagram(destination, &table, datagram, size,
+                     size - count * (int)sizeof(header), &stats, &metrics,
+                     oldest_time);
+        size = count = 0;
+      }
+      // Parity packets never share a datagram with the packets they protect,
+      // or losing it would take both.
+      for (int i = 0; i < parities; ++i) {
+        int parity_size;
+        const void* parity = FecEncoderParity(&fec, i, &parity_size);
+        if (size + parity_size > max_datagram) {
+          SendDatagram(destination, &table, datagram, size, 0, &stats,
+                       &metrics, 0);
+          size = 0;
+        }
+        memcpy(datagram + size, parity, parity_size);
+        size += parity_size;
+      }
+      if (parities) {
+        SendDatagram(destination, &table, datagram, size, 0, &stats,
+                     &metrics, 0);
+        size = 0;
+      }
+    }
+    BufferQueuePush(&sender->queue_impl[0], buffer);
+    if (table.count &&
+        header.timestamp - metrics_timestamp >= metrics_interval) {
+      SendMetrics(destination, &table, &header, &callback_metrics, &metrics,
+                  &stats);
+      metrics_timestamp = header.timestamp;
+    }
+    int tuned = (int)atomic_load_explicit(&callback_metrics.depth,
+                                          memory_order_relaxed);
+    if (tuned != depth) {
+      LOG(INFO, "Capture buffer depth went from %d to %d", depth, tuned);
+      depth = tuned;
+    }
+    if (!first_sent_time && stats.datagrams) {
+      first_sent_time = MonotonicTime();
+      LOG(INFO, "First datagram went out %.1f ms after start",
+          (first_sent_time - start_time) / 1e6);
+    }
+    ReportStats(&stats, dsp, header.timestamp, sender->sample_rate);
+  }
+  StopCapture(sender);
+  // Packets still waiting for more to share their datagram used sequence
+  // numbers up, which a resumed session goes on from, so they go out now
+  // rather than being counted as lost.
+  if (size) {
+    SendDatagram(destination, &table, datagram, size,
+                 size - count * (int)sizeof(header), &stats, &metrics,
+                 oldest_time);
+  }
+  StopControl(&control);
+  if (last_filled_time) {
+    SaveSession(sender, &control.table, &header, last_filled_time);
+  }
+  goto done;
+shortcut:
+  StopCapture(sender);
+done:
+  free(pool);
+  if (dsp) {
+    DspFree(dsp);
+  }
+}
+
+int SetSenderOption(struct Sender* sender, const char* option) {
+  const char* value = strchr(option, '=');
+  if (!value) {
+    LOG(ERROR, "Option %s is not in key=value form", option);
+    return 0;
+  }
+  size_t name_length = (size_t)(value++ - option);
+  FOR_EACH(const struct SenderOption * it, sender_options) {
+    if (strlen(it->name) == name_length &&
+        !strncmp(it->name, option, name_length)) {
+      if (it->size) {
+        if (strlen(value) >= it->size) {
+          LOG(ERROR, "Value of option %s is too long", option);
+          return 0;
+        }
+        strcpy((char*)sender + it->offset, value);
+        return 1;
+      }
+      int* field = (int*)((char*)sender + it->offset);
+      if (!it->values) {
+        *field = atoi(value);
+        return 1;
+      }
+      for (int i = 0; it->values[i]; ++i) {
+        if (!strcmp(it->values[i], value)) {
+          *field = i;
+          return 1;
+        }
+      }
+      LOG(ERROR, "Unknown value of option %s", option);
+      return 0;
+    }
+  }
+  LOG(ERROR, "Unknown option %s", option);
+  return 0;
+}
+
+int LoadSenderOptions(struct Sender* sender, const char* path) {
+  FILE* file = fopen(path, "r");
+  if (!file) {
+    // Configuration file is optional, defaults are fine without it.
+    return errno == ENOENT;
+  }
+  int result = 1;
+  char line[256];
+  while (result && fgets(line, sizeof(line), file)) {
+    line[strcspn(line, "\r\n")] = 0;
+    if (*line && *line != '#') {
+      result = SetSenderOption(sender, line);
+    }
+  }
+  fclose(file);
+  return result;
+}
+
+// Returns 0 for formats that do not fit into a packet format id.
+int SenderFrameSize(const struct Sender* sender) {
+  if (sender->channels < 1 || sender->channels > 16) {
+    return 0;
+  }
+  return PacketEncodingSampleSize(sender->encoding) * sender->channels;
+}
+
+// Buffers over depth are set aside as they come back from the sender loop,
+// and go around again first thing once depth grows.
+static void* TakeFreeBuffer(struct Sender* sender) {
+  for (;;) {
+    if (sender->circulating < sender->depth && sender->reserve_count) {
+      sender->circulating++;
+      return sender->reserve[--sender->reserve_count];
+    }
+    void* buffer = BufferQueueTryPop(&sender->queue_impl[0]);
+    if (!buffer || sender->circulating <= sender->depth) {
+      return buffer;
+    }
+    sender->reserve[sender->reserve_count++] = buffer;
+    sender->circulating--;
+  }
+}
+
+static void TuneDepth(struct Sender* sender, uint64_t interval, int spare) {
+  struct CallbackMetrics* metrics = sender->metrics;
+  int depth = BufferTunerUpdate(sender->tuner, interval, spare,
+                                sender->circulating - spare);
+  if (depth != sender->depth) {
+    MetricsCount(depth > sender->depth ? &metrics->depth_increases
+                                       : &metrics->depth_decreases);
+    atomic_store_explicit(&metrics->depth, depth, memory_order_relaxed);
+    sender->depth = depth;
+  }
+  MetricsCount(&metrics->depth_history[depth - 1]);
+}
+
+void SenderCallback(void* data) {
+#ifdef ENABLE_CALLBACK_LOGGING
+  LOG(DEBUG, "Entering %s(%p)", __func__, data);
+#endif  // ENABLE_CALLBACK_LOGGING
+  struct Sender* sender = (struct Sender*)data;
+  struct CaptureBackend* capture = sender->capture;
+  struct CallbackMetrics* metrics = sender->metrics;
+  void* output = BufferQueuePop(&sender->queue_impl[1]);
+  uint64_t now = MonotonicTime();
+  sender->capture_times[((uint8_t*)output - (uint8_t*)sender->pool) /
+                        sender->buffer_stride] = now;
+  MetricsCount(&metrics->callbacks);
+  uint64_t interval = 0;
+  if (metrics->last_time) {
+    interval = now - metrics->last_time;
+    MetricsRecord(metrics->interval, interval);
+    if (interval > metrics->period * 3 / 2) {
+      MetricsCount(&metrics->overruns);
+    }
+  }
+  metrics->last_time = now;
+  // Whatever the device still has to fill is all it can go on with until the
+  // buffers enqueued below.
+  int spare = BufferQueueSize(&sender->queue_impl[1]);
+  BufferQueuePush(&sender->queue_impl[2], output);
+  TuneDepth(sender, interval, spare);
+  // Only park waiting for the sender when the recorder would otherwise run out
+  // of buffers, so that a slow network never stalls this callback needlessly,
+  // and never once the sender loop is done giving buffers back.
+  void* input = sender->pending;
+  if (!input) {
+    input = TakeFreeBuffer(sender);
+    if (!input && !spare && !atomic_load(&sender->stopping)) {
+      MetricsCount(&metrics->stalls);
+      input = BufferQueuePop(&sender->queue_impl[0]);
+    }
+  }
+  sender->pending = NULL;
+  for (; input; input = TakeFreeBuffer(sender)) {
+    if (!capture->Enqueue(capture, input, sender->buffer_size)) {
+      MetricsCount(&metrics->enqueue_failures);
+      sender->pending = input;
+      return;
+    }
+    BufferQueuePush(&sender->queue_impl[1], input);
+  }
+  // TODO(mburakov): In sample code there's a logic to put device to sleep if
+  // shadow buffer is empty. This makes no sense here as we always enqueue.
+}
+
+// Takes IPv4 groups as IPv4-mapped addresses, so that they go out of the same
+// socket as everything else, and sets how far they go.
+static int SetupMulticast(const struct Sender* sender,
+                          struct Destination* destination) {
+  struct sockaddr_in6* group = &destination->group;
+  int port = sender->multicast_port ? sender->multicast_port
+                                    : SENDER_MULTICAST_PORT;
+  int ttl = sender->multicast_ttl ? sender->multicast_ttl
+                                  : SENDER_MULTICAST_TTL;
+  *group = (struct sockaddr_in6){.sin6_family = AF_INET6,
+                                 .sin6_port = htons(port)};
+  struct in_addr group4;
+  int result;
+  if (inet_pton(AF_INET, sender->multicast, &group4) == 1 &&
+      IN_MULTICAST(ntohl(group4.s_addr))) {
+    group->sin6_addr.s6_addr[10] = group->sin6_addr.s6_addr[11] = 0xff;
+    memcpy(&group->sin6_addr.s6_addr[12], &group4, sizeof(group4));
+    result = setsockopt(destination->fd, IPPROTO_IP, IP_MULTICAST_TTL, &ttl,
+                        sizeof(ttl));
+  } else if (inet_pton(AF_INET6, sender->multicast, &group->sin6_addr) == 1 &&
+             IN6_IS_ADDR_MULTICAST(&group->sin6_addr)) {
+    destination->overhead = UDP6_OVERHEAD;
+    result = setsockopt(destination->fd, IPPROTO_IPV6, IPV6_MULTICAST_HOPS,
+                        &ttl, sizeof(ttl));
+  } else {
+    LOG(ERROR, "%s is not a multicast group", sender->multicast);
+    return 0;
+  }
+  if (result == -1) {
+    LOG(ERROR, "Failed to set multicast ttl (%s)", strerror(errno));
+    return 0;
+  }
+  char address[INET6_ADDRSTRLEN + 8];
+  LOG(INFO, "Sending to multicast group %s",
+      FormatAddress(group, address, sizeof(address)));
+  destination->multicast = 1;
+  return 1;
+}
+
+int RunSender(struct Sender* sender, struct CaptureBackend* capture) {
+  LOG(DEBUG, "Entering %s(%p)", __func__, (void*)sender);
+  int fd = socket(AF_INET6, SOCK_DGRAM, 0);
+  if (fd == -1) {
+    LOG(ERROR, "Failed to create socket (%s)", strerror(errno));
+    return 0;
+  }
+  // Receivers can come over either IPv4 or IPv6.
+  int v6only = 0;
+  if (setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &v6only, sizeof(v6only)) ==
+      -1) {
+    LOG(WARN, "Failed to accept IPv4 (%s)", strerror(errno));
+  }
+  // Clock requests are answered with the time they came in at rather than
+  // the time they were read at.
+  int timestamps = 1;
+  if (setsockopt(fd, SOL_SOCKET, SO_TIMESTAMPNS, &timestamps,
+                 sizeof(timestamps)) == -1) {
+    LOG(WARN, "Failed to enable receive timestamps (%s)", strerror(errno));
+  }
+  int result = 0;
+  int port = sender->port ? sender->port : SENDER_PORT;
+  struct sockaddr_in6 addr = {.sin6_family = AF_INET6,
+                              .sin6_port = htons(port),
+                              .sin6_addr = IN6ADDR_ANY_INIT};
+  struct Destination destination = {.fd = fd, .overhead = UDP_OVERHEAD};
+  if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) == -1) {
+    LOG(ERROR, "Failed to bind socket (%s)", strerror(errno));
+  } else if (!*sender->multicast || SetupMulticast(sender, &destination)) {
+    sender->capture = capture;
+    SenderLoop(sender, &destination);
+    result = 1;
+  }
+  close(fd);
+  LOG(DEBUG, "Leaving %s(%p)", __func__, (void*)sender);
+  return result;
+}
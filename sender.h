@@ -0,0 +1,117 @@
+#include <netinet/in.h>
+#include <stdatomic.h>
+#include <stdint.h>
+
+// Capture buffers that go around at first, and at least and at most as the
+// depth is tuned. Buffers are aligned to SENDER_BUFFER_ALIGN bytes in a pool
+// that starts on a page.
+#define SENDER_BUFFERS 4
+#define SENDER_MIN_BUFFERS 3
+#define SENDER_MAX_BUFFERS 16
+#define SENDER_BUFFER_ALIGN 64
+#define SENDER_PORT 12345
+#define SENDER_MULTICAST_PORT 12346
+#define SENDER_MULTICAST_TTL 1
+#define SENDER_MTU 1500
+#define SENDER_STATS_INTERVAL 10
+#define SENDER_METRICS_INTERVAL 1
+#define SENDER_VAD_THRESHOLD 9
+#define SENDER_VAD_HANGOVER 200
+#define SENDER_SID_INTERVAL 50
+#define SENDER_MAX_SUBSCRIBERS 16
+
+struct BufferTuner;
+struct CaptureBackend;
+struct CallbackMetrics;
+
+// Capture format is interleaved frames of channels samples in one of
+// PACKET_ENCODING_*, and buffers are sized in bytes.
+struct Sender {
+  int sample_rate;
+  int channels;
+  int encoding;
+  int buffer_size;
+  int codec;
+  // Port to listen for receivers on, SENDER_PORT unless set, so that several
+  // senders can share a host.
+  int port;
+  // With a multicast group set, IPv4 or IPv6, every datagram goes out once to
+  // the group at multicast_port, SENDER_MULTICAST_PORT unless set, and
+  // multicast_ttl hops far, SENDER_MULTICAST_TTL unless set, rather than once
+  // to every subscriber. Receivers still subscribe, and nothing goes out while
+  // there are none.
+  char multicast[INET6_ADDRSTRLEN];
+  int multicast_port;
+  int multicast_ttl;
+  // Consecutive buffers are sent together in datagrams of up to mtu bytes,
+  // as long as none is held back for longer than max_latency milliseconds.
+  int mtu;
+  int max_latency;
+  // Every fec consecutive packets are protected by one parity packet, and
+  // fec_interleave groups are interleaved, so that bursts of up to that many
+  // losses can be recovered from.
+  int fec;
+  int fec_interleave;
+  // With vad set, buffers without voice in them are not sent. A silence
+  // descriptor goes out instead every SENDER_SID_INTERVAL milliseconds, which
+  // also keeps receivers from taking the sender for gone. Voice is whatever is
+  // vad_threshold decibels above the background noise, and is held for
+  // vad_hangover milliseconds after it ends.
+  int vad;
+  int vad_threshold;
+  int vad_hangover;
+  // Signal conditioning of every buffer before anything else looks at it,
+  // configured as the options of struct DspConfig are, and off while all of
+  // them are 0.
+  int dsp_highpass;
+  int dsp_gain;
+  int dsp_agc;
+  int dsp_agc_max;
+  int dsp_gate;
+  int dsp_limit;
+  int dsp_budget;
+  // With buffers set, that many capture buffers go around all along rather
+  // than as many as the tuner finds enough.
+  int buffers;
+  // With realtime set, the sender loop, and the capture thread of the host
+  // build it starts, run SCHED_FIFO at that priority, or at a raised nice
+  // value where that is not allowed, with memory locked, and only on
+  // realtime_cpus, a list like 0-1,3, unless that is empty.
+  int realtime;
+  char realtime_cpus[32];
+  atomic_flag running;
+  atomic_int stopping;
+  struct CaptureBackend* capture;
+  struct BufferQueue* queue_impl;
+  struct CallbackMetrics* metrics;
+  struct BufferTuner* tuner;
+  void* pending;
+  // Buffers go around up to depth of them, and the callback sets those over
+  // it aside in reserve as they come back.
+  int depth;
+  int circulating;
+  int reserve_count;
+  void* reserve[SENDER_MAX_BUFFERS];
+  // Monotonic time every buffer was last filled at, by index into the pool.
+  void* pool;
+  int buffer_stride;
+  uint64_t capture_times[SENDER_MAX_BUFFERS];
+  // Where the last run of the sender loop left off, unless resume_time is 0:
+  // subscribers with when each was last heard from, and the sequence number
+  // and timestamp of the next packet, with the time its first frame would
+  // have been captured at. Next run streams to those subscribers at once,
+  // with sequence numbers that go on and timestamps that kept counting the
+  // while, so that receivers that still play the stream carry on with it.
+  int resume_count;
+  struct sockaddr_in6 resume_addrs[SENDER_MAX_SUBSCRIBERS];
+  uint64_t resume_seen[SENDER_MAX_SUBSCRIBERS];
+  uint16_t resume_sequence;
+  uint32_t resume_timestamp;
+  uint64_t resume_time;
+};
+
+int SetSenderOption(struct Sender* sender, const char* option);
+int LoadSenderOptions(struct Sender* sender, const char* path);
+int SenderFrameSize(const struct Sender* sender);
+void SenderCallback(void* data);
+int RunSender(struct Sender* sender, struct CaptureBackend* capture);
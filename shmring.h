@@ -0,0 +1,305 @@
+#include <errno.h>
+#include <limits.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/un.h>
+
+// Single-writer, multi-reader byte ring in shared memory, with everything
+// pamnc writes to the pipe of a stream going into it too. Data follows the
+// header at data_offset, and is mapped twice back to back, so that whatever
+// is available can always be read in place, wrap or not. Writer only ever
+// advances the total count of bytes written, and readers keep cursors of
+// their own, so any number of them can come and go without the writer ever
+// knowing. A reader that falls more than the size of the ring behind has
+// missed data, and skips ahead to the latest. Format fields follow the pipe,
+// and only change between whole frames.
+//
+// Readers ask pamnc for the ring of a stream by sending its name, or nothing
+// for any stream, in a datagram to the abstract unix socket SHM_RING_SOCKET.
+// The answer carries the name and the ring file descriptor, or nothing at all
+// if there is no such stream.
+#define SHM_RING_MAGIC 0x676e6972
+#define SHM_RING_VERSION 1
+#define SHM_RING_SOCKET "pamnc"
+#define SHM_RING_NAME_SIZE 64
+
+struct shm_ring {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t data_offset;
+  uint32_t size;
+  atomic_uint rate;
+  atomic_uint channels;
+  atomic_uint encoding;
+  // Readers parked in shm_ring_wait, and the futex word they park on, which
+  // changes with every write.
+  atomic_uint waiters;
+  atomic_uint wake;
+  // Bytes written so far, and what they will be once the write in progress
+  // is done.
+  atomic_ullong write;
+  atomic_ullong reserve;
+  // Monotonic time of the last write, in nanoseconds.
+  atomic_ullong write_time;
+};
+
+struct shm_ring_writer {
+  int fd;
+  struct shm_ring* ring;
+  uint8_t* data;
+};
+
+struct shm_ring_reader {
+  struct shm_ring* ring;
+  const uint8_t* data;
+  uint64_t cursor;
+  // Bytes skipped for falling behind.
+  uint64_t lost;
+};
+
+static inline size_t shm_ring_map_size(uint32_t data_offset, uint32_t size) {
+  return (size_t)data_offset + 2 * (size_t)size;
+}
+
+// Maps header and data, and then data once more right after it.
+static inline struct shm_ring* shm_ring_map(int fd, uint32_t data_offset,
+                                            uint32_t size) {
+  uint8_t* base = mmap(NULL, shm_ring_map_size(data_offset, size), PROT_NONE,
+                       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (base == MAP_FAILED) {
+    return NULL;
+  }
+  if (mmap(base, (size_t)data_offset + size, PROT_READ | PROT_WRITE,
+           MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED ||
+      mmap(base + data_offset + size, size, PROT_READ | PROT_WRITE,
+           MAP_SHARED | MAP_FIXED, fd, data_offset) == MAP_FAILED) {
+    munmap(base, shm_ring_map_size(data_offset, size));
+    return NULL;
+  }
+  return (struct shm_ring*)base;
+}
+
+static inline void shm_ring_unmap(struct shm_ring* ring) {
+  munmap(ring, shm_ring_map_size(ring->data_offset, ring->size));
+}
+
+static inline uint64_t shm_ring_now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// Size is rounded up to whole pages. Returns 0 and leaves errno set on
+// failure.
+static inline int shm_ring_create(struct shm_ring_writer* writer,
+                                  const char* name, size_t size) {
+  size_t page = (size_t)sysconf(_SC_PAGESIZE);
+  size = (size + page - 1) / page * page;
+  if (size > UINT32_MAX - page) {
+    errno = EINVAL;
+    return 0;
+  }
+  writer->fd = memfd_create(name, MFD_CLOEXEC);
+  if (writer->fd == -1) {
+    return 0;
+  }
+  if (ftruncate(writer->fd, (off_t)(page + size)) == -1 ||
+      !(writer->ring = shm_ring_map(writer->fd, page, size))) {
+    int error = errno;
+    close(writer->fd);
+    errno = error;
+    return 0;
+  }
+  struct shm_ring* ring = writer->ring;
+  ring->magic = SHM_RING_MAGIC;
+  ring->version = SHM_RING_VERSION;
+  ring->data_offset = page;
+  ring->size = size;
+  writer->data = (uint8_t*)ring + page;
+  return 1;
+}
+
+static inline void shm_ring_destroy(struct shm_ring_writer* writer) {
+  shm_ring_unmap(writer->ring);
+  close(writer->fd);
+}
+
+static inline void shm_ring_set_format(struct shm_ring_writer* writer,
+                                       unsigned rate, unsigned channels,
+                                       unsigned encoding) {
+  atomic_store_explicit(&writer->ring->rate, rate, memory_order_relaxed);
+  atomic_store_explicit(&writer->ring->channels, channels,
+                        memory_order_relaxed);
+  atomic_store_explicit(&writer->ring->encoding, encoding,
+                        memory_order_relaxed);
+}
+
+// Only takes a syscall when some reader is parked.
+static inline void shm_ring_write(struct shm_ring_writer* writer,
+                                  const void* data, size_t length) {
+  struct shm_ring* ring = writer->ring;
+  uint64_t write = atomic_load_explicit(&ring->write, memory_order_relaxed);
+  atomic_store_explicit(&ring->reserve, write + length, memory_order_relaxed);
+  atomic_thread_fence(memory_order_release);
+  for (size_t chunk; length; length -= chunk) {
+    chunk = length < ring->size ? length : ring->size;
+    memcpy(writer->data + write % ring->size, data, chunk);
+    data = (const uint8_t*)data + chunk;
+    write += chunk;
+  }
+  atomic_store_explicit(&ring->write_time, shm_ring_now(),
+                        memory_order_relaxed);
+  atomic_store_explicit(&ring->write, write, memory_order_release);
+  // Sequentially consistent pair with shm_ring_wait: either the reader sees
+  // the new word, or the writer sees it parked.
+  atomic_fetch_add(&ring->wake, 1);
+  if (atomic_load(&ring->waiters)) {
+    syscall(SYS_futex, &ring->wake, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+  }
+}
+
+// Asks pamnc for the ring of the named stream, or of any stream if name is
+// NULL. Name receives the name of the stream if it is not NULL. Returns 0 and
+// leaves errno set on failure.
+static inline int shm_ring_connect(struct shm_ring_reader* reader,
+                                   const char* name,
+                                   char stream_name[SHM_RING_NAME_SIZE]) {
+  int sock = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+  if (sock == -1) {
+    return 0;
+  }
+  int fd = -1;
+  do {
+    // Unnamed sockets can not be answered, so bind to an autogenerated name.
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    if (bind(sock, (struct sockaddr*)&addr, sizeof(sa_family_t)) == -1) {
+      break;
+    }
+    memcpy(addr.sun_path + 1, SHM_RING_SOCKET, sizeof(SHM_RING_SOCKET) - 1);
+    socklen_t addr_len =
+        offsetof(struct sockaddr_un, sun_path) + sizeof(SHM_RING_SOCKET);
+    size_t name_length = name ? strlen(name) : 0;
+    if (sendto(sock, name, name_length, 0, (struct sockaddr*)&addr,
+               addr_len) == -1) {
+      break;
+    }
+    struct timeval timeout = {.tv_sec = 1};
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    char answer[SHM_RING_NAME_SIZE] = {0};
+    union {
+      struct cmsghdr header;
+      char buffer[CMSG_SPACE(sizeof(int))];
+    } control;
+    struct iovec iov = {.iov_base = answer, .iov_len = sizeof(answer) - 1};
+    struct msghdr msg = {.msg_iov = &iov,
+                         .msg_iovlen = 1,
+                         .msg_control = control.buffer,
+                         .msg_controllen = sizeof(control.buffer)};
+    if (recvmsg(sock, &msg, MSG_CMSG_CLOEXEC) == -1) {
+      break;
+    }
+    struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+    if (!cmsg || cmsg->cmsg_level != SOL_SOCKET ||
+        cmsg->cmsg_type != SCM_RIGHTS) {
+      errno = ENOENT;
+      break;
+    }
+    memcpy(&fd, CMSG_DATA(cmsg), sizeof(fd));
+    if (stream_name) {
+      memcpy(stream_name, answer, sizeof(answer));
+    }
+  } while (0);
+  int error = errno;
+  close(sock);
+  if (fd == -1) {
+    errno = error;
+    return 0;
+  }
+  // Size of the ring is only known once its header is mapped.
+  struct shm_ring* header =
+      mmap(NULL, sizeof(struct shm_ring), PROT_READ, MAP_SHARED, fd, 0);
+  if (header == MAP_FAILED) {
+    error = errno;
+    close(fd);
+    errno = error;
+    return 0;
+  }
+  int known = header->magic == SHM_RING_MAGIC &&
+              header->version == SHM_RING_VERSION;
+  uint32_t data_offset = header->data_offset, size = header->size;
+  munmap(header, sizeof(struct shm_ring));
+  reader->ring = known ? shm_ring_map(fd, data_offset, size) : NULL;
+  error = known ? errno : EPROTO;
+  close(fd);
+  if (!reader->ring) {
+    errno = error;
+    return 0;
+  }
+  reader->data = (const uint8_t*)reader->ring + data_offset;
+  reader->cursor =
+      atomic_load_explicit(&reader->ring->write, memory_order_acquire);
+  reader->lost = 0;
+  return 1;
+}
+
+static inline void shm_ring_close(struct shm_ring_reader* reader) {
+  shm_ring_unmap(reader->ring);
+}
+
+// Returns whatever was written past the cursor in one contiguous piece, and
+// its length, which is 0 if there is nothing new. Data stays in place until
+// shm_ring_consume.
+static inline const void* shm_ring_peek(struct shm_ring_reader* reader,
+                                        size_t* length) {
+  struct shm_ring* ring = reader->ring;
+  uint64_t write = atomic_load_explicit(&ring->write, memory_order_acquire);
+  if (write - reader->cursor > ring->size) {
+    reader->lost += write - reader->cursor;
+    reader->cursor = write;
+  }
+  *length = (size_t)(write - reader->cursor);
+  return reader->data + reader->cursor % ring->size;
+}
+
+// Moves the cursor past length bytes of what shm_ring_peek returned. Returns
+// 0 if the writer overwrote them in the meantime, even partially, and then
+// they are to be thrown away.
+static inline int shm_ring_consume(struct shm_ring_reader* reader,
+                                   size_t length) {
+  struct shm_ring* ring = reader->ring;
+  atomic_thread_fence(memory_order_acquire);
+  uint64_t reserve =
+      atomic_load_explicit(&ring->reserve, memory_order_relaxed);
+  int intact = reserve - reader->cursor <= ring->size;
+  reader->cursor += length;
+  return intact;
+}
+
+// Parks until something is written past the cursor, for at most timeout_ms,
+// or forever if it is negative. Returns 0 on timeout.
+static inline int shm_ring_wait(struct shm_ring_reader* reader,
+                                int timeout_ms) {
+  struct shm_ring* ring = reader->ring;
+  struct timespec timeout = {.tv_sec = timeout_ms / 1000,
+                             .tv_nsec = timeout_ms % 1000 * 1000000l};
+  atomic_fetch_add(&ring->waiters, 1);
+  unsigned wake = atomic_load(&ring->wake);
+  int result = 1;
+  if (atomic_load(&ring->write) == reader->cursor &&
+      syscall(SYS_futex, &ring->wake, FUTEX_WAIT, wake,
+              timeout_ms < 0 ? NULL : &timeout, NULL, 0) == -1 &&
+      errno == ETIMEDOUT) {
+    result = 0;
+  }
+  atomic_fetch_sub(&ring->waiters, 1);
+  return result;
+}
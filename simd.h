@@ -0,0 +1,55 @@
+#include <stdint.h>
+
+// Vector kernels are written with GCC vector extensions, which compile to NEON
+// on ARM and to SSE on x86, and to plain scalar code where neither exists.
+typedef float v4sf __attribute__((vector_size(16)));
+typedef float v4sf_u __attribute__((vector_size(16), aligned(4)));
+typedef uint8_t v16qu_u __attribute__((vector_size(16), aligned(1)));
+
+static inline float DotProduct(const float* a, const float* b, int count) {
+  v4sf sum0 = {0}, sum1 = {0};
+  int i = 0;
+  for (; i + 8 <= count; i += 8) {
+    sum0 += *(const v4sf_u*)(a + i) * *(const v4sf_u*)(b + i);
+    sum1 += *(const v4sf_u*)(a + i + 4) * *(const v4sf_u*)(b + i + 4);
+  }
+  sum0 += sum1;
+  float result = sum0[0] + sum0[1] + sum0[2] + sum0[3];
+  for (; i < count; ++i) {
+    result += a[i] * b[i];
+  }
+  return result;
+}
+
+static inline void XorBytes(uint8_t* dst, const uint8_t* src, int count) {
+  int i = 0;
+  for (; i + 32 <= count; i += 32) {
+    *(v16qu_u*)(dst + i) ^= *(const v16qu_u*)(src + i);
+    *(v16qu_u*)(dst + i + 16) ^= *(const v16qu_u*)(src + i + 16);
+  }
+  for (; i < count; ++i) {
+    dst[i] ^= src[i];
+  }
+}
+
+// Adds a four tap filter of in to out, which with the taps of an
+// interpolator reads in at a fixed fraction of a sample past every index. In
+// has count + 3 samples.
+static inline void MixTaps(float* out, const float* in, const float* taps,
+                           int count) {
+  v4sf t0 = {taps[0], taps[0], taps[0], taps[0]};
+  v4sf t1 = {taps[1], taps[1], taps[1], taps[1]};
+  v4sf t2 = {taps[2], taps[2], taps[2], taps[2]};
+  v4sf t3 = {taps[3], taps[3], taps[3], taps[3]};
+  int i = 0;
+  for (; i + 4 <= count; i += 4) {
+    *(v4sf_u*)(out + i) += t0 * *(const v4sf_u*)(in + i) +
+                           t1 * *(const v4sf_u*)(in + i + 1) +
+                           t2 * *(const v4sf_u*)(in + i + 2) +
+                           t3 * *(const v4sf_u*)(in + i + 3);
+  }
+  for (; i < count; ++i) {
+    out[i] += taps[0] * in[i] + taps[1] * in[i + 1] + taps[2] * in[i + 2] +
+              taps[3] * in[i + 3];
+  }
+}
@@ -1,10 +1,23 @@
 #include "sles.h"
+#include "capture.h"
+#include "packet.h"
 #include "utils.h"
 
+#include <stdlib.h>
 #include <string.h>
 
 #include <android/log.h>
 
+struct SlesCapture {
+  struct CaptureBackend backend;
+  SLObjectItf engine_obj;
+  SLObjectItf recorder_obj;
+  SLRecordItf recorder;
+  SLAndroidSimpleBufferQueueItf queue;
+  CaptureCallback callback;
+  void* callback_arg;
+};
+
 const char* SlResultString(SLresult result) {
   BEGIN_MAP(result);
   MAP_STR(SL_RESULT_SUCCESS);
@@ -48,17 +61,34 @@ SLEngineItf CreateAudioEngine(SLObjectItf* object) {
   return iface;
 }
 
+// Channels beyond stereo are microphones of an array rather than positions,
+// so they are given by index.
+static SLuint32 ChannelMask(SLuint32 channels) {
+  switch (channels) {
+    case 1:
+      return SL_SPEAKER_FRONT_CENTER;
+    case 2:
+      return SL_SPEAKER_FRONT_LEFT | SL_SPEAKER_FRONT_RIGHT;
+    default:
+      return SL_ANDROID_MAKE_INDEXED_CHANNEL_MASK((1u << channels) - 1);
+  }
+}
+
 SLRecordItf CreateAudioRecorder(SLEngineItf engine, SLuint32 sample_rate,
+                                SLuint32 channels, int encoding,
                                 SLuint32 queue_length, SLObjectItf* object) {
   SLAndroidDataFormat_PCM_EX format_pcm;
   memset(&format_pcm, 0, sizeof(format_pcm));
-  format_pcm.formatType = SL_DATAFORMAT_PCM;
-  format_pcm.numChannels = 1;
+  format_pcm.formatType = SL_ANDROID_DATAFORMAT_PCM_EX;
+  format_pcm.numChannels = channels;
   format_pcm.sampleRate = sample_rate * 1000;
-  format_pcm.bitsPerSample = SL_PCMSAMPLEFORMAT_FIXED_16;
-  format_pcm.containerSize = SL_PCMSAMPLEFORMAT_FIXED_16;
-  format_pcm.channelMask = SL_SPEAKER_FRONT_CENTER;
+  format_pcm.bitsPerSample = PacketEncodingSampleSize(encoding) * 8;
+  format_pcm.containerSize = format_pcm.bitsPerSample;
+  format_pcm.channelMask = ChannelMask(channels);
   format_pcm.endianness = SL_BYTEORDER_LITTLEENDIAN;
+  format_pcm.representation = encoding == PACKET_ENCODING_F32LE
+                                  ? SL_ANDROID_PCM_REPRESENTATION_FLOAT
+                                  : SL_ANDROID_PCM_REPRESENTATION_SIGNED_INT;
   SLDataLocator_IODevice loc_dev = {SL_DATALOCATOR_IODEVICE,
                                     SL_IODEVICE_AUDIOINPUT,
                                     SL_DEFAULTDEVICEID_AUDIOINPUT, NULL};
@@ -120,3 +150,100 @@ SLAndroidSimpleBufferQueueItf CreateAudioQueue(
   }
   return iface;
 }
+
+static void SlesQueueCallback(SLAndroidSimpleBufferQueueItf queue,
+                              void* data) {
+  (void)queue;
+  struct SlesCapture* capture = (struct SlesCapture*)data;
+  capture->callback(capture->callback_arg);
+}
+
+static int SlesEnqueue(struct CaptureBackend* backend, void* buffer,
+                       int size) {
+  struct SlesCapture* capture = (struct SlesCapture*)backend;
+  SLresult result = (*capture->queue)->Enqueue(capture->queue, buffer, size);
+  if (result != SL_RESULT_SUCCESS) {
+    LOG(ERROR, "Failed to enqueue buffer (%s)", SlResultString(result));
+    return 0;
+  }
+  return 1;
+}
+
+static int SlesStart(struct CaptureBackend* backend) {
+  struct SlesCapture* capture = (struct SlesCapture*)backend;
+  SLresult result = (*capture->recorder)
+                        ->SetRecordState(capture->recorder,
+                                         SL_RECORDSTATE_RECORDING);
+  if (result != SL_RESULT_SUCCESS) {
+    LOG(ERROR, "Failed to start recording (%s)", SlResultString(result));
+    return 0;
+  }
+  return 1;
+}
+
+static void SlesStop(struct CaptureBackend* backend) {
+  struct SlesCapture* capture = (struct SlesCapture*)backend;
+  SLresult result = (*capture->recorder)
+                        ->SetRecordState(capture->recorder,
+                                         SL_RECORDSTATE_STOPPED);
+  if (result != SL_RESULT_SUCCESS) {
+    LOG(ERROR, "Failed to stop recording (%s)", SlResultString(result));
+  }
+  result = (*capture->queue)->Clear(capture->queue);
+  if (result != SL_RESULT_SUCCESS) {
+    LOG(ERROR, "Failed to clear queue (%s)", SlResultString(result));
+  }
+}
+
+static void SlesDestroy(struct CaptureBackend* backend) {
+  struct SlesCapture* capture = (struct SlesCapture*)backend;
+  if (capture->recorder_obj) {
+    (*capture->recorder_obj)->Destroy(capture->recorder_obj);
+  }
+  if (capture->engine_obj) {
+    (*capture->engine_obj)->Destroy(capture->engine_obj);
+  }
+  free(capture);
+}
+
+struct CaptureBackend* CreateSlesCapture(SLuint32 sample_rate,
+                                         SLuint32 channels, int encoding,
+                                         SLuint32 queue_length,
+                                         CaptureCallback callback,
+                                         void* callback_arg) {
+  struct SlesCapture* capture =
+      (struct SlesCapture*)calloc(1, sizeof(struct SlesCapture));
+  if (!capture) {
+    LOG(ERROR, "Failed to allocate capture backend");
+    return NULL;
+  }
+  capture->backend.Enqueue = SlesEnqueue;
+  capture->backend.Start = SlesStart;
+  capture->backend.Stop = SlesStop;
+  capture->backend.Destroy = SlesDestroy;
+  capture->callback = callback;
+  capture->callback_arg = callback_arg;
+  do {
+    SLEngineItf engine_iface = CreateAudioEngine(&capture->engine_obj);
+    if (!engine_iface) {
+      LOG(ERROR, "Failed to create audio engine");
+      break;
+    }
+    capture->recorder =
+        CreateAudioRecorder(engine_iface, sample_rate, channels, encoding,
+                            queue_length, &capture->recorder_obj);
+    if (!capture->recorder) {
+      LOG(ERROR, "Failed to create audio recorder");
+      break;
+    }
+    capture->queue = CreateAudioQueue(capture->recorder_obj,
+                                      SlesQueueCallback, capture);
+    if (!capture->queue) {
+      LOG(ERROR, "Failed to create audio queue");
+      break;
+    }
+    return &capture->backend;
+  } while (0);
+  SlesDestroy(&capture->backend);
+  return NULL;
+}
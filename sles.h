@@ -3,7 +3,14 @@
 const char* SlResultString(SLresult result);
 SLEngineItf CreateAudioEngine(SLObjectItf* object);
 SLRecordItf CreateAudioRecorder(SLEngineItf engine, SLuint32 sample_rate,
+                                SLuint32 channels, int encoding,
                                 SLuint32 queue_length, SLObjectItf* object);
 SLAndroidSimpleBufferQueueItf CreateAudioQueue(
     SLObjectItf recorder, slAndroidSimpleBufferQueueCallback callback,
     void* callback_arg);
+
+struct CaptureBackend* CreateSlesCapture(SLuint32 sample_rate,
+                                         SLuint32 channels, int encoding,
+                                         SLuint32 queue_length,
+                                         void (*callback)(void*),
+                                         void* callback_arg);
@@ -0,0 +1,1027 @@
+#define _GNU_SOURCE
+
+#include "archive.h"
+#include "arena.h"
+#include "clocksync.h"
+#include "codec.h"
+#include "convert.h"
+#include "drift.h"
+#include "dsp.h"
+#include "fec.h"
+#include "histogram.h"
+#include "fft.h"
+#include "jitter.h"
+#include "micarray.h"
+#include "packet.h"
+#include "pipeout.h"
+#include "plc.h"
+#include "resample.h"
+#include "shmring.h"
+#include "stream.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <arpa/inet.h>
+#include <sys/ioctl.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
+
+#define JITTER_CAPACITY 256
+#define STATS_INTERVAL 1000
+#define LATENCY_INTERVAL 10000
+#define UDP_OVERHEAD 28
+#define RESAMPLE_CHUNK (STREAM_SLOT_SIZE / 2)
+#define COMFORT_CHUNK 10
+#define COMFORT_TIMEOUT 500
+
+// Gathers payloads straight from the arena slots and writes them to the pipe
+// with as few syscalls as possible, in whole frames however little of them
+// fits, so that a stuck reader never holds up the other streams. Ring, if
+// there is one, gets everything as it comes, regardless of the pipe.
+struct output {
+  struct pipe_out* pipe;
+  int count;
+  struct iovec iov[STREAM_WRITE_BATCH];
+  struct shm_ring_writer* ring;
+};
+
+static int output_flush(struct output* output) {
+  int result = !output->count ||
+               pipe_out_write(output->pipe, output->iov, output->count);
+  output->count = 0;
+  return result;
+}
+
+static int output_add(struct output* output, const void* data, int length) {
+  if (output->count == STREAM_WRITE_BATCH && !output_flush(output)) {
+    return 0;
+  }
+  if (output->ring) {
+    shm_ring_write(output->ring, data, length);
+  }
+  output->iov[output->count++] =
+      (struct iovec){.iov_base = (void*)data, .iov_len = length};
+  return 1;
+}
+
+static int output_silence(struct output* output, int length) {
+  static const char silence[16384];
+  for (; length > 0; length -= sizeof(silence)) {
+    int chunk = length < (int)sizeof(silence) ? length : (int)sizeof(silence);
+    if (!output_add(output, silence, chunk)) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+static void release_packet(void* packet, void* user) {
+  arena_release(user, packet);
+}
+
+// Runs pactl with the given arguments. If module is not NULL, it receives the
+// index that load-module prints, or -1 if there was none.
+static int pactl(int* module, int argc, ...) {
+  va_list args;
+  va_start(args, argc);
+  char* argv[argc + 2];
+  argv[0] = "pactl";
+  for (int i = 1; i < argc + 1; ++i) {
+    argv[i] = va_arg(args, char*);
+  }
+  argv[argc + 1] = NULL;
+  va_end(args);
+  int fds[2];
+  if (module && pipe(fds) == -1) {
+    perror("Failed to create pipe");
+    return 0;
+  }
+  pid_t pid = fork();
+  switch (pid) {
+    case -1:
+      perror("Failed to fork");
+      if (module) {
+        close(fds[0]);
+        close(fds[1]);
+      }
+      return 0;
+    case 0: {
+      // Signals that pamnc blocks outside of waiting are for pamnc alone.
+      sigset_t none;
+      sigemptyset(&none);
+      sigprocmask(SIG_SETMASK, &none, NULL);
+      if (module) {
+        dup2(fds[1], STDOUT_FILENO);
+        close(fds[0]);
+        close(fds[1]);
+      }
+      execvp(argv[0], argv);
+      perror("Failed to exec");
+      _exit(EXIT_FAILURE);
+    }
+    default:
+      break;
+  }
+  if (module) {
+    char index[32] = {0};
+    close(fds[1]);
+    ssize_t length = read(fds[0], index, sizeof(index) - 1);
+    close(fds[0]);
+    *module = length > 0 ? atoi(index) : -1;
+  }
+  int result;
+  if (waitpid(pid, &result, 0) == -1) {
+    perror("Failed to wait");
+    return 0;
+  }
+  return result == EXIT_SUCCESS;
+}
+
+static const char* sample_format(int encoding) {
+  switch (encoding) {
+    case PACKET_ENCODING_S16LE:
+      return "s16le";
+    case PACKET_ENCODING_S24LE:
+      return "s24le";
+    case PACKET_ENCODING_F32LE:
+      return "float32le";
+    default:
+      return NULL;
+  }
+}
+
+int stream_open_source(const char* name, int* module, int sample_rate,
+                       int channels, int encoding) {
+  char file[96], source_name[80], format[32], rate[16], channel_count[16];
+  // Several receivers on a host each get their own pipe for the same sender.
+  snprintf(file, sizeof(file), "/tmp/%s.%d.pipe", name, getpid());
+  snprintf(source_name, sizeof(source_name), "source_name=%s", name);
+  snprintf(format, sizeof(format), "format=%s", sample_format(encoding));
+  snprintf(rate, sizeof(rate), "rate=%d", sample_rate);
+  snprintf(channel_count, sizeof(channel_count), "channels=%d", channels);
+  char file_arg[sizeof(file) + 5];
+  snprintf(file_arg, sizeof(file_arg), "file=%s", file);
+  int pares = pactl(module, 7, "load-module", "module-pipe-source",
+                    source_name, file_arg, format, rate, channel_count);
+  if (!pares) {
+    return -1;
+  }
+  int fd = open(file, O_WRONLY);
+  if (fd == -1) {
+    perror("Failed to open pipe");
+    return -1;
+  }
+  // Pipe source is already reading, so the open above did not block, but no
+  // write should ever block past this point.
+  if (fcntl(fd, F_SETFL, O_NONBLOCK) == -1) {
+    perror("Failed to make pipe non-blocking");
+  }
+  if (unlink(file) == -1) {
+    perror("Failed to unlink pipe");
+  }
+  return fd;
+}
+
+void stream_close_source(const char* name, int fd, int module) {
+  if (close(fd) == -1) {
+    perror("Failed to close pipe");
+  }
+  if (module == -1) {
+    fprintf(stderr, "Module of %s is unknown, leaving it loaded\n", name);
+    return;
+  }
+  char index[16];
+  snprintf(index, sizeof(index), "%d", module);
+  pactl(NULL, 2, "unload-module", index);
+}
+
+static void close_pipe(struct stream* stream) {
+  if (stream->out == -1) {
+    return;
+  }
+  stream_close_source(stream->name, stream->out, stream->module);
+  stream->out = -1;
+}
+
+static void free_resampler(struct stream* stream) {
+  if (!stream->resampling) {
+    return;
+  }
+  resampler_free(&stream->resampler);
+  free(stream->resample_in);
+  free(stream->resample_out);
+  free(stream->converted);
+  stream->resampling = 0;
+}
+
+static int init_resampler(struct stream* stream, int sample_rate,
+                          int channels, int encoding) {
+  if (!resampler_init(&stream->resampler, channels, sample_rate,
+                      stream->out_rate, RESAMPLE_CHUNK)) {
+    perror("Failed to allocate resampler");
+    return 0;
+  }
+  stream->to_float = GetConvertToFloat(encoding);
+  stream->from_float = GetConvertFromFloat(encoding);
+  // Twice the nominal output leaves room for any drift the ratio can take.
+  // No encoding takes more than a float per sample.
+  int frames = resampler_max_output(&stream->resampler, RESAMPLE_CHUNK) * 2;
+  stream->resample_in = malloc(RESAMPLE_CHUNK * channels * sizeof(float));
+  stream->resample_out = malloc(frames * channels * sizeof(float));
+  stream->converted = malloc(frames * channels * sizeof(float));
+  stream->resampling = 1;
+  if (!stream->resample_in || !stream->resample_out || !stream->converted) {
+    perror("Failed to allocate resampler buffers");
+    free_resampler(stream);
+    return 0;
+  }
+  drift_reset(&stream->fifo);
+  return 1;
+}
+
+static void free_dsp(struct stream* stream) {
+  if (stream->processing) {
+    DspFree(&stream->dsp);
+    stream->processing = 0;
+  }
+}
+
+static void free_plc(struct stream* stream) {
+  if (stream->concealing) {
+    plc_free(&stream->plc);
+    stream->concealing = 0;
+  }
+}
+
+// Opens the pipe source for the first datagram, and reopens it whenever the
+// stream changes in a way the pipe cannot follow.
+static int configure(struct stream* stream, struct output* output,
+                     uint16_t format) {
+  if (stream->out != -1 && format == stream->format) {
+    return 1;
+  }
+  if (!output_flush(output)) {
+    return 0;
+  }
+  int sample_rate = PacketFormatRate(format);
+  int channels = PACKET_FORMAT_CHANNELS(format);
+  int encoding = PACKET_FORMAT_ENCODING(format);
+  int pipe_rate = stream->out_rate ? stream->out_rate : sample_rate;
+  free_resampler(stream);
+  if (pipe_rate != stream->pipe_rate || channels != stream->pipe_channels ||
+      encoding != stream->pipe_encoding) {
+    close_pipe(stream);
+  }
+  if (stream->out == -1) {
+    fprintf(stderr, "Opening %s at %d Hz, %d channels, %s\n", stream->name,
+            pipe_rate, channels, sample_format(encoding));
+    stream->out = stream_open_source(stream->name, &stream->module, pipe_rate,
+                                     channels, encoding);
+    if (stream->out == -1) {
+      return 0;
+    }
+    stream->pipe_rate = pipe_rate;
+    stream->pipe_channels = channels;
+    stream->pipe_encoding = encoding;
+    pipe_out_open(&stream->pipe, stream->out, PacketFormatFrameSize(format));
+  }
+  if (stream->ring_ms && !stream->ring.ring) {
+    size_t size = (size_t)stream->ring_ms * pipe_rate / 1000 * channels *
+                  PacketEncodingSampleSize(encoding);
+    if (!shm_ring_create(&stream->ring, stream->name, size)) {
+      perror("Failed to create ring");
+      stream->ring_ms = 0;
+    }
+  }
+  if (stream->ring.ring) {
+    shm_ring_set_format(&stream->ring, pipe_rate, channels, encoding);
+    output->ring = &stream->ring;
+  }
+  if (stream->out_rate &&
+      !init_resampler(stream, sample_rate, channels, encoding)) {
+    return 0;
+  }
+  free_dsp(stream);
+  if (DspEnabled(stream->dsp_config)) {
+    int max_frames = STREAM_SLOT_SIZE / PacketFormatFrameSize(format);
+    if (!DspInit(&stream->dsp, stream->dsp_config, sample_rate, channels,
+                 encoding, max_frames)) {
+      perror("Failed to allocate signal processing");
+      return 0;
+    }
+    stream->processing = 1;
+  }
+  free_plc(stream);
+  if (stream->conceal) {
+    if (!plc_init(&stream->plc, sample_rate, channels)) {
+      perror("Failed to allocate loss concealment");
+      return 0;
+    }
+    stream->concealing = 1;
+  }
+  if (stream->array && (stream->array_input == -1 ||
+                        sample_rate != stream->array->rate)) {
+    if (stream->array_input != -1) {
+      array_leave(stream->array, stream->array_input);
+    }
+    stream->array_input = array_join(stream->array, sample_rate);
+    if (stream->array_input == -1) {
+      fprintf(stderr, "Stream %s is left out of the array\n", stream->name);
+    }
+  }
+  stream->format = format;
+  return 1;
+}
+
+// Hands frames over to the array at the rate of the stream, as floats.
+static void write_array(struct stream* stream, uint32_t timestamp,
+                        const void* samples, int frames) {
+  static float converted[STREAM_SLOT_SIZE / sizeof(float)];
+  int channels = PACKET_FORMAT_CHANNELS(stream->format);
+  int frame_size = PacketFormatFrameSize(stream->format);
+  ConvertToFloat to_float =
+      GetConvertToFloat(PACKET_FORMAT_ENCODING(stream->format));
+  int max_chunk = (int)(sizeof(converted) / sizeof(*converted)) / channels;
+  while (frames) {
+    int chunk = frames < max_chunk ? frames : max_chunk;
+    if (samples) {
+      to_float(samples, converted, chunk * channels);
+      samples = (const char*)samples + chunk * frame_size;
+    }
+    array_write(stream->array, stream->array_input, timestamp,
+                clock_sync_capture_time(&stream->clock, timestamp),
+                samples ? converted : NULL, chunk, channels);
+    timestamp += chunk;
+    frames -= chunk;
+  }
+}
+
+// Writes frames to the pipe, or silence if samples is NULL, starting at the
+// given timestamp. Zeros are silence in every encoding. Archive, if there is
+// one, takes them before they are resampled, and stops for good once it
+// fails, and so does the array.
+static int deliver(struct stream* stream, struct output* output,
+                   uint32_t timestamp, const void* samples, int frames) {
+  int channels = stream->pipe_channels;
+  int sample_size = PacketEncodingSampleSize(stream->pipe_encoding);
+  if (stream->array_input != -1) {
+    write_array(stream, timestamp, samples, frames);
+  }
+  if (stream->archiving &&
+      !archive_write(&stream->archive, stream->format, samples,
+                     (size_t)frames * PacketFormatFrameSize(stream->format),
+                     clock_sync_capture_time(&stream->clock, timestamp))) {
+    fprintf(stderr, "Archiving of %s stopped\n", stream->name);
+    archive_free(&stream->archive);
+    stream->archiving = 0;
+  }
+  if (!stream->resampling) {
+    int length = frames * channels * sample_size;
+    return samples ? output_add(output, samples, length)
+                   : output_silence(output, length);
+  }
+  while (frames) {
+    int chunk = frames < RESAMPLE_CHUNK ? frames : RESAMPLE_CHUNK;
+    int count = chunk * channels;
+    if (samples) {
+      stream->to_float(samples, stream->resample_in, count);
+    } else {
+      memset(stream->resample_in, 0, count * sizeof(float));
+    }
+    int produced = resampler_process(&stream->resampler, stream->resample_in,
+                                     chunk, stream->resample_out);
+    count = produced * channels;
+    stream->from_float(stream->resample_out, stream->converted, count);
+    // Converted samples are overwritten by the next chunk.
+    if (!output_add(output, stream->converted, count * sample_size) ||
+        !output_flush(output)) {
+      return 0;
+    }
+    if (samples) {
+      samples = (const char*)samples + chunk * channels * sample_size;
+    }
+    frames -= chunk;
+  }
+  return 1;
+}
+
+// Writes frames of white noise at the level of the last silence descriptor.
+// Samples are uniform, which takes a peak of sqrt(3) times the RMS level.
+static int deliver_comfort(struct stream* stream, struct output* output,
+                           uint32_t timestamp, int frames) {
+  static float noise[STREAM_SLOT_SIZE / sizeof(float)];
+  static char samples[STREAM_SLOT_SIZE];
+  int channels = PACKET_FORMAT_CHANNELS(stream->format);
+  ConvertFromFloat from_float =
+      GetConvertFromFloat(PACKET_FORMAT_ENCODING(stream->format));
+  float scale = stream->comfort_level * 1.7320508f / 2147483648.f;
+  int max_chunk = (int)(sizeof(noise) / sizeof(*noise)) / channels;
+  stream->comfort_frames += frames;
+  while (frames) {
+    int chunk = frames < max_chunk ? frames : max_chunk;
+    int count = chunk * channels;
+    uint32_t seed = stream->comfort_seed;
+    for (int i = 0; i < count; ++i) {
+      seed ^= seed << 13;
+      seed ^= seed >> 17;
+      seed ^= seed << 5;
+      noise[i] = (int32_t)seed * scale;
+    }
+    stream->comfort_seed = seed;
+    from_float(noise, samples, count);
+    // Samples are overwritten by the next chunk.
+    if (!deliver(stream, output, timestamp, samples, chunk) ||
+        !output_flush(output)) {
+      return 0;
+    }
+    timestamp += chunk;
+    frames -= chunk;
+  }
+  return 1;
+}
+
+// Keeps comfort noise going up to now on the playout schedule, for as long
+// as it takes the next descriptor or packet to come, but no longer than
+// COMFORT_TIMEOUT milliseconds past the last descriptor.
+static int play_comfort(struct stream* stream, struct output* output,
+                        uint64_t now) {
+  const struct jitter_buffer* jitter = &stream->jitter;
+  int sample_rate = PacketFormatRate(stream->format);
+  int32_t left = stream->comfort_timestamp +
+                 COMFORT_TIMEOUT * sample_rate / 1000 -
+                 stream->next_timestamp;
+  if (left <= 0) {
+    stream->comfort = 0;
+    return 1;
+  }
+  uint64_t start = jitter_release_time(jitter, stream->next_timestamp);
+  if (start >= now || jitter_deadline(jitter) <= now) {
+    return 1;
+  }
+  int64_t frames =
+      (int64_t)((now - start) * (sample_rate / 1e9) / jitter->period);
+  if (frames > left) {
+    frames = left;
+  }
+  uint32_t timestamp = stream->next_timestamp;
+  stream->next_timestamp += (uint32_t)frames;
+  return deliver_comfort(stream, output, timestamp, (int)frames);
+}
+
+// Takes frames that were received for concealing losses later, and fades
+// them in from concealment that went on right before them.
+static void receive_frames(struct stream* stream, void* payload, int frames) {
+  static float samples[STREAM_SLOT_SIZE / 2];
+  int encoding = PACKET_FORMAT_ENCODING(stream->format);
+  int channels = PACKET_FORMAT_CHANNELS(stream->format);
+  GetConvertToFloat(encoding)(payload, samples, frames * channels);
+  int merged = plc_receive(&stream->plc, samples, frames);
+  if (merged) {
+    GetConvertFromFloat(encoding)(samples, payload, merged * channels);
+  }
+}
+
+// Writes frames made up in place of lost ones.
+static int deliver_concealed(struct stream* stream, struct output* output,
+                             uint32_t timestamp, int frames) {
+  static float concealed[STREAM_SLOT_SIZE / sizeof(float)];
+  static char samples[STREAM_SLOT_SIZE];
+  int channels = PACKET_FORMAT_CHANNELS(stream->format);
+  ConvertFromFloat from_float =
+      GetConvertFromFloat(PACKET_FORMAT_ENCODING(stream->format));
+  int max_chunk = (int)(sizeof(concealed) / sizeof(*concealed)) / channels;
+  stream->concealed_frames += frames;
+  while (frames) {
+    int chunk = frames < max_chunk ? frames : max_chunk;
+    plc_conceal(&stream->plc, concealed, chunk);
+    from_float(concealed, samples, chunk * channels);
+    // Samples are overwritten by the next chunk.
+    if (!deliver(stream, output, timestamp, samples, chunk) ||
+        !output_flush(output)) {
+      return 0;
+    }
+    timestamp += chunk;
+    frames -= chunk;
+  }
+  return 1;
+}
+
+// Frames that never came are comfort noise during silence, concealment with
+// that on, and silence otherwise.
+static int deliver_missing(struct stream* stream, struct output* output,
+                           uint32_t timestamp, int frames) {
+  if (stream->comfort) {
+    return deliver_comfort(stream, output, timestamp, frames);
+  }
+  if (stream->concealing) {
+    return deliver_concealed(stream, output, timestamp, frames);
+  }
+  return deliver(stream, output, timestamp, NULL, frames);
+}
+
+// Frames that are overdue on the playout schedule are concealed up to now,
+// until concealment fades out. The rest of a gap is filled with silence once
+// the next packet comes, as without concealment.
+static int play_concealed(struct stream* stream, struct output* output,
+                          uint64_t now) {
+  const struct jitter_buffer* jitter = &stream->jitter;
+  int left = plc_audible(&stream->plc);
+  if (!left) {
+    return 1;
+  }
+  uint64_t start = jitter_release_time(jitter, stream->next_timestamp);
+  if (start >= now || jitter_deadline(jitter) <= now) {
+    return 1;
+  }
+  int64_t frames = (int64_t)((now - start) *
+                             (PacketFormatRate(stream->format) / 1e9) /
+                             jitter->period);
+  if (frames > left) {
+    frames = left;
+  }
+  uint32_t timestamp = stream->next_timestamp;
+  stream->next_timestamp += (uint32_t)frames;
+  return deliver_concealed(stream, output, timestamp, (int)frames);
+}
+
+// Pipe fill creeps up when its reader runs slower than the schedule. Scale the
+// resampling ratio by that and by the frame period of the sender.
+static void track_drift(struct stream* stream, uint64_t now) {
+  int queued;
+  if (!stream->resampling || ioctl(stream->out, FIONREAD, &queued) == -1) {
+    return;
+  }
+  int frame_size = PacketFormatFrameSize(stream->format);
+  int64_t fill = (int64_t)queued / frame_size * 1000000000 / stream->pipe_rate;
+  drift_update(&stream->fifo, fill, now);
+  resampler_set_drift(&stream->resampler,
+                      stream->fifo.correction / stream->jitter.period);
+}
+
+// Returns the size of the packet at the start of data, or everything that is
+// left when it is not well-formed, so that the jitter buffer rejects it.
+static int packet_size(struct io_stats* io, const void* data, int length) {
+  const struct PacketHeader* header = data;
+  if (length < (int)sizeof(*header) ||
+      (int)sizeof(*header) + header->length > length) {
+    io->packets++;
+    return length;
+  }
+  if (header->type != PACKET_TYPE_PARITY &&
+      header->type != PACKET_TYPE_CLOCK &&
+      header->type != PACKET_TYPE_STATS) {
+    io->packets++;
+    io->payload_bytes += header->length;
+  }
+  return (int)sizeof(*header) + header->length;
+}
+
+static uint32_t to_microseconds(int64_t duration) {
+  if (duration < 0) {
+    return 0;
+  }
+  duration /= 1000;
+  return duration < UINT32_MAX ? (uint32_t)duration : UINT32_MAX;
+}
+
+// Transit time of a datagram is how long after capture of its first frame it
+// came in. Its variation from one datagram to the next is the network jitter,
+// as in RFC 3550, regardless of how far apart the clocks are.
+static void track_transit(struct stream* stream, const void* data, int length,
+                          uint64_t now) {
+  const struct PacketHeader* header = data;
+  if (length < (int)sizeof(*header) || header->type != PACKET_TYPE_AUDIO) {
+    return;
+  }
+  uint64_t capture = clock_sync_capture_time(&stream->clock,
+                                             header->timestamp);
+  if (!capture) {
+    return;
+  }
+  int64_t transit = (int64_t)(now - capture);
+  if (stream->have_transit) {
+    int64_t delta = transit - stream->last_transit;
+    histogram_add(&stream->transit_jitter,
+                  to_microseconds(delta < 0 ? -delta : delta));
+  }
+  stream->last_transit = transit;
+  stream->have_transit = 1;
+}
+
+// Parity packets go to the decoder, and whatever it rebuilds goes on to the
+// jitter buffer as if it was received. Clock packets are answers to requests,
+// and stats packets replace whatever the sender reported before.
+static void put_packet(struct stream* stream, void* packet, int size,
+                       uint64_t now) {
+  const struct PacketHeader* header = packet;
+  if (size >= (int)sizeof(*header) && header->type == PACKET_TYPE_CLOCK) {
+    clock_sync_update(&stream->clock, packet, size, now);
+    arena_release(stream->arena, packet);
+    return;
+  }
+  if (size >= (int)sizeof(*header) && header->type == PACKET_TYPE_STATS) {
+    if (size == (int)(sizeof(*header) + sizeof(stream->sender_stats))) {
+      memcpy(&stream->sender_stats, header + 1, sizeof(stream->sender_stats));
+      stream->have_sender_stats = 1;
+    }
+    arena_release(stream->arena, packet);
+    return;
+  }
+  if (size < (int)sizeof(*header) || header->type != PACKET_TYPE_PARITY) {
+    FecDecoderAdd(&stream->fec, packet, size);
+    jitter_put(&stream->jitter, packet, size, now);
+    return;
+  }
+  void* rebuilt = arena_alloc(stream->arena);
+  int length =
+      rebuilt ? FecDecoderRecover(&stream->fec, packet, size, rebuilt) : 0;
+  arena_release(stream->arena, packet);
+  if (length) {
+    jitter_put(&stream->jitter, rebuilt, length, now);
+  } else if (rebuilt) {
+    arena_release(stream->arena, rebuilt);
+  }
+}
+
+int stream_init(struct stream* stream, const struct sockaddr_in6* addr,
+                struct arena* arena, int depth_ms, int out_rate, int ring_ms,
+                const struct DspConfig* dsp_config, int conceal,
+                const char* archive_dir, size_t segment_size,
+                struct mic_array* array, uint64_t now) {
+  memset(stream, 0, sizeof(*stream));
+  if (!jitter_init(&stream->jitter, JITTER_CAPACITY, depth_ms, release_packet,
+                   arena)) {
+    perror("Failed to allocate jitter buffer");
+    return 0;
+  }
+  FecDecoderInit(&stream->fec, STREAM_SLOT_SIZE);
+  stream->addr = *addr;
+  // Senders on IPv4 come as IPv4-mapped addresses, and are named the IPv4 way.
+  // Source names can not have dots or colons in them.
+  char address[INET6_ADDRSTRLEN];
+  int mapped = IN6_IS_ADDR_V4MAPPED(&addr->sin6_addr);
+  inet_ntop(mapped ? AF_INET : AF_INET6,
+            mapped ? (const void*)&addr->sin6_addr.s6_addr[12]
+                   : (const void*)&addr->sin6_addr,
+            address, sizeof(address));
+  int length = snprintf(stream->name, sizeof(stream->name), "pamnc_%s_%u",
+                        address, ntohs(addr->sin6_port));
+  for (int i = 0; i < length; ++i) {
+    if (stream->name[i] == '.' || stream->name[i] == ':') {
+      stream->name[i] = '_';
+    }
+  }
+  stream->arena = arena;
+  stream->module = -1;
+  stream->out = -1;
+  stream->out_rate = out_rate;
+  stream->ring_ms = ring_ms;
+  stream->dsp_config = dsp_config;
+  stream->conceal = conceal;
+  stream->array = array;
+  stream->array_input = -1;
+  if (archive_dir) {
+    stream->archiving =
+        archive_init(&stream->archive, archive_dir, stream->name, segment_size);
+  }
+  stream->comfort_seed = 1;
+  stream->stats_time = now;
+  stream->last_seen = now;
+  stream->latency_time = now;
+  return 1;
+}
+
+void stream_free(struct stream* stream) {
+  close_pipe(stream);
+  if (stream->array_input != -1) {
+    array_leave(stream->array, stream->array_input);
+  }
+  if (stream->ring.ring) {
+    shm_ring_destroy(&stream->ring);
+  }
+  free_resampler(stream);
+  free_dsp(stream);
+  free_plc(stream);
+  if (stream->archiving) {
+    archive_free(&stream->archive);
+  }
+  jitter_free(&stream->jitter);
+  FecDecoderFree(&stream->fec);
+}
+
+void stream_reset(struct stream* stream) {
+  jitter_reset(&stream->jitter);
+  stream->primed = 0;
+  stream->comfort = 0;
+  if (stream->concealing) {
+    plc_reset(&stream->plc);
+  }
+}
+
+// Datagrams carry one or more packets back to back. A lone packet stays in the
+// slot it was received into, otherwise each one is copied to a slot of its own.
+void stream_put(struct stream* stream, void* data, int length, uint64_t now) {
+  stream->last_seen = now;
+  if (stream->failed_time) {
+    arena_release(stream->arena, data);
+    return;
+  }
+  stream->io.datagrams++;
+  stream->io.wire_bytes += length + UDP_OVERHEAD;
+  track_transit(stream, data, length, now);
+  int size = packet_size(&stream->io, data, length);
+  if (size == length) {
+    put_packet(stream, data, length, now);
+    return;
+  }
+  for (int offset = 0; offset < length; offset += size) {
+    if (offset) {
+      size = packet_size(&stream->io, (char*)data + offset, length - offset);
+    }
+    void* slot = arena_alloc(stream->arena);
+    if (!slot) {
+      break;
+    }
+    memcpy(slot, (char*)data + offset, size);
+    put_packet(stream, slot, size, now);
+  }
+  arena_release(stream->arena, data);
+}
+
+int stream_play(struct stream* stream, uint64_t now) {
+  struct jitter_buffer* jitter = &stream->jitter;
+  struct output output = {
+      .pipe = &stream->pipe,
+      .ring = stream->ring.ring ? &stream->ring : NULL};
+  void* played[STREAM_WRITE_BATCH * 2];
+  int count = 0;
+  int result = 1;
+  for (struct PacketHeader* header;
+       result && count < STREAM_WRITE_BATCH &&
+       (header = jitter_get(jitter, now));) {
+    played[count++] = header;
+    if (!configure(stream, &output, header->format)) {
+      result = 0;
+      break;
+    }
+    int sample_rate = PacketFormatRate(header->format);
+    int frame_size = PacketFormatFrameSize(header->format);
+    void* payload = header + 1;
+    int length = header->length;
+    if (header->flags & PACKET_FLAG_CODED) {
+      // Only s16 samples are ever coded.
+      void* decoded =
+          PACKET_FORMAT_ENCODING(header->format) == PACKET_ENCODING_S16LE
+              ? arena_alloc(stream->arena)
+              : NULL;
+      int frames =
+          decoded ? CodecDecode(payload, length,
+                                PACKET_FORMAT_CHANNELS(header->format),
+                                decoded, STREAM_SLOT_SIZE / frame_size)
+                  : -1;
+      if (frames == -1) {
+        if (decoded) {
+          arena_release(stream->arena, decoded);
+        }
+        jitter->stats.invalid++;
+        continue;
+      }
+      played[count++] = decoded;
+      payload = decoded;
+      length = frames * frame_size;
+    }
+    int sid = header->flags & PACKET_FLAG_SID;
+    if (sid && length != 1) {
+      jitter->stats.invalid++;
+      continue;
+    }
+    if (stream->resync != jitter->stats.resync) {
+      stream->resync = jitter->stats.resync;
+      stream->primed = 0;
+    }
+    // Keep the pipe in step with capture time across lost datagrams, and
+    // across silence.
+    int32_t gap = header->timestamp - stream->next_timestamp;
+    if (stream->primed && gap > 0 && gap < sample_rate) {
+      result = deliver_missing(stream, &output, stream->next_timestamp, gap);
+    }
+    int frames = sid ? 0 : length / frame_size;
+    uint32_t start = header->timestamp;
+    uint32_t end = start + frames;
+    if (stream->primed && (stream->comfort || stream->concealing) &&
+        gap < 0) {
+      // Comfort noise and concealment can run past the start of the next
+      // packet.
+      int skip = -gap < frames ? -gap : frames;
+      payload = (char*)payload + skip * frame_size;
+      start += skip;
+      frames -= skip;
+      if ((int32_t)(end - stream->next_timestamp) < 0) {
+        end = stream->next_timestamp;
+      }
+    }
+    if (sid) {
+      stream->comfort = 1;
+      stream->comfort_level = powf(10, -*(const uint8_t*)payload / 20.f);
+      stream->comfort_timestamp = header->timestamp;
+    } else {
+      stream->comfort = 0;
+      if (stream->processing) {
+        DspProcess(&stream->dsp, payload, frames);
+      }
+      if (stream->concealing && frames > 0) {
+        receive_frames(stream, payload, frames);
+      }
+      result = result && deliver(stream, &output, start, payload, frames);
+    }
+    uint64_t capture =
+        clock_sync_capture_time(&stream->clock, header->timestamp);
+    if (result && capture) {
+      histogram_add(&stream->latency,
+                    to_microseconds((int64_t)(now - capture)));
+    }
+    stream->primed = 1;
+    stream->next_timestamp = end;
+  }
+  if (result && stream->comfort && stream->primed) {
+    result = play_comfort(stream, &output, now);
+  } else if (result && stream->concealing && stream->primed) {
+    result = play_concealed(stream, &output, now);
+  }
+  result = result && output_flush(&output);
+  while (count) {
+    arena_release(stream->arena, played[--count]);
+  }
+  if (result) {
+    track_drift(stream, now);
+  }
+  return result;
+}
+
+uint64_t stream_deadline(const struct stream* stream) {
+  uint64_t deadline = jitter_deadline(&stream->jitter);
+  if (stream->primed &&
+      (stream->comfort ||
+       (stream->concealing && plc_audible(&stream->plc)))) {
+    uint32_t chunk = PacketFormatRate(stream->format) * COMFORT_CHUNK / 1000;
+    uint64_t comfort =
+        jitter_release_time(&stream->jitter, stream->next_timestamp + chunk);
+    if (comfort < deadline) {
+      deadline = comfort;
+    }
+  }
+  return deadline;
+}
+
+// Only reports when something went wrong since the last report, except for
+// latency, which is reported every once in a while.
+void stream_report(struct stream* stream, uint64_t now) {
+  if (now - stream->latency_time >= LATENCY_INTERVAL * 1000000ull) {
+    stream_print_latency(stream, now);
+    stream_print_sender_stats(stream);
+  }
+  struct jitter_stats stats = stream->jitter.stats;
+  stats.received = stream->stats.received;
+  if (memcmp(&stream->stats, &stats, sizeof(stats)) &&
+      now - stream->stats_time >= STATS_INTERVAL * 1000000ull) {
+    stream_print_stats(stream, now);
+  }
+}
+
+void stream_prepare_archive(struct stream* stream) {
+  if (stream->archiving && !archive_prepare(&stream->archive)) {
+    fprintf(stderr, "Archiving of %s stopped\n", stream->name);
+    archive_free(&stream->archive);
+    stream->archiving = 0;
+  }
+}
+
+void stream_print_stats(struct stream* stream, uint64_t now) {
+  const struct jitter_stats* stats = &stream->jitter.stats;
+  const struct io_stats* io = &stream->io;
+  double seconds = (now - stream->stats_time) / 1e9;
+  fprintf(stderr,
+          "%s: received %u, lost %u, late %u, duplicate %u, reordered %u, "
+          "invalid %u, resync %u, recovered %u, unrecoverable %u, "
+          "packets per write %.2f, datagrams/s %.1f, "
+          "packets per datagram %.2f, payload efficiency %.1f%%, "
+          "dropped bytes %lu, comfort noise %.1f s, concealed %.2f s, "
+          "sender drift %+.1f ppm, pipe drift %+.1f ppm\n",
+          stream->name, stats->received, stats->lost, stats->late,
+          stats->duplicate, stats->reordered, stats->invalid, stats->resync,
+          stream->fec.recovered, stream->fec.unrecoverable,
+          stream->pipe.write_calls
+              ? (double)io->packets / stream->pipe.write_calls
+              : 0,
+          seconds > 0 ? (io->datagrams - stream->reported_datagrams) / seconds
+                      : 0,
+          io->datagrams ? (double)io->packets / io->datagrams : 0,
+          io->wire_bytes ? 100.0 * io->payload_bytes / io->wire_bytes : 0,
+          stream->pipe.dropped_bytes,
+          (double)stream->comfort_frames / PacketFormatRate(stream->format),
+          (double)stream->concealed_frames / PacketFormatRate(stream->format),
+          stream->jitter.started ? (1 / stream->jitter.period - 1) * 1e6 : 0,
+          stream->resampling ? (stream->fifo.correction - 1) * 1e6 : 0);
+  stream->stats = *stats;
+  stream->stats_time = now;
+  stream->reported_datagrams = io->datagrams;
+}
+
+// Percentiles are over everything since the stream started.
+void stream_print_latency(struct stream* stream, uint64_t now) {
+  const struct histogram* latency = &stream->latency;
+  const struct histogram* jitter = &stream->transit_jitter;
+  stream->latency_time = now;
+  if (!latency->total && !jitter->total) {
+    return;
+  }
+  fprintf(stderr,
+          "%s: latency p50 %.1f ms, p99 %.1f ms, max %.1f ms, "
+          "jitter p50 %.1f ms, p99 %.1f ms, max %.1f ms, "
+          "clock offset %+.3f ms, rtt %.3f ms\n",
+          stream->name, histogram_percentile(latency, 50) / 1e3,
+          histogram_percentile(latency, 99) / 1e3, latency->max / 1e3,
+          histogram_percentile(jitter, 50) / 1e3,
+          histogram_percentile(jitter, 99) / 1e3, jitter->max / 1e3,
+          stream->clock.offset / 1e6, stream->clock.rtt / 1e6);
+}
+
+// Returns the upper bound of the bucket of a sender histogram the percentile
+// falls into, in milliseconds.
+static double bucket_percentile(const uint32_t* buckets, double percentile) {
+  unsigned long total = 0;
+  for (int i = 0; i < PACKET_STATS_BUCKETS; ++i) {
+    total += buckets[i];
+  }
+  unsigned long seen = 0;
+  for (int i = 0; i < PACKET_STATS_BUCKETS; ++i) {
+    seen += buckets[i];
+    if (seen && seen >= total * percentile / 100) {
+      return (1ul << i) / 1e3;
+    }
+  }
+  return 0;
+}
+
+static int max_depth(const uint32_t* depths, int count) {
+  int result = 0;
+  for (int i = 0; i < count; ++i) {
+    if (depths[i]) {
+      result = i;
+    }
+  }
+  return result;
+}
+
+// Depth history starts at one buffer.
+static int median_buffer_depth(const uint32_t* history) {
+  unsigned long total = 0;
+  for (int i = 0; i < PACKET_STATS_BUFFERS; ++i) {
+    total += history[i];
+  }
+  unsigned long seen = 0;
+  for (int i = 0; i < PACKET_STATS_BUFFERS; ++i) {
+    seen += history[i];
+    if (seen && seen >= total / 2) {
+      return i + 1;
+    }
+  }
+  return 0;
+}
+
+void stream_print_sender_stats(const struct stream* stream) {
+  const struct StatsReport* report = &stream->sender_stats;
+  if (!stream->have_sender_stats) {
+    return;
+  }
+  fprintf(stderr,
+          "%s: sender callbacks %u, overruns %u, stalls %u, "
+          "enqueue failures %u, buffers %u, send errors %u, "
+          "callback interval p50 < %.3f ms, p99 < %.3f ms, "
+          "send latency p50 < %.3f ms, p99 < %.3f ms, "
+          "loop wakeup p50 < %.3f ms, p99 < %.3f ms, "
+          "max queue depth %d/%d/%d, buffer depth %u, p50 %d, max %d, "
+          "increased %u times, decreased %u times\n",
+          stream->name, report->callbacks, report->overruns, report->stalls,
+          report->enqueue_failures, report->buffers, report->send_errors,
+          bucket_percentile(report->callback_interval, 50),
+          bucket_percentile(report->callback_interval, 99),
+          bucket_percentile(report->send_latency, 50),
+          bucket_percentile(report->send_latency, 99),
+          bucket_percentile(report->wakeup_latency, 50),
+          bucket_percentile(report->wakeup_latency, 99),
+          max_depth(report->queue_depth[0], PACKET_STATS_DEPTHS),
+          max_depth(report->queue_depth[1], PACKET_STATS_DEPTHS),
+          max_depth(report->queue_depth[2], PACKET_STATS_DEPTHS),
+          report->buffer_depth, median_buffer_depth(report->depth_history),
+          max_depth(report->depth_history, PACKET_STATS_BUFFERS) + 1,
+          report->depth_increases, report->depth_decreases);
+}
@@ -0,0 +1,120 @@
+#include <netinet/in.h>
+#include <stdint.h>
+
+#define STREAM_SLOT_SIZE 8192
+#define STREAM_WRITE_BATCH 64
+
+struct arena;
+struct mic_array;
+
+struct io_stats {
+  unsigned long datagrams;
+  unsigned long packets;
+  unsigned long payload_bytes;
+  unsigned long wire_bytes;
+};
+
+// Everything received from one sender and the PulseAudio pipe source it plays
+// into. Packets lost on the way are rebuilt from parity, if the sender sends
+// any, before they reach the jitter buffer. Source and its pipe are named
+// after the address of the sender, and are created for the first datagram.
+// With an output rate configured, everything goes through the resampler,
+// which also absorbs the drift of the sender clock and of the pipe reader.
+// Otherwise payloads are written as is and the pipe follows the rate of the
+// stream. The pipe always takes the channel count and sample encoding of the
+// stream. Once the sender answers a clock request, latency from capture to the
+// pipe and jitter of the transit time of datagrams are counted in
+// microseconds. Latest metrics the sender reported about itself are kept too.
+// With a ring duration configured, whatever goes to the pipe also goes to a
+// shared memory ring of that many milliseconds, for local readers. With any
+// signal processing configured, it runs on every payload before the pipe, at
+// the rate of the stream. Silence descriptors from the sender make for comfort
+// noise at the level they carry, which goes on in real time until the next
+// packet. With an archive directory configured, everything played also goes
+// to segment files there at the rate of the stream, indexed by capture time.
+// With concealment on, frames of lost packets are made up from the ones
+// before them, and so are frames of packets that are overdue, in real time,
+// until concealment fades out. With an array, everything played also goes
+// to it at the rate of the stream, as one of its inputs.
+struct stream {
+  struct sockaddr_in6 addr;
+  char name[64];
+  struct arena* arena;
+  struct jitter_buffer jitter;
+  struct FecDecoder fec;
+  struct io_stats io;
+  int module;
+  int out;
+  struct pipe_out pipe;
+  int out_rate;
+  int ring_ms;
+  struct shm_ring_writer ring;
+  const struct DspConfig* dsp_config;
+  int processing;
+  struct Dsp dsp;
+  int conceal;
+  int concealing;
+  struct plc plc;
+  unsigned long concealed_frames;
+  int archiving;
+  struct archive archive;
+  struct mic_array* array;
+  int array_input;
+  int pipe_rate;
+  int pipe_channels;
+  int pipe_encoding;
+  uint16_t format;
+  int resampling;
+  struct resampler resampler;
+  struct drift fifo;
+  ConvertToFloat to_float;
+  ConvertFromFloat from_float;
+  float* resample_in;
+  float* resample_out;
+  void* converted;
+  int primed;
+  uint32_t next_timestamp;
+  int comfort;
+  float comfort_level;
+  uint32_t comfort_timestamp;
+  uint32_t comfort_seed;
+  unsigned long comfort_frames;
+  unsigned resync;
+  uint64_t stats_time;
+  struct jitter_stats stats;
+  unsigned long reported_datagrams;
+  uint64_t last_seen;
+  uint64_t ping_time;
+  uint64_t probe_interval;
+  uint64_t failed_time;
+  struct clock_sync clock;
+  struct histogram latency;
+  struct histogram transit_jitter;
+  int64_t last_transit;
+  int have_transit;
+  uint64_t latency_time;
+  struct StatsReport sender_stats;
+  int have_sender_stats;
+};
+
+int stream_init(struct stream* stream, const struct sockaddr_in6* addr,
+                struct arena* arena, int depth_ms, int out_rate, int ring_ms,
+                const struct DspConfig* dsp_config, int conceal,
+                const char* archive_dir, size_t segment_size,
+                struct mic_array* array, uint64_t now);
+void stream_free(struct stream* stream);
+void stream_reset(struct stream* stream);
+void stream_put(struct stream* stream, void* data, int length, uint64_t now);
+int stream_play(struct stream* stream, uint64_t now);
+uint64_t stream_deadline(const struct stream* stream);
+void stream_report(struct stream* stream, uint64_t now);
+void stream_prepare_archive(struct stream* stream);
+void stream_print_stats(struct stream* stream, uint64_t now);
+void stream_print_latency(struct stream* stream, uint64_t now);
+void stream_print_sender_stats(const struct stream* stream);
+// Loads a PulseAudio pipe source of that name and returns the pipe to write
+// to, non-blocking, or -1 on failure. Module receives the index of the module
+// to unload with the pipe, or -1 if it is unknown.
+int stream_open_source(const char* name, int* module, int sample_rate,
+                       int channels, int encoding);
+void stream_close_source(const char* name, int fd, int module);
@@ -1,9 +1,17 @@
 #define STRIMPL(op) #op
 #define STR(op) STRIMPL(op)
 
+#ifdef __ANDROID__
+#include <android/log.h>
 #define LOG(level, ...)                                 \
   __android_log_print(ANDROID_LOG_##level, "andrecord", \
                       __FILE__ ":" STR(__LINE__) " " __VA_ARGS__)
+#else  // __ANDROID__
+#include <stdio.h>
+#define LOG(level, ...)                                                 \
+  (fprintf(stderr, #level " " __FILE__ ":" STR(__LINE__) " " __VA_ARGS__), \
+   fputc('\n', stderr))
+#endif  // __ANDROID__
 
 #define LENGTH(op) (sizeof(op) / sizeof *(op))
 #define FOR_EACH(it, container)                           \
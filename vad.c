@@ -0,0 +1,139 @@
+#include "vad.h"
+#include "packet.h"
+#include "simd.h"
+
+#include <math.h>
+#include <string.h>
+
+// Noise never goes below -80 dBFS, so that digital silence does not make the
+// faintest hiss active. It creeps up by about 1 dB a second at 100 buffers a
+// second, and the zero-crossing rate of the noise follows inactive buffers
+// with a time constant of 8 buffers.
+#define VAD_MIN_NOISE 1e-8f
+#define VAD_NOISE_RISE 1.0023f
+#define VAD_CROSSINGS_WEIGHT 0.125f
+#define VAD_CROSSINGS_MARGIN 0.1f
+#define VAD_MAX_LEVEL 127
+
+// Energy and zero crossings get loops of their own for every encoding, with
+// no early exits or mixed types, so that the compiler vectorizes them. Sample
+// i crosses zero when its sign differs from that of sample i - channels.
+static float S16Energy(const void* input, int count) {
+  const int16_t* restrict samples = input;
+  int64_t sum = 0;
+  for (int i = 0; i < count; ++i) {
+    sum += (int32_t)samples[i] * samples[i];
+  }
+  return sum / (32768.f * 32768.f);
+}
+
+static int S16Crossings(const void* input, int count, int channels) {
+  const int16_t* restrict samples = input;
+  int crossings = 0;
+  for (int i = channels; i < count; ++i) {
+    crossings += (samples[i] ^ samples[i - channels]) < 0;
+  }
+  return crossings;
+}
+
+static float S24Energy(const void* input, int count) {
+  const uint8_t* restrict bytes = input;
+  int64_t sum = 0;
+  for (int i = 0; i < count; ++i) {
+    int32_t sample = (int32_t)((uint32_t)bytes[i * 3] << 8 |
+                               (uint32_t)bytes[i * 3 + 1] << 16 |
+                               (uint32_t)bytes[i * 3 + 2] << 24) >>
+                     8;
+    sum += (int64_t)sample * sample;
+  }
+  return sum / (8388608.f * 8388608.f);
+}
+
+// Only the most significant byte holds the sign.
+static int S24Crossings(const void* input, int count, int channels) {
+  const int8_t* restrict bytes = input;
+  int crossings = 0;
+  for (int i = channels; i < count; ++i) {
+    crossings += (bytes[i * 3 + 2] ^ bytes[(i - channels) * 3 + 2]) < 0;
+  }
+  return crossings;
+}
+
+static float F32Energy(const void* input, int count) {
+  return DotProduct(input, input, count);
+}
+
+static int F32Crossings(const void* input, int count, int channels) {
+  const uint32_t* restrict bits = input;
+  int crossings = 0;
+  for (int i = channels; i < count; ++i) {
+    crossings += (bits[i] ^ bits[i - channels]) >> 31;
+  }
+  return crossings;
+}
+
+void VadInit(struct Vad* vad, int channels, int encoding, int threshold_db,
+             int hangover) {
+  memset(vad, 0, sizeof(*vad));
+  vad->channels = channels;
+  vad->encoding = encoding;
+  vad->threshold = powf(10, threshold_db / 10.f);
+  vad->margin = powf(10, threshold_db / 20.f);
+  vad->hangover = hangover;
+  // Noise starts at full scale and drops to the first buffer, which is sent
+  // along with the rest of the hangover, since there is no telling yet.
+  vad->noise = 1;
+  vad->remaining = hangover;
+}
+
+int VadProcess(struct Vad* vad, const void* samples, int frames) {
+  int count = frames * vad->channels;
+  float energy;
+  int crossings;
+  switch (vad->encoding) {
+    case PACKET_ENCODING_S16LE:
+      energy = S16Energy(samples, count);
+      crossings = S16Crossings(samples, count, vad->channels);
+      break;
+    case PACKET_ENCODING_S24LE:
+      energy = S24Energy(samples, count);
+      crossings = S24Crossings(samples, count, vad->channels);
+      break;
+    case PACKET_ENCODING_F32LE:
+      energy = F32Energy(samples, count);
+      crossings = F32Crossings(samples, count, vad->channels);
+      break;
+    default:
+      return 1;
+  }
+  if (count <= vad->channels) {
+    return 1;
+  }
+  energy /= count;
+  float rate = (float)crossings / (count - vad->channels);
+  float difference = rate - vad->noise_crossings;
+  int active =
+      energy > vad->noise * vad->threshold ||
+      (energy > vad->noise * vad->margin &&
+       (difference > VAD_CROSSINGS_MARGIN ||
+        difference < -VAD_CROSSINGS_MARGIN));
+  vad->noise = energy < vad->noise ? energy : vad->noise * VAD_NOISE_RISE;
+  if (vad->noise < VAD_MIN_NOISE) {
+    vad->noise = VAD_MIN_NOISE;
+  }
+  if (active) {
+    vad->remaining = vad->hangover;
+    return 1;
+  }
+  vad->noise_crossings += difference * VAD_CROSSINGS_WEIGHT;
+  if (vad->remaining) {
+    vad->remaining--;
+    return 1;
+  }
+  return 0;
+}
+
+int VadNoiseLevel(const struct Vad* vad) {
+  int level = (int)ceilf(-10 * log10f(vad->noise));
+  return level < 0 ? 0 : level > VAD_MAX_LEVEL ? VAD_MAX_LEVEL : level;
+}
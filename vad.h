@@ -0,0 +1,27 @@
+#include <stdint.h>
+
+// Voice activity detector that looks at the energy and the zero-crossing rate
+// of every capture buffer. Background noise follows the quietest buffers down
+// at once and creeps up slowly, and a buffer is active when its energy is
+// threshold times that of the noise, or half as far above it in decibels and
+// crossing zero at a rate unlike that of the noise, as unvoiced speech does.
+// Activity holds for hangover buffers after the last active one, so that
+// trailing consonants and short pauses between words are still sent.
+struct Vad {
+  int channels;
+  int encoding;
+  float threshold;
+  float margin;
+  int hangover;
+  int remaining;
+  // Mean square of the background noise, with full scale at 1, and how many
+  // times per sample it crosses zero.
+  float noise;
+  float noise_crossings;
+};
+
+void VadInit(struct Vad* vad, int channels, int encoding, int threshold_db,
+             int hangover);
+int VadProcess(struct Vad* vad, const void* samples, int frames);
+// Level of the background noise in -dBov, as silence descriptors carry it.
+int VadNoiseLevel(const struct Vad* vad);
@@ -0,0 +1,288 @@
+#include "packet.h"
+#include "vad.h"
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define SAMPLE_RATE 48000
+#define BUFFER_FRAMES 480
+#define DURATION 60
+#define SEED 1
+#define HARMONICS 24
+#define NOISE_DBFS -50
+#define THRESHOLD 9
+#define HANGOVER_MS 200
+#define SID_INTERVAL_MS 50
+#define UDP_OVERHEAD 28
+#define MIN_SPEECH_SENT 0.99
+
+// Runs a recording, or a synthetic signal of talk spurts and pauses, through
+// vad.c buffer by buffer the way the sender does with vad=1, and sends what
+// the sender would: every active buffer, and a silence descriptor on the
+// first silent one and then every SID_INTERVAL_MS. Prints one line of JSON to
+// stdout and a summary to stderr, with what that comes to in kbit/s on the
+// wire against sending every buffer, one packet per datagram, and what the
+// detector took per buffer. For the synthetic signal, which comes with where
+// the speech is, it also prints the share of speech and of pauses that was
+// sent, and fails if less than MIN_SPEECH_SENT of the speech was.
+//
+// Talk spurts last 0.5 to 2.5 s and pauses 0.3 to 3 s, about the way they
+// alternate in a conversation. Spurts are syllables of a train of harmonics
+// on a gliding pitch, shaped by two moving formants, and everything carries
+// noise at NOISE_DBFS. Recordings are s16le at SAMPLE_RATE, as wave files or
+// raw, with any number of channels a wave file says or one.
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static uint32_t next_random(uint32_t* state) {
+  uint32_t x = *state;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  return *state = x;
+}
+
+static double uniform(uint32_t* state, double low, double high) {
+  return low + (high - low) * next_random(state) / 4294967296.0;
+}
+
+static double formant(double frequency, double center, double width) {
+  double distance = (frequency - center) / width;
+  return 1 / (1 + distance * distance);
+}
+
+// Returns 0 in the pauses between syllables, where envelope is 0 too.
+static double voice(double t, double* phase, double* envelope) {
+  double pitch = 170 + 80 * sin(2 * M_PI * 0.7 * t) * sin(2 * M_PI * 0.13 * t);
+  *phase += 2 * M_PI * pitch / SAMPLE_RATE;
+  double syllable = sin(M_PI * fmod(t * 4.7, 1.0));
+  *envelope = syllable > 0.2 ? (syllable - 0.2) / 0.8 : 0;
+  double first = 500 + 300 * sin(2 * M_PI * 1.9 * t);
+  double second = 1500 + 700 * sin(2 * M_PI * 1.3 * t + 1);
+  double sum = 0;
+  for (int k = 1; k <= HARMONICS; ++k) {
+    double frequency = k * pitch;
+    if (frequency > SAMPLE_RATE / 2) {
+      break;
+    }
+    sum += sin(k * *phase) / k *
+           (formant(frequency, first, 150) + formant(frequency, second, 250));
+  }
+  return 0.3 * *envelope * sum;
+}
+
+// Marks every buffer with any voice in it as speech.
+static void make_signal(int16_t* samples, uint8_t* speech, int buffers,
+                        uint32_t seed) {
+  uint32_t state = seed;
+  double phase = 0;
+  // Triangular noise with this peak has a sixth of its square as power.
+  double noise = sqrt(6) * 32767 * pow(10, NOISE_DBFS / 20.0);
+  int talking = 0;
+  int left = (int)(uniform(&state, 0.3, 3) * SAMPLE_RATE);
+  memset(speech, 0, buffers);
+  for (int i = 0; i < buffers * BUFFER_FRAMES; ++i) {
+    if (!left--) {
+      talking = !talking;
+      left = (int)((talking ? uniform(&state, 0.5, 2.5)
+                            : uniform(&state, 0.3, 3)) *
+                   SAMPLE_RATE);
+    }
+    double envelope = 0;
+    double value =
+        talking ? voice((double)i / SAMPLE_RATE, &phase, &envelope) : 0;
+    speech[i / BUFFER_FRAMES] |= envelope > 0;
+    value = value * 32767 +
+            noise * (uniform(&state, 0, 1) + uniform(&state, 0, 1) - 1);
+    value = value > 32767 ? 32767 : value < -32768 ? -32768 : value;
+    samples[i] = (int16_t)lrint(value);
+  }
+}
+
+// Returns how many frames there are, or -1 on failure.
+static long read_recording(const char* path, int16_t** samples,
+                           int* channels) {
+  FILE* file = fopen(path, "rb");
+  if (!file) {
+    perror("Failed to open recording");
+    return -1;
+  }
+  struct {
+    char id[4];
+    uint32_t size;
+    char format[4];
+  } riff;
+  long size = -1;
+  *channels = 1;
+  if (fread(&riff, sizeof(riff), 1, file) == 1 &&
+      !memcmp(riff.id, "RIFF", 4) && !memcmp(riff.format, "WAVE", 4)) {
+    struct {
+      char id[4];
+      uint32_t size;
+    } chunk;
+    while (fread(&chunk, sizeof(chunk), 1, file) == 1) {
+      if (!memcmp(chunk.id, "data", 4)) {
+        size = chunk.size;
+        break;
+      }
+      struct {
+        uint16_t format;
+        uint16_t channels;
+        uint32_t sample_rate;
+        uint32_t byte_rate;
+        uint16_t block_align;
+        uint16_t bits_per_sample;
+      } fmt;
+      if (!memcmp(chunk.id, "fmt ", 4)) {
+        if (chunk.size < sizeof(fmt) ||
+            fread(&fmt, sizeof(fmt), 1, file) != 1 || fmt.format != 1 ||
+            fmt.bits_per_sample != 16 || fmt.sample_rate != SAMPLE_RATE ||
+            !fmt.channels) {
+          fprintf(stderr, "Recording is not s16le at %d Hz\n", SAMPLE_RATE);
+          fclose(file);
+          return -1;
+        }
+        *channels = fmt.channels;
+        chunk.size -= sizeof(fmt);
+      }
+      if (fseek(file, chunk.size + (chunk.size & 1), SEEK_CUR) == -1) {
+        break;
+      }
+    }
+  } else if (fseek(file, 0, SEEK_END) != -1) {
+    // Not a wave file, take the whole of it for raw samples.
+    size = ftell(file);
+    rewind(file);
+  }
+  long frames = size / (*channels * (long)sizeof(int16_t));
+  *samples = frames > 0 ? malloc(frames * *channels * sizeof(int16_t)) : NULL;
+  if (!*samples ||
+      fread(*samples, *channels * sizeof(int16_t), frames, file) !=
+          (size_t)frames) {
+    fprintf(stderr, "Failed to read samples from %s\n", path);
+    free(*samples);
+    frames = -1;
+  }
+  fclose(file);
+  return frames;
+}
+
+int main(int argc, char** argv) {
+  int duration = DURATION;
+  uint32_t seed = SEED;
+  const char* path = NULL;
+  for (int opt; (opt = getopt(argc, argv, "d:i:s:")) != -1;) {
+    switch (opt) {
+      case 'd':
+        duration = atoi(optarg);
+        break;
+      case 'i':
+        path = optarg;
+        break;
+      case 's':
+        seed = (uint32_t)strtoul(optarg, NULL, 0);
+        break;
+      default:
+        duration = 0;
+        break;
+    }
+  }
+  if (optind != argc || duration <= 0 || !seed) {
+    fprintf(stderr, "Usage: %s [-d seconds] [-i recording] [-s seed]\n",
+            argv[0]);
+    return EXIT_FAILURE;
+  }
+  int16_t* samples;
+  uint8_t* speech = NULL;
+  int channels = 1;
+  int buffers;
+  if (path) {
+    long frames = read_recording(path, &samples, &channels);
+    if (frames < BUFFER_FRAMES) {
+      return EXIT_FAILURE;
+    }
+    buffers = (int)(frames / BUFFER_FRAMES);
+  } else {
+    buffers = duration * SAMPLE_RATE / BUFFER_FRAMES;
+    samples = malloc((size_t)buffers * BUFFER_FRAMES * sizeof(int16_t));
+    speech = malloc(buffers);
+    if (!samples || !speech) {
+      perror("Failed to allocate signal");
+      return EXIT_FAILURE;
+    }
+    make_signal(samples, speech, buffers, seed);
+  }
+  int hangover = HANGOVER_MS * SAMPLE_RATE / 1000 / BUFFER_FRAMES;
+  int sid_interval = SID_INTERVAL_MS * SAMPLE_RATE / 1000 / BUFFER_FRAMES;
+  struct Vad vad;
+  VadInit(&vad, channels, PACKET_ENCODING_S16LE, THRESHOLD, hangover);
+  int buffer_size = BUFFER_FRAMES * channels * (int)sizeof(int16_t);
+  int per_packet = UDP_OVERHEAD + (int)sizeof(struct PacketHeader);
+  uint64_t time = 0;
+  uint64_t sent_bytes = 0;
+  int active_buffers = 0, sids = 0, silent = 0, since_sid = 0;
+  int speech_buffers = 0, speech_sent = 0, pause_buffers = 0, pause_sent = 0;
+  for (int b = 0; b < buffers; ++b) {
+    uint64_t start = now_ns();
+    int active = VadProcess(
+        &vad, samples + (size_t)b * BUFFER_FRAMES * channels, BUFFER_FRAMES);
+    time += now_ns() - start;
+    // First buffer of every silence gets a descriptor right away.
+    int sid = !active && (!silent || ++since_sid >= sid_interval);
+    if (sid) {
+      since_sid = 0;
+    }
+    silent = !active;
+    active_buffers += active;
+    sids += sid;
+    sent_bytes += active ? per_packet + buffer_size : sid ? per_packet + 1 : 0;
+    if (speech) {
+      speech_buffers += speech[b];
+      speech_sent += speech[b] && active;
+      pause_buffers += !speech[b];
+      pause_sent += !speech[b] && active;
+    }
+  }
+  double seconds = (double)buffers * BUFFER_FRAMES / SAMPLE_RATE;
+  double full_kbps =
+      (double)buffers * (per_packet + buffer_size) * 8 / seconds / 1000;
+  double vad_kbps = sent_bytes * 8 / seconds / 1000;
+  double ns_per_buffer = (double)time / buffers;
+  double speech_share =
+      speech_buffers ? (double)speech_sent / speech_buffers : 1;
+  double pause_share = pause_buffers ? (double)pause_sent / pause_buffers : 0;
+  int good = !speech || speech_share >= MIN_SPEECH_SENT;
+  printf("{\"signal\":\"%s\",\"channels\":%d,\"buffer_frames\":%d,"
+         "\"buffers\":%d,\"active_buffers\":%d,\"descriptors\":%d,"
+         "\"kbps_without_vad\":%.1f,\"kbps_with_vad\":%.1f,"
+         "\"ns_per_buffer\":%.1f",
+         path ? path : "talk spurts", channels, BUFFER_FRAMES, buffers,
+         active_buffers, sids, full_kbps, vad_kbps, ns_per_buffer);
+  if (speech) {
+    printf(",\"speech_sent\":%.4f,\"pauses_sent\":%.4f", speech_share,
+           pause_share);
+  }
+  printf("}\n");
+  fprintf(stderr,
+          "%s: %d of %d buffers active, %d descriptors, %.1f kbit/s with "
+          "vad against %.1f without, %.1f ns per buffer",
+          path ? path : "talk spurts", active_buffers, buffers, sids,
+          vad_kbps, full_kbps, ns_per_buffer);
+  if (speech) {
+    fprintf(stderr, ", %.2f%% of speech and %.2f%% of pauses sent%s",
+            100 * speech_share, 100 * pause_share,
+            good ? "" : ", SPEECH LOST");
+  }
+  fprintf(stderr, "\n");
+  free(samples);
+  free(speech);
+  return good ? EXIT_SUCCESS : EXIT_FAILURE;
+}